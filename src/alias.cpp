@@ -24,7 +24,7 @@ extern CAliasDB *paliasdb;
 
 map<vector<unsigned char>, uint256> mapMyAliases;
 map<vector<unsigned char>, set<uint256> > mapAliasesPending;
-list<CAliasFee> lstAliasFees;
+CFeeRegenWindow aliasFeeWindow("namefee", 60 * 60 * 12, true, true);
 
 #ifdef GUI
 extern std::map<uint160, std::vector<unsigned char> > mapMyNameHashes;
@@ -54,13 +54,8 @@ extern bool DecodeAliasScript(const CScript& script, int& op,
 extern bool Solver(const CKeyStore& keystore, const CScript& scriptPubKey,
 		uint256 hash, int nHashType, CScript& scriptSigRet,
 		txnouttype& whichTypeRet);
-extern bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey,
-		const CTransaction& txTo, unsigned int nIn, unsigned int flags,
-		int nHashType);
 extern bool IsConflictedAliasTx(CBlockTreeDB& txdb, const CTransaction& tx,
 		vector<unsigned char>& name);
-extern void rescanforaliases(CBlockIndex *pindexRescan);
-extern void rescanforoffers(CBlockIndex *pindexRescan);
 //extern Value sendtoaddress(const Array& params, bool fHelp);
 
 CScript RemoveAliasScriptPrefix(const CScript& scriptIn);
@@ -125,77 +120,15 @@ bool IsAliasOp(int op) {
 }
 
 bool InsertAliasFee(CBlockIndex *pindex, uint256 hash, uint64 vValue) {
-	TRY_LOCK(cs_main, cs_trymain);
-	list<CAliasFee> txnDup;
-	CAliasFee txnVal(hash, pindex->nTime, pindex->nHeight, vValue);
-	bool bFound = false;
-
-	BOOST_FOREACH(CAliasFee &nmTxnValue, lstAliasFees) {
-		if (txnVal.hash == nmTxnValue.hash
-				&& txnVal.nHeight == nmTxnValue.nHeight) {
-			nmTxnValue = txnVal;
-			bFound = true;
-			break;
-		}
-	}
-	if (!bFound)
-		lstAliasFees.push_front(txnVal);
-	return bFound;
+	return aliasFeeWindow.Insert(pindex, hash, vValue);
 }
 
-bool RemoveAliasFee(CAliasFee &txnVal) {
-	TRY_LOCK(cs_main, cs_trymain);
-	CAliasFee *theval = NULL;
-	if(lstAliasFees.size()==0) return false;
-
-	BOOST_FOREACH(CAliasFee &nmTxnValue, lstAliasFees) {
-		if (txnVal.hash == nmTxnValue.hash
-		 && txnVal.nHeight == nmTxnValue.nHeight) {
-			theval = &nmTxnValue;
-			break;
-		}
-	}
-
-	if(theval)
-		lstAliasFees.remove(*theval);
-	return theval != NULL;
+bool RemoveAliasFee(CBlockIndex *pindex, uint256 hash) {
+	return aliasFeeWindow.Remove(pindex->nHeight, hash);
 }
 
 uint64 GetAliasFeeSubsidy(unsigned int nHeight) {
-	uint64 hr1 = 1, hr12 = 1;
-	{
-		TRY_LOCK(cs_main, cs_trymain);
-
-		unsigned int h12 = 60 * 60 * 12;
-		unsigned int nTargetTime = 0;
-		unsigned int nTarget1hrTime = 0;
-		unsigned int blk1hrht = nHeight - 1, blk12hrht = nHeight - 1;
-		bool bFound = false;
-
-		BOOST_FOREACH(CAliasFee &nmTxnValue, lstAliasFees) {
-			if (nmTxnValue.nHeight <= nHeight)
-				bFound = true;
-			if (bFound) {
-				if (nTargetTime == 0) {
-					hr1 = hr12 = 0;
-					nTargetTime = nmTxnValue.nBlockTime - h12;
-					nTarget1hrTime = nmTxnValue.nBlockTime - (h12 / 12);
-				}
-				if (nmTxnValue.nBlockTime > nTargetTime) {
-					hr12 += nmTxnValue.nValue;
-					blk12hrht = nmTxnValue.nHeight;
-					if (nmTxnValue.nBlockTime > nTarget1hrTime) {
-						hr1 += nmTxnValue.nValue;
-						blk1hrht = nmTxnValue.nHeight;
-					}
-				}
-			}
-		}
-		hr12 /= (nHeight - blk12hrht) + 1;
-		hr1 /= (nHeight - blk1hrht) + 1;
-	//	printf("GetAliasFeeSubsidy() : Alias fee mining reward for height %d: %llu\n", nHeight, nSubsidyOut);
-	}
-	return (hr12 + hr1) / 2;
+	return aliasFeeWindow.GetSubsidy(nHeight);
 }
 
 bool IsMyAlias(const CTransaction& tx, const CTxOut& txout) {
@@ -316,30 +249,22 @@ bool IsAliasMine(const CTransaction& tx, const CTxOut& txout,
 }
 
 bool CheckAliasInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
-		CValidationState &state, CCoinsViewCache &inputs,
+		CValidationState &state, const CTxInputs &inputs,
 		map<vector<unsigned char>, uint256> &mapTestPool, bool fBlock,
 		bool fMiner, bool fJustCheck) {
 
 	if (!tx.IsCoinBase()) {
 
-		bool found = false;
-		const COutPoint *prevOutput = NULL;
-		const CCoins *prevCoins = NULL;
-		int prevOp;
+		int nPrevIn;
+		int prevOp = 0;
 		vector<vector<unsigned char> > vvchPrevArgs;
-
-		// Strict check - bug disallowed
-		for (int i = 0; i < (int) tx.vin.size(); i++) {
-			prevOutput = &tx.vin[i].prevout;
-			prevCoins = &inputs.GetCoins(prevOutput->hash);
-			vector<vector<unsigned char> > vvch;
-			if (DecodeAliasScript(prevCoins->vout[prevOutput->n].scriptPubKey,
-					prevOp, vvch)) {
-				found = true;
-				vvchPrevArgs = vvch;
-				break;
-			}
-		}
+		bool found = inputs.GetServiceInput(SERVICE_ALIAS, nPrevIn, prevOp, vvchPrevArgs);
+		// without an alias input these point at the last input, where the
+		// search over the inputs used to leave them
+		if (!found)
+			nPrevIn = tx.vin.size() - 1;
+		const COutPoint *prevOutput = &tx.vin[nPrevIn].prevout;
+		const CCoins *prevCoins = &inputs.GetCoins(nPrevIn);
 
 		// Make sure alias outputs are not spent by a regular transaction, or the alias would be lost
 		if (tx.nVersion != SYSCOIN_TX_VERSION) {
@@ -526,17 +451,12 @@ bool CheckAliasInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
 						return error( "CheckAliasInputs() :  failed to write to alias DB");
 					mapTestPool[vvchArgs[0]] = tx.GetHash();
 
-					// write alias fees to db
+					// track alias fees for regeneration
 					int64 nTheFee = GetAliasNetFee(tx);
 					InsertAliasFee(pindexBlock, tx.GetHash(), nTheFee);
 					if (nTheFee != 0)
 						printf( "ALIAS FEES: Added %lf in fees to track for regeneration.\n",
 								(double) nTheFee / COIN);
-
-					vector<CAliasFee> vAliasFees(lstAliasFees.begin(),
-							lstAliasFees.end());
-					if (!paliasdb->WriteAliasTxFees(vAliasFees))
-						return error( "CheckOfferInputs() : failed to write fees to alias DB");
 					
 						std::map<std::vector<unsigned char>, std::set<uint256> >::iterator mi =
 								mapAliasesPending.find(vvchArgs[0]);
@@ -651,7 +571,8 @@ bool CAliasDB::ScanNames(const std::vector<unsigned char>& vchName,
 				if (!vtxPos.empty())
 					txPos = vtxPos.back();
 				nameScan.push_back(make_pair(vchName, txPos));
-			}
+			} else
+				break;
 			if (nameScan.size() >= nMax)
 				break;
 
@@ -664,87 +585,60 @@ bool CAliasDB::ScanNames(const std::vector<unsigned char>& vchName,
 	return true;
 }
 
-void rescanforaliases(CBlockIndex *pindexRescan) {
-	printf("Scanning blockchain for names to create fast index...\n");
-	paliasdb->ReconstructNameIndex(pindexRescan);
-}
-
-bool CAliasDB::ReconstructNameIndex(CBlockIndex *pindexRescan) {
-	CDiskTxPos txindex;
-	CBlockIndex* pindex = pindexRescan;
-
-	{
-		TRY_LOCK(pwalletMain->cs_wallet, cs_trylock);
-		while (pindex) {
-			CBlock block;
-			block.ReadFromDisk(pindex);
-			int nHeight = pindex->nHeight;
-			uint256 txblkhash;
+bool CAliasDB::ReconstructNameBlock(const CBlock &block, CBlockIndex *pindex) {
+	int nHeight = pindex->nHeight;
+	BOOST_FOREACH(const CTransaction& tx, block.vtx) {
 
-			BOOST_FOREACH(CTransaction& tx, block.vtx) {
+		if (tx.nVersion != SYSCOIN_TX_VERSION)
+			continue;
 
-				if (tx.nVersion != SYSCOIN_TX_VERSION)
-					continue;
+		vector<vector<unsigned char> > vvchArgs;
+		int op, nOut;
 
-				vector<vector<unsigned char> > vvchArgs;
-				int op, nOut;
+		// decode the alias op
+		bool o = DecodeAliasTx(tx, op, nOut, vvchArgs, -1);
+		if (!o || !IsAliasOp(op))
+			continue;
+		if (op == OP_ALIAS_NEW)
+			continue;
 
-				// decode the alias op
-				bool o = DecodeAliasTx(tx, op, nOut, vvchArgs, -1);
-				if (!o || !IsAliasOp(op))
-					continue;
-				if (op == OP_ALIAS_NEW)
-					continue;
+		const vector<unsigned char> &vchName = vvchArgs[0];
+		const vector<unsigned char> &vchValue = vvchArgs[
+				op == OP_ALIAS_ACTIVATE ? 2 : 1];
 
-				const vector<unsigned char> &vchName = vvchArgs[0];
-				const vector<unsigned char> &vchValue = vvchArgs[
-						op == OP_ALIAS_ACTIVATE ? 2 : 1];
+		// if name exists in DB, read it to verify
+		vector<CAliasIndex> vtxPos;
+		if (ExistsAlias(vchName)) {
+			if (!ReadAlias(vchName, vtxPos))
+				return error(
+						"ReconstructNameBlock() : failed to read from alias DB");
+		}
 
-				if (!GetTransaction(tx.GetHash(), tx, txblkhash, true))
-					continue;
+		// rebuild the alias object, store to DB
+		CAliasIndex txName;
+		txName.nHeight = nHeight;
+		txName.vValue = vchValue;
+		txName.txHash = tx.GetHash();
 
-				// if name exists in DB, read it to verify
-				vector<CAliasIndex> vtxPos;
-				if (ExistsAlias(vchName)) {
-					if (!ReadAlias(vchName, vtxPos))
-						return error(
-								"ReconstructNameIndex() : failed to read from alias DB");
-				}
+		PutToAliasList(vtxPos, txName);
 
-				// rebuild the alias object, store to DB
-				CAliasIndex txName;
-				txName.nHeight = nHeight;
-				txName.vValue = vchValue;
-				txName.txHash = tx.GetHash();
+		if (!WriteName(vchName, vtxPos))
+			return error(
+					"ReconstructNameBlock() : failed to write to alias DB");
 
-				PutToAliasList(vtxPos, txName);
+		// get fees for txn and add them to regenerate list
+		int64 nTheFee = GetAliasNetFee(tx);
+		InsertAliasFee(pindex, tx.GetHash(), nTheFee);
 
-				if (!WriteName(vchName, vtxPos))
-					return error(
-							"ReconstructNameIndex() : failed to write to alias DB");
-
-				// get fees for txn and add them to regenerate list
-				int64 nTheFee = GetAliasNetFee(tx);
-				InsertAliasFee(pindex, tx.GetHash(), nTheFee);
-				vector<CAliasFee> vAliasFees(lstAliasFees.begin(),
-					lstAliasFees.end());
-				if (!paliasdb->WriteAliasTxFees(vAliasFees))
-					return error(
-							"CheckOfferInputs() : failed to write fees to alias DB");
 
+		printf(
+				"RECONSTRUCT ALIAS: op=%s alias=%s value=%s hash=%s height=%d fees=%llu\n",
+				aliasFromOp(op).c_str(), stringFromVch(vchName).c_str(),
+				stringFromVch(vchValue).c_str(),
+				tx.GetHash().ToString().c_str(), nHeight,
+				nTheFee / COIN);
 
-				printf(
-						"RECONSTRUCT ALIAS: op=%s alias=%s value=%s hash=%s height=%d fees=%llu\n",
-						aliasFromOp(op).c_str(), stringFromVch(vchName).c_str(),
-						stringFromVch(vchValue).c_str(),
-						tx.GetHash().ToString().c_str(), nHeight,
-						nTheFee / COIN);
-
-			} /* TX */
-			pindex = pindex->pnext;
-		} /* BLOCK */
-		Flush();
-	} /* LOCK */
+	} /* TX */
 	return true;
 }
 
@@ -792,20 +686,27 @@ int GetAliasDisplayExpirationDepth(int nHeight) {
 	return GetAliasExpirationDepth(nHeight);
 }
 
+int GetAliasExpiryHeight(const vector<CAliasIndex> &vtxPos) {
+	if (vtxPos.empty())
+		return -1;
+	int nHeight = vtxPos.back().nHeight;
+	return nHeight + GetAliasDisplayExpirationDepth(nHeight);
+}
+
+int CAliasDB::GetHeadExpiry(const string &strValue) {
+	vector<CAliasIndex> vtxPos;
+	try {
+		CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+		ssValue >> vtxPos;
+	} catch (std::exception &e) {
+		return -1;
+	}
+	return GetAliasExpiryHeight(vtxPos);
+}
+
 int GetNameTxPosHeight(const CDiskTxPos& txPos) {
-	// Read block header
-	CBlock block;
-	if (!block.ReadFromDisk(txPos))
-		return 0;
-	// Find the block in the index
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(
-			block.GetHash());
-	if (mi == mapBlockIndex.end())
-		return 0;
-	CBlockIndex* pindex = (*mi).second;
-	if (!pindex || !pindex->IsInMainChain())
-		return 0;
-	return pindex->nHeight;
+	CBlockIndex* pindex = GetTxPosBlockIndex(txPos);
+	return pindex ? pindex->nHeight : 0;
 }
 
 int GetNameTxPosHeight2(const CDiskTxPos& txPos, int nHeight) {
@@ -831,6 +732,7 @@ bool SignNameSignature(const CTransaction& txFrom, CTransaction& txTo,
 	CTxIn& txin = txTo.vin[nIn];
 	assert(txin.prevout.n < txFrom.vout.size());
 	const CTxOut& txout = txFrom.vout[txin.prevout.n];
+	txTo.InvalidateCache();
 
 	// Leave out the signature from the hash, since a signature can't sign itself.
 	// The checksig op will also drop the signatures from its hash.
@@ -872,6 +774,7 @@ bool CreateTransactionWithInputTx(const vector<pair<CScript, int64> >& vecSend,
 		loop {
 			wtxNew.vin.clear();
 			wtxNew.vout.clear();
+			wtxNew.InvalidateCache();
 			wtxNew.fFromMe = true;
 			wtxNew.data = vchFromString(txData);
 
@@ -1046,9 +949,8 @@ string SendMoneyWithInputTx(CScript scriptPubKey, int64 nValue, int64 nNetFee,
 }
 
 int64 GetAliasTxHashHeight(const uint256 txHash) {
-	CDiskTxPos postx;
-	pblocktree->ReadTxIndex(txHash, postx);
-	return GetNameTxPosHeight(postx);
+	CBlockIndex* pindex = GetTxBlockIndex(txHash);
+	return pindex ? pindex->nHeight : 0;
 }
 
 bool GetValueOfAliasTxHash(const uint256 &txHash, vector<unsigned char>& vchValue, uint256& hash, int& nHeight) {
@@ -1233,24 +1135,7 @@ bool GetValueOfAliasTx(const CTransaction& tx, vector<unsigned char>& value) {
 
 bool DecodeAliasTx(const CTransaction& tx, int& op, int& nOut,
 		vector<vector<unsigned char> >& vvch, int nHeight) {
-	bool found = false;
-
-
-	// Strict check - bug disallowed
-	for (unsigned int i = 0; i < tx.vout.size(); i++) {
-		const CTxOut& out = tx.vout[i];
-		vector<vector<unsigned char> > vvchRead;
-		if (DecodeAliasScript(out.scriptPubKey, op, vvchRead)) {
-			nOut = i;
-			found = true;
-			vvch = vvchRead;
-			break;
-		}
-	}
-	if (!found)
-		vvch.clear();
-
-	return found;
+	return tx.GetServiceOutput(SERVICE_ALIAS, op, nOut, vvch);
 }
 
 bool GetValueOfAliasTx(const CCoins& tx, vector<unsigned char>& value) {
@@ -1304,38 +1189,7 @@ bool DecodeAliasScript(const CScript& script, int& op,
 
 bool DecodeAliasScript(const CScript& script, int& op,
 		vector<vector<unsigned char> > &vvch, CScript::const_iterator& pc) {
-	opcodetype opcode;
-	if (!script.GetOp(pc, opcode))
-		return false;
-	if (opcode < OP_1 || opcode > OP_16)
-		return false;
-
-	op = CScript::DecodeOP_N(opcode);
-
-	for (;;) {
-		vector<unsigned char> vch;
-		if (!script.GetOp(pc, opcode, vch))
-			return false;
-		if (opcode == OP_DROP || opcode == OP_2DROP || opcode == OP_NOP)
-			break;
-		if (!(opcode >= 0 && opcode <= OP_PUSHDATA4))
-			return false;
-		vvch.push_back(vch);
-	}
-
-	// move the pc to after any DROP or NOP
-	while (opcode == OP_DROP || opcode == OP_2DROP || opcode == OP_NOP) {
-		if (!script.GetOp(pc, opcode))
-			break;
-	}
-
-	pc--;
-
-	if ((op == OP_ALIAS_NEW && vvch.size() == 1)
-			|| (op == OP_ALIAS_ACTIVATE && vvch.size() == 3)
-			|| (op == OP_ALIAS_UPDATE && vvch.size() == 2))
-		return true;
-	return false;
+	return DecodeServiceScript(script, op, vvch, pc) == SERVICE_ALIAS;
 }
 
 Value aliasnew(const Array& params, bool fHelp) {
@@ -1828,7 +1682,8 @@ Value aliasfilter(const Array& params, bool fHelp) {
 						"[stat] : show some stats instead of results\n"
 						"aliasfilter \"\" 5 # list aliases updated in last 5 blocks\n"
 						"aliasfilter \"^name\" # list all aliases starting with \"name\"\n"
-						"aliasfilter 36000 0 0 stat # display stats (number of names) on active aliases\n");
+						"aliasfilter 36000 0 0 stat # display stats (number of names) on active aliases\n"
+						"aliasfilter \"\" 0 0 0 stat # display the number of active, expired and archived aliases\n");
 
 	string strRegexp;
 	int nFrom = 0;
@@ -1853,6 +1708,18 @@ Value aliasfilter(const Array& params, bool fHelp) {
 	if (params.size() > 4)
 		fStat = (params[4].get_str() == "stat" ? true : false);
 
+	// stats over all aliases come from the counts the DB keeps
+	if (fStat && strRegexp == "" && nMaxAge == 0 && nFrom == 0 && nNb == 0) {
+		CServiceCounts counts;
+		paliasdb->ReadCounts(counts);
+		Object oStat;
+		oStat.push_back(Pair("blocks", (int) nBestHeight));
+		oStat.push_back(Pair("count", (boost::int64_t)counts.nLive));
+		oStat.push_back(Pair("expired", (boost::int64_t)counts.nExpired));
+		oStat.push_back(Pair("archived", (boost::int64_t)counts.nArchived));
+		return oStat;
+	}
+
 	Array oRes;
 
 	vector<unsigned char> vchName;
@@ -1860,14 +1727,15 @@ Value aliasfilter(const Array& params, bool fHelp) {
 	if (!paliasdb->ScanNames(vchName, 100000000, nameScan))
 		throw JSONRPCError(RPC_WALLET_ERROR, "scan failed");
 
+	using namespace boost::xpressive;
+	smatch nameparts;
+	sregex cregex = sregex::compile(strRegexp);
+
 	pair<vector<unsigned char>, CAliasIndex> pairScan;
 	BOOST_FOREACH(pairScan, nameScan) {
 		string name = stringFromVch(pairScan.first);
 
 		// regexp
-		using namespace boost::xpressive;
-		smatch nameparts;
-		sregex cregex = sregex::compile(strRegexp);
 		if (strRegexp != "" && !regex_search(name, nameparts, cregex))
 			continue;
 
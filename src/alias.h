@@ -2,7 +2,8 @@
 #define NAMEDB_H
 
 #include "bitcoinrpc.h"
-#include "leveldb.h"
+#include "servicedb.h"
+#include "feeregen.h"
 
 class CAliasIndex {
 public:
@@ -83,25 +84,53 @@ public:
         return !(a == b);
     }
 };
-extern std::list<CAliasFee> lstAliasFees;
+extern CFeeRegenWindow aliasFeeWindow;
+
+// height at which an alias with these versions expires, -1 if it has none
+int GetAliasExpiryHeight(const std::vector<CAliasIndex> &vtxPos);
+
+class CAliasDB : public CServiceDB {
+private:
+	CServiceRecordCache<std::vector<CAliasIndex> > cacheAliases;
+
+	void RecordChanged(const std::string &strKey) {
+		std::vector<unsigned char> vchName;
+		if (DecodeRecordKey(strKey, "namei", vchName))
+			cacheAliases.Erase(vchName);
+	}
+
+	int GetHeadExpiry(const std::string &strValue);
 
-class CAliasDB : public CLevelDB {
 public:
-    CAliasDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "aliases", nCacheSize, fMemory, fWipe) {
+    CAliasDB(size_t nCacheSize, bool fMemory, bool fWipe) : CServiceDB(GetDataDir() / "aliases", nCacheSize, fMemory, fWipe) {
+        strHeadPrefix = "namei";
     }
 
 	bool WriteName(const std::vector<unsigned char>& name, std::vector<CAliasIndex>& vtxPos) {
-		return Write(make_pair(std::string("namei"), name), vtxPos);
+		LOCK(cs_cache);
+		if (!Write(make_pair(std::string("namei"), name), vtxPos))
+			return false;
+		cacheAliases.Put(name, vtxPos);
+		return UpdateExpiry(name, GetAliasExpiryHeight(vtxPos));
 	}
 
 	bool EraseName(const std::vector<unsigned char>& name) {
-	    return Erase(make_pair(std::string("namei"), name));
+		if (!Erase(make_pair(std::string("namei"), name)))
+			return false;
+		return UpdateExpiry(name, -1);
 	}
+	// long expired aliases are read from the archive
 	bool ReadAlias(const std::vector<unsigned char>& name, std::vector<CAliasIndex>& vtxPos) {
-		return Read(make_pair(std::string("namei"), name), vtxPos);
+		LOCK(cs_cache);
+		if (cacheAliases.Get(name, vtxPos))
+			return true;
+		if (!Read(make_pair(std::string("namei"), name), vtxPos) && !ReadArchived(name, vtxPos))
+			return false;
+		cacheAliases.Put(name, vtxPos);
+		return true;
 	}
 	bool ExistsAlias(const std::vector<unsigned char>& name) {
-	    return Exists(make_pair(std::string("namei"), name));
+	    return Exists(make_pair(std::string("namei"), name)) || ExistsArchived(name);
 	}
 
 	bool WriteAliasTxFees(std::vector<CAliasFee>& vtxPos) {
@@ -110,6 +139,9 @@ public:
 	bool ReadAliasTxFees(std::vector<CAliasFee>& vtxPos) {
 		return Read(std::string("nametxf"), vtxPos);
 	}
+	bool EraseAliasTxFees() {
+		return Erase(std::string("nametxf"));
+	}
 
     bool WriteAliasIndex(std::vector<std::vector<unsigned char> >& vtxIndex) {
         return Write(std::string("namendx"), vtxIndex);
@@ -123,7 +155,18 @@ public:
             unsigned int nMax,
             std::vector<std::pair<std::vector<unsigned char>, CAliasIndex> >& nameScan);
 
-    bool ReconstructNameIndex(CBlockIndex *pindexRescan);
+    // apply the alias txns of a main chain block, when rebuilding the DB
+    bool ReconstructNameBlock(const CBlock &block, CBlockIndex *pindex);
+
+    void SetRecordCacheSize(uint64 nBytes) {
+        LOCK(cs_cache);
+        cacheAliases.SetMaxBytes(nBytes);
+    }
+
+    void GetRecordCacheStats(std::vector<std::pair<std::string, CServiceCacheStats> > &vStats) const {
+        LOCK(cs_cache);
+        vStats.push_back(make_pair(std::string("aliases"), cacheAliases.GetStats()));
+    }
 };
 
 
@@ -145,7 +188,7 @@ static const unsigned int MIN_ACTIVATE_DEPTH_CAKENET = 1;
 
 bool CheckAliasInputs(
     CBlockIndex *pindex, const CTransaction &tx, CValidationState &state,
-	CCoinsViewCache &inputs, std::map<std::vector<unsigned char>,uint256> &mapTestPool, 
+	const CTxInputs &inputs, std::map<std::vector<unsigned char>,uint256> &mapTestPool, 
     bool fBlock, bool fMiner, bool fJustCheck);
 bool ExtractAliasAddress(const CScript& script, std::string& address);
 bool IsAliasMine(const CTransaction& tx);
@@ -180,6 +223,6 @@ std::string aliasFromOp(int op);
 bool IsAliasOp(int op);
 int GetAliasDisplayExpirationDepth(int nHeight);
 void UnspendInputs(CWalletTx& wtx);
-bool RemoveAliasFee(CAliasFee &txnVal);
+bool RemoveAliasFee(CBlockIndex *pindex, uint256 hash);
 
 #endif // NAMEDB_H
@@ -5,6 +5,10 @@
 #include "auxpow.h"
 #include "init.h"
 
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
 using namespace std;
 using namespace boost;
 
@@ -128,7 +132,157 @@ void IncrementExtraNonceWithAux(CBlock* pblock, CBlockIndex* pindexPrev, unsigne
     ++nExtraNonce;
 	unsigned int nHeight = pindexPrev->nHeight+1; // Height first in coinbase required for block.version=2
     pblock->vtx[0].vin[0].scriptSig = MakeCoinbaseWithAux(nHeight, nExtraNonce, vchAux);
+    pblock->vtx[0].InvalidateCache();
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
 
 
+
+CAuxPowStore auxpowstore;
+
+// a record is the block hash, the size of the AuxPoW and the AuxPoW
+static const unsigned int AUXPOW_RECORD_HEADER_SIZE = 32 + 4;
+
+CAuxPowStore::CAuxPowStore() : file(NULL), nSize(0)
+{
+#ifndef WIN32
+    pMap = NULL;
+    nMapSize = 0;
+#endif
+}
+
+CAuxPowStore::~CAuxPowStore()
+{
+    Close();
+}
+
+void CAuxPowStore::Unmap()
+{
+#ifndef WIN32
+    if (pMap != NULL)
+        munmap((void*)pMap, nMapSize);
+    pMap = NULL;
+    nMapSize = 0;
+#endif
+}
+
+bool CAuxPowStore::Open(const boost::filesystem::path &path, bool fWipe)
+{
+    LOCK(cs);
+    Close();
+    file = fopen(path.string().c_str(), fWipe ? "wb+" : "ab+");
+    if (file == NULL)
+        return error("CAuxPowStore::Open() : cannot open %s", path.string().c_str());
+    fseek(file, 0, SEEK_END);
+    nSize = ftell(file);
+    return true;
+}
+
+void CAuxPowStore::Close()
+{
+    LOCK(cs);
+    Unmap();
+    if (file != NULL)
+        fclose(file);
+    file = NULL;
+    nSize = 0;
+    lru.clear();
+    mapCache.clear();
+}
+
+bool CAuxPowStore::Append(const uint256 &hashBlock, const CAuxPow &auxpow, uint64 &nPos)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << hashBlock << (unsigned int)::GetSerializeSize(auxpow, SER_DISK, CLIENT_VERSION) << auxpow;
+
+    LOCK(cs);
+    if (file == NULL)
+        return false;
+    // "a" mode writes at the end whatever the file position
+    fseek(file, 0, SEEK_END);
+    if (fwrite(&ss[0], 1, ss.size(), file) != ss.size() || fflush(file) != 0)
+        return error("CAuxPowStore::Append() : write failed");
+    nPos = nSize;
+    nSize += ss.size();
+    return true;
+}
+
+bool CAuxPowStore::ReadBytes(uint64 nPos, char *pch, unsigned int nBytes)
+{
+    if (nPos + nBytes > nSize)
+        return false;
+#ifndef WIN32
+    if (nPos + nBytes > nMapSize) {
+        // the file grew since it was mapped
+        Unmap();
+        void *p = mmap(NULL, nSize, PROT_READ, MAP_SHARED, fileno(file), 0);
+        if (p == MAP_FAILED)
+            return error("CAuxPowStore::ReadBytes() : mmap failed");
+        pMap = (const char*)p;
+        nMapSize = nSize;
+    }
+    memcpy(pch, pMap + nPos, nBytes);
+    return true;
+#else
+    if (fseek(file, nPos, SEEK_SET) != 0)
+        return false;
+    return fread(pch, 1, nBytes, file) == nBytes;
+#endif
+}
+
+bool CAuxPowStore::Read(uint64 nPos, const uint256 &hashBlock, boost::shared_ptr<CAuxPow> &auxpow)
+{
+    LOCK(cs);
+    std::map<uint64, list_type::iterator>::iterator mi = mapCache.find(nPos);
+    if (mi != mapCache.end()) {
+        if (mi->second->hashBlock != hashBlock)
+            return false;
+        lru.splice(lru.begin(), lru, mi->second);
+        auxpow = mi->second->auxpow;
+        return true;
+    }
+    if (file == NULL)
+        return false;
+
+    char pchHeader[AUXPOW_RECORD_HEADER_SIZE];
+    if (!ReadBytes(nPos, pchHeader, sizeof(pchHeader)))
+        return false;
+    uint256 hashRecord;
+    unsigned int nRecordSize;
+    CDataStream ssHeader(pchHeader, pchHeader + sizeof(pchHeader), SER_DISK, CLIENT_VERSION);
+    ssHeader >> hashRecord >> nRecordSize;
+    // lost or torn by a crash, or an offset from before a wipe
+    if (hashRecord != hashBlock || nRecordSize > MAX_BLOCK_SIZE)
+        return false;
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss.resize(nRecordSize);
+    if (nRecordSize > 0 && !ReadBytes(nPos + sizeof(pchHeader), &ss[0], nRecordSize))
+        return false;
+    boost::shared_ptr<CAuxPow> auxpowRead(new CAuxPow());
+    try {
+        ss >> *auxpowRead;
+    } catch (std::exception &e) {
+        return error("CAuxPowStore::Read() : deserialize error at %"PRI64u, nPos);
+    }
+
+    CCacheEntry entry;
+    entry.nPos = nPos;
+    entry.hashBlock = hashBlock;
+    entry.auxpow = auxpowRead;
+    lru.push_front(entry);
+    mapCache[nPos] = lru.begin();
+    if (mapCache.size() > AUXPOW_CACHE_ENTRIES) {
+        mapCache.erase(lru.back().nPos);
+        lru.pop_back();
+    }
+    auxpow = auxpowRead;
+    return true;
+}
+
+void CAuxPowStore::Commit()
+{
+    LOCK(cs);
+    if (file != NULL)
+        FileCommit(file);
+}
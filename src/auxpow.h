@@ -6,6 +6,9 @@
 
 #include "main.h"
 
+#include <list>
+#include <map>
+
 class CAuxPow : public CMerkleTx
 {
 public:
@@ -79,6 +82,55 @@ int ReadWriteAuxPow(Stream& s, boost::shared_ptr<CAuxPow>& auxpow, int nType, in
     }
 }
 
+// decoded AuxPoW kept in memory, enough for a getheaders reply of merge-mined blocks
+static const unsigned int AUXPOW_CACHE_ENTRIES = 2000;
+
+/** Append-only file of the AuxPoW of merge-mined blocks (blocks/auxpow.dat).
+ *  A record is found by the offset kept in its block's CBlockIndex, so a
+ *  header is served without reading CDiskBlockIndex from the block tree DB,
+ *  and blocks connected one after another have their records one after
+ *  another. Reads go through a read-only mapping of the file where mmap is
+ *  available, and decoded records are cached, least recently used dropped
+ *  first. CDiskBlockIndex keeps its copy; records this file lost in a crash
+ *  are read from there. Decoded records are shared and must not be changed. */
+class CAuxPowStore
+{
+private:
+    CCriticalSection cs;
+    FILE *file;
+    uint64 nSize;
+#ifndef WIN32
+    const char *pMap;
+    uint64 nMapSize;
+#endif
+
+    struct CCacheEntry {
+        uint64 nPos;
+        uint256 hashBlock;
+        boost::shared_ptr<CAuxPow> auxpow;
+    };
+    typedef std::list<CCacheEntry> list_type;
+    list_type lru; // most recently used first
+    std::map<uint64, list_type::iterator> mapCache;
+
+    void Unmap();
+    bool ReadBytes(uint64 nPos, char *pch, unsigned int nBytes);
+
+public:
+    CAuxPowStore();
+    ~CAuxPowStore();
+
+    bool Open(const boost::filesystem::path &path, bool fWipe);
+    void Close();
+    // append the AuxPoW of block hashBlock, nPos is where it went
+    bool Append(const uint256 &hashBlock, const CAuxPow &auxpow, uint64 &nPos);
+    // false if there is no record of hashBlock at nPos
+    bool Read(uint64 nPos, const uint256 &hashBlock, boost::shared_ptr<CAuxPow> &auxpow);
+    void Commit();
+};
+
+extern CAuxPowStore auxpowstore;
+
 extern void RemoveMergedMiningHeader(std::vector<unsigned char>& vchAux);
 extern CScript MakeCoinbaseWithAux(unsigned int nHeight, unsigned int nExtraNonce, std::vector<unsigned char>& vchAux);
 #endif
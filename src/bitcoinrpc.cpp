@@ -271,6 +271,9 @@ static const CRPCCommand vRPCCommands[] =
     { "lockunspent",            &lockunspent,            false,     false,      true },
     { "listlockunspent",        &listlockunspent,        false,     false,      true },
     { "verifychain",            &verifychain,            true,      false,      false },
+    { "getservicecacheinfo",    &getservicecacheinfo,    true,      false,      false },
+    { "getsigcacheinfo",        &getsigcacheinfo,        true,      false,      false },
+    { "getscriptcacheinfo",     &getscriptcacheinfo,     true,      false,      false },
 	
     // store data in the blockchain
 	{ "dumpdata",           &dumpdata,           false,      false,      true },
@@ -310,6 +313,7 @@ static const CRPCCommand vRPCCommands[] =
     { "offerscan",        &offerscan,      false,      false,      true },
     { "offerclean",       &offerclean,     false,      false,      true },
     { "offerfilter",      &offerfilter,    false,      false,      true },
+    { "offerquery",       &offerquery,     false,      false,      false },
     { "getofferfees",      &getofferfees,         false,      false,      true },
 
   // use the blockchain as a certificate issuance platform
@@ -207,6 +207,9 @@ extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp)
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value verifychain(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getservicecacheinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getsigcacheinfo(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getscriptcacheinfo(const json_spirit::Array& params, bool fHelp);
 
 // get / set data in the blockchain
 extern json_spirit::Value setdata(const json_spirit::Array& params, bool fHelp);
@@ -246,6 +249,7 @@ extern json_spirit::Value offeracceptlist(const json_spirit::Array& params, bool
 extern json_spirit::Value offerhistory(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value offerfilter(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value offerscan(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value offerquery(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value offerclean(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getofferfees(const json_spirit::Array& params, bool fHelp);
 
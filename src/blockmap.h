@@ -0,0 +1,203 @@
+// Copyright (c) 2012 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_BLOCKMAP_H
+#define BITCOIN_BLOCKMAP_H
+
+#include "hash.h"
+#include "uint256.h"
+
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <utility>
+#include <vector>
+
+/** Allocates objects in chunks of contiguous memory. Objects keep their
+ *  address until clear(), which destroys all of them at once; there is no
+ *  way to free a single object. */
+template <typename T> class objectarena
+{
+public:
+    typedef size_t size_type;
+    static const size_type CHUNK_SIZE = 4096;
+
+protected:
+    std::vector<void*> vChunks;
+    size_type nSize;
+
+    void* slot(size_type n) const { return (char*)vChunks[n / CHUNK_SIZE] + (n % CHUNK_SIZE) * sizeof(T); }
+    void* next()
+    {
+        if (nSize == vChunks.size() * CHUNK_SIZE)
+            vChunks.push_back(::operator new(CHUNK_SIZE * sizeof(T)));
+        return slot(nSize);
+    }
+
+private:
+    objectarena(const objectarena&);
+    objectarena& operator=(const objectarena&);
+
+public:
+    objectarena() : nSize(0) {}
+    ~objectarena() { clear(); }
+
+    T* create()
+    {
+        T* p = new (next()) T();
+        nSize++;
+        return p;
+    }
+    T* create(const T& x)
+    {
+        T* p = new (next()) T(x);
+        nSize++;
+        return p;
+    }
+
+    T& operator[](size_type n) { return *(T*)slot(n); }
+    const T& operator[](size_type n) const { return *(const T*)slot(n); }
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    void clear()
+    {
+        for (size_type n = 0; n < nSize; n++)
+            ((T*)slot(n))->~T();
+        for (size_type i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i]);
+        vChunks.clear();
+        nSize = 0;
+    }
+};
+
+/** STL-like map container from block hashes to V, for mapBlockIndex.
+ *
+ *  Open addressing with linear probing over a table of entry numbers, which
+ *  is kept at most half full. The entries themselves live in an
+ *  objectarena, so keys never move (CBlockIndex::phashBlock points at them)
+ *  and iteration runs in insertion order. Slots are chosen by a hash of the
+ *  key with a CSaltedHasher, so a peer cannot pick block hashes that pile up
+ *  in one run of the table. Entries cannot be erased. */
+template <typename V> class blockmap
+{
+public:
+    typedef uint256 key_type;
+    typedef V mapped_type;
+    typedef std::pair<const key_type, mapped_type> value_type;
+    typedef size_t size_type;
+
+    template <typename M, typename E> class basic_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const uint256, V> value_type;
+        typedef ptrdiff_t difference_type;
+        typedef E* pointer;
+        typedef E& reference;
+
+        M* pmap;
+        size_type n;
+
+        basic_iterator() : pmap(NULL), n(0) {}
+        basic_iterator(M* pmapIn, size_type nIn) : pmap(pmapIn), n(nIn) {}
+        template <typename M2, typename E2> basic_iterator(const basic_iterator<M2, E2>& it) : pmap(it.pmap), n(it.n) {}
+
+        E& operator*() const { return pmap->entries[n]; }
+        E* operator->() const { return &pmap->entries[n]; }
+        basic_iterator& operator++() { n++; return *this; }
+        basic_iterator operator++(int) { basic_iterator it = *this; n++; return it; }
+        template <typename M2, typename E2> bool operator==(const basic_iterator<M2, E2>& it) const { return n == it.n; }
+        template <typename M2, typename E2> bool operator!=(const basic_iterator<M2, E2>& it) const { return n != it.n; }
+    };
+    typedef basic_iterator<blockmap, value_type> iterator;
+    typedef basic_iterator<const blockmap, const value_type> const_iterator;
+
+protected:
+    static const unsigned int EMPTY = 0xffffffff;
+
+    objectarena<value_type> entries;
+    std::vector<unsigned int> vSlots; // entry numbers, EMPTY if free
+    size_type nMask;
+    CSaltedHasher hasher;
+
+    // slot holding key, or the free slot it would go in
+    size_type locate(const key_type& key) const
+    {
+        size_type i = hasher(key) & nMask;
+        while (vSlots[i] != EMPTY && entries[vSlots[i]].first != key)
+            i = (i + 1) & nMask;
+        return i;
+    }
+
+    void rehash(size_type nSlots)
+    {
+        if (vSlots.empty())
+            hasher = CSaltedHasher();
+        std::vector<unsigned int>(nSlots, (unsigned int)EMPTY).swap(vSlots);
+        nMask = nSlots - 1;
+        for (size_type n = 0; n < entries.size(); n++)
+            vSlots[locate(entries[n].first)] = n;
+    }
+
+private:
+    blockmap(const blockmap&);
+    blockmap& operator=(const blockmap&);
+
+public:
+    blockmap() : nMask(0) {}
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, entries.size()); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, entries.size()); }
+    size_type size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+
+    iterator find(const key_type& key)
+    {
+        if (vSlots.empty())
+            return end();
+        size_type i = locate(key);
+        return vSlots[i] == EMPTY ? end() : iterator(this, vSlots[i]);
+    }
+    const_iterator find(const key_type& key) const
+    {
+        if (vSlots.empty())
+            return end();
+        size_type i = locate(key);
+        return vSlots[i] == EMPTY ? end() : const_iterator(this, vSlots[i]);
+    }
+    size_type count(const key_type& key) const { return find(key) == end() ? 0 : 1; }
+
+    std::pair<iterator, bool> insert(const value_type& x)
+    {
+        reserve(entries.size() + 1);
+        size_type i = locate(x.first);
+        if (vSlots[i] != EMPTY)
+            return std::make_pair(iterator(this, vSlots[i]), false);
+        vSlots[i] = entries.size();
+        entries.create(x);
+        return std::make_pair(iterator(this, vSlots[i]), true);
+    }
+    mapped_type& operator[](const key_type& key) { return insert(value_type(key, mapped_type())).first->second; }
+
+    // make room for n entries without growing the table again
+    void reserve(size_type n)
+    {
+        size_type nSlots = vSlots.empty() ? 64 : vSlots.size();
+        while (nSlots < 2 * n)
+            nSlots *= 2;
+        if (nSlots != vSlots.size())
+            rehash(nSlots);
+    }
+
+    void clear()
+    {
+        entries.clear();
+        std::vector<unsigned int>().swap(vSlots);
+        nMask = 0;
+    }
+};
+
+#endif
@@ -20,7 +20,7 @@ std::map<std::vector<unsigned char>, uint256> mapMyCertIssuers;
 std::map<std::vector<unsigned char>, uint256> mapMyCertItems;
 std::map<std::vector<unsigned char>, std::set<uint256> > mapCertIssuerPending;
 std::map<std::vector<unsigned char>, std::set<uint256> > mapCertItemPending;
-std::list<CCertFee> lstCertIssuerFees;
+CFeeRegenWindow certFeeWindow("certissuerfee", 360 * 12, false, false);
 
 #ifdef GUI
 extern std::map<uint160, std::vector<unsigned char> > mapMyCertIssuerHashes;
@@ -39,9 +39,6 @@ bool DecodeCertScript(const CScript& script, int& op,
 extern bool Solver(const CKeyStore& keystore, const CScript& scriptPubKey,
         uint256 hash, int nHashType, CScript& scriptSigRet,
         txnouttype& whichTypeRet);
-extern bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey,
-        const CTransaction& txTo, unsigned int nIn, unsigned int flags,
-        int nHashType);
 
 bool IsCertOp(int op) {
     return op == OP_CERTISSUER_NEW
@@ -100,6 +97,24 @@ int GetCertDisplayExpirationDepth(int nHeight) {
     return GetCertExpirationDepth(nHeight);
 }
 
+int GetCertIssuerExpiryHeight(const vector<CCertIssuer> &vtxPos) {
+    if (vtxPos.empty())
+        return -1;
+    int nHeight = vtxPos.back().nHeight;
+    return nHeight + GetCertDisplayExpirationDepth(nHeight);
+}
+
+int CCertDB::GetHeadExpiry(const string &strValue) {
+    vector<CCertIssuer> vtxPos;
+    try {
+        CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> vtxPos;
+    } catch (std::exception &e) {
+        return -1;
+    }
+    return GetCertIssuerExpiryHeight(vtxPos);
+}
+
 bool IsMyCert(const CTransaction& tx, const CTxOut& txout) {
     const CScript& scriptPubKey = RemoveCertIssuerScriptPrefix(txout.scriptPubKey);
     CScript scriptSig;
@@ -139,6 +154,7 @@ bool CCertIssuer::UnserializeFromTx(const CTransaction &tx) {
 void CCertIssuer::SerializeToTx(CTransaction &tx) {
     vector<unsigned char> vchData = vchFromString(SerializeToString());
     tx.data = vchData;
+    tx.InvalidateCache();
 }
 
 string CCertIssuer::SerializeToString() {
@@ -178,7 +194,8 @@ bool CCertDB::ScanCertIssuers(const std::vector<unsigned char>& vchCertIssuer, u
                 if (!vtxPos.empty())
                     txPos = vtxPos.back();
                 certissuerScan.push_back(make_pair(vchCertIssuer, txPos));
-            }
+            } else
+                break;
             if (certissuerScan.size() >= nMax)
                 break;
 
@@ -191,126 +208,99 @@ bool CCertDB::ScanCertIssuers(const std::vector<unsigned char>& vchCertIssuer, u
     return true;
 }
 
-/**
- * [CCertDB::ReconstructCertIndex description]
- * @param  pindexRescan [description]
- * @return              [description]
- */
-bool CCertDB::ReconstructCertIndex(CBlockIndex *pindexRescan) {
-    CBlockIndex* pindex = pindexRescan;
+bool CCertDB::ReconstructCertBlock(const CBlock &block, CBlockIndex *pindex) {
+    int nHeight = pindex->nHeight;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
 
-    {
-    TRY_LOCK(pwalletMain->cs_wallet, cs_trylock);
-    while (pindex) {
-
-        int nHeight = pindex->nHeight;
-        CBlock block;
-        block.ReadFromDisk(pindex);
-        uint256 txblkhash;
-
-        BOOST_FOREACH(CTransaction& tx, block.vtx) {
-
-            if (tx.nVersion != SYSCOIN_TX_VERSION)
-                continue;
+        if (tx.nVersion != SYSCOIN_TX_VERSION)
+            continue;
 
-            vector<vector<unsigned char> > vvchArgs;
-            int op, nOut;
+        vector<vector<unsigned char> > vvchArgs;
+        int op, nOut;
 
-            // decode the certissuer op, params, height
-            bool o = DecodeCertTx(tx, op, nOut, vvchArgs, nHeight);
-            if (!o || !IsCertOp(op)) continue;
-            if (op == OP_CERTISSUER_NEW) continue;
+        // decode the certissuer op, params, height
+        bool o = DecodeCertTx(tx, op, nOut, vvchArgs, nHeight);
+        if (!o || !IsCertOp(op)) continue;
+        if (op == OP_CERTISSUER_NEW) continue;
 
-            vector<unsigned char> vchCertIssuer = vvchArgs[0];
+        vector<unsigned char> vchCertIssuer = vvchArgs[0];
 
-            // get the transaction
-            if(!GetTransaction(tx.GetHash(), tx, txblkhash, true))
-                continue;
+        // attempt to read certissuer from txn
+        CCertIssuer txCertIssuer;
+        CCertItem txCA;
+        if(!txCertIssuer.UnserializeFromTx(tx))
+            return error("ReconstructCertBlock() : failed to unserialize certissuer from tx");
 
-            // attempt to read certissuer from txn
-            CCertIssuer txCertIssuer;
-            CCertItem txCA;
-            if(!txCertIssuer.UnserializeFromTx(tx))
-                return error("ReconstructCertIndex() : failed to unserialize certissuer from tx");
-
-            // save serialized certissuer
-            CCertIssuer serializedCertIssuer = txCertIssuer;
-
-            // read certissuer from DB if it exists
-            vector<CCertIssuer> vtxPos;
-            if (ExistsCertIssuer(vchCertIssuer)) {
-                if (!ReadCertIssuer(vchCertIssuer, vtxPos))
-                    return error("ReconstructCertIndex() : failed to read certissuer from DB");
-                if(vtxPos.size()!=0) {
-                    txCertIssuer.nHeight = nHeight;
-                    txCertIssuer.GetCertFromList(vtxPos);
-                }
-            }
+        // save serialized certissuer
+        CCertIssuer serializedCertIssuer = txCertIssuer;
 
-            // read the certissuer certitem from db if exists
-            if(op == OP_CERT_NEW || op == OP_CERT_TRANSFER) {
-                bool bReadCertIssuer = false;
-                vector<unsigned char> vchCertItem = vvchArgs[1];
-                if (ExistsCertItem(vchCertItem)) {
-                    if (!ReadCertItem(vchCertItem, vchCertIssuer))
-                        printf("ReconstructCertIndex() : warning - failed to read certissuer certitem from certissuer DB\n");
-                    else bReadCertIssuer = true;
-                }
-                if(!bReadCertIssuer && !txCertIssuer.GetCertItemByHash(vchCertItem, txCA))
-                    printf("ReconstructCertIndex() : failed to read certissuer certitem from certissuer\n");
-
-                // add txn-specific values to certissuer certitem object
-                txCA.vchRand = vvchArgs[1];
-                txCA.nTime = pindex->nTime;
-                txCA.txHash = tx.GetHash();
-                txCA.nHeight = nHeight;
-                txCertIssuer.PutCertItem(txCA);
+        // read certissuer from DB if it exists
+        vector<CCertIssuer> vtxPos;
+        if (ExistsCertIssuer(vchCertIssuer)) {
+            if (!ReadCertIssuer(vchCertIssuer, vtxPos))
+                return error("ReconstructCertBlock() : failed to read certissuer from DB");
+            if(vtxPos.size()!=0) {
+                txCertIssuer.nHeight = nHeight;
+                txCertIssuer.GetCertFromList(vtxPos);
             }
+        }
 
-            // use the txn certissuer as master on updates,
-            // but grab the certitems from the DB first
-            if(op == OP_CERTISSUER_UPDATE) {
-                serializedCertIssuer.certs = txCertIssuer.certs;
-                txCertIssuer = serializedCertIssuer;
+        // read the certissuer certitem from db if exists
+        if(op == OP_CERT_NEW || op == OP_CERT_TRANSFER) {
+            bool bReadCertIssuer = false;
+            vector<unsigned char> vchCertItem = vvchArgs[1];
+            if (ExistsCertItem(vchCertItem)) {
+                if (!ReadCertItem(vchCertItem, vchCertIssuer))
+                    printf("ReconstructCertBlock() : warning - failed to read certissuer certitem from certissuer DB\n");
+                else bReadCertIssuer = true;
             }
+            if(!bReadCertIssuer && !txCertIssuer.GetCertItemByHash(vchCertItem, txCA))
+                printf("ReconstructCertBlock() : failed to read certissuer certitem from certissuer\n");
+
+            // add txn-specific values to certissuer certitem object
+            txCA.vchRand = vvchArgs[1];
+            txCA.nTime = pindex->nTime;
+            txCA.txHash = tx.GetHash();
+            txCA.nHeight = nHeight;
+            txCertIssuer.PutCertItem(txCA);
+        }
 
-            if(op != OP_CERTISSUER_NEW) {
-                // txn-specific values to certissuer object
-                txCertIssuer.vchRand = vvchArgs[0];
-                txCertIssuer.txHash = tx.GetHash();
-                txCertIssuer.nHeight = nHeight;
-                txCertIssuer.nTime = pindex->nTime;
-                txCertIssuer.PutToCertIssuerList(vtxPos);
+        // use the txn certissuer as master on updates,
+        // but grab the certitems from the DB first
+        if(op == OP_CERTISSUER_UPDATE) {
+            serializedCertIssuer.certs = txCertIssuer.certs;
+            txCertIssuer = serializedCertIssuer;
+        }
 
-                if (!WriteCertIssuer(vchCertIssuer, vtxPos))
-                    return error("ReconstructCertIndex() : failed to write to certissuer DB");
-            }
+        if(op != OP_CERTISSUER_NEW) {
+            // txn-specific values to certissuer object
+            txCertIssuer.vchRand = vvchArgs[0];
+            txCertIssuer.txHash = tx.GetHash();
+            txCertIssuer.nHeight = nHeight;
+            txCertIssuer.nTime = pindex->nTime;
+            txCertIssuer.PutToCertIssuerList(vtxPos);
 
-            if(op == OP_CERT_NEW || op == OP_CERT_TRANSFER)
-                if (!WriteCertItem(vvchArgs[1], vvchArgs[0]))
-                    return error("ReconstructCertIndex() : failed to write to certissuer DB");
-
-            // insert certissuers fees to regenerate list, write certissuer to
-            // master index
-            int64 nTheFee = GetCertNetFee(tx);
-            InsertCertFee(pindex, tx.GetHash(), nTheFee);
-			vector<CCertFee> vCertFees(lstCertIssuerFees.begin(),
-				lstCertIssuerFees.end());
-			if (!pcertdb->WriteCertFees(vCertFees))
-				return error("CheckOfferInputs() : failed to write fees to alias DB");
-
-
-            printf( "RECONSTRUCT CERT: op=%s certissuer=%s title=%s hash=%s height=%d fees=%llu\n",
-                    certissuerFromOp(op).c_str(),
-                    stringFromVch(vvchArgs[0]).c_str(),
-                    stringFromVch(txCertIssuer.vchTitle).c_str(),
-                    tx.GetHash().ToString().c_str(),
-                    nHeight,
-                    nTheFee);
+            if (!WriteCertIssuer(vchCertIssuer, vtxPos))
+                return error("ReconstructCertBlock() : failed to write to certissuer DB");
         }
-        pindex = pindex->pnext;
-        Flush();
-    }
+
+        if(op == OP_CERT_NEW || op == OP_CERT_TRANSFER)
+            if (!WriteCertItem(vvchArgs[1], vvchArgs[0]))
+                return error("ReconstructCertBlock() : failed to write to certissuer DB");
+
+        // insert certissuers fees to regenerate list, write certissuer to
+        // master index
+        int64 nTheFee = GetCertNetFee(tx);
+        InsertCertFee(pindex, tx.GetHash(), nTheFee);
+
+
+        printf( "RECONSTRUCT CERT: op=%s certissuer=%s title=%s hash=%s height=%d fees=%llu\n",
+                certissuerFromOp(op).c_str(),
+                stringFromVch(vvchArgs[0]).c_str(),
+                stringFromVch(txCertIssuer.vchTitle).c_str(),
+                tx.GetHash().ToString().c_str(),
+                nHeight,
+                nTheFee);
     }
     return true;
 }
@@ -328,85 +318,22 @@ int CheckCertIssuerTransactionAtRelativeDepth(CBlockIndex* pindexBlock,
 }
 
 int GetCertTxHashHeight(const uint256 txHash) {
-	CDiskTxPos postx;
-	pblocktree->ReadTxIndex(txHash, postx);
-	return GetCertTxPosHeight(postx);
+	CBlockIndex* pindex = GetTxBlockIndex(txHash);
+	return pindex ? pindex->nHeight : 0;
 }
 
 uint64 GetCertFeeSubsidy(unsigned int nHeight) {
-
-    unsigned int h12 = 360 * 12;
-    unsigned int nTargetTime = 0;
-    unsigned int nTarget1hrTime = 0;
-    unsigned int blk1hrht = nHeight - 1;
-    unsigned int blk12hrht = nHeight - 1;
-    bool bFound = false;
-    uint64 hr1 = 1, hr12 = 1;
-
-    BOOST_FOREACH(CCertFee &nmFee, lstCertIssuerFees) {
-        if(nmFee.nHeight <= nHeight)
-            bFound = true;
-        if(bFound) {
-            if(nTargetTime==0) {
-                hr1 = hr12 = 0;
-                nTargetTime = nmFee.nTime - h12;
-                nTarget1hrTime = nmFee.nTime - (h12/12);
-            }
-            if(nmFee.nTime > nTargetTime) {
-                hr12 += nmFee.nFee;
-                blk12hrht = nmFee.nHeight;
-                if(nmFee.nTime > nTarget1hrTime) {
-                    hr1 += nmFee.nFee;
-                    blk1hrht = nmFee.nHeight;
-                }
-            }
-        }
-    }
-    hr12 /= (nHeight - blk12hrht) + 1;
-    hr1 /= (nHeight - blk1hrht) + 1;
-    uint64 nSubsidyOut = hr1 > hr12 ? hr1 : hr12;
-    return nSubsidyOut;
+    return certFeeWindow.GetSubsidy(nHeight);
 }
 
-bool RemoveCertFee(CCertFee &txnVal) {
-	TRY_LOCK(cs_main, cs_trymain);
-
-	CCertFee *theval = NULL;
-
-	BOOST_FOREACH(CCertFee &nmTxnValue, lstCertIssuerFees) {
-		if (txnVal.hash == nmTxnValue.hash
-		 && txnVal.nHeight == nmTxnValue.nHeight) {
-			theval = &nmTxnValue;
-			break;
-		}
-	}
-
-	if(theval)
-		lstCertIssuerFees.remove(*theval);
-
-	return theval != NULL;
+// cert fees are tracked by height only: the first cert txn
+// connected at a height is the one whose fee is regenerated
+bool RemoveCertFee(CBlockIndex *pindex) {
+    return certFeeWindow.Remove(pindex->nHeight, 0);
 }
 
 bool InsertCertFee(CBlockIndex *pindex, uint256 hash, uint64 nValue) {
-	TRY_LOCK(cs_main, cs_trymain);
-    list<CCertFee> txnDup;
-    CCertFee oFee;
-    oFee.nTime = pindex->nTime;
-    oFee.nHeight = pindex->nHeight;
-    oFee.nFee = nValue;
-    bool bFound = false;
-
-    BOOST_FOREACH(CCertFee &nmFee, lstCertIssuerFees) {
-        if (oFee.hash == nmFee.hash
-                && oFee.nHeight == nmFee.nHeight) {
-            bFound = true;
-            break;
-        }
-    }
-    if (!bFound)
-        lstCertIssuerFees.push_front(oFee);
-
-    return bFound;
+    return certFeeWindow.Insert(pindex, 0, nValue);
 }
 
 int64 GetCertNetFee(const CTransaction& tx) {
@@ -630,20 +557,7 @@ bool GetTxOfCertItem(CCertDB& dbCert, const vector<unsigned char> &vchCertItem,
 
 bool DecodeCertTx(const CTransaction& tx, int& op, int& nOut,
         vector<vector<unsigned char> >& vvch, int nHeight) {
-    bool found = false;
-
-
-    // Strict check - bug disallowed
-    for (unsigned int i = 0; i < tx.vout.size(); i++) {
-        const CTxOut& out = tx.vout[i];
-        vector<vector<unsigned char> > vvchRead;
-        if (DecodeCertScript(out.scriptPubKey, op, vvchRead)) {
-            nOut = i; found = true; vvch = vvchRead;
-            break;
-        }
-    }
-    if (!found) vvch.clear();
-    return found && IsCertOp(op);
+    return tx.GetServiceOutput(SERVICE_CERT, op, nOut, vvch);
 }
 
 bool GetValueOfCertIssuerTx(const CCoins& tx, vector<unsigned char>& value) {
@@ -697,37 +611,7 @@ bool DecodeCertScript(const CScript& script, int& op,
 
 bool DecodeCertScript(const CScript& script, int& op,
         vector<vector<unsigned char> > &vvch, CScript::const_iterator& pc) {
-    opcodetype opcode;
-    if (!script.GetOp(pc, opcode)) return false;
-    if (opcode < OP_1 || opcode > OP_16) return false;
-    op = CScript::DecodeOP_N(opcode);
-
-    for (;;) {
-        vector<unsigned char> vch;
-        if (!script.GetOp(pc, opcode, vch))
-            return false;
-        if (opcode == OP_DROP || opcode == OP_2DROP || opcode == OP_NOP)
-            break;
-        if (!(opcode >= 0 && opcode <= OP_PUSHDATA4))
-            return false;
-        vvch.push_back(vch);
-    }
-
-    // move the pc to after any DROP or NOP
-    while (opcode == OP_DROP || opcode == OP_2DROP || opcode == OP_NOP) {
-        if (!script.GetOp(pc, opcode))
-            break;
-    }
-
-    pc--;
-
-    if ((op == OP_CERTISSUER_NEW && vvch.size() == 1)
-        || (op == OP_CERTISSUER_ACTIVATE && vvch.size() == 3)
-        || (op == OP_CERTISSUER_UPDATE && vvch.size() == 2)
-        || (op == OP_CERT_NEW && vvch.size() == 3)
-        || (op == OP_CERT_TRANSFER && vvch.size() == 2))
-        return true;
-    return false;
+    return DecodeServiceScript(script, op, vvch, pc) == SERVICE_CERT;
 }
 
 bool SignCertIssuerSignature(const CTransaction& txFrom, CTransaction& txTo,
@@ -737,6 +621,7 @@ bool SignCertIssuerSignature(const CTransaction& txFrom, CTransaction& txTo,
     CTxIn& txin = txTo.vin[nIn];
     assert(txin.prevout.n < txFrom.vout.size());
     const CTxOut& txout = txFrom.vout[txin.prevout.n];
+    txTo.InvalidateCache();
 
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
@@ -780,6 +665,7 @@ bool CreateCertTransactionWithInputTx(
         loop {
             wtxNew.vin.clear();
             wtxNew.vout.clear();
+            wtxNew.InvalidateCache();
             wtxNew.fFromMe = true;
             wtxNew.data = vchFromString(txData);
 
@@ -979,7 +865,7 @@ CScript RemoveCertIssuerScriptPrefix(const CScript& scriptIn) {
 }
 
 bool CheckCertInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
-        CValidationState &state, CCoinsViewCache &inputs,
+        CValidationState &state, const CTxInputs &inputs,
         map<vector<unsigned char>, uint256> &mapTestPool, bool fBlock, bool fMiner,
         bool fJustCheck) {
 
@@ -989,24 +875,15 @@ bool CheckCertInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
                 fBlock ? "BLOCK" : "", fMiner ? "MINER" : "",
                 fJustCheck ? "JUSTCHECK" : "");
 
-        bool found = false;
-        const COutPoint *prevOutput = NULL;
-        const CCoins *prevCoins = NULL;
-        int prevOp;
+        int nPrevIn;
+        int prevOp = 0;
         vector<vector<unsigned char> > vvchPrevArgs;
-
-        // Strict check - bug disallowed
-        for (int i = 0; i < (int) tx.vin.size(); i++) {
-            prevOutput = &tx.vin[i].prevout;
-            prevCoins = &inputs.GetCoins(prevOutput->hash);
-            vector<vector<unsigned char> > vvch;
-            if (DecodeCertScript(prevCoins->vout[prevOutput->n].scriptPubKey,
-                    prevOp, vvch)) {
-                found = true; vvchPrevArgs = vvch;
-                break;
-            }
-            if(!found)vvchPrevArgs.clear();
-        }
+        bool found = inputs.GetServiceInput(SERVICE_CERT, nPrevIn, prevOp, vvchPrevArgs);
+        // without a certificate input this points at the last input, where the
+        // search over the inputs used to leave it
+        if (!found)
+            nPrevIn = tx.vin.size() - 1;
+        const CCoins *prevCoins = &inputs.GetCoins(nPrevIn);
 
         // Make sure certissuer outputs are not spent by a regular transaction, or the certissuer would be lost
         if (tx.nVersion != SYSCOIN_TX_VERSION) {
@@ -1317,9 +1194,6 @@ bool CheckCertInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
                     int64 nTheFee = GetCertNetFee(tx);
                     InsertCertFee(pindexBlock, tx.GetHash(), nTheFee);
                     if(nTheFee > 0) printf("CERT FEES: Added %lf in fees to track for regeneration.\n", (double) nTheFee / COIN);
-                    vector<CCertFee> vCertIssuerFees(lstCertIssuerFees.begin(), lstCertIssuerFees.end());
-                    if (!pcertdb->WriteCertFees(vCertIssuerFees))
-                        return error( "CheckCertInputs() : failed to write fees to certissuer DB");
 
                     // remove certissuer from pendings
 
@@ -1385,21 +1259,9 @@ bool ExtractCertIssuerAddress(const CScript& script, string& address) {
     return true;
 }
 
-void rescanforcertissuers(CBlockIndex *pindexRescan) {
-    printf("Scanning blockchain for certissuers to create fast index...\n");
-    pcertdb->ReconstructCertIndex(pindexRescan);
-}
-
 int GetCertTxPosHeight(const CDiskTxPos& txPos) {
-    // Read block header
-    CBlock block;
-    if (!block.ReadFromDisk(txPos)) return 0;
-    // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
-    if (mi == mapBlockIndex.end()) return 0;
-    CBlockIndex* pindex = (*mi).second;
-    if (!pindex || !pindex->IsInMainChain()) return 0;
-    return pindex->nHeight;
+    CBlockIndex* pindex = GetTxPosBlockIndex(txPos);
+    return pindex ? pindex->nHeight : 0;
 }
 
 int GetCertTxPosHeight2(const CDiskTxPos& txPos, int nHeight) {
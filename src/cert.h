@@ -2,19 +2,21 @@
 #define CERT_H
 
 #include "bitcoinrpc.h"
-#include "leveldb.h"
+#include "servicedb.h"
+#include "feeregen.h"
 
 class CTransaction;
+class CBlock;
 class CTxOut;
 class CValidationState;
-class CCoinsViewCache;
+class CTxInputs;
 class COutPoint;
 class CCoins;
 class CScript;
 class CWalletTx;
 class CDiskTxPos;
 
-bool CheckCertInputs(CBlockIndex *pindex, const CTransaction &tx, CValidationState &state, CCoinsViewCache &inputs,
+bool CheckCertInputs(CBlockIndex *pindex, const CTransaction &tx, CValidationState &state, const CTxInputs &inputs,
                      std::map<std::vector<unsigned char>,uint256> &mapTestPool, bool fBlock, bool fMiner, bool fJustCheck);
 bool IsCertMine(const CTransaction& tx);
 bool IsCertMine(const CTransaction& tx, const CTxOut& txout, bool ignore_aliasnew = false);
@@ -266,26 +268,55 @@ public:
     void SetNull() { hash = nTime = nHeight = nFee = 0;}
     bool IsNull() const { return (nTime == 0 && nFee == 0 && hash == 0 && nHeight == 0); }
 };
-bool RemoveCertFee(CCertFee &txnVal);
+bool RemoveCertFee(CBlockIndex *pindex);
+
+// height at which an issuer with these versions expires, -1 if it has none
+int GetCertIssuerExpiryHeight(const std::vector<CCertIssuer> &vtxPos);
+
+class CCertDB : public CServiceDB {
+private:
+    CServiceRecordCache<std::vector<CCertIssuer> > cacheIssuers;
+
+    void RecordChanged(const std::string &strKey) {
+        std::vector<unsigned char> vchName;
+        if (DecodeRecordKey(strKey, "certissueri", vchName))
+            cacheIssuers.Erase(vchName);
+    }
+
+    int GetHeadExpiry(const std::string &strValue);
 
-class CCertDB : public CLevelDB {
 public:
-    CCertDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "certificates", nCacheSize, fMemory, fWipe) {}
+    CCertDB(size_t nCacheSize, bool fMemory, bool fWipe) : CServiceDB(GetDataDir() / "certificates", nCacheSize, fMemory, fWipe) {
+        strHeadPrefix = "certissueri";
+    }
 
     bool WriteCertIssuer(const std::vector<unsigned char>& name, std::vector<CCertIssuer>& vtxPos) {
-        return Write(make_pair(std::string("certissueri"), name), vtxPos);
+        LOCK(cs_cache);
+        if (!Write(make_pair(std::string("certissueri"), name), vtxPos))
+            return false;
+        cacheIssuers.Put(name, vtxPos);
+        return UpdateExpiry(name, GetCertIssuerExpiryHeight(vtxPos));
     }
 
     bool EraseCertIssuer(const std::vector<unsigned char>& name) {
-        return Erase(make_pair(std::string("certissueri"), name));
+        if (!Erase(make_pair(std::string("certissueri"), name)))
+            return false;
+        return UpdateExpiry(name, -1);
     }
 
+    // long expired issuers are read from the archive
     bool ReadCertIssuer(const std::vector<unsigned char>& name, std::vector<CCertIssuer>& vtxPos) {
-        return Read(make_pair(std::string("certissueri"), name), vtxPos);
+        LOCK(cs_cache);
+        if (cacheIssuers.Get(name, vtxPos))
+            return true;
+        if (!Read(make_pair(std::string("certissueri"), name), vtxPos) && !ReadArchived(name, vtxPos))
+            return false;
+        cacheIssuers.Put(name, vtxPos);
+        return true;
     }
 
     bool ExistsCertIssuer(const std::vector<unsigned char>& name) {
-        return Exists(make_pair(std::string("certissueri"), name));
+        return Exists(make_pair(std::string("certissueri"), name)) || ExistsArchived(name);
     }
 
     bool WriteCertItem(const std::vector<unsigned char>& name, std::vector<unsigned char>& vchValue) {
@@ -312,14 +343,29 @@ public:
         return Read(make_pair(std::string("certissuera"), std::string("certissuertxf")), vtxPos);
     }
 
+    bool EraseCertFees() {
+        return Erase(make_pair(std::string("certissuera"), std::string("certissuertxf")));
+    }
+
     bool ScanCertIssuers(
             const std::vector<unsigned char>& vchName,
             unsigned int nMax,
             std::vector<std::pair<std::vector<unsigned char>, CCertIssuer> >& certIssuerScan);
 
-    bool ReconstructCertIndex(CBlockIndex *pindexRescan);
+    // apply the certificate txns of a main chain block, when rebuilding the DB
+    bool ReconstructCertBlock(const CBlock &block, CBlockIndex *pindex);
+
+    void SetRecordCacheSize(uint64 nBytes) {
+        LOCK(cs_cache);
+        cacheIssuers.SetMaxBytes(nBytes);
+    }
+
+    void GetRecordCacheStats(std::vector<std::pair<std::string, CServiceCacheStats> > &vStats) const {
+        LOCK(cs_cache);
+        vStats.push_back(make_pair(std::string("certissuers"), cacheIssuers.GetStats()));
+    }
 };
-extern std::list<CCertFee> lstCertIssuerFees;
+extern CFeeRegenWindow certFeeWindow;
 
 
 bool GetTxOfCertIssuer(CCertDB& dbCertIssuer, const std::vector<unsigned char> &vchCertIssuer, CTransaction& tx);
@@ -8,8 +8,9 @@
 #include <boost/thread/locks.hpp>
 #include <boost/thread/condition_variable.hpp>
 
-#include <vector>
 #include <algorithm>
+#include <deque>
+#include <vector>
 
 template<typename T> class CCheckQueueControl;
 
@@ -21,9 +22,28 @@ template<typename T> class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every thread has a deque of its own, each with its own lock, and the
+  * master deals the checks it adds out over them. A thread takes the newest
+  * checks of its own deque, and once that is empty steals the oldest half
+  * of another's. The shared lock only guards the counters and is taken once
+  * per batch, so threads do not wait on each other for the checks.
   */
 template<typename T> class CCheckQueue {
 private:
+    // Most threads, the master included, that get a deque of their own;
+    // any more share them
+    static const unsigned int MAX_QUEUES = 128;
+
+    struct CWorkQueue {
+        boost::mutex mutex;
+        std::deque<T> checks;
+    };
+
+    // The deques, the master's first. Only the first nQueues are allocated;
+    // a thread reads nQueues under the shared lock before using them.
+    CWorkQueue *vpQueues[MAX_QUEUES];
+
     // Mutex to protect the inner state
     boost::mutex mutex;
 
@@ -33,10 +53,6 @@ private:
     // Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    // The queue of elements to be processed.
-    // As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
     // The number of workers (including the master) that are idle.
     int nIdle;
 
@@ -47,7 +63,7 @@ private:
     bool fAllOk;
 
     // Number of verifications that haven't completed yet.
-    // This includes elements that are not anymore in queue, but still in
+    // This includes elements that are not anymore in a deque, but still in
     // worker's own batches.
     unsigned int nTodo;
 
@@ -57,54 +73,113 @@ private:
     // The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    // The number of deques in use, and the next one Add starts dealing at.
+    unsigned int nQueues;
+    unsigned int nNextQueue;
+
+    // The number of worker threads that ever joined.
+    unsigned int nWorkers;
+
+    // Give a new worker thread a deque. Called with the shared lock held.
+    unsigned int AddWorker() {
+        unsigned int nQueue = 1 + nWorkers++ % (MAX_QUEUES - 1);
+        if (nQueue == nQueues)
+            vpQueues[nQueues++] = new CWorkQueue();
+        return nQueue;
+    }
+
+    // Whether any deque holds checks. Called with the shared lock held.
+    bool HaveWork() {
+        for (unsigned int i = 0; i < nQueues; i++) {
+            boost::unique_lock<boost::mutex> lock(vpQueues[i]->mutex);
+            if (!vpQueues[i]->checks.empty())
+                return true;
+        }
+        return false;
+    }
+
+    // Move a batch of checks into vChecks and return its size: the newest of
+    // deque nQueue, or if that is empty the oldest half of another's.
+    unsigned int Take(unsigned int nQueue, unsigned int nQueuesNow, std::vector<T> &vChecks) {
+        {
+            CWorkQueue &own = *vpQueues[nQueue];
+            boost::unique_lock<boost::mutex> lock(own.mutex);
+            if (!own.checks.empty()) {
+                // Aim for smaller batches as the deque drains, so that what
+                // is left can still be stolen and threads finish together.
+                unsigned int nNow = std::max(1U, std::min(nBatchSize, (unsigned int)own.checks.size() / 2));
+                vChecks.resize(nNow);
+                for (unsigned int i = 0; i < nNow; i++) {
+                    vChecks[i].swap(own.checks.back());
+                    own.checks.pop_back();
+                }
+                return nNow;
+            }
+        }
+        for (unsigned int i = 1; i < nQueuesNow; i++) {
+            CWorkQueue &other = *vpQueues[(nQueue + i) % nQueuesNow];
+            boost::unique_lock<boost::mutex> lock(other.mutex);
+            if (other.checks.empty())
+                continue;
+            unsigned int nNow = std::min(nBatchSize, (unsigned int)(other.checks.size() + 1) / 2);
+            vChecks.resize(nNow);
+            for (unsigned int j = 0; j < nNow; j++) {
+                vChecks[j].swap(other.checks.front());
+                other.checks.pop_front();
+            }
+            return nNow;
+        }
+        return 0;
+    }
+
     // Internal function that does bulk of the verification work.
     bool Loop(bool fMaster = false) {
         boost::condition_variable &cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
+        unsigned int nQueue = 0;
+        unsigned int nQueuesNow = 0;
+        unsigned int nDone = 0;
         bool fOk = true;
         do {
+            // Take the next batch before reporting the previous one: until
+            // then the master cannot finish, and so cannot start a new round
+            // whose checks this thread could take with a stale fOk.
+            unsigned int nNow = nQueuesNow ? Take(nQueue, nQueuesNow, vChecks) : 0;
             {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
+                if (nQueuesNow == 0) {
+                    // first iteration
+                    nTotal++;
+                    if (!fMaster)
+                        nQueue = AddWorker();
+                }
+                if (nDone) {
                     fAllOk &= fOk;
-                    nTodo -= nNow;
+                    nTodo -= nDone;
+                    nDone = 0;
                     if (nTodo == 0 && !fMaster)
                         // We processed the last element; inform the master he can exit and return the result
                         condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                nQueuesNow = nQueues;
+                if (nNow == 0) {
+                    while (!HaveWork()) {
+                        if ((fMaster || fQuit) && nTodo == 0) {
+                            nTotal--;
+                            bool fRet = fAllOk;
+                            // reset the status for new work later
+                            if (fMaster)
+                                fAllOk = true;
+                            // return the current status
+                            return fRet;
+                        }
+                        nIdle++;
+                        cond.wait(lock); // wait
+                        nIdle--;
                     }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                     // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                     // queue to the local batch vector instead of copying.
-                     vChecks[i].swap(queue.back());
-                     queue.pop_back();
+                    nQueuesNow = nQueues;
+                    continue;
                 }
                 // Check whether we need to do work at all
                 fOk = fAllOk;
@@ -114,13 +189,17 @@ private:
                 if (fOk)
                     fOk = check();
             vChecks.clear();
+            nDone = nNow;
         } while(true);
     }
 
 public:
     // Create a new check queue
     CCheckQueue(unsigned int nBatchSizeIn) :
-        nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+        nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn),
+        nQueues(1), nNextQueue(0), nWorkers(0) {
+        vpQueues[0] = new CWorkQueue();
+    }
 
     // Worker thread
     void Thread() {
@@ -132,21 +211,31 @@ public:
         return Loop(true);
     }
 
-    // Add a batch of checks to the queue
+    // Add a batch of checks to the queue, dealt out in runs over the deques
     void Add(std::vector<T> &vChecks) {
+        if (vChecks.empty())
+            return;
         boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH(T &check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        unsigned int nRun = (vChecks.size() + nQueues - 1) / nQueues;
+        for (unsigned int i = 0; i < vChecks.size(); i += nRun) {
+            CWorkQueue &queue = *vpQueues[nNextQueue];
+            nNextQueue = (nNextQueue + 1) % nQueues;
+            boost::unique_lock<boost::mutex> lockQueue(queue.mutex);
+            for (unsigned int j = i; j < vChecks.size() && j < i + nRun; j++) {
+                queue.checks.push_back(T());
+                vChecks[j].swap(queue.checks.back());
+            }
         }
         nTodo += vChecks.size();
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
     ~CCheckQueue() {
+        for (unsigned int i = 0; i < nQueues; i++)
+            delete vpQueues[i];
     }
 
     friend class CCheckQueueControl<T>;
@@ -164,7 +253,7 @@ public:
     CCheckQueueControl(CCheckQueue<T> *pqueueIn) : pqueue(pqueueIn), fDone(false) {
         // passed queue is supposed to be unused, or NULL
         if (pqueue != NULL) {
-            assert(pqueue->nTotal == pqueue->nIdle);
+            // workers may still be on their way to sleep, but hold no checks
             assert(pqueue->nTodo == 0);
             assert(pqueue->fAllOk == true);
         }
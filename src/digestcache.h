@@ -0,0 +1,159 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_DIGESTCACHE_H
+#define BITCOIN_DIGESTCACHE_H
+
+#include "uint256.h"
+#include "util.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Largest size a CDigestCache is given, in MiB */
+static const unsigned int MAX_DIGEST_CACHE_SIZE = 16384;
+
+/** Size and hit/miss counts of a CDigestCache. */
+struct CDigestCacheStats
+{
+    uint64 nEntries;
+    uint64 nMaxEntries;
+    uint64 nBytes;
+    uint64 nHits;
+    uint64 nMisses;
+    uint64 nErased;
+
+    CDigestCacheStats() : nEntries(0), nMaxEntries(0), nBytes(0), nHits(0), nMisses(0), nErased(0) {}
+};
+
+/** A set of 32-byte digests of a fixed size in memory, for caching what
+ *  has been validated before.
+ *
+ *  Entries are salted hashes of what they stand for, made with GetSalt().
+ *  The table is split in shards, each with its own lock, and an entry can
+ *  only be in the PROBE slots following the one its hash picks in its
+ *  shard; when they are all taken a new entry replaces one of them. The salt
+ *  is random, so nobody can make up entries that crowd out others by landing
+ *  in the same slots. Lookups never go past those slots, so erasing an entry
+ *  just frees its slot.
+ */
+class CDigestCache
+{
+private:
+    static const unsigned int SHARDS = 32;
+    static const unsigned int PROBE = 8;
+
+    struct CShard
+    {
+        boost::mutex cs;
+        std::vector<uint256> vSlots; // 0 if free
+        uint64 nEntries;
+        uint64 nHits;
+        uint64 nMisses;
+        uint64 nErased;
+
+        CShard() : nEntries(0), nHits(0), nMisses(0), nErased(0) {}
+    };
+
+    CShard vShards[SHARDS];
+    uint256 nSalt;
+
+    // the shard of an entry, and where in it the slots it may be in start
+    CShard &GetShard(const uint256 &entry, size_t &nPos)
+    {
+        CShard &shard = vShards[entry.Get64(0) % SHARDS];
+        nPos = shard.vSlots.empty() ? 0 : entry.Get64(1) % shard.vSlots.size();
+        return shard;
+    }
+
+    static size_t Find(const CShard &shard, size_t nPos, const uint256 &entry)
+    {
+        for (unsigned int i = 0; i < PROBE; i++) {
+            size_t n = (nPos + i) % shard.vSlots.size();
+            if (shard.vSlots[n] == entry)
+                return n;
+        }
+        return shard.vSlots.size();
+    }
+
+public:
+    const uint256 &GetSalt() const { return nSalt; }
+
+    // Empty the cache and make it nBytes large, with a new salt. Not safe
+    // while it is in use, as entries hashed with the old salt may be in flight.
+    void Resize(uint64 nBytes)
+    {
+        nSalt = GetRandHash();
+        nBytes = std::min(nBytes, (uint64)MAX_DIGEST_CACHE_SIZE << 20);
+        size_t nSlots = nBytes / sizeof(uint256) / SHARDS;
+        if (nSlots > 0 && nSlots < PROBE)
+            nSlots = PROBE;
+        for (unsigned int i = 0; i < SHARDS; i++) {
+            CShard &shard = vShards[i];
+            boost::unique_lock<boost::mutex> lock(shard.cs);
+            std::vector<uint256>(nSlots).swap(shard.vSlots);
+            shard.nEntries = 0;
+        }
+    }
+
+    // Whether an entry is in the cache, taking it out if fErase.
+    bool Contains(const uint256 &entry, bool fErase)
+    {
+        size_t nPos;
+        CShard &shard = GetShard(entry, nPos);
+        boost::unique_lock<boost::mutex> lock(shard.cs);
+        if (shard.vSlots.empty())
+            return false;
+        size_t n = Find(shard, nPos, entry);
+        if (n == shard.vSlots.size()) {
+            shard.nMisses++;
+            return false;
+        }
+        shard.nHits++;
+        if (fErase) {
+            shard.vSlots[n] = 0;
+            shard.nEntries--;
+            shard.nErased++;
+        }
+        return true;
+    }
+
+    void Insert(const uint256 &entry)
+    {
+        size_t nPos;
+        CShard &shard = GetShard(entry, nPos);
+        boost::unique_lock<boost::mutex> lock(shard.cs);
+        if (shard.vSlots.empty() || Find(shard, nPos, entry) != shard.vSlots.size())
+            return;
+        for (unsigned int i = 0; i < PROBE; i++) {
+            size_t n = (nPos + i) % shard.vSlots.size();
+            if (shard.vSlots[n] == 0) {
+                shard.vSlots[n] = entry;
+                shard.nEntries++;
+                return;
+            }
+        }
+        // all taken: evict one, picked by other bits of the salted hash
+        shard.vSlots[(nPos + entry.Get64(2) % PROBE) % shard.vSlots.size()] = entry;
+    }
+
+    void GetStats(CDigestCacheStats &stats)
+    {
+        stats = CDigestCacheStats();
+        for (unsigned int i = 0; i < SHARDS; i++) {
+            CShard &shard = vShards[i];
+            boost::unique_lock<boost::mutex> lock(shard.cs);
+            stats.nEntries += shard.nEntries;
+            stats.nMaxEntries += shard.vSlots.size();
+            stats.nHits += shard.nHits;
+            stats.nMisses += shard.nMisses;
+            stats.nErased += shard.nErased;
+        }
+        stats.nBytes = stats.nMaxEntries * sizeof(uint256);
+    }
+};
+
+#endif
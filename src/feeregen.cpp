@@ -0,0 +1,221 @@
+#include "feeregen.h"
+#include "main.h"
+
+#include <boost/scoped_ptr.hpp>
+
+using namespace std;
+
+CFeeRegenWindow::CFeeRegenWindow(const string &strPrefixIn, unsigned int nWindowIn, bool fUpdateExistingIn, bool fAverageIn) {
+    nNextSeq = 0;
+    nLastPruneHeight = 0;
+    pdb = NULL;
+    strPrefix = strPrefixIn;
+    nWindow = nWindowIn;
+    fUpdateExisting = fUpdateExistingIn;
+    fAverage = fAverageIn;
+}
+
+deque<CFeeRegenEntry>::iterator CFeeRegenWindow::Find(uint64 nHeight, const uint256 &hash) {
+    map<pair<uint64, uint256>, unsigned int>::iterator mi = mapEntries.find(make_pair(nHeight, hash));
+    if (mi == mapEntries.end())
+        return entries.end();
+    // sequence numbers increase along the deque but may have gaps
+    unsigned int nSeq = mi->second;
+    deque<CFeeRegenEntry>::iterator it = entries.end();
+    while (it != entries.begin()) {
+        --it;
+        if (it->nSeq == nSeq)
+            return it;
+        if (it->nSeq < nSeq)
+            break;
+    }
+    return entries.end();
+}
+
+void CFeeRegenWindow::Append(CLevelDBBatch &batch, CFeeRegenEntry &entry) {
+    entry.nSeq = nNextSeq++;
+    entry.nMaxTime = entry.nTime;
+    if (!entries.empty() && entries.back().nMaxTime > entry.nMaxTime)
+        entry.nMaxTime = entries.back().nMaxTime;
+    entries.push_back(entry);
+    mapEntries[make_pair(entry.nHeight, entry.hash)] = entry.nSeq;
+    batch.Write(make_pair(strPrefix, CBigEndianKey(entry.nSeq)), entry);
+}
+
+bool CFeeRegenWindow::Load(CServiceDB *pdbIn, const vector<CFeeRegenEntry> &vLegacy) {
+    LOCK(cs);
+    pdb = pdbIn;
+    entries.clear();
+    mapEntries.clear();
+    nNextSeq = 0;
+    nLastPruneHeight = 0;
+
+    boost::scoped_ptr<leveldb::Iterator> pcursor(pdb->NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(strPrefix, CBigEndianKey(0));
+    for (pcursor->Seek(ssKeySet.str()); pcursor->Valid(); pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            string sType;
+            ssKey >> sType;
+            if (sType != strPrefix)
+                break;
+            CBigEndianKey key;
+            ssKey >> key;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CFeeRegenEntry entry;
+            ssValue >> entry;
+            entry.nSeq = key.n;
+            entry.nMaxTime = entry.nTime;
+            if (!entries.empty() && entries.back().nMaxTime > entry.nMaxTime)
+                entry.nMaxTime = entries.back().nMaxTime;
+            entries.push_back(entry);
+            mapEntries[make_pair(entry.nHeight, entry.hash)] = entry.nSeq;
+            nNextSeq = entry.nSeq + 1;
+        } catch (std::exception &e) {
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+        }
+    }
+
+    if (!entries.empty() || vLegacy.empty())
+        return true;
+
+    // the legacy list was kept newest first
+    CLevelDBBatch batch;
+    for (vector<CFeeRegenEntry>::const_reverse_iterator it = vLegacy.rbegin(); it != vLegacy.rend(); ++it) {
+        CFeeRegenEntry entry = *it;
+        Append(batch, entry);
+    }
+    return pdb->WriteBatch(batch);
+}
+
+bool CFeeRegenWindow::Insert(CBlockIndex *pindex, const uint256 &hash, uint64 nFee) {
+    LOCK(cs);
+    CLevelDBBatch batch;
+    bool fFound = false;
+    deque<CFeeRegenEntry>::iterator it = Find(pindex->nHeight, hash);
+    if (it != entries.end()) {
+        fFound = true;
+        if (fUpdateExisting) {
+            it->nTime = pindex->nTime;
+            it->nFee = nFee;
+            batch.Write(make_pair(strPrefix, CBigEndianKey(it->nSeq)), *it);
+        }
+    } else {
+        CFeeRegenEntry entry(hash, pindex->nHeight, pindex->nTime, nFee);
+        Append(batch, entry);
+    }
+
+    if (pindex->nHeight >= nLastPruneHeight + FEE_REGEN_PRUNE_INTERVAL) {
+        nLastPruneHeight = pindex->nHeight;
+        Prune(pindex);
+    }
+    if (pdb && !pdb->WriteBatch(batch))
+        return error("CFeeRegenWindow::Insert() : failed to write %s entry", strPrefix.c_str());
+    return fFound;
+}
+
+bool CFeeRegenWindow::Remove(uint64 nHeight, const uint256 &hash) {
+    LOCK(cs);
+    deque<CFeeRegenEntry>::iterator it = Find(nHeight, hash);
+    if (it == entries.end())
+        return false;
+    if (pdb)
+        pdb->Erase(make_pair(strPrefix, CBigEndianKey(it->nSeq)));
+    mapEntries.erase(make_pair(nHeight, hash));
+    // disconnects remove the newest entries, so this is normally a pop_back;
+    // nMaxTime of later entries stays a valid upper bound either way
+    entries.erase(it);
+    return true;
+}
+
+void CFeeRegenWindow::ClearNewest(uint64 nStartHeight, uint64 nEndHeight) {
+    LOCK(cs);
+    for (deque<CFeeRegenEntry>::reverse_iterator it = entries.rbegin(); it != entries.rend(); ++it) {
+        if (it->nHeight >= nStartHeight && it->nHeight < nEndHeight) {
+            it->nFee = 0;
+            if (pdb)
+                pdb->Write(make_pair(strPrefix, CBigEndianKey(it->nSeq)), *it);
+            break;
+        }
+    }
+}
+
+// Drop entries that no subsidy computation at or above the prune depth can
+// count. Such a computation anchors its window on an entry at least as new
+// as the newest one below the prune depth, or on a future entry, whose block
+// time exceeds the median time past at the prune depth.
+void CFeeRegenWindow::Prune(CBlockIndex *pindex) {
+    CBlockIndex *pindexDepth = pindex;
+    for (int i = 0; pindexDepth && i < FEE_REGEN_PRUNE_DEPTH; i++)
+        pindexDepth = pindexDepth->pprev;
+    if (!pindexDepth || entries.empty())
+        return;
+
+    uint64 nMinTime = pindexDepth->GetMedianTimePast();
+    unsigned int nAnchorSeq = entries.front().nSeq;
+    for (deque<CFeeRegenEntry>::reverse_iterator it = entries.rbegin(); it != entries.rend(); ++it) {
+        if (it->nTime < nMinTime)
+            nMinTime = it->nTime;
+        if (it->nHeight <= (uint64)pindexDepth->nHeight) {
+            nAnchorSeq = it->nSeq;
+            break;
+        }
+    }
+    if (nMinTime <= nWindow)
+        return;
+    uint64 nPruneTime = nMinTime - nWindow;
+
+    CLevelDBBatch batch;
+    unsigned int nPruned = 0;
+    while (!entries.empty() && entries.front().nSeq < nAnchorSeq && entries.front().nTime <= nPruneTime) {
+        const CFeeRegenEntry &entry = entries.front();
+        batch.Erase(make_pair(strPrefix, CBigEndianKey(entry.nSeq)));
+        mapEntries.erase(make_pair(entry.nHeight, entry.hash));
+        entries.pop_front();
+        nPruned++;
+    }
+    if (nPruned && pdb)
+        pdb->WriteBatch(batch);
+}
+
+uint64 CFeeRegenWindow::GetSubsidy(unsigned int nHeight) const {
+    LOCK(cs);
+    uint64 hr1 = 1, hr12 = 1;
+    unsigned int blk1hrht = nHeight - 1, blk12hrht = nHeight - 1;
+
+    // the newest entry at or below nHeight anchors both windows,
+    // every entry connected before it is a candidate
+    int i = (int)entries.size() - 1;
+    while (i >= 0 && entries[i].nHeight > nHeight)
+        i--;
+    if (i >= 0) {
+        hr1 = hr12 = 0;
+        unsigned int nTargetTime = entries[i].nTime - nWindow;
+        unsigned int nTarget1hrTime = entries[i].nTime - (nWindow / 12);
+        for (; i >= 0 && entries[i].nMaxTime > nTargetTime; i--) {
+            const CFeeRegenEntry &entry = entries[i];
+            if (entry.nTime > nTargetTime) {
+                hr12 += entry.nFee;
+                blk12hrht = entry.nHeight;
+                if (entry.nTime > nTarget1hrTime) {
+                    hr1 += entry.nFee;
+                    blk1hrht = entry.nHeight;
+                }
+            }
+        }
+    }
+    hr12 /= (nHeight - blk12hrht) + 1;
+    hr1 /= (nHeight - blk1hrht) + 1;
+    if (fAverage)
+        return (hr12 + hr1) / 2;
+    return hr1 > hr12 ? hr1 : hr12;
+}
+
+unsigned int CFeeRegenWindow::size() const {
+    LOCK(cs);
+    return entries.size();
+}
@@ -0,0 +1,102 @@
+#ifndef FEEREGEN_H
+#define FEEREGEN_H
+
+#include "servicedb.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <deque>
+#include <map>
+
+class CBlockIndex;
+
+// entries connected less than this many blocks ago are never pruned
+static const int FEE_REGEN_PRUNE_DEPTH = 240;
+// only attempt to prune once per this many blocks
+static const int FEE_REGEN_PRUNE_INTERVAL = 60;
+
+/** A service fee tracked for regeneration into later block subsidies. */
+class CFeeRegenEntry {
+public:
+    uint256 hash;
+    uint64 nHeight;
+    uint64 nTime;
+    uint64 nFee;
+
+    // not serialized: DB position, and the newest nTime of this and every older entry
+    unsigned int nSeq;
+    uint64 nMaxTime;
+
+    CFeeRegenEntry() {
+        SetNull();
+    }
+
+    CFeeRegenEntry(const uint256 &hashIn, uint64 nHeightIn, uint64 nTimeIn, uint64 nFeeIn) {
+        SetNull();
+        hash = hashIn;
+        nHeight = nHeightIn;
+        nTime = nTimeIn;
+        nFee = nFeeIn;
+    }
+
+    IMPLEMENT_SERIALIZE (
+        READWRITE(hash);
+        READWRITE(nHeight);
+        READWRITE(nTime);
+        READWRITE(nFee);
+    )
+
+    void SetNull() { hash = 0; nHeight = nTime = nFee = nMaxTime = 0; nSeq = 0; }
+};
+
+/** Fees paid by alias, offer and certificate transactions are paid back to
+ *  miners through GetBlockValue, averaged over the 1 and 12 hour windows that
+ *  precede the newest fee at or below the block height.
+ *
+ *  Entries are kept in connect order in a deque. Each entry remembers the
+ *  newest block time at or before it, so a subsidy computation stops as soon
+ *  as no older entry can fall inside the window, and its cost depends only on
+ *  the number of fees in the window, never on the length of the chain.
+ *  Entries are persisted one DB record each, keyed by their connect sequence,
+ *  and dropped once they can no longer be inside any window. */
+class CFeeRegenWindow {
+private:
+    mutable CCriticalSection cs;
+    std::deque<CFeeRegenEntry> entries;
+    std::map<std::pair<uint64, uint256>, unsigned int> mapEntries;
+    unsigned int nNextSeq;
+    int nLastPruneHeight;
+
+    CServiceDB *pdb;
+    std::string strPrefix;
+    unsigned int nWindow;
+    bool fUpdateExisting;
+    bool fAverage;
+
+    std::deque<CFeeRegenEntry>::iterator Find(uint64 nHeight, const uint256 &hash);
+    void Append(CLevelDBBatch &batch, CFeeRegenEntry &entry);
+    void Prune(CBlockIndex *pindex);
+
+public:
+    // strPrefixIn: DB key prefix; nWindowIn: long window in seconds (the short one
+    // is 1/12 of it); fUpdateExistingIn: a fee re-inserted for the same txn and
+    // height replaces the stored value; fAverageIn: subsidy is the average of both
+    // windows rather than the larger one
+    CFeeRegenWindow(const std::string &strPrefixIn, unsigned int nWindowIn, bool fUpdateExistingIn, bool fAverageIn);
+
+    // attach to a service DB and load its entries; vLegacy is a fee list in the
+    // old single-record format (newest first) to migrate when the DB has none
+    bool Load(CServiceDB *pdbIn, const std::vector<CFeeRegenEntry> &vLegacy);
+
+    // track the fee of a txn connected in pindex; returns true if it was already tracked
+    bool Insert(CBlockIndex *pindex, const uint256 &hash, uint64 nFee);
+    // forget the fee of a txn disconnected from nHeight
+    bool Remove(uint64 nHeight, const uint256 &hash);
+    // zero the most recently connected fee within [nStartHeight, nEndHeight)
+    void ClearNewest(uint64 nStartHeight, uint64 nEndHeight);
+
+    uint64 GetSubsidy(unsigned int nHeight) const;
+    unsigned int size() const;
+};
+
+#endif // FEEREGEN_H
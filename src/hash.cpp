@@ -1,4 +1,7 @@
 #include "hash.h"
+#include "util.h"
+
+#include <limits>
 
 inline uint32_t ROTL32 ( uint32_t x, int8_t r )
 {
@@ -56,3 +59,9 @@ unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char
 
     return h1;
 }
+
+CSaltedHasher::CSaltedHasher()
+{
+    k0 = GetRand(std::numeric_limits<uint64>::max());
+    k1 = GetRand(std::numeric_limits<uint64>::max());
+}
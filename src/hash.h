@@ -10,6 +10,7 @@
 
 #include <openssl/sha.h>
 #include <openssl/ripemd.h>
+#include <string.h>
 #include <vector>
 
 template<typename T1>
@@ -45,6 +46,15 @@ public:
         return (*this);
     }
 
+    // the state of the hash so far, to carry on from it in another writer
+    const SHA256_CTX& GetMidstate() const {
+        return ctx;
+    }
+
+    void SetMidstate(const SHA256_CTX& ctxIn) {
+        ctx = ctxIn;
+    }
+
     // invalidates the object
     uint256 GetHash() {
         uint256 hash1;
@@ -123,4 +133,27 @@ inline uint160 Hash160(const std::vector<unsigned char>& vch)
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
 
+/** Hasher of uint256 keys for hash tables. The salt is random per instance,
+ *  so txids or block hashes cannot be picked to pile up in one bucket. */
+class CSaltedHasher
+{
+private:
+    uint64 k0, k1;
+
+public:
+    CSaltedHasher();
+
+    size_t operator()(const uint256& key) const
+    {
+        uint64 pn[4];
+        memcpy(pn, key.begin(), sizeof(pn));
+        uint64 h = k0;
+        for (int i = 0; i < 4; i++) {
+            h = (h ^ pn[i]) * 0x9e3779b97f4a7c15ULL;
+            h ^= h >> 29;
+        }
+        return (size_t)((h ^ k1) * 0xbf58476d1ce4e5b9ULL >> 16);
+    }
+};
+
 #endif
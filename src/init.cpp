@@ -10,6 +10,7 @@
 #include "init.h"
 #include "util.h"
 #include "ui_interface.h"
+#include "auxpow.h"
 
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -29,9 +30,6 @@ extern CAliasDB *paliasdb;
 extern COfferDB *pofferdb;
 extern CCertDB *pcertdb;
 
-void rescanforaliases(CBlockIndex *pindexRescan);
-void rescanforoffers(CBlockIndex *pindexRescan);
-void rescanforcertissuers(CBlockIndex *pindexRescan);
 
 CWallet* pwalletMain;
 CClientUIInterface uiInterface;
@@ -119,15 +117,13 @@ void Shutdown()
             pblocktree->Flush();
         if (pcoinsTip)
             pcoinsTip->Flush();
-        if (paliasdb)
-            paliasdb->Flush();        
-        if (pofferdb)
-            pofferdb->Flush(); 
-        if (pcertdb)
-            pcertdb->Flush();   
+        if (pcoinsTip && paliasdb && pofferdb && pcertdb)
+            FlushServiceDBs();
+        WriteBlockIndexSnapshot();
         delete pcoinsTip; pcoinsTip = NULL;
         delete pcoinsdbview; pcoinsdbview = NULL;
         delete pblocktree; pblocktree = NULL;
+        auxpowstore.Close();
         delete paliasdb; paliasdb = NULL;
         delete pofferdb; pofferdb = NULL;
         delete pcertdb; pcertdb = NULL;
@@ -320,6 +316,7 @@ std::string HelpMessage()
         "  -gen                   " + _("Generate coins (default: 0)") + "\n" +
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
+        "  -servicecache=<n>      " + _("Set the size of the decoded alias, offer and certificate cache in megabytes (default: 16)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n" +
         "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n" +
@@ -388,7 +385,10 @@ std::string HelpMessage()
         "  -txindex               " + _("Maintain a full transaction index (default: 1)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000??.dat file") + "\n" +
         "  -reindex               " + _("Rebuild block chain index from current blk000??.dat files") + "\n" +
-        "  -par=<n>               " + _("Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n" +
+        "  -par=<n>               " + _("Set the number of script verification threads (up to 64, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n" +
+        "  -fetchpar=<n>          " + _("Set the number of threads reading block inputs from the coins database (up to 64, 0 = none, default: 4)") + "\n" +
+        "  -sigcachesize=<n>      " + _("Set the size of the cache of valid signatures in megabytes (default: 32, up to 16384)") + "\n" +
+        "  -maxscriptcachesize=<n> " + _("Set the size of the cache of transactions with valid scripts in megabytes (default: 8, up to 16384)") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
         "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n" +
@@ -584,6 +584,16 @@ bool AppInit2(boost::thread_group& threadGroup)
         nScriptCheckThreads = 0;
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    // the reads wait on the disk rather than the CPU, so this does not
+    // follow the number of cores; 1 is the connecting thread alone
+    nCoinsFetchThreads = GetArg("-fetchpar", DEFAULT_COINS_FETCH_THREADS);
+    if (nCoinsFetchThreads <= 1)
+        nCoinsFetchThreads = 0;
+    else if (nCoinsFetchThreads > MAX_SCRIPTCHECK_THREADS)
+        nCoinsFetchThreads = MAX_SCRIPTCHECK_THREADS;
+
+    InitSignatureCache();
+    InitScriptExecutionCache();
 
     // -debug implies fDebug*
     if (fDebug)
@@ -686,6 +696,17 @@ bool AppInit2(boost::thread_group& threadGroup)
         printf("Using %u threads for script verification\n", nScriptCheckThreads);
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        // blocks still queue for PoW checks with none of these, the
+        // checking thread then does them alone
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadPoWCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadTxPrecompute);
+    }
+    if (nCoinsFetchThreads) {
+        printf("Using %u threads for reading block inputs\n", nCoinsFetchThreads);
+        for (int i=0; i<nCoinsFetchThreads-1; i++)
+            threadGroup.create_thread(&ThreadCoinsFetch);
     }
 
     int64 nStart;
@@ -881,8 +902,8 @@ bool AppInit2(boost::thread_group& threadGroup)
     nTotalCache -= nBlockTreeDBCache;
     size_t nCoinDBCache = nTotalCache / 2; // use half of the remaining cache for coindb cache
     nTotalCache -= nCoinDBCache;
-    nCoinCacheSize = nTotalCache / 300; // coins in memory require around 300 bytes
-    size_t nNameDBCache = nCoinCacheSize;
+    nCoinCacheUsage = nTotalCache; // the rest is for the coins in memory
+    size_t nNameDBCache = nCoinCacheUsage / 300;
 
     bool fLoaded = false;
     while (!fLoaded) {
@@ -908,14 +929,39 @@ bool AppInit2(boost::thread_group& threadGroup)
                 paliasdb = new CAliasDB(nNameDBCache, false, fReindex);
                 pofferdb = new COfferDB(nNameDBCache*2, false, fReindex);
                 pcertdb = new CCertDB(nNameDBCache*2, false, fReindex);
+                SetServiceRecordCacheSize(GetArg("-servicecache", 16) << 20);
 
                 if (fReindex) pblocktree->WriteReindexing(true);
 
+                if (!auxpowstore.Open(GetDataDir() / "blocks" / "auxpow.dat", fReindex)) {
+                    strLoadError = _("Error opening the AuxPoW store");
+                    break;
+                }
+
+                // The offers DB changed to one record per offer version and accept,
+                // keyed by chain position; older layouts are rebuilt by -reindex
+                if (!pofferdb->CheckVersion()) {
+                    strLoadError = _("You need to rebuild the database using -reindex to upgrade the offer database");
+                    break;
+                }
+
+                // DBs written before the expiry indexes get them built once
+                if (!paliasdb->CheckExpiryIndex() || !pofferdb->CheckExpiryIndex() || !pcertdb->CheckExpiryIndex()) {
+                    strLoadError = _("Error indexing the alias, offer and certificate databases");
+                    break;
+                }
+
                 if (!LoadBlockIndex()) {
                     strLoadError = _("Error loading block database");
                     break;
                 }
 
+                // service DB changes are flushed with the coins; a crash in between leaves them apart
+                if (!CheckServiceDBs()) {
+                    strLoadError = _("The alias, offer and certificate databases do not match the chain state, you need to rebuild the database using -reindex");
+                    break;
+                }
+
                 // If the loaded chain has a wrong genesis, bail out immediately
                 // (we're likely using a testnet datadir, or the other way around).
                 if (!mapBlockIndex.empty() && pindexGenesisBlock == NULL)
@@ -985,7 +1031,7 @@ bool AppInit2(boost::thread_group& threadGroup)
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -1105,13 +1151,16 @@ bool AppInit2(boost::thread_group& threadGroup)
             pwalletMain->ScanForWalletTransactions(pindexRescan, true);
             printf(" rescan      %15"PRI64d"ms\n", GetTimeMillis() - nStart);
             pwalletMain->SetBestChain(CBlockLocator(pindexBest));
-    		rescanforaliases(pindexRescan);
-    		rescanforoffers(pindexRescan);
-    		rescanforcertissuers(pindexRescan);
+            if (!RescanServiceDBs(pindexRescan))
+                strErrors << _("Error rebuilding the alias, offer and certificate databases") << "\n";
             nWalletDBUpdated++;
         }
     } // (!fDisableWallet)
 
+    // finish a service DB rebuild that the last run was interrupted in
+    if (!RescanServiceDBs(NULL))
+        strErrors << _("Error rebuilding the alias, offer and certificate databases") << "\n";
+
     // ********************************************************* Step 9: import blocks
 
     // scan for better chains in the block chain database, that are not yet connected in the active best chain
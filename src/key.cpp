@@ -7,6 +7,7 @@
 #include <openssl/obj_mac.h>
 
 #include "key.h"
+#include "secp256k1.h"
 
 
 // anonymous namespace with local implementation code (OpenSSL interaction)
@@ -201,13 +202,6 @@ public:
         return true;
     }
 
-    bool Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
-        // -1 = error, 0 = bad sig, 1 = good
-        if (ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey) != 1)
-            return false;
-        return true;
-    }
-
     bool SignCompact(const uint256 &hash, unsigned char *p64, int &rec) {
         bool fOk = false;
         ECDSA_SIG *sig = ECDSA_do_sign((unsigned char*)&hash, sizeof(hash), pkey);
@@ -256,6 +250,43 @@ public:
     }
 };
 
+// Fill in a signature check. The DER signature is still decoded by OpenSSL,
+// and, as ECDSA_verify does since 1.0.1k, only accepted if encoding it again
+// gives the same bytes: no trailing data, and no padded lengths or integers.
+bool SetSignatureCheck(CECDSACheck &check, const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey &pubkey)
+{
+    if (vchSig.empty())
+        return false;
+    const unsigned char *pbegin = &vchSig[0];
+    ECDSA_SIG *sig = d2i_ECDSA_SIG(NULL, &pbegin, vchSig.size());
+    if (sig == NULL)
+        return false;
+    unsigned char *pder = NULL;
+    int nDERSize = i2d_ECDSA_SIG(sig, &pder);
+    bool fCanonical = nDERSize > 0 && (unsigned int)nDERSize == vchSig.size() &&
+                      memcmp(pder, &vchSig[0], nDERSize) == 0;
+    OPENSSL_free(pder);
+    if (!fCanonical) {
+        ECDSA_SIG_free(sig);
+        return false;
+    }
+    // negative or wider than 256 bits is out of range for the verifier anyway
+    int nBytesR = BN_num_bytes(sig->r);
+    int nBytesS = BN_num_bytes(sig->s);
+    bool fOk = !BN_is_negative(sig->r) && !BN_is_negative(sig->s) && nBytesR <= 32 && nBytesS <= 32;
+    if (fOk) {
+        memset(check.r, 0, 32 - nBytesR);
+        BN_bn2bin(sig->r, &check.r[32 - nBytesR]);
+        memset(check.s, 0, 32 - nBytesS);
+        BN_bn2bin(sig->s, &check.s[32 - nBytesS]);
+        memcpy(check.hash, &hash, 32);
+        check.nPubKeySize = pubkey.size();
+        memcpy(check.pubkey, pubkey.begin(), pubkey.size());
+    }
+    ECDSA_SIG_free(sig);
+    return fOk;
+}
+
 }; // end of anonymous namespace
 
 bool CKey::Check(const unsigned char *vch) {
@@ -343,12 +374,10 @@ bool CKey::SignCompact(const uint256 &hash, std::vector<unsigned char>& vchSig)
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
     if (!IsValid())
         return false;
-    CECKey key;
-    if (!key.SetPubKey(*this))
+    CECDSACheck check;
+    if (!SetSignatureCheck(check, hash, vchSig, *this))
         return false;
-    if (!key.Verify(hash, vchSig))
-        return false;
-    return true;
+    return Secp256k1Verify(check);
 }
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
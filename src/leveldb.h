@@ -19,10 +19,129 @@ public:
 
 void HandleError(const leveldb::Status &status) throw(leveldb_error);
 
+/** Unsigned integer serialized big-endian, so that keys containing it sort
+ *  numerically (e.g. by block height) within a common key prefix. */
+class CBigEndianKey
+{
+public:
+    unsigned int n;
+
+    CBigEndianKey(unsigned int nIn = 0) : n(nIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 4;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        unsigned char buf[4];
+        buf[0] = (n >> 24) & 0xff;
+        buf[1] = (n >> 16) & 0xff;
+        buf[2] = (n >> 8) & 0xff;
+        buf[3] = n & 0xff;
+        s.write((char*)buf, 4);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        unsigned char buf[4];
+        s.read((char*)buf, 4);
+        n = ((unsigned int)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+    }
+};
+
+/** 64 bit CBigEndianKey, e.g. for amounts. */
+class CBigEndianKey64
+{
+public:
+    uint64 n;
+
+    CBigEndianKey64(uint64 nIn = 0) : n(nIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 8;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        unsigned char buf[8];
+        for (int i = 0; i < 8; i++)
+            buf[i] = (n >> (56 - 8 * i)) & 0xff;
+        s.write((char*)buf, 8);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        unsigned char buf[8];
+        s.read((char*)buf, 8);
+        n = 0;
+        for (int i = 0; i < 8; i++)
+            n = (n << 8) | buf[i];
+    }
+};
+
+/** Byte string serialized so that keys containing it sort like the strings
+ *  themselves and can be matched by prefix: 0x00 is escaped as 0x00 0xff and
+ *  the string ends with 0x00 0x01. A prefix key leaves out the end marker,
+ *  so it is a prefix of the keys of every string starting with it. */
+class CLexicalKey
+{
+public:
+    std::vector<unsigned char> vch;
+    bool fPrefix;
+
+    CLexicalKey() : fPrefix(false) {}
+    CLexicalKey(const std::vector<unsigned char> &vchIn, bool fPrefixIn = false) : vch(vchIn), fPrefix(fPrefixIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        unsigned int nSize = vch.size() + (fPrefix ? 0 : 2);
+        for (unsigned int i = 0; i < vch.size(); i++)
+            if (vch[i] == 0)
+                nSize++;
+        return nSize;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const {
+        std::vector<unsigned char> buf;
+        buf.reserve(GetSerializeSize(nType, nVersion));
+        for (unsigned int i = 0; i < vch.size(); i++) {
+            buf.push_back(vch[i]);
+            if (vch[i] == 0)
+                buf.push_back(0xff);
+        }
+        if (!fPrefix) {
+            buf.push_back(0x00);
+            buf.push_back(0x01);
+        }
+        if (!buf.empty())
+            s.write((char*)&buf[0], buf.size());
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion) {
+        vch.clear();
+        fPrefix = false;
+        while (true) {
+            unsigned char ch;
+            s.read((char*)&ch, 1);
+            if (ch == 0) {
+                s.read((char*)&ch, 1);
+                if (ch == 0x01)
+                    return;
+                if (ch != 0xff)
+                    throw std::ios_base::failure("CLexicalKey::Unserialize() : invalid escape");
+            }
+            vch.push_back(ch);
+        }
+    }
+};
+
 // Batch of changes queued to be written to a CLevelDB
 class CLevelDBBatch
 {
     friend class CLevelDB;
+    friend class CServiceDB;
 
 private:
     leveldb::WriteBatch batch;
@@ -103,6 +222,18 @@ public:
         return true;
     }
 
+    // read the serialized value stored under an already serialized key
+    bool ReadRaw(const std::string &strKey, std::string &strValue) throw(leveldb_error) {
+        leveldb::Status status = pdb->Get(readoptions, strKey, &strValue);
+        if (!status.ok()) {
+            if (status.IsNotFound())
+                return false;
+            printf("LevelDB read failure: %s\n", status.ToString().c_str());
+            HandleError(status);
+        }
+        return true;
+    }
+
     template<typename K, typename V> bool Write(const K& key, const V& value, bool fSync = false) throw(leveldb_error) {
         CLevelDBBatch batch;
         batch.Write(key, value);
@@ -18,6 +18,10 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/xpressive/xpressive_dynamic.hpp>
 
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
 using namespace std;
 using namespace boost;
 
@@ -31,7 +35,11 @@ CCriticalSection cs_main;
 
 CTxMemPool mempool;
 unsigned int nTransactionsUpdated = 0;
-map<uint256, CBlockIndex*> mapBlockIndex;
+BlockMap mapBlockIndex;
+// storage of the CBlockIndex objects in mapBlockIndex
+static objectarena<CBlockIndex> arenaBlockIndex;
+// when blocks/index.snapshot was last written or loaded
+static int64 nLastBlockIndexSnapshot = 0;
 uint256 hashGenesisBlock(
 		"0xc84c8d0f52a7418b28a24e7b5354d6febed47c8cc33b3fa20fdbe4b3a1fcd9c4");
 static CBigNum bnProofOfWorkLimit(~uint256(0) >> 20); // Syscoin: starting difficulty is 1 / 2^12
@@ -42,14 +50,16 @@ uint256 nBestChainWork = 0;
 uint256 nBestInvalidWork = 0;
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
+CChain chainActive;
 set<CBlockIndex*, CBlockIndexWorkComparator> setBlockIndexValid; // may contain all CBlockIndex*'s that have validness >=BLOCK_VALID_TRANSACTIONS, and must contain those who aren't failed
 int64 nTimeBestReceived = 0;
 int nScriptCheckThreads = 0;
+int nCoinsFetchThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fBenchmark = false;
 bool fTxIndex = true; // syscoin is using transaction index by default
-unsigned int nCoinCacheSize = 5000;
+size_t nCoinCacheUsage = 5000 * 300;
 
 int hardforkLaunch = 1660;
 
@@ -58,9 +68,6 @@ std::map<std::vector<unsigned char>, uint256> dummyTestPool;
 extern bool Solver(const CKeyStore& keystore, const CScript& scriptPubKey,
 		uint256 hash, int nHashType, CScript& scriptSigRet,
 		txnouttype& whichTypeRet);
-extern bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey,
-		const CTransaction& txTo, unsigned int nIn, unsigned int flags,
-		int nHashType);
 
 extern map<vector<unsigned char>, set<uint256> > mapAliasesPending;
 
@@ -218,7 +225,7 @@ CBlockIndex *CCoinsView::GetBestBlock() {
 bool CCoinsView::SetBestBlock(CBlockIndex *pindex) {
 	return false;
 }
-bool CCoinsView::BatchWrite(const std::map<uint256, CCoins> &mapCoins,
+bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
 		CBlockIndex *pindex) {
 	return false;
 }
@@ -247,7 +254,7 @@ bool CCoinsViewBacked::SetBestBlock(CBlockIndex *pindex) {
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) {
 	base = &viewIn;
 }
-bool CCoinsViewBacked::BatchWrite(const std::map<uint256, CCoins> &mapCoins,
+bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
 		CBlockIndex *pindex) {
 	return base->BatchWrite(mapCoins, pindex);
 }
@@ -256,43 +263,175 @@ bool CCoinsViewBacked::GetStats(CCoinsStats &stats) {
 }
 
 CCoinsViewCache::CCoinsViewCache(CCoinsView &baseIn, bool fDummy) :
-		CCoinsViewBacked(baseIn), pindexTip(NULL) {
+		CCoinsViewBacked(baseIn), pindexTip(NULL), cachedCoinsUsage(0),
+		fHasModifier(false) {
+}
+
+CCoinsViewCache::~CCoinsViewCache() {
+	assert(!fHasModifier);
 }
 
 bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) {
-	if (cacheCoins.count(txid)) {
-		coins = cacheCoins[txid];
-		return true;
-	}
-	if (base->GetCoins(txid, coins)) {
-		cacheCoins[txid] = coins;
-		return true;
-	}
-	return false;
+	CCoinsMap::iterator it = FetchCoins(txid);
+	if (it == cacheCoins.end())
+		return false;
+	coins = it->second.coins;
+	return true;
 }
 
-std::map<uint256, CCoins>::iterator CCoinsViewCache::FetchCoins(
-		const uint256 &txid) {
-	std::map<uint256, CCoins>::iterator it = cacheCoins.lower_bound(txid);
-	if (it != cacheCoins.end() && it->first == txid)
+CCoinsMap::iterator CCoinsViewCache::FetchCoins(const uint256 &txid) {
+	CCoinsMap::iterator it = cacheCoins.find(txid);
+	if (it != cacheCoins.end())
 		return it;
 	CCoins tmp;
 	if (!base->GetCoins(txid, tmp))
 		return cacheCoins.end();
-	std::map<uint256, CCoins>::iterator ret = cacheCoins.insert(it,
-			std::make_pair(txid, CCoins()));
-	tmp.swap(ret->second);
+	return InsertFetchedCoins(txid, tmp);
+}
+
+CCoinsMap::iterator CCoinsViewCache::InsertFetchedCoins(const uint256 &txid,
+		CCoins &coins) {
+	CCoinsMap::iterator ret = cacheCoins.insert(
+			std::make_pair(txid, CCoinsCacheEntry())).first;
+	coins.swap(ret->second.coins);
+	// a pruned entry of the base need not be written back if it is spent here
+	if (ret->second.coins.IsPruned())
+		ret->second.flags = CCoinsCacheEntry::FRESH;
+	cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
 	return ret;
 }
 
-CCoins &CCoinsViewCache::GetCoins(const uint256 &txid) {
-	std::map<uint256, CCoins>::iterator it = FetchCoins(txid);
-	assert(it != cacheCoins.end());
-	return it->second;
+const CCoins *CCoinsViewCache::AccessCoins(const uint256 &txid) {
+	CCoinsMap::iterator it = FetchCoins(txid);
+	if (it == cacheCoins.end())
+		return NULL;
+	return &it->second.coins;
+}
+
+const CCoins &CCoinsViewCache::GetCoins(const uint256 &txid) {
+	const CCoins *coins = AccessCoins(txid);
+	assert(coins);
+	return *coins;
+}
+
+CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
+	assert(!fHasModifier);
+	std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(
+			std::make_pair(txid, CCoinsCacheEntry()));
+	size_t nUsageBefore = 0;
+	if (ret.second) {
+		// the base has nothing unspent for it: if it is spent again before
+		// the cache is flushed, it need not be written at all
+		if (!base->GetCoins(txid, ret.first->second.coins)
+				|| ret.first->second.coins.IsPruned()) {
+			ret.first->second.coins = CCoins();
+			ret.first->second.flags = CCoinsCacheEntry::FRESH;
+		}
+	} else {
+		nUsageBefore = ret.first->second.coins.DynamicMemoryUsage();
+	}
+	ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+	return CCoinsModifier(*this, ret.first, nUsageBefore);
+}
+
+CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
+	assert(!fHasModifier);
+	std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(
+			std::make_pair(txid, CCoinsCacheEntry()));
+	size_t nUsageBefore = 0;
+	if (ret.second)
+		ret.first->second.flags = CCoinsCacheEntry::FRESH;
+	else
+		nUsageBefore = ret.first->second.coins.DynamicMemoryUsage();
+	ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+	return CCoinsModifier(*this, ret.first, nUsageBefore);
+}
+
+/** Read of the coins of one transaction from a view, for PrefetchCoins. */
+class CCoinsFetch {
+private:
+	CCoinsView *pview;
+	const uint256 *ptxid;
+	CCoins *pcoins;
+	char *pfFound;
+
+public:
+	CCoinsFetch() : pview(NULL), ptxid(NULL), pcoins(NULL), pfFound(NULL) {}
+	CCoinsFetch(CCoinsView *pviewIn, const uint256 *ptxidIn, CCoins *pcoinsIn,
+			char *pfFoundIn) :
+		pview(pviewIn), ptxid(ptxidIn), pcoins(pcoinsIn), pfFound(pfFoundIn) {}
+
+	bool operator()() {
+		// a failed read is left to the connect loop, which reads it again
+		// and reports the error on its own thread
+		try {
+			*pfFound = pview->GetCoins(*ptxid, *pcoins);
+		} catch (std::exception &e) {
+			*pfFound = false;
+		}
+		return true;
+	}
+
+	void swap(CCoinsFetch &fetch) {
+		std::swap(pview, fetch.pview);
+		std::swap(ptxid, fetch.ptxid);
+		std::swap(pcoins, fetch.pcoins);
+		std::swap(pfFound, fetch.pfFound);
+	}
+};
+
+static CCheckQueue<CCoinsFetch> coinsfetchqueue(16);
+
+void ThreadCoinsFetch() {
+	RenameThread("bitcoin-coinsfetch");
+	coinsfetchqueue.Thread();
+}
+
+unsigned int CCoinsViewCache::PrefetchCoins(const std::vector<uint256> &vTxidIn) {
+	assert(!fHasModifier);
+	std::vector<uint256> vTxid;
+	vTxid.reserve(vTxidIn.size());
+	BOOST_FOREACH(const uint256 &txid, vTxidIn)
+		if (!cacheCoins.count(txid))
+			vTxid.push_back(txid);
+	std::sort(vTxid.begin(), vTxid.end());
+	vTxid.erase(std::unique(vTxid.begin(), vTxid.end()), vTxid.end());
+	if (vTxid.empty())
+		return 0;
+
+	// each read has its own result slot, so the cache itself is only
+	// touched here, once all of them are done
+	std::vector<CCoins> vCoins(vTxid.size());
+	std::vector<char> vFound(vTxid.size(), 0);
+	{
+		CCheckQueueControl<CCoinsFetch> control(&coinsfetchqueue);
+		std::vector<CCoinsFetch> vFetches;
+		vFetches.reserve(vTxid.size());
+		for (unsigned int i = 0; i < vTxid.size(); i++)
+			vFetches.push_back(CCoinsFetch(base, &vTxid[i], &vCoins[i], &vFound[i]));
+		control.Add(vFetches);
+		control.Wait();
+	}
+	for (unsigned int i = 0; i < vTxid.size(); i++)
+		if (vFound[i])
+			InsertFetchedCoins(vTxid[i], vCoins[i]);
+	return vTxid.size();
 }
 
 bool CCoinsViewCache::SetCoins(const uint256 &txid, const CCoins &coins) {
-	cacheCoins[txid] = coins;
+	CCoinsMap::iterator it = cacheCoins.find(txid);
+	if (it == cacheCoins.end()) {
+		it = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
+	} else {
+		cachedCoinsUsage -= it->second.coins.DynamicMemoryUsage();
+		if ((it->second.flags & CCoinsCacheEntry::FRESH) && coins.IsPruned()) {
+			cacheCoins.erase(it);
+			return true;
+		}
+	}
+	it->second.coins = coins;
+	it->second.flags |= CCoinsCacheEntry::DIRTY;
+	cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
 	return true;
 }
 
@@ -311,19 +450,45 @@ bool CCoinsViewCache::SetBestBlock(CBlockIndex *pindex) {
 	return true;
 }
 
-bool CCoinsViewCache::BatchWrite(const std::map<uint256, CCoins> &mapCoins,
-		CBlockIndex *pindex) {
-	for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin();
-			it != mapCoins.end(); it++)
-		cacheCoins[it->first] = it->second;
+bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex) {
+	assert(!fHasModifier);
+	for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+		if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+			continue;
+		CCoinsMap::iterator itUs = cacheCoins.find(it->first);
+		if (itUs == cacheCoins.end()) {
+			// spent again where it was created, nothing to write
+			if ((it->second.flags & CCoinsCacheEntry::FRESH)
+					&& it->second.coins.IsPruned())
+				continue;
+			CCoinsCacheEntry &entry = cacheCoins[it->first];
+			entry.coins.swap(it->second.coins);
+			entry.flags = CCoinsCacheEntry::DIRTY
+					| (it->second.flags & CCoinsCacheEntry::FRESH);
+			cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
+		} else {
+			cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+			if ((itUs->second.flags & CCoinsCacheEntry::FRESH)
+					&& it->second.coins.IsPruned()) {
+				// our base never saw it, so it can go
+				cacheCoins.erase(itUs);
+			} else {
+				itUs->second.coins.swap(it->second.coins);
+				itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+				cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+			}
+		}
+	}
 	pindexTip = pindex;
 	return true;
 }
 
 bool CCoinsViewCache::Flush() {
 	bool fOk = base->BatchWrite(cacheCoins, pindexTip);
-	if (fOk)
+	if (fOk) {
 		cacheCoins.clear();
+		cachedCoinsUsage = 0;
+	}
 	return fOk;
 }
 
@@ -331,6 +496,32 @@ unsigned int CCoinsViewCache::GetCacheSize() {
 	return cacheCoins.size();
 }
 
+size_t CCoinsViewCache::DynamicMemoryUsage() const {
+	// each entry is a node holding the key, the entry and a link, and its
+	// allocation is rounded up to 16 bytes
+	size_t nNodeSize = (sizeof(CCoinsMap::value_type) + 2 * sizeof(void*) + 15) & ~(size_t)15;
+	return cacheCoins.size() * nNodeSize
+			+ cacheCoins.bucket_count() * sizeof(void*) + cachedCoinsUsage;
+}
+
+CCoinsModifier::CCoinsModifier(CCoinsViewCache &cacheIn,
+		CCoinsMap::iterator itIn, size_t nUsageBeforeIn) :
+		cache(cacheIn), it(itIn), nUsageBefore(nUsageBeforeIn) {
+	assert(!cache.fHasModifier);
+	cache.fHasModifier = true;
+}
+
+CCoinsModifier::~CCoinsModifier() {
+	assert(cache.fHasModifier);
+	cache.fHasModifier = false;
+	it->second.coins.Cleanup();
+	cache.cachedCoinsUsage -= nUsageBefore;
+	if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned())
+		cache.cacheCoins.erase(it);
+	else
+		cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+}
+
 /** CCoinsView that brings transactions from a memorypool into view.
  It does not check for spendings by memory pool transactions. */
 CCoinsViewMemPool::CCoinsViewMemPool(CCoinsView &baseIn, CTxMemPool &mempoolIn) :
@@ -430,6 +621,30 @@ bool CTxOut::IsDust() const {
 	return false;
 }
 
+void CServiceOutputs::Decode(const vector<CTxOut>& vout) {
+	SetNull();
+	fDecoded = true;
+	// Transactions of any version are decoded: CheckInputs relies on it to
+	// reject regular transactions spending service outputs. Scripts that
+	// cannot be service scripts are passed over on their first byte.
+	int nFound = 0;
+	for (unsigned int i = 0; i < vout.size() && nFound < SERVICE_TYPES; i++) {
+		const CScript& script = vout[i].scriptPubKey;
+		if (script.empty() || script[0] < OP_1 || script[0] > OP_16)
+			continue;
+		int opRead;
+		vector<vector<unsigned char> > vvchRead;
+		CScript::const_iterator pc = script.begin();
+		servicetype type = DecodeServiceScript(script, opRead, vvchRead, pc);
+		if (type == SERVICE_NONE || nOut[type] >= 0)
+			continue;
+		op[type] = opRead;
+		nOut[type] = i;
+		vvch[type].swap(vvchRead);
+		nFound++;
+	}
+}
+
 bool CTransaction::IsStandard(string& strReason) const {
 	if ((nVersion > CTransaction::CURRENT_VERSION || nVersion < 1)
 			&& nVersion != SYSCOIN_TX_VERSION) {
@@ -562,9 +777,9 @@ unsigned int CTransaction::GetLegacySigOpCount() const {
 int CMerkleTx::SetMerkleBranch(const CBlock* pblock) {
 	CBlock blockTmp;
 	if (pblock == NULL) {
-		CCoins coins;
-		if (pcoinsTip->GetCoins(GetHash(), coins)) {
-			CBlockIndex *pindex = FindBlockByHeight(coins.nHeight);
+		const CCoins *coins = pcoinsTip->AccessCoins(GetHash());
+		if (coins) {
+			CBlockIndex *pindex = FindBlockByHeight(coins->nHeight);
 			if (pindex) {
 				if (!blockTmp.ReadFromDisk(pindex))
 					return 0;
@@ -593,7 +808,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock) {
 	}
 
 	// Is the tx in a block that's in the main chain
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+	BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
 	if (mi == mapBlockIndex.end())
 		return 0;
 	CBlockIndex* pindex = (*mi).second;
@@ -974,7 +1189,7 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx,
 		}
       vector<vector<unsigned char> > vvch;
 	    int op, nOut;
-		if(DecodeAliasTx(tx, op, nOut, vvch, -1)) {
+		if(tx.GetServiceOutput(op, nOut, vvch) != SERVICE_NONE) {
 			if(IsAliasOp(op)) {
 				TRY_LOCK(cs_main, cs_maintry);
 	            mapAliasesPending[vvch[0]].insert(tx.GetHash());
@@ -1005,7 +1220,10 @@ bool CTxMemPool::accept(CValidationState &state, CTransaction &tx,
 
 		// Check against previous transactions
 		// This is done last to help prevent CPU exhaustion denial-of-service attacks.
-		if (!tx.CheckInputs(pindexBest, state, view, true, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC,
+		// This also remembers the scripts as passed under the flags blocks
+		// are checked with, see CheckScripts.
+		CTxInputs inputs(tx, view);
+		if (!tx.CheckInputs(pindexBest, state, inputs, true, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC,
 				dummyTestPool, NULL, true, false, false)) {
 			return error("CTxMemPool::accept() : CheckInputs failed %s",
 					hash.ToString().c_str());
@@ -1130,7 +1348,7 @@ int CMerkleTx::GetDepthInMainChain(CBlockIndex* &pindexRet) const {
 		return 0;
 
 	// Find the block it claims to be in
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+	BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
 	if (mi == mapBlockIndex.end())
 		return 0;
 	CBlockIndex* pindex = (*mi).second;
@@ -1217,10 +1435,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 		if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
 			int nHeight = -1;
 			{
-				CCoinsViewCache &view = *pcoinsTip;
-				CCoins coins;
-				if (view.GetCoins(hash, coins))
-					nHeight = coins.nHeight;
+				const CCoins *coins = pcoinsTip->AccessCoins(hash);
+				if (coins)
+					nHeight = coins->nHeight;
 			}
 			if (nHeight > 0)
 				pindexSlow = FindBlockByHeight(nHeight);
@@ -1248,23 +1465,63 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
 // CBlock and CBlockIndex
 //
 
-static CBlockIndex* pblockindexFBBHLast;
 CBlockIndex* FindBlockByHeight(int nHeight) {
-	CBlockIndex *pblockindex;
-	if (nHeight < nBestHeight / 2)
-		pblockindex = pindexGenesisBlock;
-	else
-		pblockindex = pindexBest;
-	if (pblockindexFBBHLast
-			&& abs(nHeight - pblockindex->nHeight)
-					> abs(nHeight - pblockindexFBBHLast->nHeight))
-		pblockindex = pblockindexFBBHLast;
-	while (pblockindex->nHeight > nHeight)
-		pblockindex = pblockindex->pprev;
-	while (pblockindex->nHeight < nHeight)
-		pblockindex = pblockindex->pnext;
-	pblockindexFBBHLast = pblockindex;
-	return pblockindex;
+	return chainActive[nHeight];
+}
+
+void CChain::SetTip(CBlockIndex *pindex) {
+	if (pindex == NULL) {
+		vChain.clear();
+		return;
+	}
+	vChain.resize(pindex->nHeight + 1);
+	while (pindex && vChain[pindex->nHeight] != pindex) {
+		vChain[pindex->nHeight] = pindex;
+		pindex = pindex->pprev;
+	}
+}
+
+bool CBlockIndex::IsInMainChain() const {
+	return chainActive.Contains(this);
+}
+
+CBlockIndex* GetTxPosBlockIndex(const CDiskTxPos &postx) {
+	if (postx.IsNull())
+		return NULL;
+	CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+	if (!file)
+		return NULL;
+	CBlockHeader header;
+	try {
+		file >> header;
+	} catch (std::exception &e) {
+		error("%s() : deserialize or I/O error", __PRETTY_FUNCTION__);
+		return NULL;
+	}
+	BlockMap::iterator mi = mapBlockIndex.find(header.GetHash());
+	if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+		return NULL;
+	return mi->second;
+}
+
+CBlockIndex* GetTxBlockIndex(const uint256 &txid) {
+	CTxBlockPos blockpos;
+	if (pblocktree->ReadTxBlockPos(txid, blockpos)) {
+		BlockMap::iterator mi = mapBlockIndex.find(blockpos.hashBlock);
+		if (mi == mapBlockIndex.end() || !mi->second->IsInMainChain())
+			return NULL;
+		return mi->second;
+	}
+
+	// indexed before block positions were recorded: read the header once
+	// and remember where the txn is
+	CDiskTxPos postx;
+	if (!pblocktree->ReadTxIndex(txid, postx))
+		return NULL;
+	CBlockIndex *pindex = GetTxPosBlockIndex(postx);
+	if (pindex)
+		pblocktree->WriteTxBlockPos(txid, CTxBlockPos(pindex->GetBlockHash(), pindex->nHeight));
+	return pindex;
 }
 
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex) {
@@ -1376,7 +1633,7 @@ unsigned int ComputeMinWork(unsigned int nBase, int64 nTime) {
 	return bnResult.GetCompact();
 }
 
-unsigned int static KimotoGravityWell(const CBlockIndex* pindexLast,
+unsigned int KimotoGravityWellBigNum(const CBlockIndex* pindexLast,
 		const CBlockHeader *pblock, uint64 TargetBlocksSpacingSeconds,
 		uint64 PastBlocksMin, uint64 PastBlocksMax) {
 	/* current difficulty formula - kimoto gravity well */
@@ -1460,6 +1717,135 @@ unsigned int static KimotoGravityWell(const CBlockIndex* pindexLast,
 	return bnNew.GetCompact();
 }
 
+// KGW event horizons of up to this many past blocks are precomputed
+static const unsigned int KGW_DEVIATION_TABLE_SIZE = 256;
+
+/** The KGW event horizon deviation 1 + 0.7084 * (mass / 144)^-1.228 and its
+ *  inverse by mass of past blocks, so the retarget loop does not call pow(). */
+class CKGWDeviationTable {
+private:
+	double pdFast[KGW_DEVIATION_TABLE_SIZE + 1];
+	double pdSlow[KGW_DEVIATION_TABLE_SIZE + 1];
+
+	// the expressions of KimotoGravityWellBigNum, so the doubles are identical
+	static void Compute(uint64 PastBlocksMass, double &EventHorizonDeviationFast, double &EventHorizonDeviationSlow) {
+		double EventHorizonDeviation =
+				1
+						+ (0.7084
+								* pow((double(PastBlocksMass) / double(144)),
+										-1.228));
+		EventHorizonDeviationFast = EventHorizonDeviation;
+		EventHorizonDeviationSlow = 1 / EventHorizonDeviation;
+	}
+
+public:
+	CKGWDeviationTable() {
+		for (unsigned int i = 1; i <= KGW_DEVIATION_TABLE_SIZE; i++)
+			Compute(i, pdFast[i], pdSlow[i]);
+	}
+
+	void Get(uint64 PastBlocksMass, double &EventHorizonDeviationFast, double &EventHorizonDeviationSlow) const {
+		if (PastBlocksMass >= 1 && PastBlocksMass <= KGW_DEVIATION_TABLE_SIZE) {
+			EventHorizonDeviationFast = pdFast[PastBlocksMass];
+			EventHorizonDeviationSlow = pdSlow[PastBlocksMass];
+		} else
+			Compute(PastBlocksMass, EventHorizonDeviationFast, EventHorizonDeviationSlow);
+	}
+};
+static const CKGWDeviationTable kgwDeviations;
+
+unsigned int KimotoGravityWell(const CBlockIndex* pindexLast,
+		const CBlockHeader *pblock, uint64 TargetBlocksSpacingSeconds,
+		uint64 PastBlocksMin, uint64 PastBlocksMax) {
+	// KimotoGravityWellBigNum on uint256, which gives the same results for
+	// every nBits that uint256 can represent; the rest go to the original
+	const CBlockIndex *BlockLastSolved = pindexLast;
+	const CBlockIndex *BlockReading = pindexLast;
+
+	uint64 PastBlocksMass = 0;
+	int64 PastRateActualSeconds = 0;
+	int64 PastRateTargetSeconds = 0;
+	double PastRateAdjustmentRatio = double(1);
+	uint256 PastDifficultyAverage;
+	uint256 PastDifficultyAveragePrev;
+	double EventHorizonDeviationFast;
+	double EventHorizonDeviationSlow;
+
+	const CBigNum &bnPOWLimit = fCakeNet ? bnProofOfWorkLimitCake : bnProofOfWorkLimit;
+	if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0
+			|| (uint64) BlockLastSolved->nHeight < PastBlocksMin) {
+		return bnPOWLimit.GetCompact();
+	}
+	// the rate target is a 32 bit divisor below
+	if (TargetBlocksSpacingSeconds * PastBlocksMax > 0xffffffffULL || PastBlocksMax == 0)
+		return KimotoGravityWellBigNum(pindexLast, pblock, TargetBlocksSpacingSeconds, PastBlocksMin, PastBlocksMax);
+
+	for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
+		if (i > PastBlocksMax)
+			break;
+
+		PastBlocksMass++;
+
+		uint256 Difficulty;
+		bool fNegative, fOverflow;
+		Difficulty.SetCompact(BlockReading->nBits, &fNegative, &fOverflow);
+		if (fNegative || fOverflow)
+			return KimotoGravityWellBigNum(pindexLast, pblock, TargetBlocksSpacingSeconds, PastBlocksMin, PastBlocksMax);
+
+		if (i == 1)
+			PastDifficultyAverage = Difficulty;
+		else if (Difficulty >= PastDifficultyAveragePrev) {
+			PastDifficultyAverage = Difficulty - PastDifficultyAveragePrev;
+			PastDifficultyAverage /= i;
+			PastDifficultyAverage += PastDifficultyAveragePrev;
+		} else {
+			// CBigNum division of the negative difference rounds towards zero
+			uint256 Decrease = PastDifficultyAveragePrev - Difficulty;
+			Decrease /= i;
+			PastDifficultyAverage = PastDifficultyAveragePrev - Decrease;
+		}
+
+		PastDifficultyAveragePrev = PastDifficultyAverage;
+		PastRateActualSeconds = BlockLastSolved->GetBlockTime()
+				- BlockReading->GetBlockTime();
+		PastRateTargetSeconds = TargetBlocksSpacingSeconds * PastBlocksMass;
+		PastRateAdjustmentRatio = double(1);
+
+		if (PastRateActualSeconds < 0)
+			PastRateActualSeconds = 0;
+		if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0)
+			PastRateAdjustmentRatio = double(PastRateTargetSeconds)
+					/ double(PastRateActualSeconds);
+
+		if (PastBlocksMass >= PastBlocksMin) {
+			kgwDeviations.Get(PastBlocksMass, EventHorizonDeviationFast, EventHorizonDeviationSlow);
+			if ((PastRateAdjustmentRatio <= EventHorizonDeviationSlow)
+					|| (PastRateAdjustmentRatio >= EventHorizonDeviationFast)) {
+				assert(BlockReading);
+				break;
+			}
+		}
+		if (BlockReading->pprev == NULL) {
+			assert(BlockReading);
+			break;
+		}
+		BlockReading = BlockReading->pprev;
+	}
+
+	uint256 bnLimit = bnPOWLimit.getuint256();
+	uint256 bnNew(PastDifficultyAverage);
+	// block times are 32 bit, so both factors fit 32 bits; a product over
+	// 256 bits is over the limit too
+	if (PastRateActualSeconds != 0 && PastRateTargetSeconds != 0)
+		if (!bnNew.MulDiv(PastRateActualSeconds, PastRateTargetSeconds))
+			bnNew = bnLimit;
+
+	if (bnNew > bnLimit)
+		bnNew = bnLimit;
+
+	return bnNew.GetCompact();
+}
+
 // Using KGW
 unsigned int static GetNextWorkRequired(const CBlockIndex* pindexLast,
 		const CBlockHeader *pblock) {
@@ -1542,42 +1928,253 @@ void static InvalidBlockFound(CBlockIndex *pindex) {
 }
 
 bool LoadSyscoinFees() {
-	TRY_LOCK(cs_main, cs_maintry);
-    // read alias and offer indexes
+    // older versions kept each fee list in a single record, newest first;
+    // the fee windows migrate it to one record per fee
+    vector<CFeeRegenEntry> vLegacy;
 
     // read alias network fees
-    lstAliasFees.clear();
     vector<CAliasFee> va;
     paliasdb->ReadAliasTxFees(va);
-    list<CAliasFee> lAF(va.begin(), va.end());
-    lstAliasFees = lAF;
-	BOOST_FOREACH(CAliasFee& fee, lstAliasFees) {
-		printf("Alias Fee - height: %llu \t value: %llu\n", fee.nHeight, fee.nValue);
-	}
+    BOOST_FOREACH(const CAliasFee& fee, va)
+        vLegacy.push_back(CFeeRegenEntry(fee.hash, fee.nHeight, fee.nBlockTime, fee.nValue));
+    if (!aliasFeeWindow.Load(paliasdb, vLegacy))
+        return error("LoadSyscoinFees() : failed to load alias fees");
+    if (!va.empty())
+        paliasdb->EraseAliasTxFees();
+    printf("Alias fees: %u tracked for regeneration\n", aliasFeeWindow.size());
 
     // read offer network fees
-    lstOfferFees.clear();
+    vLegacy.clear();
     vector<COfferFee> vo;
     pofferdb->ReadOfferTxFees(vo);
-    list<COfferFee> lOF(vo.begin(), vo.end());
-    lstOfferFees = lOF;
-	BOOST_FOREACH(COfferFee& fee, lstOfferFees) {
-		printf("Offer Fee - height: %llu \t value: %llu\n", fee.nHeight, fee.nFee);
-	}
+    BOOST_FOREACH(const COfferFee& fee, vo)
+        vLegacy.push_back(CFeeRegenEntry(fee.hash, fee.nHeight, fee.nTime, fee.nFee));
+    if (!offerFeeWindow.Load(pofferdb, vLegacy))
+        return error("LoadSyscoinFees() : failed to load offer fees");
+    if (!vo.empty())
+        pofferdb->EraseOfferTxFees();
+    printf("Offer fees: %u tracked for regeneration\n", offerFeeWindow.size());
 
     // read cert issuer network fees
-    lstCertIssuerFees.clear();
+    vLegacy.clear();
     vector<CCertFee> vc;
     pcertdb->ReadCertFees(vc);
-    list<CCertFee> lCF(vc.begin(), vc.end());
-    lstCertIssuerFees = lCF;
-	BOOST_FOREACH(CCertFee& fee, lstCertIssuerFees) {
-		printf("Cert Fee - height: %llu \t value: %llu\n", fee.nHeight, fee.nFee);
-	}
+    BOOST_FOREACH(const CCertFee& fee, vc)
+        vLegacy.push_back(CFeeRegenEntry(fee.hash, fee.nHeight, fee.nTime, fee.nFee));
+    if (!certFeeWindow.Load(pcertdb, vLegacy))
+        return error("LoadSyscoinFees() : failed to load cert fees");
+    if (!vc.empty())
+        pcertdb->EraseCertFees();
+    printf("Cert fees: %u tracked for regeneration\n", certFeeWindow.size());
 
     return true;
 }
 
+// Service DB changes are buffered in views like the coins; see CServiceDB
+static void BeginServiceViews() {
+    paliasdb->BeginView();
+    pofferdb->BeginView();
+    pcertdb->BeginView();
+}
+
+static void CommitServiceViews() {
+    paliasdb->CommitView();
+    pofferdb->CommitView();
+    pcertdb->CommitView();
+}
+
+static void DiscardServiceViews() {
+    paliasdb->DiscardView();
+    pofferdb->DiscardView();
+    pcertdb->DiscardView();
+}
+
+unsigned int GetServiceCacheSize() {
+    return paliasdb->GetCacheSize() + pofferdb->GetCacheSize() + pcertdb->GetCacheSize();
+}
+
+void SetServiceRecordCacheSize(uint64 nBytes) {
+    paliasdb->SetRecordCacheSize(nBytes / 3);
+    pofferdb->SetRecordCacheSize(nBytes / 3);
+    pcertdb->SetRecordCacheSize(nBytes / 3);
+}
+
+void GetServiceRecordCacheStats(std::vector<std::pair<std::string, CServiceCacheStats> > &vStats) {
+    paliasdb->GetRecordCacheStats(vStats);
+    pofferdb->GetRecordCacheStats(vStats);
+    pcertdb->GetRecordCacheStats(vStats);
+}
+
+bool FlushServiceDBs() {
+    CBlockIndex *pindexCoins = pcoinsTip->GetBestBlock();
+    uint256 hashBestBlock = pindexCoins ? pindexCoins->GetBlockHash() : 0;
+    return paliasdb->Flush(hashBestBlock)
+        && pofferdb->Flush(hashBestBlock)
+        && pcertdb->Flush(hashBestBlock);
+}
+
+bool CheckServiceDBs() {
+    CBlockIndex *pindexCoins = pcoinsTip->GetBestBlock();
+    uint256 hashBestBlock = pindexCoins ? pindexCoins->GetBlockHash() : 0;
+    CServiceDB *pdbs[] = { paliasdb, pofferdb, pcertdb };
+    for (unsigned int i = 0; i < 3; i++) {
+        // DBs written by older versions carry no marker
+        uint256 hashServiceBlock;
+        if (pdbs[i]->ReadBestBlock(hashServiceBlock) && hashServiceBlock != hashBestBlock)
+            return error("CheckServiceDBs() : service DB at block %s, coins at %s",
+                    hashServiceBlock.ToString().c_str(), hashBestBlock.ToString().c_str());
+    }
+    return true;
+}
+
+// blocks a service DB rebuild reads ahead of the one it applies
+static const unsigned int SERVICE_RESCAN_READAHEAD = 64;
+// a rebuild flushes and records how far it got this often
+static const unsigned int SERVICE_RESCAN_CHECKPOINT = 1000;
+
+/** Reads the blocks of a service DB rebuild on several threads and hands
+ *  them to the applying thread in chain order. */
+class CServiceRescanReader {
+private:
+    const std::vector<CBlockIndex*> &vChain;
+    std::map<unsigned int, CBlock> mapRead;
+    std::set<unsigned int> setFailed;
+    unsigned int nNextRead;
+    unsigned int nNextApply;
+    bool fStop;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+
+public:
+    CServiceRescanReader(const std::vector<CBlockIndex*> &vChainIn) : vChain(vChainIn), nNextRead(0), nNextApply(0), fStop(false) {}
+
+    void Thread() {
+        while (true) {
+            unsigned int i;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNextRead < vChain.size() && nNextRead >= nNextApply + SERVICE_RESCAN_READAHEAD)
+                    cond.wait(lock);
+                if (fStop || nNextRead >= vChain.size())
+                    return;
+                i = nNextRead++;
+            }
+            CBlock block;
+            bool fRead = block.ReadFromDisk(vChain[i]);
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                if (fRead)
+                    mapRead[i] = block;
+                else
+                    setFailed.insert(i);
+            }
+            cond.notify_all();
+        }
+    }
+
+    // blocks must be taken in order; false if vChain[i] could not be read
+    bool Get(unsigned int i, CBlock &block) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!mapRead.count(i) && !setFailed.count(i))
+            cond.wait(lock);
+        nNextApply = i + 1;
+        cond.notify_all();
+        if (setFailed.count(i))
+            return false;
+        block = mapRead[i];
+        mapRead.erase(i);
+        return true;
+    }
+
+    void Stop() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fStop = true;
+        cond.notify_all();
+    }
+};
+
+bool RescanServiceDBs(CBlockIndex *pindexRescan) {
+    CServiceDB *pdbs[] = { paliasdb, pofferdb, pcertdb };
+
+    // an interrupted rebuild continues after the block the DB that got least
+    // far applied last; applying a block twice leaves the DBs unchanged
+    CBlockIndex *pindexStart = pindexRescan;
+    bool fResume = false;
+    for (unsigned int i = 0; i < 3; i++) {
+        uint256 hashCheckpoint;
+        if (!pdbs[i]->ReadRescanCheckpoint(hashCheckpoint))
+            continue;
+        fResume = true;
+        BlockMap::iterator mi = mapBlockIndex.find(hashCheckpoint);
+        CBlockIndex *pindex = mi == mapBlockIndex.end() ? NULL : mi->second;
+        while (pindex && !pindex->IsInMainChain())
+            pindex = pindex->pprev;
+        pindex = pindex ? pindex->pnext : pindexGenesisBlock;
+        if (pindex && (!pindexStart || pindex->nHeight < pindexStart->nHeight))
+            pindexStart = pindex;
+    }
+
+    vector<CBlockIndex*> vChain;
+    for (CBlockIndex *pindex = pindexStart; pindex; pindex = pindex->pnext)
+        vChain.push_back(pindex);
+    if (vChain.empty()) {
+        for (unsigned int i = 0; i < 3; i++)
+            pdbs[i]->EraseRescanCheckpoint();
+        return FlushServiceDBs();
+    }
+
+    printf("Rebuilding the alias, offer and certificate DBs from %"PRIszu" blocks (from block %d)...\n",
+            vChain.size(), pindexStart->nHeight);
+    int64 nStart = GetTimeMillis();
+    if (!fResume)
+        offerFeeWindow.ClearNewest(pindexStart->nHeight, vChain.back()->nHeight);
+    // until it completes, the rebuild is one that an interrupted run resumes
+    CBlockIndex *pindexBefore = pindexStart->pprev ? pindexStart->pprev : pindexStart;
+    for (unsigned int i = 0; i < 3; i++)
+        pdbs[i]->WriteRescanCheckpoint(pindexBefore->GetBlockHash());
+    if (!FlushServiceDBs())
+        return false;
+
+    CServiceRescanReader reader(vChain);
+    boost::thread_group threadGroup;
+    int nThreads = std::max(1, std::min((int)boost::thread::hardware_concurrency(), 8));
+    for (int i = 0; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CServiceRescanReader::Thread, &reader));
+
+    bool fOk = true;
+    unsigned int nApplied = 0;
+    for (; nApplied < vChain.size(); nApplied++) {
+        CBlockIndex *pindex = vChain[nApplied];
+        CBlock block;
+        if (!reader.Get(nApplied, block)) {
+            fOk = error("RescanServiceDBs() : failed to read block %s", pindex->GetBlockHash().ToString().c_str());
+            break;
+        }
+        if (!paliasdb->ReconstructNameBlock(block, pindex) || !pofferdb->ReconstructOfferBlock(block, pindex)
+                || !pcertdb->ReconstructCertBlock(block, pindex)) {
+            fOk = false;
+            break;
+        }
+        if ((nApplied + 1) % SERVICE_RESCAN_CHECKPOINT == 0 || ShutdownRequested()) {
+            for (unsigned int i = 0; i < 3; i++)
+                pdbs[i]->WriteRescanCheckpoint(pindex->GetBlockHash());
+            if (!FlushServiceDBs() || ShutdownRequested()) {
+                fOk = false;
+                break;
+            }
+        }
+    }
+    reader.Stop();
+    threadGroup.join_all();
+
+    if (fOk)
+        for (unsigned int i = 0; i < 3; i++)
+            pdbs[i]->EraseRescanCheckpoint();
+    printf("Rebuilt the service DBs up to block %d in %"PRI64d"ms\n",
+            nApplied ? vChain[nApplied - 1]->nHeight : pindexStart->nHeight - 1, GetTimeMillis() - nStart);
+    return FlushServiceDBs() && fOk;
+}
+
 bool ConnectBestBlock(CValidationState &state) {
 	do {
 		CBlockIndex *pindexNewBest;
@@ -1655,6 +2252,48 @@ const CCoins &CTransaction::GetOutputCoinsFor(const CTxIn& input,
 	return coins;
 }
 
+CTxInputs::CTxInputs(const CTransaction &txIn, CCoinsViewCache &view) :
+		tx(txIn), fHaveInputs(true), nSpendHeight(0) {
+	for (int i = 0; i < SERVICE_TYPES; i++) {
+		nServiceIn[i] = -1;
+		serviceOp[i] = 0;
+	}
+	if (tx.IsCoinBase())
+		return;
+
+	vpCoins.reserve(tx.vin.size());
+	for (unsigned int i = 0; i < tx.vin.size(); i++) {
+		const COutPoint &prevout = tx.vin[i].prevout;
+		const CCoins *coins = view.AccessCoins(prevout.hash);
+		if (!coins || !coins->IsAvailable(prevout.n)) {
+			fHaveInputs = false;
+			return;
+		}
+		vpCoins.push_back(coins);
+
+		// as in CServiceOutputs::Decode, scripts that cannot be service
+		// scripts are passed over on their first byte
+		const CScript &script = coins->vout[prevout.n].scriptPubKey;
+		if (script.empty() || script[0] < OP_1 || script[0] > OP_16)
+			continue;
+		int op;
+		vector<vector<unsigned char> > vvch;
+		CScript::const_iterator pc = script.begin();
+		servicetype type = DecodeServiceScript(script, op, vvch, pc);
+		if (type == SERVICE_NONE || nServiceIn[type] >= 0)
+			continue;
+		nServiceIn[type] = i;
+		serviceOp[type] = op;
+		serviceArgs[type].swap(vvch);
+	}
+
+	// While checking, GetBestBlock() refers to the parent block.
+	// This is also true for mempool checks.
+	CBlockIndex *pindexView = view.GetBestBlock();
+	if (pindexView)
+		nSpendHeight = pindexView->nHeight + 1;
+}
+
 int64 CTransaction::GetValueIn(CCoinsViewCache& inputs) const {
 	if (IsCoinBase())
 		return 0;
@@ -1666,6 +2305,17 @@ int64 CTransaction::GetValueIn(CCoinsViewCache& inputs) const {
 	return nResult;
 }
 
+int64 CTransaction::GetValueIn(const CTxInputs& inputs) const {
+	if (IsCoinBase())
+		return 0;
+
+	int64 nResult = 0;
+	for (unsigned int i = 0; i < vin.size(); i++)
+		nResult += inputs.GetOutput(i).nValue;
+
+	return nResult;
+}
+
 unsigned int CTransaction::GetP2SHSigOpCount(CCoinsViewCache& inputs) const {
 	if (IsCoinBase())
 		return 0;
@@ -1679,36 +2329,41 @@ unsigned int CTransaction::GetP2SHSigOpCount(CCoinsViewCache& inputs) const {
 	return nSigOps;
 }
 
+unsigned int CTransaction::GetP2SHSigOpCount(const CTxInputs& inputs) const {
+	if (IsCoinBase())
+		return 0;
+
+	unsigned int nSigOps = 0;
+	for (unsigned int i = 0; i < vin.size(); i++) {
+		const CTxOut &prevout = inputs.GetOutput(i);
+		if (prevout.scriptPubKey.IsPayToScriptHash())
+			nSigOps += prevout.scriptPubKey.GetSigOpCount(vin[i].scriptSig);
+	}
+	return nSigOps;
+}
+
 void CTransaction::UpdateCoins(CValidationState &state, CCoinsViewCache &inputs,
 		CTxUndo &txundo, int nHeight, const uint256 &txhash) const {
 	// mark inputs spent
 	if (!IsCoinBase()) {
 		BOOST_FOREACH(const CTxIn &txin, vin) {
-			CCoins &coins = inputs.GetCoins(txin.prevout.hash);
+			CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
 			CTxInUndo undo;
-			assert(coins.Spend(txin.prevout, undo));
+			assert(coins->Spend(txin.prevout, undo));
 			txundo.vprevout.push_back(undo);
 		}
 	}
 
-	// add outputs
-	assert(inputs.SetCoins(txhash, CCoins(*this, nHeight)));
+	// add outputs; callers have made sure no unspent outputs of txhash exist
+	*inputs.ModifyNewCoins(txhash) = CCoins(*this, nHeight);
 }
 
 bool CTransaction::HaveInputs(CCoinsViewCache &inputs) const {
 	if (!IsCoinBase()) {
-		// first check whether information about the prevout hash is available
 		for (unsigned int i = 0; i < vin.size(); i++) {
 			const COutPoint &prevout = vin[i].prevout;
-			if (!inputs.HaveCoins(prevout.hash))
-				return false;
-		}
-
-		// then check whether the actual outputs are available
-		for (unsigned int i = 0; i < vin.size(); i++) {
-			const COutPoint &prevout = vin[i].prevout;
-			const CCoins &coins = inputs.GetCoins(prevout.hash);
-			if (!coins.IsAvailable(prevout.n))
+			const CCoins *coins = inputs.AccessCoins(prevout.hash);
+			if (!coins || !coins->IsAvailable(prevout.n))
 				return false;
 		}
 	}
@@ -1717,7 +2372,7 @@ bool CTransaction::HaveInputs(CCoinsViewCache &inputs) const {
 
 bool CScriptCheck::operator()() const {
 	const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-	if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType))
+	if (!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, nFlags, nHashType, pcache.get()))
 		return error("CScriptCheck() : %s VerifySignature failed",
 				ptxTo->GetHash().ToString().c_str());
 	return true;
@@ -1728,7 +2383,15 @@ bool VerifySignature(const CCoins& txFrom, const CTransaction& txTo,
 	return CScriptCheck(txFrom, txTo, nIn, flags, nHashType)();
 }
 
-bool CTransaction::CheckInputs(CBlockIndex *pindex, CValidationState &state, CCoinsViewCache &inputs,
+bool CTransaction::CheckInputs(CBlockIndex *pindex, CValidationState &state, CCoinsViewCache &view,
+		bool fScriptChecks, unsigned int flags, std::map<std::vector<unsigned char>,uint256> &mapTestPool,
+		std::vector<CScriptCheck> *pvChecks, bool bJustCheck, bool fBlock, bool fMiner) const {
+	CTxInputs inputs(*this, view);
+	return CheckInputs(pindex, state, inputs, fScriptChecks, flags, mapTestPool,
+			pvChecks, bJustCheck, fBlock, fMiner);
+}
+
+bool CTransaction::CheckInputs(CBlockIndex *pindex, CValidationState &state, const CTxInputs &inputs,
 		bool fScriptChecks, unsigned int flags, std::map<std::vector<unsigned char>,uint256> &mapTestPool,
 		std::vector<CScriptCheck> *pvChecks, bool bJustCheck, bool fBlock, bool fMiner) const {
 	
@@ -1738,19 +2401,17 @@ bool CTransaction::CheckInputs(CBlockIndex *pindex, CValidationState &state, CCo
 
 		// This doesn't trigger the DoS code on purpose; if it did, it would make it easier
 		// for an attacker to attempt to split the network.
-		if (!HaveInputs(inputs))
+		if (!inputs.fHaveInputs)
 			return state.Invalid(
 					error("CheckInputs() : %s inputs unavailable",
 							GetHash().ToString().c_str()));
 
-		// While checking, GetBestBlock() refers to the parent block.
-		// This is also true for mempool checks.
-		int nSpendHeight = inputs.GetBestBlock()->nHeight + 1;
+		int nSpendHeight = inputs.nSpendHeight;
 		int64 nValueIn = 0;
 		int64 nFees = 0;
 		for (unsigned int i = 0; i < vin.size(); i++) {
 			const COutPoint &prevout = vin[i].prevout;
-			const CCoins &coins = inputs.GetCoins(prevout.hash);
+			const CCoins &coins = inputs.GetCoins(i);
 
 			// If prev is coinbase, check that it's matured
 			if (coins.IsCoinBase()) {
@@ -1773,20 +2434,17 @@ bool CTransaction::CheckInputs(CBlockIndex *pindex, CValidationState &state, CCo
 		int op;
 		int nOut;
 
-		bool bGood = DecodeAliasTx(*this, op, nOut, vvchArgs, -1);
-		if(bGood && IsAliasOp(op)) {
+		if (GetServiceOutput(SERVICE_ALIAS, op, nOut, vvchArgs)) {
 			if (!CheckAliasInputs(pindex, *this, state, inputs, mapTestPool, fBlock, fMiner, bJustCheck))
 				return false;
 		}
-		
-		bGood = DecodeOfferTx(*this, op, nOut, vvchArgs, pindex->nHeight);
-		if (bGood && IsOfferOp(op)) {
+
+		if (GetServiceOutput(SERVICE_OFFER, op, nOut, vvchArgs)) {
 			if (!CheckOfferInputs(pindex, *this, state, inputs, mapTestPool, fBlock, fMiner, bJustCheck))
 				return false;
-		} 
-		
-		bGood = DecodeCertTx(*this, op, nOut, vvchArgs, pindex->nHeight);
-		if (bGood && IsCertOp(op)) {
+		}
+
+		if (GetServiceOutput(SERVICE_CERT, op, nOut, vvchArgs)) {
 			if (!CheckCertInputs(pindex, *this, state, inputs, mapTestPool, fBlock, fMiner, bJustCheck))
 				return false;
 		}
@@ -1824,37 +2482,110 @@ bool CTransaction::CheckInputs(CBlockIndex *pindex, CValidationState &state, CCo
 		// Skip ECDSA signature verification when connecting blocks
 		// before the last block chain checkpoint. This is safe because block merkle hashes are
 		// still computed and checked, and any change will be caught at the next checkpoint.
-		if (fScriptChecks) {
-			for (unsigned int i = 0; i < vin.size(); i++) {
-				const COutPoint &prevout = vin[i].prevout;
-				const CCoins &coins = inputs.GetCoins(prevout.hash);
-
-				// Verify signature
-				CScriptCheck check(coins, *this, i, flags, 0);
-				if (pvChecks) {
-					pvChecks->push_back(CScriptCheck());
-					check.swap(pvChecks->back());
-				} else if (!check()) {
-					if (flags & SCRIPT_VERIFY_STRICTENC) {
-						// For now, check whether the failure was caused by non-canonical
-						// encodings or not; if so, don't trigger DoS protection.
-						CScriptCheck check(coins, *this, i,
-								flags & (~SCRIPT_VERIFY_STRICTENC), 0);
-						if (check())
-							return state.Invalid();
-					}
-					return state.DoS(100, false);
-				}
+		if (fScriptChecks && !CheckScripts(state, inputs, flags, pvChecks))
+			return false;
+	}
+
+	return true;
+}
+
+// Transactions whose scripts all passed, by a salted hash of their hash and
+// the flags they were checked with
+static CDigestCache scriptExecutionCache;
+
+void InitScriptExecutionCache()
+{
+	int64 nMaxCacheSize = GetArg("-maxscriptcachesize", DEFAULT_MAX_SCRIPT_CACHE_SIZE);
+	nMaxCacheSize = std::max(std::min(nMaxCacheSize, (int64)MAX_DIGEST_CACHE_SIZE), (int64)0);
+	scriptExecutionCache.Resize((uint64)nMaxCacheSize << 20);
+}
+
+void GetScriptExecutionCacheStats(CDigestCacheStats &stats)
+{
+	scriptExecutionCache.GetStats(stats);
+}
+
+// the cache flags say how the caches are used, not what is checked
+static uint256 GetScriptExecutionCacheEntry(const CTransaction &tx, unsigned int flags)
+{
+	CHashWriter ss(SER_GETHASH, 0);
+	ss << scriptExecutionCache.GetSalt() << tx.GetHash()
+			<< (flags & ~(SCRIPT_VERIFY_NOCACHE | SCRIPT_VERIFY_UNCACHE | SCRIPT_VERIFY_ENCFAIL));
+	return ss.GetHash();
+}
+
+bool CTransaction::CheckScripts(CValidationState &state, const CTxInputs &inputs, unsigned int flags,
+		std::vector<CScriptCheck> *pvChecks) const {
+	// a transaction in a block being connected will not be checked again
+	if (scriptExecutionCache.Contains(GetScriptExecutionCacheEntry(*this, flags),
+			flags & SCRIPT_VERIFY_UNCACHE))
+		return true;
+
+	// Checked inline, the transaction is remembered here, and its entry
+	// stands for its signatures: they are not stored in the signature cache,
+	// where nothing would take them out once the transaction is connected.
+	// With STRICTENC, a non-canonical encoding fails the first try. If none
+	// did, the scripts ran as they would without STRICTENC, and they are
+	// remembered for the flags blocks are checked with instead.
+	bool fRemember = !pvChecks && !(flags & SCRIPT_VERIFY_NOCACHE);
+	unsigned int flagsRun = flags;
+	if (fRemember) {
+		flagsRun |= SCRIPT_VERIFY_NOCACHE;
+		if (flags & SCRIPT_VERIFY_STRICTENC)
+			flagsRun |= SCRIPT_VERIFY_ENCFAIL;
+	}
+	bool fEncodingsCanonical = true;
+
+	// what the signature hashes of the inputs have in common
+	boost::shared_ptr<const CSignatureHashCache> pcache;
+	if (vin.size() > 1)
+		pcache.reset(new CSignatureHashCache(*this));
+
+	for (unsigned int i = 0; i < vin.size(); i++) {
+		const CCoins &coins = inputs.GetCoins(i);
+
+		// Verify signature
+		CScriptCheck check(coins, *this, i, flagsRun, 0, pcache);
+		if (pvChecks) {
+			pvChecks->push_back(CScriptCheck());
+			check.swap(pvChecks->back());
+		} else if (!check()) {
+			if (flagsRun & SCRIPT_VERIFY_ENCFAIL) {
+				// an encoding was turned down: whether the script passes
+				// anyway is up to CHECKSIG pushing false as usual
+				fEncodingsCanonical = false;
+				CScriptCheck check(coins, *this, i,
+						flagsRun & ~SCRIPT_VERIFY_ENCFAIL, 0, pcache);
+				if (check())
+					continue;
+			}
+			if (flags & SCRIPT_VERIFY_STRICTENC) {
+				// For now, check whether the failure was caused by non-canonical
+				// encodings or not; if so, don't trigger DoS protection.
+				CScriptCheck check(coins, *this, i,
+						flagsRun & ~(SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_ENCFAIL), 0, pcache);
+				if (check())
+					return state.Invalid();
 			}
+			return state.DoS(100, false);
 		}
 	}
 
+	if (fRemember) {
+		unsigned int flagsEntry = flags;
+		if ((flags & SCRIPT_VERIFY_STRICTENC) && fEncodingsCanonical)
+			flagsEntry &= ~SCRIPT_VERIFY_STRICTENC;
+		scriptExecutionCache.Insert(GetScriptExecutionCacheEntry(*this, flagsEntry));
+	}
 	return true;
 }
 
-bool DisconnectAlias( CBlockIndex *pindex, const CTransaction &tx, int op, vector<vector<unsigned char> > &vvchArgs ) {
+bool DisconnectAlias( CBlockIndex *pindex, const CTransaction &tx, int op, vector<vector<unsigned char> > &vvchArgs, bool fUndone ) {
 
-	if(op != OP_ALIAS_NEW) {
+	if(op != OP_ALIAS_NEW && fUndone) {
+		RemoveAliasFee(pindex, tx.GetHash());
+	}
+	else if(op != OP_ALIAS_NEW) {
 
 		string opName = aliasFromOp(op);
 		vector<CAliasIndex> vtxPos;
@@ -1877,15 +2608,7 @@ bool DisconnectAlias( CBlockIndex *pindex, const CTransaction &tx, int op, vecto
 		if(!paliasdb->WriteName(vvchArgs[0], vtxPos))
 			return error("DisconnectBlock() : failed to write to alias DB");
 
-		CAliasFee theFeeObject;
-		theFeeObject.hash =  tx.GetHash();
-		theFeeObject.nHeight = pindex->nHeight;
-		theFeeObject.nValue = 0;
-		//RemoveAliasFee(theFeeObject);
-		InsertAliasFee(pindex, tx.GetHash(), 0);
-		vector<CAliasFee> vAliasFees(lstAliasFees.begin(), lstAliasFees.end());
-		if (!paliasdb->WriteAliasTxFees(vAliasFees))
-			return error( "DisconnectBlock() : failed to write fees to alias DB");
+		RemoveAliasFee(pindex, tx.GetHash());
 
 	}
 
@@ -1898,17 +2621,19 @@ bool DisconnectAlias( CBlockIndex *pindex, const CTransaction &tx, int op, vecto
 	return true;
 }
 
-bool DisconnectOffer( CBlockIndex *pindex, const CTransaction &tx, int op, vector<vector<unsigned char> > &vvchArgs ) {
+bool DisconnectOffer( CBlockIndex *pindex, const CTransaction &tx, int op, vector<vector<unsigned char> > &vvchArgs, bool fUndone ) {
     string opName = offerFromOp(op);
 
 	COffer theOffer(tx);
 	if (theOffer.IsNull())
 		error("CheckOfferInputs() : null offer object");
 
-    if(op != OP_OFFER_NEW) {
+    if(op != OP_OFFER_NEW && fUndone) {
+		RemoveOfferFee(pindex);
+    }
+    else if(op != OP_OFFER_NEW) {
         // make sure a DB record exists for this offer
-        vector<COffer> vtxPos;
-        if (!pofferdb->ReadOffer(vvchArgs[0], vtxPos))
+        if (!pofferdb->ExistsOffer(vvchArgs[0]))
             return error("DisconnectBlock() : failed to read from offer DB for %s %s\n",
             		opName.c_str(), stringFromVch(vvchArgs[0]).c_str());
 
@@ -1921,35 +2646,14 @@ bool DisconnectOffer( CBlockIndex *pindex, const CTransaction &tx, int op, vecto
 	            return error("DisconnectBlock() : not found in offer for offer accept %s %s\n",
 	            		opName.c_str(), HexStr(vvchOfferAccept).c_str());
 
-	        // make sure offer accept db record already exists
-	        if (pofferdb->ExistsOfferAccept(vvchOfferAccept))
-	        	pofferdb->EraseOfferAccept(vvchOfferAccept);
+	        // remove the accept, or roll an offerpay back to the unpaid accept
+	        if (!pofferdb->DisconnectOfferAcceptEvent(vvchArgs[0], theOfferAccept, tx.GetHash(), op == OP_OFFER_PAY))
+	            return error("DisconnectBlock() : failed to write to offer DB");
         }
+        else if (!pofferdb->DisconnectOfferVersion(vvchArgs[0], pindex->nHeight))
+            return error("DisconnectBlock() : failed to write to offer DB");
 
-        // vtxPos might be empty if we pruned expired transactions.  However, it should normally still not
-        // be empty, since a reorg cannot go that far back.  Be safe anyway and do not try to pop if empty.
-        if (vtxPos.size()) {
-            CDiskTxPos txindex;
-            if (!pblocktree->ReadTxIndex(tx.GetHash(), txindex))
-                return error("DisconnectBlock() : failed to read tx index for offer %s %s %s\n",
-                		opName.c_str(), stringFromVch(vvchArgs[0]).c_str(), tx.GetHash().ToString().c_str());
-
-            while(vtxPos.back().txHash == tx.GetHash())
-                vtxPos.pop_back();
-        }
-
-        // write new offer state to db
-		if(!pofferdb->WriteOffer(vvchArgs[0], vtxPos))
-			return error("DisconnectBlock() : failed to write to offer DB");
-
-		COfferFee theFeeObject;
-		theFeeObject.hash =  tx.GetHash();
-		theFeeObject.nHeight = pindex->nHeight;
-		//RemoveOfferFee(theFeeObject);
-		InsertOfferFee(pindex, tx.GetHash(), 0);
-		vector<COfferFee> vOfferFees(lstOfferFees.begin(), lstOfferFees.end());
-		if (!pofferdb->WriteOfferTxFees(vOfferFees))
-			return error( "DisconnectBlock() : failed to write fees to offer DB");
+		RemoveOfferFee(pindex);
 	}
 
 	printf("DISCONNECTED offer TXN: offer=%s op=%s hash=%s  height=%d\n",
@@ -1961,14 +2665,17 @@ bool DisconnectOffer( CBlockIndex *pindex, const CTransaction &tx, int op, vecto
 	return true;
 }
 
-bool DisconnectCertificate( CBlockIndex *pindex, const CTransaction &tx, int op, vector<vector<unsigned char> > &vvchArgs ) {
+bool DisconnectCertificate( CBlockIndex *pindex, const CTransaction &tx, int op, vector<vector<unsigned char> > &vvchArgs, bool fUndone ) {
 	string opName = certissuerFromOp(op);
 
 	CCertIssuer theIssuer(tx);
 	if (theIssuer.IsNull())
 		error("CheckOfferInputs() : null issuer object");
 
-	if(op != OP_CERTISSUER_NEW) {
+	if(op != OP_CERTISSUER_NEW && fUndone) {
+		RemoveCertFee(pindex);
+	}
+	else if(op != OP_CERTISSUER_NEW) {
 		// make sure a DB record exists for this cert
 		vector<CCertIssuer> vtxPos;
 		if (!pcertdb->ReadCertIssuer(vvchArgs[0], vtxPos))
@@ -2005,15 +2712,7 @@ bool DisconnectCertificate( CBlockIndex *pindex, const CTransaction &tx, int op,
 		if(!pcertdb->WriteCertIssuer(vvchArgs[0], vtxPos))
 			return error("DisconnectBlock() : failed to write to offer DB");
 
-		CCertFee theFeeObject;
-		theFeeObject.hash =  tx.GetHash();
-		theFeeObject.nHeight = pindex->nHeight;
-		theFeeObject.nFee = 0;
-		//RemoveCertFee(theFeeObject);
-		InsertCertFee(pindex, tx.GetHash(), 0);
-		vector<CCertFee> vCertIssuerFees(lstCertIssuerFees.begin(), lstCertIssuerFees.end());
-		if (!pcertdb->WriteCertFees(vCertIssuerFees))
-			return error( "DisconnectBlock() : failed to write fees to certissuer DB");
+		RemoveCertFee(pindex);
 	}
 
 	printf("DISCONNECTED CERT TXN: title=%s hash=%s height=%d\n",
@@ -2041,45 +2740,51 @@ bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoin
 	if (blockUndo.vtxundo.size() + 1 != vtx.size())
 		return error("DisconnectBlock() : block and undo data inconsistent");
 
+	// restore the service records this block changed; blocks connected by
+	// older versions have no service undo and are rolled back txn by txn
+	bool fAliasUndone = paliasdb->ApplyBlockUndo(pindex);
+	bool fOfferUndone = pofferdb->ApplyBlockUndo(pindex);
+	bool fCertUndone = pcertdb->ApplyBlockUndo(pindex);
+
 	// undo transactions in reverse order
 	for (int i = vtx.size() - 1; i >= 0; i--) {
 		const CTransaction &tx = vtx[i];
 		uint256 hash = tx.GetHash();
 
 		// check that all outputs are available
-		if (!view.HaveCoins(hash)) {
+		if (!view.HaveCoins(hash))
 			fClean =
 					fClean
 							&& error(
 									"DisconnectBlock() : outputs still spent? database corrupted");
-			view.SetCoins(hash, CCoins());
+		{
+			CCoinsModifier outs = view.ModifyCoins(hash);
+
+			CCoins outsBlock = CCoins(tx, pindex->nHeight);
+			// The CCoins serialization does not serialize negative numbers.
+			// No network rules currently depend on the version here, so an inconsistency is harmless
+			// but it must be corrected before txout nversion ever influences a network rule.
+			if (outsBlock.nVersion < 0)
+				outs->nVersion = outsBlock.nVersion;
+			if (*outs != outsBlock)
+				fClean =
+						fClean
+								&& error(
+										"DisconnectBlock() : added transaction mismatch? database corrupted");
+			// remove outputs
+			*outs = CCoins();
 		}
-		CCoins &outs = view.GetCoins(hash);
-
-		CCoins outsBlock = CCoins(tx, pindex->nHeight);
-		// The CCoins serialization does not serialize negative numbers.
-		// No network rules currently depend on the version here, so an inconsistency is harmless
-		// but it must be corrected before txout nversion ever influences a network rule.
-		if (outsBlock.nVersion < 0)
-			outs.nVersion = outsBlock.nVersion;
-		if (outs != outsBlock)
-			fClean =
-					fClean
-							&& error(
-									"DisconnectBlock() : added transaction mismatch? database corrupted");
-		// remove outputs
-		outs = CCoins();
 
 	    if (tx.nVersion == SYSCOIN_TX_VERSION) {
 		    vector<vector<unsigned char> > vvchArgs;
 		    int op, nOut;
-			// TODO CB refactor into apropriate files
-
-			if(DecodeAliasTx(tx, op, nOut, vvchArgs, -1)) {
-				if (IsAliasOp(op)) DisconnectAlias(pindex, tx, op, vvchArgs);
-				else if (IsOfferOp(op)) DisconnectOffer(pindex, tx, op, vvchArgs);
-				else if (IsCertOp(op)) DisconnectCertificate(pindex, tx, op, vvchArgs);
-			}
+			// each service was checked on its own when the tx connected
+			if (tx.GetServiceOutput(SERVICE_ALIAS, op, nOut, vvchArgs))
+				DisconnectAlias(pindex, tx, op, vvchArgs, fAliasUndone);
+			if (tx.GetServiceOutput(SERVICE_OFFER, op, nOut, vvchArgs))
+				DisconnectOffer(pindex, tx, op, vvchArgs, fOfferUndone);
+			if (tx.GetServiceOutput(SERVICE_CERT, op, nOut, vvchArgs))
+				DisconnectCertificate(pindex, tx, op, vvchArgs, fCertUndone);
 	    }
 
 		// restore inputs
@@ -2093,40 +2798,36 @@ bool CBlock::DisconnectBlock(CValidationState &state, CBlockIndex *pindex, CCoin
 			for (unsigned int j = tx.vin.size(); j-- > 0;) {
 				const COutPoint &out = tx.vin[j].prevout;
 				const CTxInUndo &undo = txundo.vprevout[j];
-				CCoins coins;
+				// empty if the prevout was already entirely spent
+				CCoinsModifier coins = view.ModifyCoins(out.hash);
 
-				view.GetCoins(out.hash, coins); // this can fail if the prevout was already entirely spent
 				if (undo.nHeight != 0) {
 					// undo data contains height: this is the last output of the prevout tx being spent
-					if (!coins.IsPruned())
+					if (!coins->IsPruned())
 						fClean =
 								fClean
 										&& error(
 												"DisconnectBlock() : undo data overwriting existing transaction");
-					coins = CCoins();
-					coins.fCoinBase = undo.fCoinBase;
-					coins.nHeight = undo.nHeight;
-					coins.nVersion = undo.nVersion;
+					*coins = CCoins();
+					coins->fCoinBase = undo.fCoinBase;
+					coins->nHeight = undo.nHeight;
+					coins->nVersion = undo.nVersion;
 				} else {
-					if (coins.IsPruned())
+					if (coins->IsPruned())
 						fClean =
 								fClean
 										&& error(
 												"DisconnectBlock() : undo data adding output to missing transaction");
 				}
 
-				if (coins.IsAvailable(out.n))
+				if (coins->IsAvailable(out.n))
 					fClean =
 							fClean
 									&& error(
 											"DisconnectBlock() : undo data overwriting existing output");
-				if (coins.vout.size() < out.n + 1)
-					coins.vout.resize(out.n + 1);
-				coins.vout[out.n] = undo.txout;
-
-				if (!view.SetCoins(out.hash, coins))
-					return error(
-							"DisconnectBlock() : cannot restore coin inputs");
+				if (coins->vout.size() < out.n + 1)
+					coins->vout.resize(out.n + 1);
+				coins->vout[out.n] = undo.txout;
 			}
 		}
 	}
@@ -2162,6 +2863,7 @@ void static FlushBlockFile(bool fFinalize = false) {
 		FileCommit(fileOld);
 		fclose(fileOld);
 	}
+	auxpowstore.Commit();
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos,
@@ -2174,6 +2876,120 @@ void ThreadScriptCheck() {
 	scriptcheckqueue.Thread();
 }
 
+/** Proof-of-work check of a group of blocks, as many as the scrypt kernel
+ *  hashes at once. Sets the flag of each block whose PoW checks out. */
+class CBlockPoWCheck {
+private:
+	std::vector<const CBlockHeader*> vHeaders;
+	char *pfValid;
+
+public:
+	CBlockPoWCheck() : pfValid(NULL) {}
+	CBlockPoWCheck(const std::vector<const CBlockHeader*> &vHeadersIn, char *pfValidIn) :
+		vHeaders(vHeadersIn), pfValid(pfValidIn) {}
+
+	bool operator()() {
+		// the height is not known yet, as in ProcessBlock's CheckBlock
+		std::vector<int> vHeights(vHeaders.size(), INT_MAX);
+		std::vector<bool> vValid;
+		CBlockHeader::CheckProofOfWork(vHeaders, vHeights, vValid);
+		bool fAllValid = true;
+		for (unsigned int i = 0; i < vHeaders.size(); i++) {
+			pfValid[i] = vValid[i];
+			fAllValid = fAllValid && vValid[i];
+		}
+		return fAllValid;
+	}
+
+	void swap(CBlockPoWCheck &check) {
+		vHeaders.swap(check.vHeaders);
+		std::swap(pfValid, check.pfValid);
+	}
+};
+
+static CCheckQueue<CBlockPoWCheck> powcheckqueue(1);
+// the network and import threads take turns at the queue
+static CCriticalSection cs_powcheck;
+
+void ThreadPoWCheck() {
+	RenameThread("bitcoin-powcheck");
+	powcheckqueue.Thread();
+}
+
+void CheckBlocksPoW(const std::vector<CBlock*> &vpblock, std::vector<char> &vValid) {
+	vValid.assign(vpblock.size(), 0);
+	if (vpblock.empty())
+		return;
+
+	LOCK(cs_powcheck);
+	CCheckQueueControl<CBlockPoWCheck> control(&powcheckqueue);
+	unsigned int nWays = scrypt_multi_ways();
+	std::vector<CBlockPoWCheck> vChecks;
+	for (unsigned int i = 0; i < vpblock.size(); i += nWays) {
+		std::vector<const CBlockHeader*> vHeaders;
+		for (unsigned int j = i; j < vpblock.size() && j < i + nWays; j++)
+			vHeaders.push_back(vpblock[j]);
+		vChecks.push_back(CBlockPoWCheck(vHeaders, &vValid[i]));
+	}
+	control.Add(vChecks);
+	// once a check fails the queue skips the rest; their flags stay unset
+	// and they are checked again in CheckBlock
+	control.Wait();
+}
+
+/** Work on a run of a block's transactions that does not depend on anything
+ *  else: their hashes, the leaves of the merkle tree, and the decoding of
+ *  their service outputs. Both are remembered with the transactions. */
+class CTxPrecompute {
+private:
+	const CTransaction *ptx;
+	unsigned int nCount;
+
+public:
+	CTxPrecompute() : ptx(NULL), nCount(0) {}
+	CTxPrecompute(const CTransaction *ptxIn, unsigned int nCountIn) :
+		ptx(ptxIn), nCount(nCountIn) {}
+
+	bool operator()() {
+		for (unsigned int i = 0; i < nCount; i++) {
+			ptx[i].GetHash();
+			if (!ptx[i].serviceOutputs.fDecoded)
+				ptx[i].serviceOutputs.Decode(ptx[i].vout);
+		}
+		return true;
+	}
+
+	void swap(CTxPrecompute &check) {
+		std::swap(ptx, check.ptx);
+		std::swap(nCount, check.nCount);
+	}
+};
+
+static CCheckQueue<CTxPrecompute> txprecomputequeue(4);
+static CCriticalSection cs_txprecompute;
+
+void ThreadTxPrecompute() {
+	RenameThread("bitcoin-txprecomp");
+	txprecomputequeue.Thread();
+}
+
+// Transactions per CTxPrecompute; fewer than twice this are done inline.
+static const unsigned int TX_PRECOMPUTE_RUN = 16;
+
+static void PrecomputeTransactions(const std::vector<CTransaction> &vtx) {
+	if (!nScriptCheckThreads || vtx.size() < 2 * TX_PRECOMPUTE_RUN)
+		return;
+
+	LOCK(cs_txprecompute);
+	CCheckQueueControl<CTxPrecompute> control(&txprecomputequeue);
+	std::vector<CTxPrecompute> vChecks;
+	for (unsigned int i = 0; i < vtx.size(); i += TX_PRECOMPUTE_RUN)
+		vChecks.push_back(CTxPrecompute(&vtx[i],
+				std::min(TX_PRECOMPUTE_RUN, (unsigned int)vtx.size() - i)));
+	control.Add(vChecks);
+	control.Wait();
+}
+
 bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex,
 		CCoinsViewCache &view, bool fJustCheck) {
 //	printf( "*** ConnectBlock height %d %s\n", pindex->nHeight, fJustCheck ? "JUSTCHECK" : "" );
@@ -2193,6 +3009,12 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex,
 		return true;
 	}
 
+	if (!fJustCheck) {
+		paliasdb->BeginBlockUndo(pindex);
+		pofferdb->BeginBlockUndo(pindex);
+		pcertdb->BeginBlockUndo(pindex);
+	}
+
 	bool fScriptChecks = pindex->nHeight >= Checkpoints::GetTotalBlocksEstimate();
 
 	// Do not allow blocks that contain transactions which 'overwrite' older transactions,
@@ -2208,10 +3030,30 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex,
 	// this prevents exploiting the issue against nodes in their initial block download.
 	bool fEnforceBIP30 = true;
 
+	// Read the transactions the block spends from ahead of the loop below,
+	// which would otherwise wait for the coins database one input at a time
+	if (nCoinsFetchThreads && vtx.size() > 1) {
+		int64 nFetchStart = GetTimeMicros();
+		std::set<uint256> setCreated;
+		for (unsigned int i = 0; i < vtx.size(); i++)
+			setCreated.insert(GetTxHash(i));
+		std::vector<uint256> vPrevouts;
+		for (unsigned int i = 1; i < vtx.size(); i++)
+			BOOST_FOREACH(const CTxIn &txin, vtx[i].vin)
+				if (!setCreated.count(txin.prevout.hash))
+					vPrevouts.push_back(txin.prevout.hash);
+		unsigned int nFetched = pcoinsTip->PrefetchCoins(vPrevouts);
+		int64 nFetchTime = GetTimeMicros() - nFetchStart;
+		if (fBenchmark)
+			printf("- Fetch %u input transactions (%u not cached): %.2fms\n",
+					(unsigned) vPrevouts.size(), nFetched, 0.001 * nFetchTime);
+	}
+
 	if (fEnforceBIP30) {
 		for (unsigned int i = 0; i < vtx.size(); i++) {
 			uint256 hash = GetTxHash(i);
-			if (view.HaveCoins(hash) && !view.GetCoins(hash).IsPruned())
+			const CCoins *coins = view.AccessCoins(hash);
+			if (coins && !coins->IsPruned())
 				return state.DoS(100,
 						error( "ConnectBlock() : tried to overwrite transaction"));
 		}
@@ -2225,6 +3067,10 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex,
 			SCRIPT_VERIFY_NOCACHE
 					| (fStrictPayToScriptHash ?
 							SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE);
+	// the signatures of a block that is connected for good will not be
+	// checked again, make room for those of new transactions
+	if (!fJustCheck)
+		flags |= SCRIPT_VERIFY_UNCACHE;
 
 	CBlockUndo blockundo;
 
@@ -2247,7 +3093,9 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex,
 			return state.DoS(100, error("ConnectBlock() : too many sigops"));
 
 		if (!tx.IsCoinBase()) {
-			if (!tx.HaveInputs(view))
+			// looked up once for all the checks below
+			CTxInputs inputs(tx, view);
+			if (!inputs.fHaveInputs)
 				return state.DoS(100,
 						error("ConnectBlock() : inputs missing/spent"));
 
@@ -2255,17 +3103,17 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex,
 				// Add in sigops done by pay-to-script-hash inputs;
 				// this is to prevent a "rogue miner" from creating
 				// an incredibly-expensive-to-validate block.
-				nSigOps += tx.GetP2SHSigOpCount(view);
+				nSigOps += tx.GetP2SHSigOpCount(inputs);
 				if (nSigOps > MAX_BLOCK_SIGOPS)
 					return state.DoS(100,
 							error("ConnectBlock() : too many sigops"));
 			}
 
-			nFees += tx.GetValueIn(view) - tx.GetValueOut();
+			nFees += tx.GetValueIn(inputs) - tx.GetValueOut();
 
 			std::vector<CScriptCheck> vChecks;
 
-			if (!tx.CheckInputs(pindex, state, view, fScriptChecks, flags, dummyTestPool,
+			if (!tx.CheckInputs(pindex, state, inputs, fScriptChecks, flags, dummyTestPool,
 					nScriptCheckThreads ? &vChecks : NULL, fJustCheck, true, false))
 				return false;
 
@@ -2354,9 +3202,18 @@ bool CBlock::ConnectBlock(CValidationState &state, CBlockIndex* pindex,
 	}
 
 	if (fTxIndex)
-		if (!pblocktree->WriteTxIndex(vPos))
+		if (!pblocktree->WriteTxIndex(vPos, CTxBlockPos(pindex->GetBlockHash(), pindex->nHeight)))
 			return state.Abort(_("Failed to write transaction index"));
 
+	// age the expiry indexes; part of the block's service undo
+	if (!paliasdb->ExpireRecords(pindex->nHeight) || !pofferdb->ExpireRecords(pindex->nHeight)
+			|| !pcertdb->ExpireRecords(pindex->nHeight))
+		return state.Abort(_("Failed to expire service records"));
+
+	paliasdb->WriteBlockUndo();
+	pofferdb->WriteBlockUndo();
+	pcertdb->WriteBlockUndo();
+
 	// add this block to the view's block chain
 	assert(view.SetBestBlock(pindex));
 
@@ -2370,6 +3227,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew) {
 	// All modifications to the coin state will be done in this cache.
 	// Only when all have succeeded, we push it to pcoinsTip.
 	CCoinsViewCache view(*pcoinsTip, true);
+	BeginServiceViews();
 
 	// Find the fork (typically, there is none)
 	CBlockIndex* pfork = view.GetBestBlock();
@@ -2409,12 +3267,16 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew) {
 	vector<CTransaction> vResurrect;
 	BOOST_FOREACH(CBlockIndex* pindex, vDisconnect) {
 		CBlock block;
-		if (!block.ReadFromDisk(pindex))
+		if (!block.ReadFromDisk(pindex)) {
+			DiscardServiceViews();
 			return state.Abort(_("Failed to read block"));
+		}
 		int64 nStart = GetTimeMicros();
-		if (!block.DisconnectBlock(state, pindex, view))
+		if (!block.DisconnectBlock(state, pindex, view)) {
+			DiscardServiceViews();
 			return error("SetBestBlock() : DisconnectBlock %s failed",
 					pindex->GetBlockHash().ToString().c_str());
+		}
 		if (fBenchmark)
 			printf("- Disconnect: %.2fms\n",
 					(GetTimeMicros() - nStart) * 0.001);
@@ -2432,10 +3294,13 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew) {
 	vector<CTransaction> vDelete;
 	BOOST_FOREACH(CBlockIndex *pindex, vConnect) {
 		CBlock block;
-		if (!block.ReadFromDisk(pindex))
+		if (!block.ReadFromDisk(pindex)) {
+			DiscardServiceViews();
 			return state.Abort(_("Failed to read block"));
+		}
 		int64 nStart = GetTimeMicros();
 		if (!block.ConnectBlock(state, pindex, view)) {
+			DiscardServiceViews();
 			if (state.IsInvalid()) {
 				InvalidChainFound(pindexNew);
 				InvalidBlockFound(pindex);
@@ -2455,9 +3320,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew) {
 	int64 nStart = GetTimeMicros();
 	int nModified = view.GetCacheSize();
 	assert(view.Flush());
-	assert(paliasdb->Flush());
-	assert(pofferdb->Flush());
-	assert(pcertdb->Flush());
+	CommitServiceViews();
 	int64 nTime = GetTimeMicros() - nStart;
 	if (fBenchmark)
 		printf("- Flush %i transactions: %.2fms (%.4fms/tx)\n", nModified,
@@ -2465,7 +3328,9 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew) {
 
 	// Make sure it's successfully written to disk before changing memory structure
 	bool fIsInitialDownload = IsInitialBlockDownload();
-	if (!fIsInitialDownload || pcoinsTip->GetCacheSize() > nCoinCacheSize) {
+	// buffered service DB records are counted at 300 bytes each
+	if (!fIsInitialDownload || pcoinsTip->DynamicMemoryUsage()
+			+ GetServiceCacheSize() * 300 > nCoinCacheUsage) {
 		// Typical CCoins structures on disk are around 100 bytes in size.
 		// Pushing a new one to the database can cause it to be written
 		// twice (once in the log, and once in the tables). This is already
@@ -2477,6 +3342,10 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew) {
 		pblocktree->Sync();
 		if (!pcoinsTip->Flush())
 			return state.Abort(_("Failed to write to coin database"));
+		if (!FlushServiceDBs())
+			return state.Abort(_("Failed to write to service database"));
+		if (GetTime() - nLastBlockIndexSnapshot > BLOCK_INDEX_SNAPSHOT_INTERVAL)
+			WriteBlockIndexSnapshot();
 	}
 
 	// At this point, all changes have been done to the database.
@@ -2516,7 +3385,7 @@ bool SetBestChain(CValidationState &state, CBlockIndex* pindexNew) {
 	// New best block
 	hashBestChain = pindexNew->GetBlockHash();
 	pindexBest = pindexNew;
-	pblockindexFBBHLast = NULL;
+	chainActive.SetTip(pindexNew);
 	nBestHeight = pindexBest->nHeight;
 	nBestChainWork = pindexNew->nChainWork;
 	nTimeBestReceived = GetTime();
@@ -2569,12 +3438,11 @@ bool CBlock::AddToBlockIndex(CValidationState &state,
 						hash.ToString().c_str()));
 
 	// Construct new block index object
-	CBlockIndex* pindexNew = new CBlockIndex(*this);
-	assert(pindexNew);
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(
+	CBlockIndex* pindexNew = arenaBlockIndex.create(CBlockIndex(*this));
+	BlockMap::iterator mi = mapBlockIndex.insert(
 			make_pair(hash, pindexNew)).first;
 	pindexNew->phashBlock = &((*mi).first);
-	map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(
+	BlockMap::iterator miPrev = mapBlockIndex.find(
 			hashPrevBlock);
 	if (miPrev != mapBlockIndex.end()) {
 		pindexNew->pprev = (*miPrev).second;
@@ -2591,6 +3459,10 @@ bool CBlock::AddToBlockIndex(CValidationState &state,
 	pindexNew->nUndoPos = 0;
 	pindexNew->nStatus = BLOCK_VALID_TRANSACTIONS | BLOCK_HAVE_DATA;
 	setBlockIndexValid.insert(pindexNew);
+	// headers are served from the AuxPoW store, the DB copy is the fallback
+	if (auxpow.get() != NULL
+			&& auxpowstore.Append(hash, *auxpow, pindexNew->nAuxPowPos))
+		pindexNew->nStatus |= BLOCK_HAVE_AUXPOW;
 
 	/* write both the immutible data (CDiskBlockIndex) and the mutable data (BlockIndex) */
 	if (!pblocktree->WriteDiskBlockIndex(
@@ -2621,7 +3493,38 @@ int GetOurChainID() {
     return 0x0001;
 }
 
-bool CBlockHeader::CheckProofOfWork(int nHeight) const {
+void CBlockHeader::GetPoWHashes(const std::vector<const CBlockHeader*> &vHeaders, std::vector<uint256> &vHashes) {
+	vHashes.resize(vHeaders.size());
+	if (vHeaders.empty())
+		return;
+	// the 80 serialized header bytes start at nVersion
+	std::vector<char> vInput(80 * vHeaders.size());
+	for (unsigned int i = 0; i < vHeaders.size(); i++)
+		memcpy(&vInput[80 * i], BEGIN(vHeaders[i]->nVersion), 80);
+	scrypt_1024_1_1_256_multi(&vInput[0], BEGIN(vHashes[0]), vHeaders.size());
+}
+
+void CBlockHeader::CheckProofOfWork(const std::vector<const CBlockHeader*> &vHeaders,
+		const std::vector<int> &vHeights, std::vector<bool> &vValid) {
+	// merge mined headers are checked by their parent block's hash instead
+	std::vector<const CBlockHeader*> vScrypt;
+	for (unsigned int i = 0; i < vHeaders.size(); i++)
+		if (vHeaders[i]->auxpow.get() == NULL)
+			vScrypt.push_back(vHeaders[i]);
+	std::vector<uint256> vHashes;
+	GetPoWHashes(vScrypt, vHashes);
+
+	vValid.resize(vHeaders.size());
+	unsigned int nScrypt = 0;
+	for (unsigned int i = 0; i < vHeaders.size(); i++) {
+		const uint256 *phashPoW = NULL;
+		if (vHeaders[i]->auxpow.get() == NULL)
+			phashPoW = &vHashes[nScrypt++];
+		vValid[i] = vHeaders[i]->CheckProofOfWork(vHeights[i], phashPoW);
+	}
+}
+
+bool CBlockHeader::CheckProofOfWork(int nHeight, const uint256 *phashPoW) const {
 	if (nHeight >= GetAuxPowStartBlock()) {
 		// Prevent same work from being submitted twice:
 		// - this block must have our chain ID
@@ -2639,7 +3542,7 @@ bool CBlockHeader::CheckProofOfWork(int nHeight) const {
 				return error("CheckProofOfWork() : AUX proof of work failed");
 		} else {
 			// Check proof of work matches claimed amount
-			if (!::CheckProofOfWork(GetPoWHash(), nBits))
+			if (!::CheckProofOfWork(phashPoW ? *phashPoW : GetPoWHash(), nBits))
 				return error("CheckProofOfWork() : proof of work failed");
 		}
 	} else {
@@ -2649,7 +3552,7 @@ bool CBlockHeader::CheckProofOfWork(int nHeight) const {
 		}
 
 		// Check if proof of work marches claimed amount
-		if (!::CheckProofOfWork(GetPoWHash(), nBits))
+		if (!::CheckProofOfWork(phashPoW ? *phashPoW : GetPoWHash(), nBits))
 			return error("CheckProofOfWork() : proof of work failed");
 	}
 	return true;
@@ -2788,6 +3691,10 @@ bool CBlock::CheckBlock(CValidationState &state, CBlockIndex* pindex,
 					error("CheckBlock() : more than one coinbase"));
 	}
 
+	// Hash the transactions and decode their service outputs on the
+	// precompute threads, ahead of the checks and the merkle tree
+	PrecomputeTransactions(vtx);
+
 	// Check transactions
 	BOOST_FOREACH(const CTransaction& tx, vtx) {
 		if (!tx.CheckTransaction(state))
@@ -2834,7 +3741,7 @@ bool CBlock::AcceptBlock(CValidationState &state, CDiskBlockPos *dbp) {
 	CBlockIndex* pindexPrev = NULL;
 	int nHeight = 0;
 	if (hash != hashGenesisBlock) {
-		map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(
+		BlockMap::iterator mi = mapBlockIndex.find(
 				hashPrevBlock);
 		if (mi == mapBlockIndex.end())
 			return state.DoS(10, error("AcceptBlock() : prev block not found"));
@@ -2951,7 +3858,7 @@ bool CBlockIndex::IsSuperMajority(int minVersion, const CBlockIndex* pstart,
 }
 
 bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock,
-		CDiskBlockPos *dbp) {
+		CDiskBlockPos *dbp, bool fCheckPOW) {
 	// Check for duplicate
 	uint256 hash = pblock->GetHash();
 	if (mapBlockIndex.count(hash))
@@ -2964,7 +3871,7 @@ bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock,
 						hash.ToString().c_str()));
 
 	// Preliminary checks
-	if (!pblock->CheckBlock(state, NULL))
+	if (!pblock->CheckBlock(state, NULL, fCheckPOW))
 		return error("ProcessBlock() : CheckBlock FAILED");
 
 	CBlockIndex* pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
@@ -3241,36 +4148,288 @@ CBlockIndex * InsertBlockIndex(uint256 hash) {
 		return NULL;
 
 	// Return existing
-	map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+	BlockMap::iterator mi = mapBlockIndex.find(hash);
 	if (mi != mapBlockIndex.end())
 		return (*mi).second;
 
 	// Create new
-	CBlockIndex* pindexNew = new CBlockIndex();
-	if (!pindexNew)
-		throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+	CBlockIndex* pindexNew = arenaBlockIndex.create();
 	mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 	pindexNew->phashBlock = &((*mi).first);
 
 	return pindexNew;
 }
 
-bool static LoadBlockIndexDB() {
+// load the block index from the DB, then compute what is kept in memory only
+static bool LoadBlockIndexGutsDB() {
 	if (!pblocktree->LoadBlockIndexGuts())
 		return false;
 
 	boost::this_thread::interruption_point();
 
-	// Calculate nChainWork
-	vector<pair<int, CBlockIndex*> > vSortedByHeight;
-	vSortedByHeight.reserve(mapBlockIndex.size());
-	BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex) {
-		CBlockIndex* pindex = item.second;
-		vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+	// Order the entries by height with a counting sort, so every parent comes
+	// before its children in the one pass below
+	int nMaxHeight = -1;
+	for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi) {
+		if ((*mi).second->nHeight < 0)
+			return error("LoadBlockIndexGutsDB() : negative height of %s",
+					(*mi).first.ToString().c_str());
+		nMaxHeight = std::max(nMaxHeight, (*mi).second->nHeight);
+	}
+	vector<unsigned int> vHeightStart(nMaxHeight + 2, 0);
+	for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+		vHeightStart[(*mi).second->nHeight + 1]++;
+	for (int nHeight = 1; nHeight <= nMaxHeight + 1; nHeight++)
+		vHeightStart[nHeight] += vHeightStart[nHeight - 1];
+	vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+	for (BlockMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+		vSortedByHeight[vHeightStart[(*mi).second->nHeight]++] = (*mi).second;
+
+	// Calculate nChainWork, and move the AuxPoW of merge-mined blocks indexed
+	// before the AuxPoW store into it, in height order so ranges of headers
+	// read sequentially
+	int nAuxPowMoved = 0;
+	BOOST_FOREACH(CBlockIndex* pindex, vSortedByHeight) {
+		pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0)
+				+ pindex->GetBlockWork().getuint256();
+		pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0)
+				+ pindex->nTx;
+		if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS
+				&& !(pindex->nStatus & BLOCK_FAILED_MASK))
+			setBlockIndexValid.insert(pindex);
+
+		if (!(pindex->nVersion & BLOCK_VERSION_AUXPOW)
+				|| (pindex->nStatus & BLOCK_HAVE_AUXPOW))
+			continue;
+		CDiskBlockIndex diskindex;
+		if (!pblocktree->ReadDiskBlockIndex(pindex->GetBlockHash(), diskindex)
+				|| diskindex.auxpow.get() == NULL)
+			return error("LoadBlockIndexGutsDB() : AuxPoW of %s not found",
+					pindex->GetBlockHash().ToString().c_str());
+		if (!auxpowstore.Append(pindex->GetBlockHash(), *diskindex.auxpow,
+				pindex->nAuxPowPos))
+			return false;
+		pindex->nStatus |= BLOCK_HAVE_AUXPOW;
+		if (!pblocktree->WriteBlockIndex(*pindex))
+			return error("LoadBlockIndexGutsDB() : failed to write block index");
+		nAuxPowMoved++;
+	}
+	if (nAuxPowMoved > 0) {
+		auxpowstore.Commit();
+		printf("LoadBlockIndexGutsDB(): moved %d AuxPoW to the AuxPoW store\n",
+				nAuxPowMoved);
+	}
+
+	return true;
+}
+
+/** Header of blocks/index.snapshot, which is followed by nRecords
+ *  CBlockIndexSnapshotRecord. Both are stored in native byte order; a
+ *  snapshot written by another machine fails the checks and is ignored. */
+struct CBlockIndexSnapshotHeader {
+	char pchMagic[8];
+	unsigned int nVersion;
+	unsigned int nRecordSize;
+	uint64 nRecords;
+	uint256 token;       // equal to the block tree DB's while the snapshot is current
+	uint256 hashRecords; // Hash() of the records
+};
+
+/** A CBlockIndex in blocks/index.snapshot, with what is otherwise recomputed at startup. */
+struct CBlockIndexSnapshotRecord {
+	uint256 hashBlock;
+	uint256 hashPrev;
+	uint256 hashMerkleRoot;
+	uint256 nChainWork;
+	uint64 nAuxPowPos;
+	int nHeight;
+	int nFile;
+	unsigned int nDataPos;
+	unsigned int nUndoPos;
+	unsigned int nTx;
+	unsigned int nChainTx;
+	unsigned int nStatus;
+	int nVersion;
+	unsigned int nTime;
+	unsigned int nBits;
+	unsigned int nNonce;
+	unsigned int nReserved;
+};
+
+static const char pchBlockIndexSnapshotMagic[8] = { 's', 'y', 's', 'i', 'n', 'd', 'e', 'x' };
+static const unsigned int BLOCK_INDEX_SNAPSHOT_VERSION = 1;
+
+static boost::filesystem::path GetBlockIndexSnapshotPath() {
+	return GetDataDir() / "blocks" / "index.snapshot";
+}
+
+bool WriteBlockIndexSnapshot() {
+	// nothing to write before the block index is loaded
+	if (pblocktree == NULL || pindexBest == NULL)
+		return true;
+	int64 nStart = GetTimeMillis();
+
+	// everything the snapshot describes must be on disk before it becomes current
+	FlushBlockFile();
+	if (!pblocktree->Sync())
+		return error("WriteBlockIndexSnapshot() : failed to sync block index");
+
+	boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+	boost::filesystem::path pathTmp = GetDataDir() / "blocks" / "index.snapshot.new";
+	FILE *file = fopen(pathTmp.string().c_str(), "wb");
+	if (!file)
+		return error("WriteBlockIndexSnapshot() : open failed");
+
+	CBlockIndexSnapshotHeader header;
+	memcpy(header.pchMagic, pchBlockIndexSnapshotMagic, sizeof(header.pchMagic));
+	header.nVersion = BLOCK_INDEX_SNAPSHOT_VERSION;
+	header.nRecordSize = sizeof(CBlockIndexSnapshotRecord);
+	header.nRecords = 0;
+	header.token = GetRandHash();
+	bool fOk = fwrite(&header, sizeof(header), 1, file) == 1;
+
+	CHashWriter hasher(SER_GETHASH, 0);
+	for (BlockMap::iterator mi = mapBlockIndex.begin(); fOk && mi != mapBlockIndex.end(); ++mi) {
+		const CBlockIndex *pindex = (*mi).second;
+		if (pindex == NULL)
+			continue;
+		CBlockIndexSnapshotRecord record;
+		record.hashBlock = (*mi).first;
+		record.hashPrev = pindex->pprev ? pindex->pprev->GetBlockHash() : 0;
+		record.hashMerkleRoot = pindex->hashMerkleRoot;
+		record.nChainWork = pindex->nChainWork;
+		record.nAuxPowPos = pindex->nAuxPowPos;
+		record.nHeight = pindex->nHeight;
+		record.nFile = pindex->nFile;
+		record.nDataPos = pindex->nDataPos;
+		record.nUndoPos = pindex->nUndoPos;
+		record.nTx = pindex->nTx;
+		record.nChainTx = pindex->nChainTx;
+		record.nStatus = pindex->nStatus;
+		record.nVersion = pindex->nVersion;
+		record.nTime = pindex->nTime;
+		record.nBits = pindex->nBits;
+		record.nNonce = pindex->nNonce;
+		record.nReserved = 0;
+		hasher.write((const char*)&record, sizeof(record));
+		fOk = fwrite(&record, sizeof(record), 1, file) == 1;
+		header.nRecords++;
+	}
+	header.hashRecords = hasher.GetHash();
+	fOk = fOk && fseek(file, 0, SEEK_SET) == 0
+			&& fwrite(&header, sizeof(header), 1, file) == 1;
+	if (fOk)
+		FileCommit(file);
+	fclose(file);
+	if (!fOk)
+		return error("WriteBlockIndexSnapshot() : write failed");
+	if (!RenameOver(pathTmp, pathSnapshot))
+		return error("WriteBlockIndexSnapshot() : rename failed");
+
+	// from here on, block index writes are journaled against this snapshot
+	if (!pblocktree->WriteSnapshotToken(header.token))
+		return error("WriteBlockIndexSnapshot() : failed to write token");
+	nLastBlockIndexSnapshot = GetTime();
+	printf("WriteBlockIndexSnapshot(): %"PRI64u" entries  %"PRI64d"ms\n",
+			header.nRecords, GetTimeMillis() - nStart);
+	return true;
+}
+
+static bool BlockIndexHeightLess(const CBlockIndex *pa, const CBlockIndex *pb) {
+	return pa->nHeight < pb->nHeight;
+}
+
+// load the block index from blocks/index.snapshot and the entries written
+// since; false if there is no current snapshot
+static bool LoadBlockIndexSnapshot() {
+	uint256 token;
+	if (!pblocktree->ReadSnapshotToken(token))
+		return false;
+	boost::filesystem::path pathSnapshot = GetBlockIndexSnapshotPath();
+	FILE *file = fopen(pathSnapshot.string().c_str(), "rb");
+	if (!file)
+		return error("LoadBlockIndexSnapshot() : %s missing",
+				pathSnapshot.string().c_str());
+	int64 nStart = GetTimeMillis();
+
+	CBlockIndexSnapshotHeader header;
+	uint64 nSize = boost::filesystem::file_size(pathSnapshot);
+	if (nSize < sizeof(header) || fread(&header, sizeof(header), 1, file) != 1
+			|| memcmp(header.pchMagic, pchBlockIndexSnapshotMagic, sizeof(header.pchMagic)) != 0
+			|| header.nVersion != BLOCK_INDEX_SNAPSHOT_VERSION
+			|| header.nRecordSize != sizeof(CBlockIndexSnapshotRecord)
+			|| header.token != token
+			|| header.nRecords != (nSize - sizeof(header)) / sizeof(CBlockIndexSnapshotRecord)
+			|| (nSize - sizeof(header)) % sizeof(CBlockIndexSnapshotRecord) != 0) {
+		fclose(file);
+		return error("LoadBlockIndexSnapshot() : snapshot is stale or of another format");
+	}
+
+	const char *pRecords = NULL;
+	size_t nRecordBytes = nSize - sizeof(header);
+#ifndef WIN32
+	void *pMap = mmap(NULL, nSize, PROT_READ, MAP_SHARED, fileno(file), 0);
+	if (pMap != MAP_FAILED)
+		pRecords = (const char*)pMap + sizeof(header);
+#endif
+	std::vector<char> vRecords;
+	if (pRecords == NULL) {
+		vRecords.resize(nRecordBytes);
+		if (nRecordBytes > 0 && fread(&vRecords[0], nRecordBytes, 1, file) != 1) {
+			fclose(file);
+			return error("LoadBlockIndexSnapshot() : read failed");
+		}
+		pRecords = nRecordBytes > 0 ? &vRecords[0] : NULL;
+	}
+	fclose(file);
+
+	bool fOk = Hash(pRecords, pRecords + nRecordBytes) == header.hashRecords;
+	if (fOk) {
+		mapBlockIndex.reserve(header.nRecords);
+		for (uint64 n = 0; n < header.nRecords; n++) {
+			CBlockIndexSnapshotRecord record;
+			memcpy(&record, pRecords + n * sizeof(record), sizeof(record));
+			CBlockIndex *pindex = InsertBlockIndex(record.hashBlock);
+			pindex->pprev = InsertBlockIndex(record.hashPrev);
+			pindex->hashMerkleRoot = record.hashMerkleRoot;
+			pindex->nChainWork = record.nChainWork;
+			pindex->nAuxPowPos = record.nAuxPowPos;
+			pindex->nHeight = record.nHeight;
+			pindex->nFile = record.nFile;
+			pindex->nDataPos = record.nDataPos;
+			pindex->nUndoPos = record.nUndoPos;
+			pindex->nTx = record.nTx;
+			pindex->nChainTx = record.nChainTx;
+			pindex->nStatus = record.nStatus;
+			pindex->nVersion = record.nVersion;
+			pindex->nTime = record.nTime;
+			pindex->nBits = record.nBits;
+			pindex->nNonce = record.nNonce;
+			if (pindexGenesisBlock == NULL && record.hashBlock == hashGenesisBlock)
+				pindexGenesisBlock = pindex;
+			if ((pindex->nStatus & BLOCK_VALID_MASK) >= BLOCK_VALID_TRANSACTIONS
+					&& !(pindex->nStatus & BLOCK_FAILED_MASK))
+				setBlockIndexValid.insert(pindex);
+		}
 	}
-	sort(vSortedByHeight.begin(), vSortedByHeight.end());
-	BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight) {
-		CBlockIndex* pindex = item.second;
+#ifndef WIN32
+	if (pMap != MAP_FAILED)
+		munmap(pMap, nSize);
+#endif
+	if (!fOk)
+		return error("LoadBlockIndexSnapshot() : checksum mismatch");
+
+	// bring the entries written after the snapshot up to date; their
+	// ancestors are either among them or in the snapshot
+	vector<CBlockIndex*> vChanged;
+	if (!pblocktree->LoadBlockIndexJournal(vChanged)) {
+		UnloadBlockIndex();
+		return error("LoadBlockIndexSnapshot() : failed to read the journal");
+	}
+	BOOST_FOREACH(CBlockIndex* pindex, vChanged)
+		setBlockIndexValid.erase(pindex);
+	sort(vChanged.begin(), vChanged.end(), BlockIndexHeightLess);
+	BOOST_FOREACH(CBlockIndex* pindex, vChanged) {
 		pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0)
 				+ pindex->GetBlockWork().getuint256();
 		pindex->nChainTx = (pindex->pprev ? pindex->pprev->nChainTx : 0)
@@ -3280,6 +4439,16 @@ bool static LoadBlockIndexDB() {
 			setBlockIndexValid.insert(pindex);
 	}
 
+	printf("LoadBlockIndexSnapshot(): %"PRI64u" entries and %"PRIszu" journaled  %"PRI64d"ms\n",
+			header.nRecords, vChanged.size(), GetTimeMillis() - nStart);
+	return true;
+}
+
+bool static LoadBlockIndexDB() {
+	if (!LoadBlockIndexSnapshot() && !LoadBlockIndexGutsDB())
+		return false;
+	nLastBlockIndexSnapshot = GetTime();
+
 	// Load block file info
 	pblocktree->ReadLastBlockFile(nLastBlockFile);
 	printf("LoadBlockIndexDB(): last block file = %i\n", nLastBlockFile);
@@ -3310,6 +4479,8 @@ bool static LoadBlockIndexDB() {
 	nBestHeight = pindexBest->nHeight;
 	nBestChainWork = pindexBest->nChainWork;
 
+	chainActive.SetTip(pindexBest);
+
 	// set 'next' pointers in best chain
 	CBlockIndex *pindex = pindexBest;
 	while (pindex != NULL && pindex->pprev != NULL) {
@@ -3324,13 +4495,7 @@ bool static LoadBlockIndexDB() {
 	return true;
 }
 
-bool VerifyDB(int nCheckLevel, int nCheckDepth) {
-	if (pindexBest == NULL || pindexBest->pprev == NULL)
-		return true;
-
-	printf("Loading Syscoin service fees from DB.\n");
-	LoadSyscoinFees();
-
+static bool VerifyChainState(int nCheckLevel, int nCheckDepth) {
 	// Verify blocks in the best chain
 	if (nCheckDepth <= 0)
 		nCheckDepth = 1000000000; // suffices until the year 19000
@@ -3372,8 +4537,8 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth) {
 		}
 		// check level 3: check for inconsistencies during memory-only disconnect of tip blocks
 		if (nCheckLevel >= 3 && pindex == pindexState
-				&& (coins.GetCacheSize() + pcoinsTip->GetCacheSize())
-						<= 2 * nCoinCacheSize + 32000) {
+				&& coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()
+						<= nCoinCacheUsage) {
 			bool fClean = true;
 			if (!block.DisconnectBlock(state, pindex, coins, &fClean))
 				return error(
@@ -3422,8 +4587,26 @@ bool VerifyDB(int nCheckLevel, int nCheckDepth) {
 	return true;
 }
 
+bool VerifyDB(int nCheckLevel, int nCheckDepth) {
+	if (pindexBest == NULL || pindexBest->pprev == NULL)
+		return true;
+
+	printf("Loading Syscoin service fees from DB.\n");
+	LoadSyscoinFees();
+
+	// blocks are disconnected and reconnected in memory only, the service
+	// DBs and fee windows must come out unchanged
+	BeginServiceViews();
+	bool fRet = VerifyChainState(nCheckLevel, nCheckDepth);
+	DiscardServiceViews();
+	if (nCheckLevel >= 3)
+		LoadSyscoinFees();
+	return fRet;
+}
+
 void UnloadBlockIndex() {
 	mapBlockIndex.clear();
+	arenaBlockIndex.clear();
 	setBlockIndexValid.clear();
 	pindexGenesisBlock = NULL;
 	nBestHeight = 0;
@@ -3431,6 +4614,7 @@ void UnloadBlockIndex() {
 	nBestInvalidWork = 0;
 	hashBestChain = 0;
 	pindexBest = NULL;
+	chainActive.SetTip(NULL);
 }
 
 bool LoadBlockIndex() {
@@ -3573,7 +4757,7 @@ bool InitBlockIndex() {
 void PrintBlockTree() {
 	// pre-compute tree structure
 	map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-	for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin();
+	for (BlockMap::iterator mi = mapBlockIndex.begin();
 			mi != mapBlockIndex.end(); ++mi) {
 		CBlockIndex* pindex = (*mi).second;
 		mapNext[pindex->pprev].push_back(pindex);
@@ -3632,10 +4816,41 @@ void PrintBlockTree() {
 	}
 }
 
+// hand blocks read by LoadExternalBlockFile to ProcessBlock once their PoW
+// has been checked in parallel; false on a system error
+static bool ProcessImportedBlocks(std::vector<CBlock> &vBlocks,
+		std::vector<uint64> &vBlockPos, CDiskBlockPos *dbp, int &nLoaded) {
+	std::vector<CBlock*> vpblock;
+	for (unsigned int i = 0; i < vBlocks.size(); i++)
+		vpblock.push_back(&vBlocks[i]);
+	std::vector<char> vValid;
+	CheckBlocksPoW(vpblock, vValid);
+
+	bool fOk = true;
+	for (unsigned int i = 0; i < vBlocks.size(); i++) {
+		LOCK(cs_main);
+		if (dbp)
+			dbp->nPos = vBlockPos[i];
+		CValidationState state;
+		if (ProcessBlock(state, NULL, &vBlocks[i], dbp, !vValid[i]))
+			nLoaded++;
+		if (state.IsError()) {
+			fOk = false;
+			break;
+		}
+	}
+	vBlocks.clear();
+	vBlockPos.clear();
+	return fOk;
+}
+
 bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp) {
 	int64 nStart = GetTimeMillis();
 
 	int nLoaded = 0;
+	std::vector<CBlock> vBlocks;
+	std::vector<uint64> vBlockPos;
+	vBlocks.reserve(MAX_POW_CHECK_BATCH);
 	try {
 		CBufferedFile blkdat(fileIn, 2 * MAX_BLOCK_SIZE, MAX_BLOCK_SIZE + 8,
 				SER_DISK, CLIENT_VERSION);
@@ -3680,22 +4895,20 @@ bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp) {
 				blkdat >> block;
 				nRewind = blkdat.GetPos();
 
-				// process block
+				// queue block, processed in batches
 				if (nBlockPos >= nStartByte) {
-					LOCK(cs_main);
-					if (dbp)
-						dbp->nPos = nBlockPos;
-					CValidationState state;
-					if (ProcessBlock(state, NULL, &block, dbp))
-						nLoaded++;
-					if (state.IsError())
-						break;
+					vBlocks.push_back(block);
+					vBlockPos.push_back(nBlockPos);
 				}
 			} catch (std::exception &e) {
 				printf("%s() : Deserialize or I/O error caught during load\n",
 						__PRETTY_FUNCTION__);
 			}
+			if (vBlocks.size() >= MAX_POW_CHECK_BATCH
+					&& !ProcessImportedBlocks(vBlocks, vBlockPos, dbp, nLoaded))
+				break;
 		}
+		ProcessImportedBlocks(vBlocks, vBlockPos, dbp, nLoaded);
 		fclose(fileIn);
 	} catch (std::runtime_error &e) {
 		AbortNode(_("Error: system error: ") + e.what());
@@ -3816,7 +5029,7 @@ void static ProcessGetData(CNode* pfrom) {
 
 			if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK) {
 				bool send = true;
-				map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(
+				BlockMap::iterator mi = mapBlockIndex.find(
 						inv.hash);
 				pfrom->nBlocksRequested++;
 				if (mi != mapBlockIndex.end()) {
@@ -3924,6 +5137,23 @@ void static ProcessGetData(CNode* pfrom) {
 	}
 }
 
+// a "block" message, by ProcessMessage or once its PoW was checked ahead
+static void ProcessReceivedBlock(CNode* pfrom, CBlock &block, bool fCheckPOW) {
+	printf("received block %s\n", block.GetHash().ToString().c_str());
+	// block.print();
+
+	CInv inv(MSG_BLOCK, block.GetHash());
+	pfrom->AddInventoryKnown(inv);
+
+	CValidationState state;
+	if (ProcessBlock(state, pfrom, &block, NULL, fCheckPOW) || state.CorruptionPossible())
+		mapAlreadyAskedFor.erase(inv);
+	int nDoS = 0;
+	if (state.IsInvalid(nDoS))
+		if (nDoS > 0)
+			pfrom->Misbehaving(nDoS);
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand,
 		CDataStream& vRecv) {
 	RandAddSeedPerfmon();
@@ -4218,7 +5448,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand,
 		CBlockIndex* pindex = NULL;
 		if (locator.IsNull()) {
 			// If locator is null, return the hashStop block
-			map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(
+			BlockMap::iterator mi = mapBlockIndex.find(
 					hashStop);
 			if (mi == mapBlockIndex.end())
 				return true;
@@ -4323,20 +5553,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand,
 			{
 		CBlock block;
 		vRecv >> block;
-
-		printf("received block %s\n", block.GetHash().ToString().c_str());
-		// block.print();
-
-		CInv inv(MSG_BLOCK, block.GetHash());
-		pfrom->AddInventoryKnown(inv);
-
-		CValidationState state;
-		if (ProcessBlock(state, pfrom, &block) || state.CorruptionPossible())
-			mapAlreadyAskedFor.erase(inv);
-		int nDoS = 0;
-		if (state.IsInvalid(nDoS))
-			if (nDoS > 0)
-				pfrom->Misbehaving(nDoS);
+		ProcessReceivedBlock(pfrom, block, true);
 	}
 
 	else if (strCommand == "getaddr") {
@@ -4473,6 +5690,28 @@ bool static ProcessMessage(CNode* pfrom, string strCommand,
 }
 
 // requires LOCK(cs_vRecvMsg)
+// check the PoW of a peer's consecutive "block" messages in parallel, then
+// process them in order
+static void ProcessQueuedBlocks(CNode* pfrom, std::vector<CBlock> &vBlocks) {
+	if (vBlocks.empty())
+		return;
+	std::vector<CBlock*> vpblock;
+	for (unsigned int i = 0; i < vBlocks.size(); i++)
+		vpblock.push_back(&vBlocks[i]);
+	std::vector<char> vValid;
+	CheckBlocksPoW(vpblock, vValid);
+
+	for (unsigned int i = 0; i < vBlocks.size(); i++) {
+		try {
+			LOCK(cs_main);
+			ProcessReceivedBlock(pfrom, vBlocks[i], !vValid[i]);
+		} catch (std::exception& e) {
+			PrintExceptionContinue(&e, "ProcessQueuedBlocks()");
+		}
+	}
+	vBlocks.clear();
+}
+
 bool ProcessMessages(CNode* pfrom) {
 	//if (fDebug)
 	//    printf("ProcessMessages(%zu messages)\n", pfrom->vRecvMsg.size());
@@ -4494,6 +5733,7 @@ bool ProcessMessages(CNode* pfrom) {
 	if (!pfrom->vRecvGetData.empty())
 		return fOk;
 
+	std::vector<CBlock> vBlocks;
 	std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
 	while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
 		// Don't bother if send buffer is too full to respond anyway
@@ -4547,6 +5787,22 @@ bool ProcessMessages(CNode* pfrom) {
 			continue;
 		}
 
+		// Collect consecutive blocks so their PoW can be checked together;
+		// other messages wait for them to be processed
+		if (strCommand == "block" && pfrom->nVersion != 0 && !fImporting && !fReindex) {
+			try {
+				vBlocks.push_back(CBlock());
+				vRecv >> vBlocks.back();
+			} catch (std::exception& e) {
+				vBlocks.pop_back();
+				PrintExceptionContinue(&e, "ProcessMessages()");
+			}
+			if (vBlocks.size() >= MAX_POW_CHECK_BATCH)
+				break;
+			continue;
+		}
+		ProcessQueuedBlocks(pfrom, vBlocks);
+
 		// Process message
 		bool fRet = false;
 		try {
@@ -4583,6 +5839,7 @@ bool ProcessMessages(CNode* pfrom) {
 
 		break;
 	}
+	ProcessQueuedBlocks(pfrom, vBlocks);
 
 	// In case the connection got shut down, its receive buffer was wiped
 	if (!pfrom->fDisconnect)
@@ -4994,12 +6251,13 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn) {
 						comparer);
 			}
 
-			if (!tx.HaveInputs(view))
+			CTxInputs inputs(tx, view);
+			if (!inputs.fHaveInputs)
 				continue;
 
-			int64 nTxFees = tx.GetValueIn(view) - tx.GetValueOut();
+			int64 nTxFees = tx.GetValueIn(inputs) - tx.GetValueOut();
 
-			nTxSigOps += tx.GetP2SHSigOpCount(view);
+			nTxSigOps += tx.GetP2SHSigOpCount(inputs);
 			if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
 				continue;
 
@@ -5008,7 +6266,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn) {
 	        // }
 
 	        CValidationState state;
-			if (!tx.CheckInputs(pindexPrev, state, view, true, SCRIPT_VERIFY_P2SH,
+			if (!tx.CheckInputs(pindexPrev, state, inputs, true, SCRIPT_VERIFY_P2SH,
 					mapTestPool, NULL, false, true, false))
 				continue;
 
@@ -5061,6 +6319,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn) {
 		pblock->nBits = GetNextWorkRequired(pindexPrev, pblock);
 		pblock->nNonce = 0;
 		pblock->vtx[0].vin[0].scriptSig = CScript() << OP_0 << OP_0;
+		pblock->vtx[0].InvalidateCache();
 		pblocktemplate->vTxSigOps[0] = pblock->vtx[0].GetLegacySigOpCount();
 
 		CBlockIndex indexDummy(*pblock);
@@ -5068,7 +6327,10 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn) {
 		indexDummy.nHeight = pindexPrev->nHeight + 1;
 		CCoinsViewCache viewNew(*pcoinsTip, true);
 		CValidationState state;
-		if (!pblock->ConnectBlock(state, &indexDummy, viewNew, true))
+		BeginServiceViews();
+		bool fConnected = pblock->ConnectBlock(state, &indexDummy, viewNew, true);
+		DiscardServiceViews();
+		if (!fConnected)
 			throw std::runtime_error("CreateNewBlock() : ConnectBlock failed");
 	}
 
@@ -5098,6 +6360,7 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev,
 	pblock->vtx[0].vin[0].scriptSig = (CScript() << nHeight
 			<< CBigNum(nExtraNonce)) + COINBASE_FLAGS;
 	assert(pblock->vtx[0].vin[0].scriptSig.size() <= 100);
+	pblock->vtx[0].InvalidateCache();
 
 	pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
@@ -5229,12 +6492,14 @@ CBlockHeader CBlockIndex::GetBlockHeader() const {
 	CBlockHeader block;
 
 	if (nVersion & BLOCK_VERSION_AUXPOW) {
-		CDiskBlockIndex diskblockindex;
-		// auxpow is not in memory, load CDiskBlockHeader
-		// from database to get it
-
-		pblocktree->ReadDiskBlockIndex(*phashBlock, diskblockindex);
-		block.auxpow = diskblockindex.auxpow;
+		// auxpow is not in memory, read it from the AuxPoW store, or load
+		// CDiskBlockHeader from database to get it if the store lacks it
+		if (!(nStatus & BLOCK_HAVE_AUXPOW)
+				|| !auxpowstore.Read(nAuxPowPos, *phashBlock, block.auxpow)) {
+			CDiskBlockIndex diskblockindex;
+			pblocktree->ReadDiskBlockIndex(*phashBlock, diskblockindex);
+			block.auxpow = diskblockindex.auxpow;
+		}
 	}
 
 	block.nVersion = nVersion;
@@ -5256,6 +6521,12 @@ void static ScryptMiner(CWallet *pwallet) {
 	CReserveKey reservekey(pwallet);
 	unsigned int nExtraNonce = 0;
 
+	// hash as many nonces at once as the scrypt kernel has lanes
+	int nWays = scrypt_multi_ways();
+	std::vector<char> vScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+	std::vector<char> vInput(80 * nWays);
+	std::vector<uint256> vHashes(nWays);
+
 	try {
 		loop {
 			while (vNodes.empty())
@@ -5304,22 +6575,33 @@ void static ScryptMiner(CWallet *pwallet) {
 			loop {
 				unsigned int nHashesDone = 0;
 
-				uint256 thash;
-				char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
-				loop {
-					scrypt_1024_1_1_256_sp_generic(BEGIN(pblock->nVersion),
-							BEGIN(thash), scratchpad);
-
-					if (thash <= hashTarget) {
-						// Found a solution
-						SetThreadPriority(THREAD_PRIORITY_NORMAL);
-						CheckWork(pblock, *pwallet, reservekey);
-						SetThreadPriority(THREAD_PRIORITY_LOWEST);
-						break;
+				// one nonce per SIMD lane, which divides the 256 nonce rounds
+				bool fFound = false;
+				while (!fFound) {
+					for (int i = 0; i < nWays; i++) {
+						memcpy(&vInput[80 * i], BEGIN(pblock->nVersion), 80);
+						*(unsigned int *) (&vInput[80 * i] + 76) = pblock->nNonce + i;
 					}
-					pblock->nNonce += 1;
-					nHashesDone += 1;
-					if ((pblock->nNonce & 0xFF) == 0)
+					scrypt_1024_1_1_256_sp_multi(&vInput[0], BEGIN(vHashes[0]),
+							nWays, &vScratchpad[0]);
+
+					for (int i = 0; i < nWays; i++) {
+						if (vHashes[i] <= hashTarget) {
+							// Found a solution
+							pblock->nNonce += i;
+							SetThreadPriority(THREAD_PRIORITY_NORMAL);
+							CheckWork(pblock, *pwallet, reservekey);
+							SetThreadPriority(THREAD_PRIORITY_LOWEST);
+							fFound = true;
+							break;
+						}
+					}
+					if (fFound)
+						break;
+					pblock->nNonce += nWays;
+					nHashesDone += nWays;
+					// crossed a multiple of 256
+					if ((pblock->nNonce & 0xFF) < (unsigned int) nWays)
 						break;
 				}
 
@@ -5457,10 +6739,8 @@ public:
 	}
 	~CMainCleanup() {
 		// block headers
-		std::map<uint256, CBlockIndex*>::iterator it1 = mapBlockIndex.begin();
-		for (; it1 != mapBlockIndex.end(); it1++)
-			delete (*it1).second;
 		mapBlockIndex.clear();
+		arenaBlockIndex.clear();
 
 		// orphan blocks
 		std::map<uint256, CBlock*>::iterator it2 = mapOrphanBlocks.begin();
@@ -6,6 +6,9 @@
 #define BITCOIN_MAIN_H
 
 #include "bignum.h"
+#include "blockmap.h"
+#include "digestcache.h"
+#include "hash.h"
 #include "sync.h"
 #include "net.h"
 #include "script.h"
@@ -13,8 +16,11 @@
 
 #include <list>
 
+#include <boost/unordered_map.hpp>
+
 class CWallet;
 class CBlock;
+class CBlockHeader;
 class CBlockIndex;
 class CKeyItem;
 class CReserveKey;
@@ -66,7 +72,15 @@ static const int COINBASE_MATURITY = 60;
 /** Threshold for nLockTime: below this value it is interpreted as block number, otherwise as UNIX timestamp. */
 static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20 1985 UTC
 /** Maximum number of script-checking threads allowed */
-static const int MAX_SCRIPTCHECK_THREADS = 16;
+static const int MAX_SCRIPTCHECK_THREADS = 64;
+/** Default number of threads reading a block's inputs from the coins database before it is connected */
+static const int DEFAULT_COINS_FETCH_THREADS = 4;
+/** Default size of the cache of transactions whose scripts passed, in MiB */
+static const unsigned int DEFAULT_MAX_SCRIPT_CACHE_SIZE = 8;
+/** Most blocks whose proof-of-work is checked in parallel before they are processed */
+static const unsigned int MAX_POW_CHECK_BATCH = 64;
+/** Seconds between block index snapshots written while the chain is flushed */
+static const int64 BLOCK_INDEX_SNAPSHOT_INTERVAL = 60 * 60;
 #ifdef USE_UPNP
 static const int fHaveUPnP = true;
 #else
@@ -78,7 +92,8 @@ extern CScript COINBASE_FLAGS;
 #define MAPTESTPOOLTYPE pair<vector<unsigned char>, uint256>
 
 extern CCriticalSection cs_main;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+typedef blockmap<CBlockIndex*> BlockMap;
+extern BlockMap mapBlockIndex;
 extern std::set<CBlockIndex*, CBlockIndexWorkComparator> setBlockIndexValid;
 extern uint256 hashGenesisBlock;
 extern CBlockIndex* pindexGenesisBlock;
@@ -101,8 +116,9 @@ extern bool fImporting;
 extern bool fReindex;
 extern bool fBenchmark;
 extern int nScriptCheckThreads;
+extern int nCoinsFetchThreads;
 extern bool fTxIndex;
-extern unsigned int nCoinCacheSize;
+extern size_t nCoinCacheUsage;
 
 // Settings
 extern int64 nTransactionFee;
@@ -126,8 +142,10 @@ class CCoins;
 class CTxUndo;
 class CCoinsView;
 class CCoinsViewCache;
+class CTxInputs;
 class CScriptCheck;
 class CValidationState;
+struct CServiceCacheStats;
 
 struct CBlockTemplate;
 
@@ -138,7 +156,7 @@ void UnregisterWallet(CWallet* pwalletIn);
 /** Push an updated transaction to all registered wallets */
 void SyncWithWallets(const uint256 &hash, const CTransaction& tx, const CBlock* pblock = NULL, bool fUpdate = false);
 /** Process an incoming block */
-bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL);
+bool ProcessBlock(CValidationState &state, CNode* pfrom, CBlock* pblock, CDiskBlockPos *dbp = NULL, bool fCheckPOW = true);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64 nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -153,18 +171,52 @@ bool InitBlockIndex();
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Write the block index to blocks/index.snapshot, for the next start to load instead of the DB */
+bool WriteBlockIndexSnapshot();
 /** Verify consistency of the block and coin databases */
 bool VerifyDB(int nCheckLevel, int nCheckDepth);
+/** Write the buffered alias, offer and certificate DB changes, marked with the coins' best block */
+bool FlushServiceDBs();
+/** Check that the service DBs were last flushed together with the coins */
+bool CheckServiceDBs();
+/** Rebuild the service DBs from the main chain blocks from pindexRescan on, or
+ *  (NULL) only finish a rebuild that an earlier run was interrupted in */
+bool RescanServiceDBs(CBlockIndex *pindexRescan);
+/** Number of buffered service DB changes */
+unsigned int GetServiceCacheSize();
+/** Split the -servicecache budget between the decoded record caches of the service DBs */
+void SetServiceRecordCacheSize(uint64 nBytes);
+/** Counters of the decoded record caches of the service DBs */
+void GetServiceRecordCacheStats(std::vector<std::pair<std::string, CServiceCacheStats> > &vStats);
+/** Kimoto Gravity Well retarget: the nBits of the block after pindexLast */
+unsigned int KimotoGravityWell(const CBlockIndex* pindexLast, const CBlockHeader *pblock, uint64 TargetBlocksSpacingSeconds, uint64 PastBlocksMin, uint64 PastBlocksMax);
+/** The same on CBigNum; the reference KimotoGravityWell is checked against */
+unsigned int KimotoGravityWellBigNum(const CBlockIndex* pindexLast, const CBlockHeader *pblock, uint64 TargetBlocksSpacingSeconds, uint64 PastBlocksMin, uint64 PastBlocksMax);
 /** Print the loaded block tree */
 void PrintBlockTree();
 /** Find a block by height in the currently-connected chain */
 CBlockIndex* FindBlockByHeight(int nHeight);
+/** Find the main chain block containing a transaction, using only the tx index (NULL if none) */
+CBlockIndex* GetTxBlockIndex(const uint256 &txid);
+/** Find the main chain block at a tx index position, reading only the block header (NULL if none) */
+CBlockIndex* GetTxPosBlockIndex(const CDiskTxPos &postx);
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /** Send queued protocol messages to be sent to a give node */
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the coins prefetch thread */
+void ThreadCoinsFetch();
+/** Size the cache of transactions whose scripts passed from -maxscriptcachesize */
+void InitScriptExecutionCache();
+void GetScriptExecutionCacheStats(CDigestCacheStats &stats);
+/** Run an instance of the proof-of-work checking thread */
+void ThreadPoWCheck();
+/** Check the proof-of-work of blocks on the PoW checking threads; vValid[i] is set if block i's checks out */
+void CheckBlocksPoW(const std::vector<CBlock*> &vpblock, std::vector<char> &vValid);
+/** Run an instance of the thread hashing and decoding the transactions of blocks being checked */
+void ThreadTxPrecompute();
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet);
 /** Generate a new block, without valid proof-of-work */
@@ -258,6 +310,31 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+/** The block an indexed transaction was connected in, kept next to its
+ *  CDiskTxPos so its height can be found without reading the block. */
+struct CTxBlockPos
+{
+    uint256 hashBlock;
+    int nHeight;
+
+    IMPLEMENT_SERIALIZE(
+        READWRITE(hashBlock);
+        READWRITE(VARINT(nHeight));
+    )
+
+    CTxBlockPos(const uint256 &hashBlockIn, int nHeightIn) : hashBlock(hashBlockIn), nHeight(nHeightIn) {
+    }
+
+    CTxBlockPos() {
+        SetNull();
+    }
+
+    void SetNull() {
+        hashBlock = 0;
+        nHeight = -1;
+    }
+};
+
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
 class CInPoint
@@ -471,6 +548,38 @@ enum GetMinFee_mode
 };
 
 int64 GetFeeAssign();
+
+/** The first alias, offer and certificate output of a transaction, with the
+ *  op and arguments of its script. Decoded in one pass over the outputs the
+ *  first time they are asked for, and kept with the transaction.
+ */
+class CServiceOutputs
+{
+public:
+    bool fDecoded;
+    int op[SERVICE_TYPES];
+    int nOut[SERVICE_TYPES];
+    std::vector<std::vector<unsigned char> > vvch[SERVICE_TYPES];
+
+    CServiceOutputs()
+    {
+        SetNull();
+    }
+
+    void SetNull()
+    {
+        fDecoded = false;
+        for (int i = 0; i < SERVICE_TYPES; i++)
+        {
+            op[i] = 0;
+            nOut[i] = -1;
+            vvch[i].clear();
+        }
+    }
+
+    void Decode(const std::vector<CTxOut>& vout);
+};
+
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks. A transaction can contain multiple inputs and outputs.
  */
@@ -485,6 +594,12 @@ public:
     std::vector<CTxOut> vout;
     unsigned int nLockTime;
     std::vector<unsigned char> data;
+
+    // memory only, see InvalidateCache
+    mutable uint256 hashCached;
+    mutable uint256 hashAuxCached;
+    mutable CServiceOutputs serviceOutputs;
+
     CTransaction()
     {
         SetNull();
@@ -499,6 +614,8 @@ public:
         READWRITE(nLockTime);
 		if (!(nType & SER_GETAUXHASH))
 			READWRITE(data);
+        if (fRead)
+            const_cast<CTransaction*>(this)->InvalidateCache();
     )
 
     void SetNull()
@@ -508,6 +625,36 @@ public:
         vout.clear();
         nLockTime = 0;
         data.clear();
+        InvalidateCache();
+    }
+
+    /** First output carrying a script of the given service, with its op and arguments.
+        The outputs are decoded once and remembered, see InvalidateCache().
+     */
+    bool GetServiceOutput(servicetype type, int& op, int& nOut, std::vector<std::vector<unsigned char> >& vvch) const
+    {
+        if (!serviceOutputs.fDecoded)
+            serviceOutputs.Decode(vout);
+        if (serviceOutputs.nOut[type] < 0)
+        {
+            vvch.clear();
+            return false;
+        }
+        op = serviceOutputs.op[type];
+        nOut = serviceOutputs.nOut[type];
+        vvch = serviceOutputs.vvch[type];
+        return true;
+    }
+
+    /** The service this transaction belongs to: the first of alias, offer and
+        certificate it has an output of, or SERVICE_NONE.
+     */
+    servicetype GetServiceOutput(int& op, int& nOut, std::vector<std::vector<unsigned char> >& vvch) const
+    {
+        for (int i = 0; i < SERVICE_TYPES; i++)
+            if (GetServiceOutput((servicetype)i, op, nOut, vvch))
+                return (servicetype)i;
+        return SERVICE_NONE;
     }
 
     bool IsNull() const
@@ -515,13 +662,36 @@ public:
         return (vin.empty() && vout.empty());
     }
 
+    /** The hashes, service outputs and anything else derived from the contents
+        of a transaction are computed once and remembered. Code that changes a
+        transaction after it may have been hashed must call InvalidateCache();
+        transactions read from the network or disk start out clean. Building
+        with -DDEBUG_TXHASH checks every cached hash against a fresh one.
+     */
+    void InvalidateCache()
+    {
+        hashCached = 0;
+        hashAuxCached = 0;
+        serviceOutputs.SetNull();
+    }
+
     uint256 GetHash() const
     {
-        return SerializeHash(*this);
+        if (hashCached == 0)
+            hashCached = SerializeHash(*this);
+#ifdef DEBUG_TXHASH
+        assert(hashCached == SerializeHash(*this)); // changed without InvalidateCache
+#endif
+        return hashCached;
     }
 	uint256 GetAuxHash() const
     {
-        return SerializeHash(*this, SER_GETAUXHASH | SER_GETHASH);
+        if (hashAuxCached == 0)
+            hashAuxCached = SerializeHash(*this, SER_GETAUXHASH | SER_GETHASH);
+#ifdef DEBUG_TXHASH
+        assert(hashAuxCached == SerializeHash(*this, SER_GETAUXHASH | SER_GETHASH));
+#endif
+        return hashAuxCached;
     }
 	
     std::string GetBase64Data() const {
@@ -610,6 +780,7 @@ public:
         @return maximum number of sigops required to validate this transaction's inputs
      */
     unsigned int GetP2SHSigOpCount(CCoinsViewCache& mapInputs) const;
+    unsigned int GetP2SHSigOpCount(const CTxInputs& inputs) const;
 
     /** Amount of bitcoins spent by this transaction.
         @return sum of all outputs (note: does not include fees)
@@ -635,6 +806,7 @@ public:
         @return	Sum of value of all inputs (scriptSigs)
      */
     int64 GetValueIn(CCoinsViewCache& mapInputs) const;
+    int64 GetValueIn(const CTxInputs& inputs) const;
 
     static bool AllowFree(double dPriority)
     {
@@ -716,6 +888,18 @@ public:
                      std::map<std::vector<unsigned char>,uint256> &mapTestPool = dummyTestPool,
                      std::vector<CScriptCheck> *pvChecks = NULL, bool bCheckInputs = true,
                      bool fBlock = false, bool fMiner = false) const;
+    // The same, with the inputs already looked up
+    bool CheckInputs(CBlockIndex *pindex, CValidationState &state, const CTxInputs &inputs, bool fScriptChecks,
+                     unsigned int flags, std::map<std::vector<unsigned char>,uint256> &mapTestPool,
+                     std::vector<CScriptCheck> *pvChecks, bool bCheckInputs,
+                     bool fBlock, bool fMiner) const;
+
+    // Check the scripts of all inputs, or push them onto pvChecks if not NULL. Transactions
+    // whose scripts all passed with these flags before are not checked again, and those
+    // checked inline here are remembered unless flags has SCRIPT_VERIFY_NOCACHE; with
+    // SCRIPT_VERIFY_STRICTENC, for the flags without it when no encoding made a difference.
+    bool CheckScripts(CValidationState &state, const CTxInputs &inputs, unsigned int flags,
+                      std::vector<CScriptCheck> *pvChecks) const;
 
     // Apply the effects of this transaction on the UTXO set represented by view
     void UpdateCoins(CValidationState &state, CCoinsViewCache &view, CTxUndo &txundo, int nHeight, const uint256 &txhash) const;
@@ -1130,8 +1314,32 @@ public:
                 return false;
         return true;
     }
+
+    // heap memory held by the outputs and their scripts, in bytes
+    size_t DynamicMemoryUsage() const {
+        size_t nUsage = vout.capacity() * sizeof(CTxOut);
+        BOOST_FOREACH(const CTxOut &out, vout)
+            nUsage += out.scriptPubKey.capacity();
+        return nUsage;
+    }
+};
+
+/** A CCoins held by a CCoinsViewCache, with what the cache knows of it */
+struct CCoinsCacheEntry
+{
+    CCoins coins;
+    unsigned char flags;
+
+    enum Flags {
+        DIRTY = (1 << 0), // differs from the base view
+        FRESH = (1 << 1)  // the base view has no unspent outputs for it
+    };
+
+    CCoinsCacheEntry() : coins(), flags(0) {}
 };
 
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CSaltedHasher> CCoinsMap;
+
 /** Closure representing one script verification
  *  Note that this stores references to the spending transaction */
 class CScriptCheck
@@ -1142,12 +1350,15 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     int nHashType;
+    // shared by the checks of the inputs of one transaction, if it has several
+    boost::shared_ptr<const CSignatureHashCache> pcache;
 
 public:
     CScriptCheck() {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn) :
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, int nHashTypeIn,
+                 const boost::shared_ptr<const CSignatureHashCache>& pcacheIn = boost::shared_ptr<const CSignatureHashCache>()) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn) { }
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), nHashType(nHashTypeIn), pcache(pcacheIn) { }
 
     bool operator()() const;
 
@@ -1157,6 +1368,7 @@ public:
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(nHashType, check.nHashType);
+        pcache.swap(check.pcache);
     }
 };
 
@@ -1380,6 +1592,9 @@ public:
         scrypt_1024_1_1_256(BEGIN(nVersion), BEGIN(thash));
         return thash;
     }
+
+    // GetPoWHash of many headers, hashed together on the SIMD lanes of the CPU
+    static void GetPoWHashes(const std::vector<const CBlockHeader*> &vHeaders, std::vector<uint256> &vHashes);
 	
     void SetAuxPow(CAuxPow* pow);
 
@@ -1408,7 +1623,10 @@ public:
 		return (int64)nTime;
     }
 
-    bool CheckProofOfWork(int nHeight) const;
+    // phashPoW is this header's GetPoWHash if the caller already has it
+    bool CheckProofOfWork(int nHeight, const uint256 *phashPoW = NULL) const;
+    // CheckProofOfWork of many headers, with the scrypt hashes computed in one batch
+    static void CheckProofOfWork(const std::vector<const CBlockHeader*> &vHeaders, const std::vector<int> &vHeights, std::vector<bool> &vValid);
 
     void UpdateTime(const CBlockIndex* pindexPrev);
 };
@@ -1692,7 +1910,9 @@ enum BlockStatus {
 
     BLOCK_FAILED_VALID       =   32, // stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, // descends from failed block
-    BLOCK_FAILED_MASK        =   96
+    BLOCK_FAILED_MASK        =   96,
+
+    BLOCK_HAVE_AUXPOW        =  128, // AuxPoW available in blocks/auxpow.dat
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -1726,6 +1946,9 @@ public:
     // Byte offset within rev?????.dat where this block's undo data is stored
     unsigned int nUndoPos;
 
+    // Byte offset within blocks/auxpow.dat where this block's AuxPoW is stored
+    uint64 nAuxPowPos;
+
     // (memory only) Total amount of work (expected number of hashes) in the chain up to and including this block
     uint256 nChainWork;
 
@@ -1756,6 +1979,7 @@ public:
         nFile = 0;
         nDataPos = 0;
         nUndoPos = 0;
+        nAuxPowPos = 0;
         nChainWork = 0;
         nTx = 0;
         nChainTx = 0;
@@ -1777,6 +2001,7 @@ public:
         nFile = 0;
         nDataPos = 0;
         nUndoPos = 0;
+        nAuxPowPos = 0;
         nChainWork = 0;
         nTx = 0;
         nChainTx = 0;
@@ -1803,6 +2028,8 @@ public:
             READWRITE(VARINT(nDataPos));
         if (nStatus & BLOCK_HAVE_UNDO)
             READWRITE(VARINT(nUndoPos));
+        if (nStatus & BLOCK_HAVE_AUXPOW)
+            READWRITE(VARINT(nAuxPowPos));
     )
 
     CDiskBlockPos GetBlockPos() const {
@@ -1844,10 +2071,7 @@ public:
         return (CBigNum(1)<<256) / (bnTarget+1);
     }
 
-    bool IsInMainChain() const
-    {
-        return (pnext || this == pindexBest);
-    }
+    bool IsInMainChain() const;
 
     bool CheckIndex() const
     {
@@ -1907,6 +2131,51 @@ public:
     }
 };
 
+/** The active chain as a vector indexed by height, kept along with the
+ *  pnext links by SetBestChain, so height lookups and main chain checks
+ *  take no pointer walks. */
+class CChain {
+private:
+    std::vector<CBlockIndex*> vChain;
+
+public:
+    CBlockIndex *Genesis() const {
+        return vChain.empty() ? NULL : vChain[0];
+    }
+
+    CBlockIndex *Tip() const {
+        return vChain.empty() ? NULL : vChain.back();
+    }
+
+    // the block at nHeight, NULL past either end
+    CBlockIndex *operator[](int nHeight) const {
+        if (nHeight < 0 || nHeight >= (int)vChain.size())
+            return NULL;
+        return vChain[nHeight];
+    }
+
+    bool Contains(const CBlockIndex *pindex) const {
+        return (*this)[pindex->nHeight] == pindex;
+    }
+
+    // successor of pindex, NULL if it is not in the chain or is the tip
+    CBlockIndex *Next(const CBlockIndex *pindex) const {
+        if (!Contains(pindex))
+            return NULL;
+        return (*this)[pindex->nHeight + 1];
+    }
+
+    int Height() const {
+        return vChain.size() - 1;
+    }
+
+    // make pindex the tip, NULL to clear; only the entries past the fork
+    // with the current chain are rewritten
+    void SetTip(CBlockIndex *pindex);
+};
+
+extern CChain chainActive;
+
 struct CBlockIndexWorkComparator
 {
     bool operator()(CBlockIndex *pa, CBlockIndex *pb) {
@@ -2071,7 +2340,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -2106,9 +2375,14 @@ public:
         {
             vHave.push_back(pindex->GetBlockHash());
 
-            // Exponentially larger steps back
-            for (int i = 0; pindex && i < nStep; i++)
-                pindex = pindex->pprev;
+            // Exponentially larger steps back, a jump once in the active chain
+            if (pindex->nHeight < nStep)
+                pindex = NULL;
+            else if (chainActive.Contains(pindex))
+                pindex = chainActive[pindex->nHeight - nStep];
+            else
+                for (int i = 0; pindex && i < nStep; i++)
+                    pindex = pindex->pprev;
             if (vHave.size() > 10)
                 nStep *= 2;
         }
@@ -2122,7 +2396,7 @@ public:
         int nStep = 1;
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -2141,7 +2415,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -2157,7 +2431,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            BlockMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -2251,8 +2525,9 @@ public:
     // Modify the currently active block index
     virtual bool SetBestBlock(CBlockIndex *pindex);
 
-    // Do a bulk modification (multiple SetCoins + one SetBestBlock)
-    virtual bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    // Do a bulk modification (multiple SetCoins + one SetBestBlock) with the
+    // DIRTY entries of mapCoins, which the caller clears afterwards
+    virtual bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex);
 
     // Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats);
@@ -2275,19 +2550,26 @@ public:
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
     void SetBackend(CCoinsView &viewIn);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex);
     bool GetStats(CCoinsStats &stats);
 };
 
+class CCoinsModifier;
+
 /** CCoinsView that adds a memory cache for transactions to another CCoinsView */
 class CCoinsViewCache : public CCoinsViewBacked
 {
 protected:
     CBlockIndex *pindexTip;
-    std::map<uint256,CCoins> cacheCoins;
+    CCoinsMap cacheCoins;
+    // heap memory held by the CCoins in cacheCoins
+    size_t cachedCoinsUsage;
+    // whether a CCoinsModifier is alive; only one may be at a time
+    bool fHasModifier;
 
 public:
     CCoinsViewCache(CCoinsView &baseIn, bool fDummy = false);
+    ~CCoinsViewCache();
 
     // Standard CCoinsView methods
     bool GetCoins(const uint256 &txid, CCoins &coins);
@@ -2295,12 +2577,29 @@ public:
     bool HaveCoins(const uint256 &txid);
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex);
+
+    // Return a pointer to the CCoins of txid in the cache, or NULL if there
+    // are none. The pointer stays valid until the entry is modified or the
+    // cache is flushed.
+    const CCoins *AccessCoins(const uint256 &txid);
+
+    // Return a reference to the CCoins of txid. Check HaveCoins first.
+    const CCoins &GetCoins(const uint256 &txid);
+
+    // Return a modifiable CCoins for txid, empty if there is none. Changes
+    // are accounted for when the CCoinsModifier goes out of scope.
+    CCoinsModifier ModifyCoins(const uint256 &txid);
 
-    // Return a modifiable reference to a CCoins. Check HaveCoins first.
-    // Many methods explicitly require a CCoinsViewCache because of this method, to reduce
-    // copying.
-    CCoins &GetCoins(const uint256 &txid);
+    // As ModifyCoins, for a txid the caller knows has no unspent outputs in
+    // the base view (BIP30 is checked), so the base is not looked up.
+    CCoinsModifier ModifyNewCoins(const uint256 &txid);
+
+    // Read the coins of the txids in vTxid that are not cached yet from the
+    // base view, several at once on the coins fetch threads. The base must
+    // allow concurrent GetCoins calls, as CCoinsViewDB does. Returns the
+    // number of txids looked up.
+    unsigned int PrefetchCoins(const std::vector<uint256> &vTxid);
 
     // Push the modifications applied to this cache to its base.
     // Failure to call this method before destruction will cause the changes to be forgotten.
@@ -2309,8 +2608,86 @@ public:
     // Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize();
 
+    // Calculate the heap memory used by the cache, in bytes
+    size_t DynamicMemoryUsage() const;
+
+private:
+    CCoinsMap::iterator FetchCoins(const uint256 &txid);
+    CCoinsMap::iterator InsertFetchedCoins(const uint256 &txid, CCoins &coins);
+
+    CCoinsViewCache(const CCoinsViewCache&);
+    void operator=(const CCoinsViewCache&);
+
+    friend class CCoinsModifier;
+};
+
+/** A modifiable CCoins in a CCoinsViewCache, from ModifyCoins. When it goes
+ *  out of scope the cache updates its memory usage, and drops the entry if
+ *  it was created in the cache and is spent again. */
+class CCoinsModifier
+{
+private:
+    CCoinsViewCache &cache;
+    CCoinsMap::iterator it;
+    size_t nUsageBefore;
+
+    CCoinsModifier(CCoinsViewCache &cacheIn, CCoinsMap::iterator itIn, size_t nUsageBeforeIn);
+
+public:
+    CCoins* operator->() { return &it->second.coins; }
+    CCoins& operator*() { return it->second.coins; }
+    ~CCoinsModifier();
+
+    friend class CCoinsViewCache;
+};
+
+/** The outputs spent by the inputs of a transaction, looked up in a view once
+ *  and then shared by the checks of the transaction, down to the service
+ *  input checks. It points into the view, so it may only be used until the
+ *  view is modified.
+ */
+class CTxInputs
+{
+public:
+    const CTransaction &tx;
+    // whether every input spends an available output; if not, the lookup
+    // stopped at the first that does not
+    bool fHaveInputs;
+    // the coins of the transaction each input spends from
+    std::vector<const CCoins*> vpCoins;
+    // the height the transaction is spent at, one past the view's best block
+    int nSpendHeight;
+    // per service, the first input spending an output of it, or -1, with
+    // the op and arguments of that output's script
+    int nServiceIn[SERVICE_TYPES];
+    int serviceOp[SERVICE_TYPES];
+    std::vector<std::vector<unsigned char> > serviceArgs[SERVICE_TYPES];
+
+    CTxInputs(const CTransaction &txIn, CCoinsViewCache &view);
+
+    const CCoins &GetCoins(unsigned int nIn) const
+    {
+        return *vpCoins[nIn];
+    }
+
+    const CTxOut &GetOutput(unsigned int nIn) const
+    {
+        return vpCoins[nIn]->vout[tx.vin[nIn].prevout.n];
+    }
+
+    bool GetServiceInput(servicetype type, int &nIn, int &op, std::vector<std::vector<unsigned char> > &vvch) const
+    {
+        if (nServiceIn[type] < 0)
+            return false;
+        nIn = nServiceIn[type];
+        op = serviceOp[type];
+        vvch = serviceArgs[type];
+        return true;
+    }
+
 private:
-    std::map<uint256,CCoins>::iterator FetchCoins(const uint256 &txid);
+    CTxInputs(const CTxInputs&);
+    void operator=(const CTxInputs&);
 };
 
 /** CCoinsView that brings transactions from a memorypool into view.
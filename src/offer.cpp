@@ -9,6 +9,7 @@
 #include "json/json_spirit_reader_template.h"
 #include "json/json_spirit_writer_template.h"
 
+#include <boost/scoped_ptr.hpp>
 #include <boost/xpressive/xpressive_dynamic.hpp>
 
 using namespace std;
@@ -20,7 +21,7 @@ std::map<std::vector<unsigned char>, uint256> mapMyOffers;
 std::map<std::vector<unsigned char>, uint256> mapMyOfferAccepts;
 std::map<std::vector<unsigned char>, std::set<uint256> > mapOfferPending;
 std::map<std::vector<unsigned char>, std::set<uint256> > mapOfferAcceptPending;
-std::list<COfferFee> lstOfferFees;
+CFeeRegenWindow offerFeeWindow("offerfee", 360 * 12, false, false);
 
 #ifdef GUI
 extern std::map<uint160, std::vector<unsigned char> > mapMyOfferHashes;
@@ -39,9 +40,6 @@ bool DecodeOfferScript(const CScript& script, int& op,
 extern bool Solver(const CKeyStore& keystore, const CScript& scriptPubKey,
 		uint256 hash, int nHashType, CScript& scriptSigRet,
 		txnouttype& whichTypeRet);
-extern bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey,
-		const CTransaction& txTo, unsigned int nIn, unsigned int flags,
-		int nHashType);
 
 bool IsOfferOp(int op) {
 	return op == OP_OFFER_NEW
@@ -138,6 +136,7 @@ bool COffer::UnserializeFromTx(const CTransaction &tx) {
 void COffer::SerializeToTx(CTransaction &tx) {
 	vector<unsigned char> vchData = vchFromString(SerializeToString());
 	tx.data = vchData;
+	tx.InvalidateCache();
 }
 
 string COffer::SerializeToString() {
@@ -148,13 +147,424 @@ string COffer::SerializeToString() {
 	return EncodeBase64(vchData.data(), vchData.size());
 }
 
-//TODO implement
+void GetOfferTitleWords(const vector<unsigned char> &vchTitle, set<vector<unsigned char> > &setWords) {
+	setWords.clear();
+	vector<unsigned char> vchWord;
+	for (unsigned int i = 0; i <= vchTitle.size(); i++) {
+		unsigned char ch = i < vchTitle.size() ? vchTitle[i] : ' ';
+		// bytes of multibyte UTF-8 characters count as letters
+		if ((ch >= 'a' && ch <= 'z') || (ch >= '0' && ch <= '9') || ch >= 0x80) {
+			if (vchWord.size() < MAX_OFFER_TITLE_WORD_LENGTH)
+				vchWord.push_back(ch);
+			continue;
+		}
+		if (ch >= 'A' && ch <= 'Z') {
+			if (vchWord.size() < MAX_OFFER_TITLE_WORD_LENGTH)
+				vchWord.push_back(ch - 'A' + 'a');
+			continue;
+		}
+		if (!vchWord.empty()) {
+			setWords.insert(vchWord);
+			if (setWords.size() >= MAX_OFFER_TITLE_WORDS)
+				return;
+			vchWord.clear();
+		}
+	}
+}
+
+void COfferDB::WriteOfferIndexes(CLevelDBBatch &batch, const vector<unsigned char>& name, const COffer &offer, bool fErase) {
+	CBigEndianKey64 price(offer.nPrice);
+	set<vector<unsigned char> > setWords;
+	GetOfferTitleWords(offer.sTitle, setWords);
+	if (fErase) {
+		batch.Erase(make_pair(string("offerp"), make_pair(price, name)));
+		batch.Erase(make_pair(string("offercp"), make_pair(CLexicalKey(offer.sCategory), make_pair(price, name))));
+		BOOST_FOREACH(const vector<unsigned char> &vchWord, setWords)
+			batch.Erase(make_pair(string("offert"), make_pair(CLexicalKey(vchWord), name)));
+	} else {
+		batch.Write(make_pair(string("offerp"), make_pair(price, name)), string());
+		batch.Write(make_pair(string("offercp"), make_pair(CLexicalKey(offer.sCategory), make_pair(price, name))), string());
+		BOOST_FOREACH(const vector<unsigned char> &vchWord, setWords)
+			batch.Write(make_pair(string("offert"), make_pair(CLexicalKey(vchWord), name)), string());
+	}
+}
+
+bool COfferDB::WriteOfferHead(CLevelDBBatch &batch, const vector<unsigned char>& name, const COfferHead *pHead) {
+	COfferHead headOld;
+	bool fOld = ReadOfferHead(name, headOld);
+	// accepts and payments leave the indexed fields alone
+	if (!fOld || !pHead || headOld.offer.sCategory != pHead->offer.sCategory
+			|| headOld.offer.sTitle != pHead->offer.sTitle || headOld.offer.nPrice != pHead->offer.nPrice) {
+		if (fOld)
+			WriteOfferIndexes(batch, name, headOld.offer, true);
+		if (pHead)
+			WriteOfferIndexes(batch, name, pHead->offer, false);
+	}
+	if (pHead)
+		batch.Write(make_pair(string("offerh"), name), *pHead);
+	else
+		batch.Erase(make_pair(string("offerh"), name));
+	return UpdateExpiry(name, pHead ? pHead->offer.nHeight + GetOfferDisplayExpirationDepth(pHead->offer.nHeight) : -1);
+}
+
+int COfferDB::GetHeadExpiry(const string &strValue) {
+	COfferHead head;
+	try {
+		CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+		ssValue >> head;
+	} catch (std::exception &e) {
+		return -1;
+	}
+	return head.offer.nHeight + GetOfferDisplayExpirationDepth(head.offer.nHeight);
+}
+
+void COfferDB::HeadArchived(const vector<unsigned char> &vchName) {
+	COfferHead head;
+	if (!Read(make_pair(string("offerh"), vchName), head))
+		return;
+	CLevelDBBatch batch;
+	WriteOfferIndexes(batch, vchName, head.offer, true);
+	WriteBatch(batch);
+}
+
+bool COfferDB::WriteOfferVersion(const vector<unsigned char>& name, const COfferHead& head) {
+	COfferHead headNew = head;
+	unsigned int nSeq = headNew.nSeq++;
+	CLevelDBBatch batch;
+	batch.Write(make_pair(string("offerv"), make_pair(name, make_pair(CBigEndianKey(head.offer.nHeight), CBigEndianKey(nSeq)))), head.offer);
+	WriteOfferHead(batch, name, &headNew);
+	return WriteBatch(batch);
+}
+
+bool COfferDB::WriteOfferAcceptEvent(const vector<unsigned char>& name, const COfferAccept& accept,
+		const COfferHead& head) {
+	COfferHead headNew = head;
+	unsigned int nSeq = headNew.nSeq++;
+	CLevelDBBatch batch;
+	// an offerpay replaces the accept and keeps its position
+	if (!Exists(make_pair(string("offerc"), make_pair(name, accept.vchRand))))
+		batch.Write(make_pair(string("offero"), make_pair(name, CBigEndianKey(nSeq))), accept.vchRand);
+	batch.Write(make_pair(string("offerc"), make_pair(name, accept.vchRand)), accept);
+	batch.Write(make_pair(string("offera"), accept.vchRand), name);
+	WriteOfferHead(batch, name, &headNew);
+	return WriteBatch(batch);
+}
+
+bool COfferDB::DisconnectOfferVersion(const vector<unsigned char>& name, unsigned int nHeight) {
+	COfferHead head;
+	if (!ReadOfferHead(name, head))
+		return error("%s() : offer %s not found", __PRETTY_FUNCTION__, stringFromVch(name).c_str());
+
+	vector<COffer> vtxPos;
+	vector<unsigned int> vSeq;
+	if (!ReadOfferVersions(name, vtxPos, &vSeq))
+		return false;
+	if (head.nSeq == 0 || vtxPos.empty() || vSeq.back() != head.nSeq - 1 || vtxPos.back().nHeight != nHeight)
+		return error("%s() : offer %s has no version at %u to disconnect", __PRETTY_FUNCTION__,
+				stringFromVch(name).c_str(), nHeight);
+
+	CLevelDBBatch batch;
+	batch.Erase(make_pair(string("offerv"), make_pair(name, make_pair(CBigEndianKey(nHeight), CBigEndianKey(vSeq.back())))));
+	vtxPos.pop_back();
+	if (vtxPos.empty())
+		WriteOfferHead(batch, name, NULL);
+	else {
+		head.offer = vtxPos.back();
+		head.nSeq--;
+		WriteOfferHead(batch, name, &head);
+	}
+	return WriteBatch(batch);
+}
+
+bool COfferDB::DisconnectOfferAcceptEvent(const vector<unsigned char>& name, const COfferAccept& txAccept,
+		const uint256& txHash, bool fPay) {
+	COfferHead head;
+	if (!ReadOfferHead(name, head))
+		return error("%s() : offer %s not found", __PRETTY_FUNCTION__, stringFromVch(name).c_str());
+
+	COfferAccept accept;
+	if (!ReadOfferAcceptEvent(name, txAccept.vchRand, accept))
+		return error("%s() : accept %s of offer %s not found", __PRETTY_FUNCTION__,
+				HexStr(txAccept.vchRand).c_str(), stringFromVch(name).c_str());
+	if (accept.txHash != txHash)
+		return error("%s() : accept %s was last written by %s, not by %s", __PRETTY_FUNCTION__,
+				HexStr(txAccept.vchRand).c_str(), accept.txHash.ToString().c_str(), txHash.ToString().c_str());
+	if (head.nSeq == 0)
+		return error("%s() : offer %s has no txn to disconnect", __PRETTY_FUNCTION__, stringFromVch(name).c_str());
+	head.nSeq--;
+
+	// the head points at the last txn that touched the offer; if that
+	// was this one, fall back to the current version's txn
+	if (head.offer.txHash == txHash) {
+		vector<COffer> vtxPos;
+		if (ReadOfferVersions(name, vtxPos) && !vtxPos.empty()) {
+			head.offer.txHash = vtxPos.back().txHash;
+			head.offer.nTime = vtxPos.back().nTime;
+		}
+	}
+
+	CLevelDBBatch batch;
+	if (fPay) {
+		// the offerpay txn carries the accept as it was before payment
+		head.nQtyAccepted += txAccept.nQty - accept.nQty;
+		accept.txHash = txAccept.txHash;
+		accept.nHeight = txAccept.nHeight;
+		accept.nTime = txAccept.nTime;
+		accept.nQty = txAccept.nQty;
+		accept.bPaid = false;
+		accept.txPayId = 0;
+		batch.Write(make_pair(string("offerc"), make_pair(name, accept.vchRand)), accept);
+	} else {
+		// the accept was the offer's last txn, so it holds the last position
+		vector<unsigned char> vchAccept;
+		if (!Read(make_pair(string("offero"), make_pair(name, CBigEndianKey(head.nSeq))), vchAccept)
+				|| vchAccept != accept.vchRand)
+			return error("%s() : accept %s is not the last txn of offer %s", __PRETTY_FUNCTION__,
+					HexStr(txAccept.vchRand).c_str(), stringFromVch(name).c_str());
+		head.nQtyAccepted -= accept.nQty;
+		batch.Erase(make_pair(string("offero"), make_pair(name, CBigEndianKey(head.nSeq))));
+		batch.Erase(make_pair(string("offerc"), make_pair(name, accept.vchRand)));
+		batch.Erase(make_pair(string("offera"), accept.vchRand));
+	}
+	WriteOfferHead(batch, name, &head);
+	return WriteBatch(batch);
+}
+
+bool COfferDB::ReadOfferVersions(const vector<unsigned char>& name, vector<COffer>& vtxPos,
+		vector<unsigned int> *pvSeq) {
+	boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+	CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+	ssKeySet << make_pair(string("offerv"), make_pair(name, make_pair(CBigEndianKey(0), CBigEndianKey(0))));
+	pcursor->Seek(ssKeySet.str());
+
+	vtxPos.clear();
+	if (pvSeq)
+		pvSeq->clear();
+	for (; pcursor->Valid(); pcursor->Next()) {
+		try {
+			leveldb::Slice slKey = pcursor->key();
+			CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+			string sType;
+			vector<unsigned char> vchName;
+			ssKey >> sType;
+			if (sType != "offerv")
+				break;
+			ssKey >> vchName;
+			if (vchName != name)
+				break;
+			CBigEndianKey height, seq;
+			ssKey >> height >> seq;
+
+			leveldb::Slice slValue = pcursor->value();
+			CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+			COffer offer;
+			ssValue >> offer;
+			vtxPos.push_back(offer);
+			if (pvSeq)
+				pvSeq->push_back(seq.n);
+		} catch (std::exception &e) {
+			return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+		}
+	}
+	return true;
+}
+
+bool COfferDB::ReadOfferAccepts(const vector<unsigned char>& name, vector<COfferAccept>& vAccepts,
+		vector<unsigned int> *pvSeq) {
+	vector<vector<unsigned char> > vvchAccept;
+	vector<unsigned int> vSeq;
+	{
+		boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+		CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+		ssKeySet << make_pair(string("offero"), make_pair(name, CBigEndianKey(0)));
+		pcursor->Seek(ssKeySet.str());
+
+		for (; pcursor->Valid(); pcursor->Next()) {
+			try {
+				leveldb::Slice slKey = pcursor->key();
+				CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+				string sType;
+				vector<unsigned char> vchName;
+				ssKey >> sType;
+				if (sType != "offero")
+					break;
+				ssKey >> vchName;
+				if (vchName != name)
+					break;
+				CBigEndianKey seq;
+				ssKey >> seq;
+
+				leveldb::Slice slValue = pcursor->value();
+				CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+				vector<unsigned char> vchAccept;
+				ssValue >> vchAccept;
+				vvchAccept.push_back(vchAccept);
+				vSeq.push_back(seq.n);
+			} catch (std::exception &e) {
+				return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+			}
+		}
+	}
+
+	// the iterator must be gone before reads fill the cache
+	vAccepts.clear();
+	for (unsigned int i = 0; i < vvchAccept.size(); i++) {
+		COfferAccept accept;
+		if (!ReadOfferAcceptEvent(name, vvchAccept[i], accept))
+			return error("%s() : accept %s of offer %s not found", __PRETTY_FUNCTION__,
+					HexStr(vvchAccept[i]).c_str(), stringFromVch(name).c_str());
+		vAccepts.push_back(accept);
+	}
+	if (pvSeq)
+		pvSeq->swap(vSeq);
+	return true;
+}
+
+bool COfferDB::ReadOffer(const vector<unsigned char>& name, vector<COffer>& vtxPos) {
+	LOCK(cs_cache);
+	if (cacheOffers.Get(name, vtxPos))
+		return true;
+	COfferHead head;
+	if (!ReadOfferHead(name, head))
+		return false;
+	vector<COfferAccept> vAccepts;
+	vector<unsigned int> vVersionSeq, vAcceptSeq;
+	if (!ReadOfferVersions(name, vtxPos, &vVersionSeq) || !ReadOfferAccepts(name, vAccepts, &vAcceptSeq))
+		return false;
+
+	// the head is the current version, updated with the last txn touching the offer
+	if (vtxPos.empty() || vtxPos.back().nHeight != head.offer.nHeight) {
+		vtxPos.push_back(head.offer);
+		vVersionSeq.push_back(head.nSeq);
+	}
+	else
+		vtxPos.back() = head.offer;
+
+	// each version carries the accepts made before the next one
+	for (unsigned int i = 0; i < vtxPos.size(); i++) {
+		vtxPos[i].accepts.clear();
+		for (unsigned int j = 0; j < vAccepts.size(); j++) {
+			if (i + 1 < vtxPos.size() && vAcceptSeq[j] >= vVersionSeq[i + 1])
+				break;
+			vtxPos[i].accepts.push_back(vAccepts[j]);
+		}
+	}
+	cacheOffers.Put(name, vtxPos);
+	return true;
+}
+
+bool COfferDB::CheckVersion() {
+	int nVersion = 0;
+	// older layouts lack the chain positions of versions and accepts
+	if (Read(make_pair(string("offera"), string("offerdbv")), nVersion))
+		return nVersion == OFFER_DB_VERSION;
+
+	// no version record: either an empty DB or the old one-key-per-offer layout
+	boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+	CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+	ssKeySet << make_pair(string("offeri"), vector<unsigned char>());
+	pcursor->Seek(ssKeySet.str());
+	if (pcursor->Valid()) {
+		leveldb::Slice slKey = pcursor->key();
+		CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+		string sType;
+		try {
+			ssKey >> sType;
+		} catch (std::exception &e) {
+			return false;
+		}
+		if (sType == "offeri")
+			return false;
+	}
+	return Write(make_pair(string("offera"), string("offerdbv")), OFFER_DB_VERSION);
+}
+
+bool COfferDB::QueryOffers(const COfferQuery& query, unsigned int nMax, string& strCursor,
+		vector<pair<vector<unsigned char>, COfferHead> >& vResults) {
+	// drive the scan by the narrowest index the query can use: a title
+	// word prefix, else the category's price range, else the price range
+	CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+	CDataStream ssStart(SER_DISK, CLIENT_VERSION);
+	int nIndex;
+	if (!query.vchTitleWord.empty()) {
+		nIndex = 0;
+		ssPrefix << string("offert") << CLexicalKey(query.vchTitleWord, true);
+		ssStart << string("offert") << CLexicalKey(query.vchTitleWord, true);
+	} else if (!query.vchCategory.empty()) {
+		nIndex = 1;
+		ssPrefix << string("offercp") << CLexicalKey(query.vchCategory);
+		ssStart << string("offercp") << CLexicalKey(query.vchCategory) << CBigEndianKey64(query.nMinPrice);
+	} else {
+		nIndex = 2;
+		ssPrefix << string("offerp");
+		ssStart << string("offerp") << CBigEndianKey64(query.nMinPrice);
+	}
+	string strPrefix = ssPrefix.str();
+	string strStart = strCursor.empty() ? ssStart.str() : strCursor;
+	if (strStart.compare(0, strPrefix.size(), strPrefix) != 0)
+		return error("QueryOffers() : cursor is not one of this query");
+
+	boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+	pcursor->Seek(strStart);
+	// the cursor is the last key of the previous page
+	if (!strCursor.empty() && pcursor->Valid() && pcursor->key() == strCursor)
+		pcursor->Next();
+	strCursor.clear();
+
+	for (; pcursor->Valid(); pcursor->Next()) {
+		boost::this_thread::interruption_point();
+		leveldb::Slice slKey = pcursor->key();
+		if (!slKey.starts_with(strPrefix))
+			break;
+
+		vector<unsigned char> vchOffer;
+		try {
+			CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+			string sType;
+			CLexicalKey word, category;
+			CBigEndianKey64 price;
+			ssKey >> sType;
+			if (nIndex == 0)
+				ssKey >> word;
+			else if (nIndex == 1)
+				ssKey >> category;
+			if (nIndex != 0) {
+				ssKey >> price;
+				if (price.n > query.nMaxPrice)
+					break;
+			}
+			ssKey >> vchOffer;
+		} catch (std::exception &e) {
+			return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+		}
+
+		COfferHead head;
+		if (!ReadOfferHead(vchOffer, head))
+			return error("QueryOffers() : index entry without offer %s", stringFromVch(vchOffer).c_str());
+		if (nIndex == 0) {
+			if (head.offer.nPrice < query.nMinPrice || head.offer.nPrice > query.nMaxPrice)
+				continue;
+			if (!query.vchCategory.empty() && head.offer.sCategory != query.vchCategory)
+				continue;
+		}
+
+		vResults.push_back(make_pair(vchOffer, head));
+		if (vResults.size() >= nMax) {
+			strCursor = slKey.ToString();
+			break;
+		}
+	}
+	return true;
+}
+
 bool COfferDB::ScanOffers(const std::vector<unsigned char>& vchOffer, unsigned int nMax,
 		std::vector<std::pair<std::vector<unsigned char>, COffer> >& offerScan) {
     leveldb::Iterator *pcursor = pofferdb->NewIterator();
 
     CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << make_pair(string("offeri"), vchOffer);
+    ssKeySet << make_pair(string("offerh"), vchOffer);
     string sType;
     pcursor->Seek(ssKeySet.str());
 
@@ -165,18 +575,16 @@ bool COfferDB::ScanOffers(const std::vector<unsigned char>& vchOffer, unsigned i
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
 
             ssKey >> sType;
-            if(sType == "offeri") {
+            if(sType == "offerh") {
             	vector<unsigned char> vchOffer;
                 ssKey >> vchOffer;
                 leveldb::Slice slValue = pcursor->value();
                 CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                vector<COffer> vtxPos;
-                ssValue >> vtxPos;
-                COffer txPos;
-                if (!vtxPos.empty())
-                    txPos = vtxPos.back();
-                offerScan.push_back(make_pair(vchOffer, txPos));
-            }
+                COfferHead head;
+                ssValue >> head;
+                offerScan.push_back(make_pair(vchOffer, head.offer));
+            } else
+                break;
             if (offerScan.size() >= nMax)
                 break;
 
@@ -189,133 +597,93 @@ bool COfferDB::ScanOffers(const std::vector<unsigned char>& vchOffer, unsigned i
     return true;
 }
 
-/**
- * [COfferDB::ReconstructOfferIndex description]
- * @param  pindexRescan [description]
- * @return              [description]
- */
-bool COfferDB::ReconstructOfferIndex(CBlockIndex *pindexRescan) {
-    CBlockIndex* pindex = pindexRescan;
-    
-    {
-	TRY_LOCK(pwalletMain->cs_wallet, cs_trylock);
+bool COfferDB::ReconstructOfferBlock(const CBlock &block, CBlockIndex *pindex) {
+    int nHeight = pindex->nHeight;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
 
-	uint64 startHeight = pindexRescan->nHeight;
-	while(pindex->pnext != NULL) pindex = pindex->pnext;
-	uint64 endHeight = pindex->nHeight;
+        if (tx.nVersion != SYSCOIN_TX_VERSION)
+            continue;
 
-	BOOST_FOREACH(COfferFee &oFee, lstOfferFees) {
-		if (oFee.nHeight >= startHeight && oFee.nHeight < endHeight) {
-			oFee.nFee = 0;
-			break;
-		}
-	}
+        vector<vector<unsigned char> > vvchArgs;
+        int op, nOut;
 
-    CBlockIndex* pindex = pindexRescan;
-    while (pindex) {  
+        // decode the offer op, params, height
+        bool o = DecodeOfferTx(tx, op, nOut, vvchArgs, nHeight);
+        if (!o || !IsOfferOp(op)) continue;
 
-        int nHeight = pindex->nHeight;
-        CBlock block;
-        block.ReadFromDisk(pindex);
-        uint256 txblkhash;
-        
-        BOOST_FOREACH(CTransaction& tx, block.vtx) {
+        if (op == OP_OFFER_NEW) continue;
 
-            if (tx.nVersion != SYSCOIN_TX_VERSION)
-                continue;
-
-            vector<vector<unsigned char> > vvchArgs;
-            int op, nOut;
+        vector<unsigned char> vchOffer = vvchArgs[0];
 
-            // decode the offer op, params, height
-            bool o = DecodeOfferTx(tx, op, nOut, vvchArgs, nHeight);
-            if (!o || !IsOfferOp(op)) continue;
-            
-            if (op == OP_OFFER_NEW) continue;
+        // attempt to read offer from txn
+        COffer txOffer;
+        COfferAccept txCA;
+        if(!txOffer.UnserializeFromTx(tx))
+			return error("ReconstructOfferBlock() : failed to unserialize offer from txn");
 
-            vector<unsigned char> vchOffer = vvchArgs[0];
-        
-            // get the transaction
-            if(!GetTransaction(tx.GetHash(), tx, txblkhash, true))
-                continue;
+		// save serialized offer
+		COffer serializedOffer = txOffer;
 
-            // attempt to read offer from txn
-            COffer txOffer;
-            COfferAccept txCA;
-            if(!txOffer.UnserializeFromTx(tx))
-				return error("ReconstructOfferIndex() : failed to unserialize offer from tx");
-
-			// save serialized offer
-			COffer serializedOffer = txOffer;
-
-            // read offer from DB if it exists
-            vector<COffer> vtxPos;
-            if (ExistsOffer(vchOffer)) {
-                if (!ReadOffer(vchOffer, vtxPos))
-                    return error("ReconstructOfferIndex() : failed to read offer from DB");
-                if(vtxPos.size()!=0) {
-                	txOffer.nHeight = nHeight;
-                	txOffer.GetOfferFromList(vtxPos);
-                }
-            }
-
-            // read the offer accept from db if exists
-            if(op == OP_OFFER_ACCEPT || op == OP_OFFER_PAY) {
-            	bool bReadOffer = false;
-            	vector<unsigned char> vchOfferAccept = vvchArgs[1];
-	            if (ExistsOfferAccept(vchOfferAccept)) {
-	                if (!ReadOfferAccept(vchOfferAccept, vchOffer))
-	                    printf("ReconstructOfferIndex() : warning - failed to read offer accept from offer DB\n");
-	                else bReadOffer = true;
-	            }
-				if(!bReadOffer && !txOffer.GetAcceptByHash(vchOfferAccept, txCA))
-					printf("ReconstructOfferIndex() : failed to read offer accept from offer\n");
-
-				// add txn-specific values to offer accept object
-                txCA.vchRand = vvchArgs[1];
-		        txCA.nTime = pindex->nTime;
-		        txCA.txHash = tx.GetHash();
-		        txCA.nHeight = nHeight;
-				txOffer.PutOfferAccept(txCA);
-			}
-
-			// use the txn offer as master on updates,
-			// but grab the accepts from the DB first
-			if(op == OP_OFFER_UPDATE) {
-				serializedOffer.accepts = txOffer.accepts;
-				txOffer = serializedOffer;
-			}
+        // read offer head from DB if it exists
+        COfferHead offerHead;
+        if (ExistsOffer(vchOffer)) {
+            if (!ReadOfferHead(vchOffer, offerHead))
+                return error("ReconstructOfferBlock() : failed to read offer from DB");
+            txOffer = offerHead.offer;
+        }
 
-			// txn-specific values to offer object
-            txOffer.vchRand = vvchArgs[0];
-			txOffer.txHash = tx.GetHash();
+		// use the txn offer as master on updates
+		if(op == OP_OFFER_UPDATE)
+			txOffer = serializedOffer;
+		txOffer.accepts.clear();
+
+		// txn-specific values to offer object
+        txOffer.vchRand = vvchArgs[0];
+		txOffer.txHash = tx.GetHash();
+        txOffer.nTime = pindex->nTime;
+
+        if(op == OP_OFFER_ACCEPT || op == OP_OFFER_PAY) {
+        	vector<unsigned char> vchOfferAccept = vvchArgs[1];
+			if(!serializedOffer.GetAcceptByHash(vchOfferAccept, txCA))
+				printf("ReconstructOfferBlock() : failed to read offer accept from offer\n");
+
+			// replace any earlier state of this accept
+			COfferAccept prevCA;
+			if (ReadOfferAcceptEvent(vchOffer, vchOfferAccept, prevCA))
+				offerHead.nQtyAccepted -= prevCA.nQty;
+			offerHead.nQtyAccepted += txCA.nQty;
+
+			// add txn-specific values to offer accept object
+            txCA.vchRand = vchOfferAccept;
+	        txCA.nTime = pindex->nTime;
+	        txCA.txHash = tx.GetHash();
+	        txCA.nHeight = nHeight;
+	        if(op == OP_OFFER_PAY)
+	        	txCA.bPaid = true;
+
+	        offerHead.offer = txOffer;
+            if (!WriteOfferAcceptEvent(vchOffer, txCA, offerHead))
+                return error("ReconstructOfferBlock() : failed to write to offer DB");
+		} else {
             txOffer.nHeight = nHeight;
-            txOffer.nTime = pindex->nTime;
-            txOffer.PutToOfferList(vtxPos);
-
-            if (!WriteOffer(vchOffer, vtxPos))
-                return error("ReconstructOfferIndex() : failed to write to offer DB");
-            if(op == OP_OFFER_ACCEPT || op == OP_OFFER_PAY)
-	            if (!WriteOfferAccept(vvchArgs[1], vvchArgs[0]))
-	                return error("ReconstructOfferIndex() : failed to write to offer DB");
-			
-			// insert offers fees to regenerate list, write offer to
-			// master index
-			int64 nTheFee = GetOfferNetFee(tx);
-			InsertOfferFee(pindex, tx.GetHash(), nTheFee);
-
-			printf( "RECONSTRUCT OFFER: op=%s offer=%s title=%s qty=%llu hash=%s height=%d fees=%llu\n",
-					offerFromOp(op).c_str(),
-					stringFromVch(vvchArgs[0]).c_str(),
-					stringFromVch(txOffer.sTitle).c_str(),
-					txOffer.GetRemQty(),
-					tx.GetHash().ToString().c_str(), 
-					nHeight,
-					nTheFee);	            
-        }
-        pindex = pindex->pnext;
-        Flush();
-    }
+            offerHead.offer = txOffer;
+            if (!WriteOfferVersion(vchOffer, offerHead))
+                return error("ReconstructOfferBlock() : failed to write to offer DB");
+		}
+
+		// insert offers fees to regenerate list, write offer to
+		// master index
+		int64 nTheFee = GetOfferNetFee(tx);
+		InsertOfferFee(pindex, tx.GetHash(), nTheFee);
+
+		printf( "RECONSTRUCT OFFER: op=%s offer=%s title=%s qty=%llu hash=%s height=%d fees=%llu\n",
+				offerFromOp(op).c_str(),
+				stringFromVch(vvchArgs[0]).c_str(),
+				stringFromVch(txOffer.sTitle).c_str(),
+				offerHead.GetRemQty(),
+				tx.GetHash().ToString().c_str(),
+				nHeight,
+				nTheFee);
     }
     return true;
 }
@@ -333,87 +701,22 @@ int CheckOfferTransactionAtRelativeDepth(CBlockIndex* pindexBlock,
 }
 
 int GetOfferTxHashHeight(const uint256 txHash) {
-	CDiskTxPos postx;
-	pblocktree->ReadTxIndex(txHash, postx);
-	return GetOfferTxPosHeight(postx);
+	CBlockIndex* pindex = GetTxBlockIndex(txHash);
+	return pindex ? pindex->nHeight : 0;
 }
 
 uint64 GetOfferFeeSubsidy(unsigned int nHeight) {
-	uint64 hr1 = 1, hr12 = 1;
-	{
-		TRY_LOCK(cs_main, cs_trymain);
-		unsigned int h12 = 360 * 12;
-		unsigned int nTargetTime = 0;
-		unsigned int nTarget1hrTime = 0;
-		unsigned int blk1hrht = nHeight - 1;
-		unsigned int blk12hrht = nHeight - 1;
-		bool bFound = false;
-
-		BOOST_FOREACH(COfferFee &nmFee, lstOfferFees) {
-			if(nmFee.nHeight <= nHeight)
-				bFound = true;
-			if(bFound) {
-				if(nTargetTime==0) {
-					hr1 = hr12 = 0;
-					nTargetTime = nmFee.nTime - h12;
-					nTarget1hrTime = nmFee.nTime - (h12/12);
-				}
-				if(nmFee.nTime > nTargetTime) {
-					hr12 += nmFee.nFee;
-					blk12hrht = nmFee.nHeight;
-					if(nmFee.nTime > nTarget1hrTime) {
-						hr1 += nmFee.nFee;
-						blk1hrht = nmFee.nHeight;
-					}
-				}
-			}
-		}
-		hr12 /= (nHeight - blk12hrht) + 1;
-		hr1 /= (nHeight - blk1hrht) + 1;
-	}
-	uint64 nSubsidyOut = hr1 > hr12 ? hr1 : hr12;
-	return nSubsidyOut;
+	return offerFeeWindow.GetSubsidy(nHeight);
 }
 
-bool RemoveOfferFee(COfferFee &txnVal) {
-	{
-		TRY_LOCK(cs_main, cs_trymain);
-
-		COfferFee *theval = NULL;
-
-		BOOST_FOREACH(COfferFee &nmTxnValue, lstOfferFees) {
-			if (txnVal.hash == nmTxnValue.hash
-			 && txnVal.nHeight == nmTxnValue.nHeight) {
-				theval = &nmTxnValue;
-				break;
-			}
-		}
-		if(theval)
-			lstOfferFees.remove(*theval);
-
-		return theval != NULL;
-	}
+// offer fees are tracked by height only: the first offer txn
+// connected at a height is the one whose fee is regenerated
+bool RemoveOfferFee(CBlockIndex *pindex) {
+	return offerFeeWindow.Remove(pindex->nHeight, 0);
 }
 
 bool InsertOfferFee(CBlockIndex *pindex, uint256 hash, uint64 nValue) {
-	TRY_LOCK(cs_main, cs_trymain);
-	list<COfferFee> txnDup;
-	COfferFee oFee;
-	oFee.nTime = pindex->nTime;
-	oFee.nHeight = pindex->nHeight;
-	oFee.nFee = nValue;
-	bool bFound = false;
-	BOOST_FOREACH(COfferFee &nmFee, lstOfferFees) {
-		if (oFee.hash == nmFee.hash
-				&& oFee.nHeight == nmFee.nHeight) {
-			bFound = true;
-			break;
-		}
-	}
-	if (!bFound)
-		lstOfferFees.push_front(oFee);
-
-	return bFound;
+	return offerFeeWindow.Insert(pindex, 0, nValue);
 }
 
 int64 GetOfferNetFee(const CTransaction& tx) {
@@ -427,13 +730,11 @@ int64 GetOfferNetFee(const CTransaction& tx) {
 }
 
 int GetOfferHeight(vector<unsigned char> vchOffer) {
-	vector<COffer> vtxPos;
+	COfferHead offerHead;
 	if (pofferdb->ExistsOffer(vchOffer)) {
-		if (!pofferdb->ReadOffer(vchOffer, vtxPos))
+		if (!pofferdb->ReadOfferHead(vchOffer, offerHead))
 			return error("GetOfferHeight() : failed to read from offer DB");
-		if (vtxPos.empty()) return -1;
-		COffer& txPos = vtxPos.back();
-		return txPos.nHeight;
+		return offerHead.offer.nHeight;
 	}
 	return -1;
 }
@@ -581,11 +882,11 @@ bool GetValueOfOfferTxHash(const uint256 &txHash,
 
 bool GetValueOfOffer(COfferDB& dbOffer, const vector<unsigned char> &vchOffer,
 		vector<unsigned char>& vchValue, int& nHeight) {
-	vector<COffer> vtxPos;
-	if (!pofferdb->ReadOffer(vchOffer, vtxPos) || vtxPos.empty())
+	COfferHead offerHead;
+	if (!pofferdb->ReadOfferHead(vchOffer, offerHead))
 		return false;
 
-	COffer& txPos = vtxPos.back();
+	COffer& txPos = offerHead.offer;
 	nHeight = txPos.nHeight;
 	vchValue = txPos.vchRand;
 	return true;
@@ -593,10 +894,10 @@ bool GetValueOfOffer(COfferDB& dbOffer, const vector<unsigned char> &vchOffer,
 
 bool GetTxOfOffer(COfferDB& dbOffer, const vector<unsigned char> &vchOffer,
 		CTransaction& tx) {
-	vector<COffer> vtxPos;
-	if (!pofferdb->ReadOffer(vchOffer, vtxPos) || vtxPos.empty())
+	COfferHead offerHead;
+	if (!pofferdb->ReadOfferHead(vchOffer, offerHead))
 		return false;
-	COffer& txPos = vtxPos.back();
+	COffer& txPos = offerHead.offer;
 	int nHeight = txPos.nHeight;
 	if (nHeight + GetOfferExpirationDepth(pindexBest->nHeight)
 			< pindexBest->nHeight) {
@@ -636,20 +937,7 @@ bool GetTxOfOfferAccept(COfferDB& dbOffer, const vector<unsigned char> &vchOffer
 
 bool DecodeOfferTx(const CTransaction& tx, int& op, int& nOut,
 		vector<vector<unsigned char> >& vvch, int nHeight) {
-	bool found = false;
-
-
-	// Strict check - bug disallowed
-	for (unsigned int i = 0; i < tx.vout.size(); i++) {
-		const CTxOut& out = tx.vout[i];
-		vector<vector<unsigned char> > vvchRead;
-		if (DecodeOfferScript(out.scriptPubKey, op, vvchRead)) {
-			nOut = i; found = true; vvch = vvchRead;
-			break;
-		}
-	}
-	if (!found) vvch.clear();
-	return found && IsOfferOp(op);
+	return tx.GetServiceOutput(SERVICE_OFFER, op, nOut, vvch);
 }
 
 bool GetValueOfOfferTx(const CCoins& tx, vector<unsigned char>& value) {
@@ -703,37 +991,7 @@ bool DecodeOfferScript(const CScript& script, int& op,
 
 bool DecodeOfferScript(const CScript& script, int& op,
 		vector<vector<unsigned char> > &vvch, CScript::const_iterator& pc) {
-	opcodetype opcode;
-	if (!script.GetOp(pc, opcode)) return false;
-	if (opcode < OP_1 || opcode > OP_16) return false;
-	op = CScript::DecodeOP_N(opcode);
-
-	for (;;) {
-		vector<unsigned char> vch;
-		if (!script.GetOp(pc, opcode, vch))
-			return false;
-		if (opcode == OP_DROP || opcode == OP_2DROP || opcode == OP_NOP)
-			break;
-		if (!(opcode >= 0 && opcode <= OP_PUSHDATA4))
-			return false;
-		vvch.push_back(vch);
-	}
-
-	// move the pc to after any DROP or NOP
-	while (opcode == OP_DROP || opcode == OP_2DROP || opcode == OP_NOP) {
-		if (!script.GetOp(pc, opcode))
-			break;
-	}
-
-	pc--;
-
-	if ((op == OP_OFFER_NEW && vvch.size() == 1)
-		|| (op == OP_OFFER_ACTIVATE && vvch.size() == 3)
-		|| (op == OP_OFFER_UPDATE && vvch.size() == 2)
-		|| (op == OP_OFFER_ACCEPT && vvch.size() == 3)
-		|| (op == OP_OFFER_PAY && vvch.size() == 2))
-		return true;
-	return false;
+	return DecodeServiceScript(script, op, vvch, pc) == SERVICE_OFFER;
 }
 
 bool SignOfferSignature(const CTransaction& txFrom, CTransaction& txTo,
@@ -743,6 +1001,7 @@ bool SignOfferSignature(const CTransaction& txFrom, CTransaction& txTo,
 	CTxIn& txin = txTo.vin[nIn];
 	assert(txin.prevout.n < txFrom.vout.size());
 	const CTxOut& txout = txFrom.vout[txin.prevout.n];
+	txTo.InvalidateCache();
 
 	// Leave out the signature from the hash, since a signature can't sign itself.
 	// The checksig op will also drop the signatures from its hash.
@@ -786,6 +1045,7 @@ bool CreateOfferTransactionWithInputTx(
 		loop {
 			wtxNew.vin.clear();
 			wtxNew.vout.clear();
+			wtxNew.InvalidateCache();
 			wtxNew.fFromMe = true;
 			wtxNew.data = vchFromString(txData);
 
@@ -989,7 +1249,7 @@ CScript RemoveOfferScriptPrefix(const CScript& scriptIn) {
 }
 
 bool CheckOfferInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
-		CValidationState &state, CCoinsViewCache &inputs,
+		CValidationState &state, const CTxInputs &inputs,
 		map<vector<unsigned char>, uint256> &mapTestPool, bool fBlock, bool fMiner,
 		bool fJustCheck) {
 
@@ -999,24 +1259,15 @@ bool CheckOfferInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
 				fBlock ? "BLOCK" : "", fMiner ? "MINER" : "",
 				fJustCheck ? "JUSTCHECK" : "");
 
-		bool found = false;
-		const COutPoint *prevOutput = NULL;
-		const CCoins *prevCoins = NULL;
-		int prevOp;
+		int nPrevIn;
+		int prevOp = 0;
 		vector<vector<unsigned char> > vvchPrevArgs;
-
-		// Strict check - bug disallowed
-		for (int i = 0; i < (int) tx.vin.size(); i++) {
-			prevOutput = &tx.vin[i].prevout;
-			prevCoins = &inputs.GetCoins(prevOutput->hash);
-			vector<vector<unsigned char> > vvch;
-			if (DecodeOfferScript(prevCoins->vout[prevOutput->n].scriptPubKey,
-					prevOp, vvch)) {
-				found = true; vvchPrevArgs = vvch;
-				break;
-			}
-			if(!found)vvchPrevArgs.clear();
-		}
+		bool found = inputs.GetServiceInput(SERVICE_OFFER, nPrevIn, prevOp, vvchPrevArgs);
+		// without an offer input this points at the last input, where the
+		// search over the inputs used to leave it
+		if (!found)
+			nPrevIn = tx.vin.size() - 1;
+		const CCoins *prevCoins = &inputs.GetCoins(nPrevIn);
 
 		// Make sure offer outputs are not spent by a regular transaction, or the offer would be lost
 		if (tx.nVersion != SYSCOIN_TX_VERSION) {
@@ -1250,25 +1501,17 @@ bool CheckOfferInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
 		// save serialized offer for later use
 		COffer serializedOffer = theOffer;
 
-		// if not an offernew, load the offer data from the DB
-		vector<COffer> vtxPos;
+		// if not an offernew, load the offer head from the DB
+		COfferHead offerHead;
+		bool fHaveHead = false;
 		if(op != OP_OFFER_NEW)
 			if (pofferdb->ExistsOffer(vvchArgs[0])) {
-				if (!pofferdb->ReadOffer(vvchArgs[0], vtxPos))
+				if (!pofferdb->ReadOfferHead(vvchArgs[0], offerHead))
 					return error(
 							"CheckOfferInputs() : failed to read from offer DB");
+				fHaveHead = true;
 			}
 
-		//todo fucking suspect
-		// // for offerupdate or offerpay check to make sure the previous txn exists and is valid
-		// if (!fBlock && fJustCheck && (op == OP_OFFER_UPDATE || op == OP_OFFER_PAY)) {
-		// 	if (!CheckOfferTxPos(vtxPos, prevCoins->nHeight))
-		// 		return error(
-		// 				"CheckOfferInputs() : tx %s rejected, since previous tx (%s) is not in the offer DB\n",
-		// 				tx.GetHash().ToString().c_str(),
-		// 				prevOutput->hash.ToString().c_str());
-		// }
-
 		// these ifs are problably total bullshit except for the offernew
 		if (fBlock || (!fBlock && !fMiner && !fJustCheck)) {
 			if (op != OP_OFFER_NEW) {
@@ -1276,16 +1519,15 @@ bool CheckOfferInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
 					int nHeight = pindexBlock->nHeight;
 
 					// get the latest offer from the db
-                	theOffer.nHeight = nHeight;
-                	theOffer.GetOfferFromList(vtxPos);
-					
-					// If update, we make the serialized offer the master
-					// but first we assign the accepts from the DB since
-					// they are not shipped in an update txn to keep size down
-					if(op == OP_OFFER_UPDATE) {
-						serializedOffer.accepts = theOffer.accepts;
+					if (fHaveHead)
+						theOffer = offerHead.offer;
+
+					// If update, we make the serialized offer the master.
+					// Accepts are stored separately and never carried
+					// in the offer record itself
+					if(op == OP_OFFER_UPDATE)
 						theOffer = serializedOffer;
-					}
+					theOffer.accepts.clear();
 
 					if (op == OP_OFFER_ACCEPT || op == OP_OFFER_PAY) {
 						// get the accept out of the offer object in the txn
@@ -1295,12 +1537,12 @@ bool CheckOfferInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
 						if(op == OP_OFFER_ACCEPT) {
 							// get the offer accept qty, validate acceptance. txn is still valid
 							// if qty cannot be fulfilled, first-to-mine makes it
-							if(theOfferAccept.nQty < 1 || theOfferAccept.nQty > theOffer.GetRemQty()) {
+							if(theOfferAccept.nQty < 1 || theOfferAccept.nQty > offerHead.GetRemQty()) {
 								printf("txn %s accepted but offer not fulfilled because desired"
 									" qty %llu is more than available qty %llu for offer accept %s\n", 
 									tx.GetHash().GetHex().c_str(), 
 									theOfferAccept.nQty, 
-									theOffer.GetRemQty(), 
+									offerHead.GetRemQty(), 
 									stringFromVch(theOfferAccept.vchRand).c_str());
 								{
 									TRY_LOCK(cs_main, cs_trymain);
@@ -1313,30 +1555,31 @@ bool CheckOfferInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
 							}
 						} 
 
+						// an accept may already be stored (offerpay), replace it
+						COfferAccept ca;
+						bool fHaveAccept = pofferdb->ReadOfferAcceptEvent(vvchArgs[0], vvchArgs[1], ca);
+
 						if(op == OP_OFFER_PAY) {
 							// validate the offer accept is in the database,
 							// this is one of the ways we validate that the accept
 							// can be fulfilled
-							COfferAccept ca;
-							if(!theOffer.GetAcceptByHash(vvchArgs[1], ca))
+							if(!fHaveAccept)
 								return error("could not read accept from DB offer");
 							// if the accept exists in the database, great. 
 							// we don't need to use it, however, the serialized
 							// version is just fine
 							theOfferAccept.bPaid = true;
 						}
+						if(fHaveAccept)
+							offerHead.nQtyAccepted -= ca.nQty;
+						offerHead.nQtyAccepted += theOfferAccept.nQty;
 
-						// set the offer accept txn-dependent values and add to the txn
+						// set the offer accept txn-dependent values
 						theOfferAccept.vchRand = vvchArgs[1];
 						theOfferAccept.txHash = tx.GetHash();
 						theOfferAccept.nTime = pindexBlock->nTime;
 						theOfferAccept.nHeight = nHeight;
-						theOffer.PutOfferAccept(theOfferAccept);
 						mapTestPool[vvchArgs[1]] = tx.GetHash();
-
-						// write the offer / offer accept mapping to the database
-						if (!pofferdb->WriteOfferAccept(vvchArgs[1], vvchArgs[0]))
-							return error( "CheckOfferInputs() : failed to write to offer DB");
 					}
 					
 					// only modify the offer's height on an activate or update
@@ -1347,10 +1590,15 @@ bool CheckOfferInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
                     theOffer.vchRand = vvchArgs[0];
 					theOffer.txHash = tx.GetHash();
 					theOffer.nTime = pindexBlock->nTime;
-					theOffer.PutToOfferList(vtxPos);
+					offerHead.offer = theOffer;
 
-					// write offer
-					if (!pofferdb->WriteOffer(vvchArgs[0], vtxPos))
+					// write the new offer version or the accept, along with
+					// the offer head and the accept / offer mapping
+					if (op == OP_OFFER_ACCEPT || op == OP_OFFER_PAY) {
+						if (!pofferdb->WriteOfferAcceptEvent(vvchArgs[0], theOfferAccept, offerHead))
+							return error( "CheckOfferInputs() : failed to write to offer DB");
+					}
+					else if (!pofferdb->WriteOfferVersion(vvchArgs[0], offerHead))
 						return error( "CheckOfferInputs() : failed to write to offer DB");
 					mapTestPool[vvchArgs[0]] = tx.GetHash();
 
@@ -1358,9 +1606,6 @@ bool CheckOfferInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
                     int64 nTheFee = GetOfferNetFee(tx);
 					InsertOfferFee(pindexBlock, tx.GetHash(), nTheFee);
 					if(nTheFee > 0) printf("OFFER FEES: Added %lf in fees to track for regeneration.\n", (double) nTheFee / COIN);
-					vector<COfferFee> vOfferFees(lstOfferFees.begin(), lstOfferFees.end());
-					if (!pofferdb->WriteOfferTxFees(vOfferFees))
-						return error( "CheckOfferInputs() : failed to write fees to offer DB");
 
 					// remove offer from pendings
 					// activate or update - seller txn
@@ -1384,7 +1629,7 @@ bool CheckOfferInputs(CBlockIndex *pindexBlock, const CTransaction &tx,
 							offerFromOp(op).c_str(),
 							stringFromVch(vvchArgs[0]).c_str(),
 							stringFromVch(theOffer.sTitle).c_str(),
-							theOffer.GetRemQty(),
+							offerHead.GetRemQty(),
 							tx.GetHash().ToString().c_str(), 
 							nHeight, nTheFee / COIN);
 				}
@@ -1423,21 +1668,9 @@ bool ExtractOfferAddress(const CScript& script, string& address) {
 	return true;
 }
 
-void rescanforoffers(CBlockIndex *pindexRescan) {
-    printf("Scanning blockchain for offers to create fast index...\n");
-    pofferdb->ReconstructOfferIndex(pindexRescan);
-}
-
 int GetOfferTxPosHeight(const CDiskTxPos& txPos) {
-    // Read block header
-    CBlock block;
-    if (!block.ReadFromDisk(txPos)) return 0;
-    // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
-    if (mi == mapBlockIndex.end()) return 0;
-    CBlockIndex* pindex = (*mi).second;
-    if (!pindex || !pindex->IsInMainChain()) return 0;
-    return pindex->nHeight;
+    CBlockIndex* pindex = GetTxPosBlockIndex(txPos);
+    return pindex ? pindex->nHeight : 0;
 }
 
 int GetOfferTxPosHeight2(const CDiskTxPos& txPos, int nHeight) {
@@ -2369,14 +2602,15 @@ Value offerfilter(const Array& params, bool fHelp) {
 	if (!pofferdb->ScanOffers(vchOffer, 100000000, offerScan))
 		throw JSONRPCError(RPC_WALLET_ERROR, "scan failed");
 
+	using namespace boost::xpressive;
+	smatch offerparts;
+	sregex cregex = sregex::compile(strRegexp);
+
 	pair<vector<unsigned char>, COffer> pairScan;
 	BOOST_FOREACH(pairScan, offerScan) {
 		string offer = stringFromVch(pairScan.first);
 
 		// regexp
-		using namespace boost::xpressive;
-		smatch offerparts;
-		sregex cregex = sregex::compile(strRegexp);
 		if (strRegexp != "" && !regex_search(offer, offerparts, cregex))
 			continue;
 
@@ -2394,11 +2628,8 @@ Value offerfilter(const Array& params, bool fHelp) {
 
 		Object oOffer;
 		oOffer.push_back(Pair("offer", offer));
-		CTransaction tx;
-		uint256 blockHash;
-		uint256 txHash = txOffer.txHash;
 		if ((nHeight + GetOfferDisplayExpirationDepth(nHeight) - pindexBest->nHeight
-				<= 0) || !GetTransaction(txHash, tx, blockHash, true)) {
+				<= 0) || GetTxBlockIndex(txOffer.txHash) == NULL) {
 			oOffer.push_back(Pair("expired", 1));
 		} else {
 			vector<unsigned char> vchValue = txOffer.sTitle;
@@ -2458,14 +2689,12 @@ Value offerscan(const Array& params, bool fHelp) {
 		Object oOffer;
 		string offer = stringFromVch(pairScan.first);
 		oOffer.push_back(Pair("offer", offer));
-		CTransaction tx;
 		COffer txOffer = pairScan.second;
-		uint256 blockHash;
 
 		int nHeight = txOffer.nHeight;
 		vector<unsigned char> vchValue = txOffer.sTitle;
 		if ((nHeight + GetOfferDisplayExpirationDepth(nHeight) - pindexBest->nHeight
-				<= 0) || !GetTransaction(txOffer.txHash, tx, blockHash, true)) {
+				<= 0) || GetTxBlockIndex(txOffer.txHash) == NULL) {
 			oOffer.push_back(Pair("expired", 1));
 		} else {
 			string value = stringFromVch(vchValue);
@@ -2485,6 +2714,75 @@ Value offerscan(const Array& params, bool fHelp) {
 	return oRes;
 }
 
+Value offerquery(const Array& params, bool fHelp) {
+	if (fHelp || params.size() > 6)
+		throw runtime_error(
+				"offerquery [<category>] [<minprice>] [<maxprice>] [<titleword>] [<count>] [<cursor>]\n"
+						"list offers by price using the offer indexes\n"
+						"<category> : only offers of this category, empty means all\n"
+						"<minprice> <maxprice> : price range in whole coins, 0 means no limit\n"
+						"<titleword> : only offers with a title word starting with this\n"
+						"<count> : return at most <count> offers (default 100)\n"
+						"<cursor> : the cursor returned with the previous page\n");
+
+	COfferQuery query;
+	unsigned int nCount = 100;
+	string strCursor;
+	if (params.size() > 0)
+		query.vchCategory = vchFromValue(params[0]);
+	if (params.size() > 1)
+		query.nMinPrice = atoi64(params[1].get_str().c_str()) * COIN;
+	if (params.size() > 2) {
+		int64 nMaxPrice = atoi64(params[2].get_str().c_str());
+		if (nMaxPrice > 0)
+			query.nMaxPrice = nMaxPrice * COIN;
+	}
+	if (params.size() > 3 && params[3].get_str() != "") {
+		// index words are normalized, normalize the query the same way
+		set<vector<unsigned char> > setWords;
+		GetOfferTitleWords(vchFromValue(params[3]), setWords);
+		if (setWords.size() != 1)
+			throw runtime_error("title word must be a single word");
+		query.vchTitleWord = *setWords.begin();
+	}
+	if (params.size() > 4)
+		nCount = atoi(params[4].get_str().c_str());
+	if (nCount < 1 || nCount > 1000)
+		throw runtime_error("count must be between 1 and 1000");
+	if (params.size() > 5) {
+		vector<unsigned char> vchCursor = ParseHex(params[5].get_str());
+		strCursor = string(vchCursor.begin(), vchCursor.end());
+	}
+
+	vector<pair<vector<unsigned char>, COfferHead> > vResults;
+	if (!pofferdb->QueryOffers(query, nCount, strCursor, vResults))
+		throw JSONRPCError(RPC_INVALID_PARAMETER, "query failed");
+
+	Array oOffers;
+	for (unsigned int i = 0; i < vResults.size(); i++) {
+		const COfferHead &head = vResults[i].second;
+		int nHeight = head.offer.nHeight;
+		Object oOffer;
+		oOffer.push_back(Pair("offer", stringFromVch(vResults[i].first)));
+		oOffer.push_back(Pair("title", stringFromVch(head.offer.sTitle)));
+		oOffer.push_back(Pair("category", stringFromVch(head.offer.sCategory)));
+		oOffer.push_back(Pair("price", ValueFromAmount(head.offer.nPrice)));
+		oOffer.push_back(Pair("quantity", strprintf("%lld", head.GetRemQty())));
+		oOffer.push_back(Pair("height", nHeight));
+		int nExpiresIn = nHeight + GetOfferDisplayExpirationDepth(nHeight) - pindexBest->nHeight;
+		if (nExpiresIn <= 0)
+			oOffer.push_back(Pair("expired", 1));
+		else
+			oOffer.push_back(Pair("expires_in", nExpiresIn));
+		oOffers.push_back(oOffer);
+	}
+
+	Object oRes;
+	oRes.push_back(Pair("offers", oOffers));
+	if (!strCursor.empty())
+		oRes.push_back(Pair("cursor", HexStr(strCursor.begin(), strCursor.end())));
+	return oRes;
+}
 
  Value offerclean(const Array& params, bool fHelp)
  {
@@ -2,19 +2,21 @@
 #define OFFER_H
 
 #include "bitcoinrpc.h"
-#include "leveldb.h"
+#include "servicedb.h"
+#include "feeregen.h"
 
 class CTransaction;
+class CBlock;
 class CTxOut;
 class CValidationState;
-class CCoinsViewCache;
+class CTxInputs;
 class COutPoint;
 class CCoins;
 class CScript;
 class CWalletTx;
 class CDiskTxPos;
 
-bool CheckOfferInputs(CBlockIndex *pindex, const CTransaction &tx, CValidationState &state, CCoinsViewCache &inputs, 
+bool CheckOfferInputs(CBlockIndex *pindex, const CTransaction &tx, CValidationState &state, const CTxInputs &inputs, 
     std::map<std::vector<unsigned char>,uint256> &mapTestPool, bool fBlock, bool fMiner, bool fJustCheck);
 bool ExtractOfferAddress(const CScript& script, std::string& address);
 bool IsOfferMine(const CTransaction& tx);
@@ -303,26 +305,123 @@ public:
 	void SetNull() { hash = nTime = nHeight = nFee = 0;}
     bool IsNull() const { return (nTime == 0 && nFee == 0 && hash == 0 && nHeight == 0); }
 };
-bool RemoveOfferFee(COfferFee &txnVal);
+bool RemoveOfferFee(CBlockIndex *pindex);
 
-class COfferDB : public CLevelDB {
+/** Latest state of an offer as kept in the offers DB: the most recent
+ *  version of the offer (without its accepts) plus the total quantity
+ *  committed to accepts, so connecting an accept never has to load the
+ *  accept history. */
+class COfferHead {
 public:
-	COfferDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "offers", nCacheSize, fMemory, fWipe) {}
+    COffer offer;
+    int64 nQtyAccepted;
+    // offer txns connected so far; the chain position of the next one
+    unsigned int nSeq;
 
-	bool WriteOffer(const std::vector<unsigned char>& name, std::vector<COffer>& vtxPos) {
-		return Write(make_pair(std::string("offeri"), name), vtxPos);
+    COfferHead() {
+        SetNull();
+    }
+
+    IMPLEMENT_SERIALIZE (
+        READWRITE(offer);
+        READWRITE(nQtyAccepted);
+        READWRITE(nSeq);
+    )
+
+    int64 GetRemQty() const { return offer.nQty - nQtyAccepted; }
+
+    void SetNull() { offer.SetNull(); nQtyAccepted = 0; nSeq = 0; }
+    bool IsNull() const { return offer.IsNull(); }
+};
+
+// offers DB layout version; bump when the key layout below changes
+static const int OFFER_DB_VERSION = 4;
+
+// title words indexed per offer, and the bytes of each word kept
+static const unsigned int MAX_OFFER_TITLE_WORDS = 16;
+static const unsigned int MAX_OFFER_TITLE_WORD_LENGTH = 32;
+
+/** The lower case words of an offer title, as indexed for offerquery. */
+void GetOfferTitleWords(const std::vector<unsigned char> &vchTitle, std::set<std::vector<unsigned char> > &setWords);
+
+/** Filters of an offerquery; empty or zero fields match everything. */
+class COfferQuery {
+public:
+    std::vector<unsigned char> vchCategory;
+    std::vector<unsigned char> vchTitleWord; // prefix of a title word
+    uint64 nMinPrice;
+    uint64 nMaxPrice;
+
+    COfferQuery() : nMinPrice(0), nMaxPrice((uint64)-1) {}
+};
+
+/** Offers DB. Every offer version and every accept is its own record:
+ *    "offerh" guid                  -> COfferHead (latest state)
+ *    "offerv" (guid, height, seq)   -> COffer version activated/updated at height
+ *    "offerc" (guid, accept guid)   -> COfferAccept
+ *    "offero" (guid, seq)           -> accept guid
+ *    "offera" accept guid           -> guid
+ *  so connecting an accept or update costs a constant number of writes
+ *  regardless of how many accepts the offer already has. seq is the chain
+ *  position of the txn among the offer's txns (COfferHead::nSeq), so
+ *  versions and accepts read back in chain order, also within a block.
+ *
+ *  The category, title words and price of every head are indexed by empty
+ *  records, written in the same batch as the head:
+ *    "offerp" (price, guid)
+ *    "offercp" (category, price, guid)
+ *    "offert" (title word, guid)
+ *  Prices are big endian and strings CLexicalKeys, so a category under a
+ *  price, or a word prefix, is one contiguous range of keys. Archived heads
+ *  (see CServiceDB) are not indexed. */
+class COfferDB : public CServiceDB {
+private:
+	CServiceRecordCache<COfferHead> cacheHeads;
+	// assembled by ReadOffer from the head, version and accept records
+	CServiceRecordCache<std::vector<COffer> > cacheOffers;
+
+	void RecordChanged(const std::string &strKey) {
+		std::vector<unsigned char> vchName;
+		if (DecodeRecordKey(strKey, "offerh", vchName)) {
+			cacheHeads.Erase(vchName);
+			cacheOffers.Erase(vchName);
+		}
+		else if (DecodeRecordKey(strKey, "offerv", vchName) || DecodeRecordKey(strKey, "offerc", vchName)
+				|| DecodeRecordKey(strKey, "offero", vchName))
+			cacheOffers.Erase(vchName);
 	}
 
-	bool EraseOffer(const std::vector<unsigned char>& name) {
-	    return Erase(make_pair(std::string("offeri"), name));
+	// write or (pHead NULL) erase the head of an offer, moving its index
+	// records from the current head to the new one
+	bool WriteOfferHead(CLevelDBBatch &batch, const std::vector<unsigned char>& name, const COfferHead *pHead);
+	void WriteOfferIndexes(CLevelDBBatch &batch, const std::vector<unsigned char>& name, const COffer &offer, bool fErase);
+
+	int GetHeadExpiry(const std::string &strValue);
+	// archived offers drop out of the indexes
+	void HeadArchived(const std::vector<unsigned char> &vchName);
+
+public:
+	COfferDB(size_t nCacheSize, bool fMemory, bool fWipe) : CServiceDB(GetDataDir() / "offers", nCacheSize, fMemory, fWipe) {
+		strHeadPrefix = "offerh";
 	}
 
-	bool ReadOffer(const std::vector<unsigned char>& name, std::vector<COffer>& vtxPos) {
-		return Read(make_pair(std::string("offeri"), name), vtxPos);
+	// long expired offers are read from the archive
+	bool ReadOfferHead(const std::vector<unsigned char>& name, COfferHead& head) {
+		LOCK(cs_cache);
+		if (cacheHeads.Get(name, head))
+			return true;
+		if (!Read(make_pair(std::string("offerh"), name), head) && !ReadArchived(name, head))
+			return false;
+		cacheHeads.Put(name, head);
+		return true;
 	}
 
 	bool ExistsOffer(const std::vector<unsigned char>& name) {
-	    return Exists(make_pair(std::string("offeri"), name));
+	    return Exists(make_pair(std::string("offerh"), name)) || ExistsArchived(name);
+	}
+
+	bool ReadOfferAcceptEvent(const std::vector<unsigned char>& name, const std::vector<unsigned char>& vchAccept, COfferAccept& accept) {
+		return Read(make_pair(std::string("offerc"), make_pair(name, vchAccept)), accept);
 	}
 
 	bool WriteOfferAccept(const std::vector<unsigned char>& name, std::vector<unsigned char>& vchValue) {
@@ -349,6 +448,10 @@ public:
 		return Read(make_pair(std::string("offera"), std::string("offertxf")), vtxPos);
 	}
 
+	bool EraseOfferTxFees() {
+		return Erase(make_pair(std::string("offera"), std::string("offertxf")));
+	}
+
     bool WriteOfferIndex(std::vector<std::vector<unsigned char> >& vtxPos) {
         return Write(make_pair(std::string("offera"), std::string("offerndx")), vtxPos);
     }
@@ -357,14 +460,55 @@ public:
         return Read(make_pair(std::string("offera"), std::string("offerndx")), vtxPos);
     }
 
+    // write a new offer version (activate/update) and the new head
+    bool WriteOfferVersion(const std::vector<unsigned char>& name, const COfferHead& head);
+    // write an accept (new or paid) and the new head
+    bool WriteOfferAcceptEvent(const std::vector<unsigned char>& name, const COfferAccept& accept, const COfferHead& head);
+    // undo WriteOfferVersion for the version at nHeight; offer txns are
+    // disconnected in reverse, so it is the offer's last txn
+    bool DisconnectOfferVersion(const std::vector<unsigned char>& name, unsigned int nHeight);
+    // undo WriteOfferAcceptEvent; txAccept is the accept as serialized in the disconnected txn
+    bool DisconnectOfferAcceptEvent(const std::vector<unsigned char>& name, const COfferAccept& txAccept,
+            const uint256& txHash, bool fPay);
+
+    // versions and accepts in chain order, with their chain positions if pvSeq is given
+    bool ReadOfferVersions(const std::vector<unsigned char>& name, std::vector<COffer>& vtxPos,
+            std::vector<unsigned int> *pvSeq = NULL);
+    bool ReadOfferAccepts(const std::vector<unsigned char>& name, std::vector<COfferAccept>& vAccepts,
+            std::vector<unsigned int> *pvSeq = NULL);
+    // assemble the full offer history, each version carrying the accepts made while it was current
+    bool ReadOffer(const std::vector<unsigned char>& name, std::vector<COffer>& vtxPos);
+
+    // false if the DB holds records in a layout older than OFFER_DB_VERSION
+    bool CheckVersion();
+
+    // up to nMax heads matching query, in index order. strCursor is empty
+    // or the value it was left at by the previous page of the same query;
+    // it is left empty once there are no more matches.
+    bool QueryOffers(const COfferQuery& query, unsigned int nMax, std::string& strCursor,
+            std::vector<std::pair<std::vector<unsigned char>, COfferHead> >& vResults);
+
     bool ScanOffers(
             const std::vector<unsigned char>& vchName,
             unsigned int nMax,
             std::vector<std::pair<std::vector<unsigned char>, COffer> >& offerScan);
 
-    bool ReconstructOfferIndex(CBlockIndex *pindexRescan);
+    // apply the offer txns of a main chain block, when rebuilding the DB
+    bool ReconstructOfferBlock(const CBlock &block, CBlockIndex *pindex);
+
+    void SetRecordCacheSize(uint64 nBytes) {
+        LOCK(cs_cache);
+        cacheHeads.SetMaxBytes(nBytes / 2);
+        cacheOffers.SetMaxBytes(nBytes / 2);
+    }
+
+    void GetRecordCacheStats(std::vector<std::pair<std::string, CServiceCacheStats> > &vStats) const {
+        LOCK(cs_cache);
+        vStats.push_back(make_pair(std::string("offerheads"), cacheHeads.GetStats()));
+        vStats.push_back(make_pair(std::string("offers"), cacheOffers.GetStats()));
+    }
 };
-extern std::list<COfferFee> lstOfferFees;
+extern CFeeRegenWindow offerFeeWindow;
 
 
 bool GetTxOfOffer(COfferDB& dbOffer, const std::vector<unsigned char> &vchOffer, CTransaction& tx);
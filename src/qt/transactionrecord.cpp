@@ -74,12 +74,7 @@ QList<TransactionRecord> TransactionRecord::decomposeTransaction(const CWallet *
         vector<vector<unsigned char> > vvchArgs;
         int op, nOut;
         if (wtx.nVersion == SYSCOIN_TX_VERSION) {
-            bool o = DecodeAliasTx(wtx, op, nOut, vvchArgs, -1);
-            if (IsOfferOp(op)) {
-                DecodeOfferTx(wtx, op, nOut, vvchArgs, -1);
-            } else if (IsCertOp(op)) {
-                DecodeCertTx(wtx, op, nOut, vvchArgs, -1);
-            }
+            wtx.GetServiceOutput(op, nOut, vvchArgs);
         }
 
         bool fAllFromMe = true;
@@ -253,7 +248,7 @@ void TransactionRecord::updateStatus(const CWalletTx &wtx)
 
     // Find the block the tx is in
     CBlockIndex* pindex = NULL;
-    std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+    BlockMap::iterator mi = mapBlockIndex.find(wtx.hashBlock);
     if (mi != mapBlockIndex.end())
         pindex = (*mi).second;
 
@@ -6,6 +6,7 @@
 #include "main.h"
 #include "bitcoinrpc.h"
 #include "auxpow.h"
+#include "servicedb.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -309,3 +310,61 @@ Value verifychain(const Array& params, bool fHelp)
     return VerifyDB(nCheckLevel, nCheckDepth);
 }
 
+Value getservicecacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getservicecacheinfo\n"
+            "Returns size and hit/miss statistics of the decoded alias, offer and certificate caches.");
+
+    Object ret;
+    vector<pair<string, CServiceCacheStats> > vStats;
+    GetServiceRecordCacheStats(vStats);
+    for (unsigned int i = 0; i < vStats.size(); i++) {
+        const CServiceCacheStats &stats = vStats[i].second;
+        Object obj;
+        obj.push_back(Pair("entries", (boost::int64_t)stats.nEntries));
+        obj.push_back(Pair("bytes", (boost::int64_t)stats.nBytes));
+        obj.push_back(Pair("maxbytes", (boost::int64_t)stats.nMaxBytes));
+        obj.push_back(Pair("hits", (boost::int64_t)stats.nHits));
+        obj.push_back(Pair("misses", (boost::int64_t)stats.nMisses));
+        ret.push_back(Pair(vStats[i].first, obj));
+    }
+    return ret;
+}
+
+static Object DigestCacheStatsToJSON(const CDigestCacheStats &stats)
+{
+    Object ret;
+    ret.push_back(Pair("entries", (boost::int64_t)stats.nEntries));
+    ret.push_back(Pair("maxentries", (boost::int64_t)stats.nMaxEntries));
+    ret.push_back(Pair("bytes", (boost::int64_t)stats.nBytes));
+    ret.push_back(Pair("hits", (boost::int64_t)stats.nHits));
+    ret.push_back(Pair("misses", (boost::int64_t)stats.nMisses));
+    ret.push_back(Pair("erased", (boost::int64_t)stats.nErased));
+    return ret;
+}
+
+Value getsigcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "Returns size and hit/miss statistics of the cache of valid signatures.");
+
+    CDigestCacheStats stats;
+    GetSignatureCacheStats(stats);
+    return DigestCacheStatsToJSON(stats);
+}
+
+Value getscriptcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getscriptcacheinfo\n"
+            "Returns size and hit/miss statistics of the cache of transactions with valid scripts.");
+
+    CDigestCacheStats stats;
+    GetScriptExecutionCacheStats(stats);
+    return DigestCacheStatsToJSON(stats);
+}
@@ -292,6 +292,7 @@ Value getworkex(const Array& params, bool fHelp)
             pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
         else
             CDataStream(coinbase, SER_NETWORK, PROTOCOL_VERSION) >> pblock->vtx[0];
+        pblock->vtx[0].InvalidateCache();
 
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 
@@ -406,6 +407,7 @@ Value getwork(const Array& params, bool fHelp)
         pblock->nTime = pdata->nTime;
         pblock->nNonce = pdata->nNonce;
         pblock->vtx[0].vin[0].scriptSig = mapNewBlock[pdata->hashMerkleRoot].second;
+        pblock->vtx[0].InvalidateCache();
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 
         assert(pwalletMain != NULL);
@@ -726,6 +728,7 @@ Value getworkaux(const Array& params, bool fHelp)
         RemoveMergedMiningHeader(vchAux);
 		unsigned int nHeight = pindexBest->nHeight+1; // Height first in coinbase required for block.version=2
         pblock->vtx[0].vin[0].scriptSig = MakeCoinbaseWithAux(nHeight, nExtraNonce, vchAux);
+        pblock->vtx[0].InvalidateCache();
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 
         if (params.size() > 2)
@@ -1071,7 +1071,7 @@ void ListTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDe
             if (fNameTx) {
                 vector<vector<unsigned char> > vvchArgs;
                 int op,nOut, nTxOut;
-                if(DecodeAliasTx(wtx, op, nOut, vvchArgs, -1)) {
+                if(wtx.GetServiceOutput(op, nOut, vvchArgs) != SERVICE_NONE) {
                     if(IsAliasOp(op)) {
                         nTxOut = IndexOfNameOutput(wtx);
                         ExtractAliasAddress(wtx.vout[nTxOut].scriptPubKey, strAddress);
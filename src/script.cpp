@@ -3,12 +3,12 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 using namespace boost;
 
 #include "script.h"
+#include "digestcache.h"
 #include "keystore.h"
 #include "bignum.h"
 #include "key.h"
@@ -16,7 +16,7 @@ using namespace boost;
 #include "sync.h"
 #include "util.h"
 
-bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags);
+bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSignatureHashCache* pcache = NULL);
 
 
 
@@ -301,7 +301,7 @@ bool IsCanonicalSignature(const valtype &vchSig) {
     return true;
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType)
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHashCache* pcache)
 {
     CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
@@ -854,8 +854,10 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     scriptCode.FindAndDelete(CScript(vchSig));
 
                     bool fSuccess = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
+                    if (!fSuccess && (flags & SCRIPT_VERIFY_ENCFAIL))
+                        return false;
                     if (fSuccess)
-                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                        fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pcache);
 
                     popstack(stack);
                     popstack(stack);
@@ -916,8 +918,10 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
                         // Check signature
                         bool fOk = (!fStrictEncodings || (IsCanonicalSignature(vchSig) && IsCanonicalPubKey(vchPubKey)));
+                        if (!fOk && (flags & SCRIPT_VERIFY_ENCFAIL))
+                            return false;
                         if (fOk)
-                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags);
+                            fOk = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, flags, pcache);
 
                         if (fOk) {
                             isig++;
@@ -975,64 +979,147 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
 
 
-uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+/** The transaction as SignatureHash hashes it, serialized with the scripts
+ *  and outputs it leaves out blanked as it goes, instead of from a modified
+ *  copy of the transaction. */
+class CTransactionSignatureSerializer
+{
+private:
+    const CTransaction& txTo;
+    const CScript& scriptCode; // the script of input nIn, without OP_CODESEPARATORs
+    unsigned int nIn;
+    bool fAnyoneCanPay;
+    bool fHashSingle;
+    bool fHashNone;
+
+public:
+    CTransactionSignatureSerializer(const CTransaction& txToIn, const CScript& scriptCodeIn, unsigned int nInIn, int nHashTypeIn) :
+        txTo(txToIn), scriptCode(scriptCodeIn), nIn(nInIn),
+        fAnyoneCanPay(!!(nHashTypeIn & SIGHASH_ANYONECANPAY)),
+        fHashSingle((nHashTypeIn & 0x1f) == SIGHASH_SINGLE),
+        fHashNone((nHashTypeIn & 0x1f) == SIGHASH_NONE) {}
+
+    template<typename S>
+    void SerializeInput(S& s, unsigned int nInput, int nType, int nVersion) const
+    {
+        // with SIGHASH_ANYONECANPAY only the input being signed is there
+        if (fAnyoneCanPay)
+            nInput = nIn;
+        const CTxIn& txin = txTo.vin[nInput];
+        ::Serialize(s, txin.prevout, nType, nVersion);
+        // other inputs' signatures are blanked out
+        if (nInput != nIn)
+            ::Serialize(s, CScript(), nType, nVersion);
+        else
+            ::Serialize(s, scriptCode, nType, nVersion);
+        // without SIGHASH_ALL the others may update their inputs at will
+        if (nInput != nIn && (fHashSingle || fHashNone))
+            ::Serialize(s, (unsigned int)0, nType, nVersion);
+        else
+            ::Serialize(s, txin.nSequence, nType, nVersion);
+    }
+
+    template<typename S>
+    void SerializeOutput(S& s, unsigned int nOutput, int nType, int nVersion) const
+    {
+        // with SIGHASH_SINGLE the outputs before nIn are null
+        if (fHashSingle && nOutput != nIn)
+            ::Serialize(s, CTxOut(), nType, nVersion);
+        else
+            ::Serialize(s, txTo.vout[nOutput], nType, nVersion);
+    }
+
+    template<typename S>
+    void Serialize(S& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, txTo.nVersion, nType, nVersion);
+        unsigned int nInputs = fAnyoneCanPay ? 1 : txTo.vin.size();
+        WriteCompactSize(s, nInputs);
+        for (unsigned int nInput = 0; nInput < nInputs; nInput++)
+            SerializeInput(s, nInput, nType, nVersion);
+        unsigned int nOutputs = fHashNone ? 0 : (fHashSingle ? nIn + 1 : txTo.vout.size());
+        WriteCompactSize(s, nOutputs);
+        for (unsigned int nOutput = 0; nOutput < nOutputs; nOutput++)
+            SerializeOutput(s, nOutput, nType, nVersion);
+        ::Serialize(s, txTo.nLockTime, nType, nVersion);
+        ::Serialize(s, txTo.data, nType, nVersion);
+    }
+};
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashCache* pcache)
 {
     if (nIn >= txTo.vin.size())
     {
         printf("ERROR: SignatureHash() : nIn=%d out of range\n", nIn);
         return 1;
     }
-    CTransaction txTmp(txTo);
+    if ((nHashType & 0x1f) == SIGHASH_SINGLE && nIn >= txTo.vout.size())
+    {
+        printf("ERROR: SignatureHash() : nOut=%d out of range\n", nIn);
+        return 1;
+    }
 
     // In case concatenating two scripts ends up with two codeseparators,
     // or an extra one at the end, this prevents all those possible incompatibilities.
     scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
 
-    // Blank out other inputs' signatures
-    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-        txTmp.vin[i].scriptSig = CScript();
-    txTmp.vin[nIn].scriptSig = scriptCode;
+    if (pcache && (nHashType & 0x1f) != SIGHASH_NONE && (nHashType & 0x1f) != SIGHASH_SINGLE
+        && !(nHashType & SIGHASH_ANYONECANPAY))
+        return pcache->SignatureHash(scriptCode, txTo, nIn, nHashType);
 
-    // Blank out some of the outputs
-    if ((nHashType & 0x1f) == SIGHASH_NONE)
-    {
-        // Wildcard payee
-        txTmp.vout.clear();
+    // Serialize and hash
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << CTransactionSignatureSerializer(txTo, scriptCode, nIn, nHashType) << nHashType;
+    return ss.GetHash();
+}
 
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
-    }
-    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    return SignatureHash(scriptCode, txTo, nIn, nHashType, NULL);
+}
+
+CSignatureHashCache::CSignatureHashCache(const CTransaction& txTo)
+{
+    CDataStream ssInputs(SER_GETHASH, 0);
+    ssInputs << txTo.nVersion;
+    WriteCompactSize(ssInputs, txTo.vin.size());
+    vInputPos.reserve(txTo.vin.size() + 1);
+    BOOST_FOREACH(const CTxIn& txin, txTo.vin)
     {
-        // Only lock-in the txout payee at same index as txin
-        unsigned int nOut = nIn;
-        if (nOut >= txTmp.vout.size())
-        {
-            printf("ERROR: SignatureHash() : nOut=%d out of range\n", nOut);
-            return 1;
-        }
-        txTmp.vout.resize(nOut+1);
-        for (unsigned int i = 0; i < nOut; i++)
-            txTmp.vout[i].SetNull();
-
-        // Let the others update at will
-        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+        vInputPos.push_back(ssInputs.size());
+        ssInputs << txin.prevout << CScript() << txin.nSequence;
     }
+    vInputPos.push_back(ssInputs.size());
+    vchInputs.assign(ssInputs.begin(), ssInputs.end());
 
-    // Blank out other inputs completely, not recommended for open transactions
-    if (nHashType & SIGHASH_ANYONECANPAY)
+    CHashWriter ss(SER_GETHASH, 0);
+    vMidstate.resize(txTo.vin.size());
+    unsigned int nPos = 0;
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
     {
-        txTmp.vin[0] = txTmp.vin[nIn];
-        txTmp.vin.resize(1);
+        ss.write(&vchInputs[nPos], vInputPos[i] - nPos);
+        nPos = vInputPos[i];
+        vMidstate[i] = ss.GetMidstate();
     }
 
-    // Serialize and hash
+    CDataStream ssOutputs(SER_GETHASH, 0);
+    ssOutputs << txTo.vout << txTo.nLockTime << txTo.data;
+    vchOutputs.assign(ssOutputs.begin(), ssOutputs.end());
+}
+
+uint256 CSignatureHashCache::SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType) const
+{
+    assert(nIn < vMidstate.size() && vMidstate.size() == txTo.vin.size());
+
+    // what comes before input nIn from its midstate, the input with the
+    // script being signed, the other inputs after it and all the rest
     CHashWriter ss(SER_GETHASH, 0);
-    ss << txTmp << nHashType;
+    ss.SetMidstate(vMidstate[nIn]);
+    ss << txTo.vin[nIn].prevout << scriptCode << txTo.vin[nIn].nSequence;
+    unsigned int nRest = vInputPos[nIn + 1];
+    ss.write(&vchInputs[0] + nRest, vchInputs.size() - nRest);
+    ss.write(&vchOutputs[0], vchOutputs.size());
+    ss << nHashType;
     return ss.GetHash();
 }
 
@@ -1041,63 +1128,44 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
 // twice for every transaction (once when accepted into memory pool, and
 // again when accepted into the block chain)
 
-class CSignatureCache
-{
-private:
-     // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+// Valid signatures seen before, so that the signatures of a transaction
+// are not verified again when it shows up in a block
+static CDigestCache signatureCache;
 
-public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+static uint256 GetSignatureCacheEntry(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << signatureCache.GetSalt() << hash << vchSig << pubKey;
+    return ss.GetHash();
+}
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
-            return true;
-        return false;
+void InitSignatureCache()
+{
+    uint64 nBytes;
+    if (mapArgs.count("-maxsigcachesize") && !mapArgs.count("-sigcachesize")) {
+        // counted in signatures before the cache held digests; keep that
+        // many, rather than taking the number for megabytes
+        int64 nEntries = std::max(GetArg("-maxsigcachesize", 0), (int64)0);
+        nEntries = std::min(nEntries, ((int64)MAX_DIGEST_CACHE_SIZE << 20) / (int64)sizeof(uint256));
+        nBytes = nEntries * sizeof(uint256);
+        printf("-maxsigcachesize is deprecated and counts signatures, use -sigcachesize in megabytes; "
+               "caching %"PRI64d" signatures\n", nEntries);
+    } else {
+        int64 nMaxCacheSize = GetArg("-sigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE);
+        nMaxCacheSize = std::max(std::min(nMaxCacheSize, (int64)MAX_DIGEST_CACHE_SIZE), (int64)0);
+        nBytes = (uint64)nMaxCacheSize << 20;
     }
+    signatureCache.Resize(nBytes);
+}
 
-    void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
-    {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
-
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
-    }
-};
+void GetSignatureCacheStats(CDigestCacheStats &stats)
+{
+    signatureCache.GetStats(stats);
+}
 
 bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubKey, const CScript &scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags)
+              const CTransaction& txTo, unsigned int nIn, int nHashType, int flags, const CSignatureHashCache* pcache)
 {
-    static CSignatureCache signatureCache;
-
     CPubKey pubkey(vchPubKey);
     if (!pubkey.IsValid())
         return false;
@@ -1111,16 +1179,18 @@ bool CheckSig(vector<unsigned char> vchSig, const vector<unsigned char> &vchPubK
         return false;
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType, pcache);
 
-    if (signatureCache.Get(sighash, vchSig, pubkey))
+    // a signature in a block being connected will not be checked again
+    uint256 entry = GetSignatureCacheEntry(sighash, vchSig, pubkey);
+    if (signatureCache.Contains(entry, flags & SCRIPT_VERIFY_UNCACHE))
         return true;
 
     if (!pubkey.Verify(sighash, vchSig))
         return false;
 
     if (!(flags & SCRIPT_VERIFY_NOCACHE))
-        signatureCache.Set(sighash, vchSig, pubkey);
+        signatureCache.Insert(entry);
 
     return true;
 }
@@ -1516,14 +1586,14 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
 }
 
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
-                  unsigned int flags, int nHashType)
+                  unsigned int flags, int nHashType, const CSignatureHashCache* pcache)
 {
     vector<vector<unsigned char> > stack, stackCopy;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptSig, txTo, nIn, flags, nHashType, pcache))
         return false;
     if (flags & SCRIPT_VERIFY_P2SH)
         stackCopy = stack;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, flags, nHashType, pcache))
         return false;
     if (stack.empty())
         return false;
@@ -1546,7 +1616,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
 
-        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType))
+        if (!EvalScript(stackCopy, pubKey2, txTo, nIn, flags, nHashType, pcache))
             return false;
         if (stackCopy.empty())
             return false;
@@ -1561,6 +1631,8 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
 {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
+    // the scriptSig is about to change
+    txTo.InvalidateCache();
 
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
@@ -1937,3 +2009,60 @@ bool CScriptCompressor::Decompress(unsigned int nSize, const std::vector<unsigne
     }
     return false;
 }
+
+servicetype DecodeServiceScript(const CScript& script, int& op, vector<vector<unsigned char> >& vvch, CScript::const_iterator& pc)
+{
+    opcodetype opcode;
+    if (!script.GetOp(pc, opcode))
+        return SERVICE_NONE;
+    if (opcode < OP_1 || opcode > OP_16)
+        return SERVICE_NONE;
+
+    op = CScript::DecodeOP_N(opcode);
+
+    for (;;) {
+        vector<unsigned char> vch;
+        if (!script.GetOp(pc, opcode, vch))
+            return SERVICE_NONE;
+        if (opcode == OP_DROP || opcode == OP_2DROP || opcode == OP_NOP)
+            break;
+        if (!(opcode >= 0 && opcode <= OP_PUSHDATA4))
+            return SERVICE_NONE;
+        vvch.push_back(vch);
+    }
+
+    // move the pc to after any DROP or NOP
+    while (opcode == OP_DROP || opcode == OP_2DROP || opcode == OP_NOP) {
+        if (!script.GetOp(pc, opcode))
+            break;
+    }
+
+    pc--;
+
+    switch (op)
+    {
+    case OP_ALIAS_NEW:
+        return vvch.size() == 1 ? SERVICE_ALIAS : SERVICE_NONE;
+    case OP_ALIAS_ACTIVATE:
+        return vvch.size() == 3 ? SERVICE_ALIAS : SERVICE_NONE;
+    case OP_ALIAS_UPDATE:
+        return vvch.size() == 2 ? SERVICE_ALIAS : SERVICE_NONE;
+    case OP_OFFER_NEW:
+        return vvch.size() == 1 ? SERVICE_OFFER : SERVICE_NONE;
+    case OP_OFFER_ACTIVATE:
+    case OP_OFFER_ACCEPT:
+        return vvch.size() == 3 ? SERVICE_OFFER : SERVICE_NONE;
+    case OP_OFFER_UPDATE:
+    case OP_OFFER_PAY:
+        return vvch.size() == 2 ? SERVICE_OFFER : SERVICE_NONE;
+    case OP_CERTISSUER_NEW:
+        return vvch.size() == 1 ? SERVICE_CERT : SERVICE_NONE;
+    case OP_CERTISSUER_ACTIVATE:
+    case OP_CERT_NEW:
+        return vvch.size() == 3 ? SERVICE_CERT : SERVICE_NONE;
+    case OP_CERTISSUER_UPDATE:
+    case OP_CERT_TRANSFER:
+        return vvch.size() == 2 ? SERVICE_CERT : SERVICE_NONE;
+    }
+    return SERVICE_NONE;
+}
@@ -11,11 +11,15 @@
 #include <boost/foreach.hpp>
 #include <boost/variant.hpp>
 
+#include <openssl/sha.h>
+
 #include "keystore.h"
 #include "bignum.h"
 
 class CCoins;
 class CTransaction;
+class CSignatureHashCache;
+struct CDigestCacheStats;
 
 static const unsigned int MAX_SCRIPT_ELEMENT_SIZE = 520; // bytes
 
@@ -34,7 +38,9 @@ enum
     SCRIPT_VERIFY_NONE      = 0,
     SCRIPT_VERIFY_P2SH      = (1U << 0),
     SCRIPT_VERIFY_STRICTENC = (1U << 1),
-    SCRIPT_VERIFY_NOCACHE   = (1U << 2),
+    SCRIPT_VERIFY_NOCACHE   = (1U << 2), // do not store valid signatures in the cache
+    SCRIPT_VERIFY_UNCACHE   = (1U << 3), // drop signatures from the cache once found there
+    SCRIPT_VERIFY_ENCFAIL   = (1U << 4), // with STRICTENC, fail on a non-canonical encoding rather than push false
 };
 
 enum txnouttype
@@ -47,6 +53,16 @@ enum txnouttype
     TX_MULTISIG,
 };
 
+/** Syscoin services an output script can carry */
+enum servicetype
+{
+    SERVICE_NONE = -1,
+    SERVICE_ALIAS,
+    SERVICE_OFFER,
+    SERVICE_CERT,
+    SERVICE_TYPES,
+};
+
 class CNoDestination {
 public:
     friend bool operator==(const CNoDestination &a, const CNoDestination &b) { return true; }
@@ -701,7 +717,39 @@ public:
 bool IsCanonicalPubKey(const std::vector<unsigned char> &vchPubKey);
 bool IsCanonicalSignature(const std::vector<unsigned char> &vchSig);
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+/** The parts of the SIGHASH_ALL signature hashes of a transaction that are
+ *  the same for each of its inputs: the inputs with blank scripts, with the
+ *  SHA256 state at the start of each, and the outputs, nLockTime and data
+ *  that follow them. Computed once for a transaction with several inputs, and
+ *  then only read, from any thread, while its signatures are checked.
+ */
+class CSignatureHashCache
+{
+public:
+    // nVersion, the number of inputs and each input with an empty scriptSig
+    std::vector<char> vchInputs;
+    // where each input starts in vchInputs, followed by its end
+    std::vector<unsigned int> vInputPos;
+    // the SHA256 state after hashing vchInputs up to each input
+    std::vector<SHA256_CTX> vMidstate;
+    // the outputs, nLockTime and data
+    std::vector<char> vchOutputs;
+
+    explicit CSignatureHashCache(const CTransaction& txTo);
+
+    // SignatureHash for a hash type that signs all inputs and outputs
+    uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType) const;
+};
+
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 32; // MiB
+
+// Size the signature cache from -sigcachesize, or from the deprecated
+// -maxsigcachesize counted in signatures; it stays empty until then.
+void InitSignatureCache();
+void GetSignatureCacheStats(CDigestCacheStats &stats);
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashCache* pcache);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHashCache* pcache = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey);
@@ -711,10 +759,15 @@ bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet)
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
 bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
 bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, unsigned int flags, int nHashType, const CSignatureHashCache* pcache = NULL);
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
 CScript CombineSignatures(CScript scriptPubKey, const CTransaction& txTo, unsigned int nIn, const CScript& scriptSig1, const CScript& scriptSig2);
 
+// Decode the OP_N <args> OP_DROP... prefix of a syscoin service script, leaving
+// pc at the first opcode after it. Returns the service whose op and number of
+// arguments match, or SERVICE_NONE.
+servicetype DecodeServiceScript(const CScript& script, int& op, std::vector<std::vector<unsigned char> >& vvch, CScript::const_iterator& pc);
+
 #endif
\ No newline at end of file
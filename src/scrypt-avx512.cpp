@@ -0,0 +1,99 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * This file was originally written by Colin Percival as part of the Tarsnap
+ * online backup system.
+ */
+
+#include "scrypt.h"
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <immintrin.h>
+#define ROTL_16WAY(a, b) _mm512_rol_epi32(a, b)
+#define XOR_ROTL_16WAY(x, a, b, r) x = _mm512_xor_si512(x, ROTL_16WAY(_mm512_add_epi32(a, b), r))
+
+/* Salsa20/8 of sixteen independent blocks, word k of each in the lanes of B[k]. */
+static inline void xor_salsa8_16way(__m512i B[16], const __m512i Bx[16])
+{
+	__m512i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm512_xor_si512(B[i], Bx[i]);
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		XOR_ROTL_16WAY(x[ 4], x[ 0], x[12],  7);  XOR_ROTL_16WAY(x[ 9], x[ 5], x[ 1],  7);
+		XOR_ROTL_16WAY(x[14], x[10], x[ 6],  7);  XOR_ROTL_16WAY(x[ 3], x[15], x[11],  7);
+
+		XOR_ROTL_16WAY(x[ 8], x[ 4], x[ 0],  9);  XOR_ROTL_16WAY(x[13], x[ 9], x[ 5],  9);
+		XOR_ROTL_16WAY(x[ 2], x[14], x[10],  9);  XOR_ROTL_16WAY(x[ 7], x[ 3], x[15],  9);
+
+		XOR_ROTL_16WAY(x[12], x[ 8], x[ 4], 13);  XOR_ROTL_16WAY(x[ 1], x[13], x[ 9], 13);
+		XOR_ROTL_16WAY(x[ 6], x[ 2], x[14], 13);  XOR_ROTL_16WAY(x[11], x[ 7], x[ 3], 13);
+
+		XOR_ROTL_16WAY(x[ 0], x[12], x[ 8], 18);  XOR_ROTL_16WAY(x[ 5], x[ 1], x[13], 18);
+		XOR_ROTL_16WAY(x[10], x[ 6], x[ 2], 18);  XOR_ROTL_16WAY(x[15], x[11], x[ 7], 18);
+
+		/* Operate on rows. */
+		XOR_ROTL_16WAY(x[ 1], x[ 0], x[ 3],  7);  XOR_ROTL_16WAY(x[ 6], x[ 5], x[ 4],  7);
+		XOR_ROTL_16WAY(x[11], x[10], x[ 9],  7);  XOR_ROTL_16WAY(x[12], x[15], x[14],  7);
+
+		XOR_ROTL_16WAY(x[ 2], x[ 1], x[ 0],  9);  XOR_ROTL_16WAY(x[ 7], x[ 6], x[ 5],  9);
+		XOR_ROTL_16WAY(x[ 8], x[11], x[10],  9);  XOR_ROTL_16WAY(x[13], x[12], x[15],  9);
+
+		XOR_ROTL_16WAY(x[ 3], x[ 2], x[ 1], 13);  XOR_ROTL_16WAY(x[ 4], x[ 7], x[ 6], 13);
+		XOR_ROTL_16WAY(x[ 9], x[ 8], x[11], 13);  XOR_ROTL_16WAY(x[14], x[13], x[12], 13);
+
+		XOR_ROTL_16WAY(x[ 0], x[ 3], x[ 2], 18);  XOR_ROTL_16WAY(x[ 5], x[ 4], x[ 7], 18);
+		XOR_ROTL_16WAY(x[10], x[ 9], x[ 8], 18);  XOR_ROTL_16WAY(x[15], x[14], x[13], 18);
+	}
+	for (i = 0; i < 16; i++)
+		B[i] = _mm512_add_epi32(B[i], x[i]);
+}
+
+void scrypt_core_avx512_16way(uint32_t *X, uint32_t *V)
+{
+	__m512i *X16 = (__m512i *)X;
+	__m512i *V16 = (__m512i *)V;
+	uint32_t i, j, k, l;
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			V16[i * 32 + k] = X16[k];
+		xor_salsa8_16way(&X16[0], &X16[16]);
+		xor_salsa8_16way(&X16[16], &X16[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* Each lane reads its own random block. */
+		for (l = 0; l < 16; l++) {
+			j = X[16 * 16 + l] & 1023;
+			for (k = 0; k < 32; k++)
+				X[k * 16 + l] ^= V[(j * 32 + k) * 16 + l];
+		}
+		xor_salsa8_16way(&X16[0], &X16[16]);
+		xor_salsa8_16way(&X16[16], &X16[0]);
+	}
+}
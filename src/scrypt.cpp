@@ -34,7 +34,7 @@
 #include <string.h>
 #include <openssl/sha.h>
 
-#if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
+#if defined(USE_SSE2)
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
 #include <intrin.h>
@@ -286,7 +286,133 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
 
+void scrypt_1024_1_1_256_sp_lanes(const char *input, char *output, char *scratchpad, int nWays, scrypt_core_multi_fn core)
+{
+	uint8_t B[128];
+	uint32_t *V, *X;
+	int k, l;
+
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+	X = V + 32 * 1024 * nWays;
+
+	for (l = 0; l < nWays; l++) {
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, (const uint8_t *)input + 80 * l, 80, 1, B, 128);
+		for (k = 0; k < 32; k++)
+			X[k * nWays + l] = le32dec(&B[4 * k]);
+	}
+
+	core(X, V);
+
+	for (l = 0; l < nWays; l++) {
+		for (k = 0; k < 32; k++)
+			le32enc(&B[4 * k], X[k * nWays + l]);
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, B, 128, 1, (uint8_t *)output + 32 * l, 32);
+	}
+}
+
+// the widest kernel the CPU supports, picked by scrypt_detect_sse2()
+static scrypt_core_multi_fn scrypt_multi_core = NULL;
+static int scrypt_multi_nways = 1;
+
+int scrypt_multi_ways()
+{
+	return scrypt_multi_nways;
+}
+
+void scrypt_1024_1_1_256_sp_multi(const char *input, char *output, int nInputs, char *scratchpad)
+{
+	while (nInputs > 0) {
+		if (scrypt_multi_core == NULL || nInputs == 1) {
+			scrypt_1024_1_1_256_sp(input, output, scratchpad);
+			input += 80;
+			output += 32;
+			nInputs--;
+		} else if (nInputs >= scrypt_multi_nways) {
+			scrypt_1024_1_1_256_sp_lanes(input, output, scratchpad, scrypt_multi_nways, scrypt_multi_core);
+			input += 80 * scrypt_multi_nways;
+			output += 32 * scrypt_multi_nways;
+			nInputs -= scrypt_multi_nways;
+		} else {
+			// fill the lanes left over with copies of the last input
+			char pinput[80 * SCRYPT_MAX_WAYS];
+			char poutput[32 * SCRYPT_MAX_WAYS];
+			int l;
+			memcpy(pinput, input, 80 * nInputs);
+			for (l = nInputs; l < scrypt_multi_nways; l++)
+				memcpy(pinput + 80 * l, input + 80 * (nInputs - 1), 80);
+			scrypt_1024_1_1_256_sp_lanes(pinput, poutput, scratchpad, scrypt_multi_nways, scrypt_multi_core);
+			memcpy(output, poutput, 32 * nInputs);
+			nInputs = 0;
+		}
+	}
+}
+
+void scrypt_1024_1_1_256_multi(const char *input, char *output, int nInputs)
+{
+	// too large for the stack of every thread
+	char *scratchpad = (char *)malloc(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+	if (scratchpad == NULL) {
+		for (int i = 0; i < nInputs; i++)
+			scrypt_1024_1_1_256(input + 80 * i, output + 32 * i);
+		return;
+	}
+	scrypt_1024_1_1_256_sp_multi(input, output, nInputs, scratchpad);
+	free(scratchpad);
+}
+
 #if defined(USE_SSE2)
+static void scrypt_cpuid(unsigned int nLeaf, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+    int x86cpuid[4];
+    __cpuidex(x86cpuid, nLeaf, 0);
+    for (int i = 0; i < 4; i++)
+        regs[i] = (unsigned int)x86cpuid[i];
+#else
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    if (__get_cpuid_max(0, NULL) >= nLeaf)
+        __cpuid_count(nLeaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+#if defined(USE_AVX512) || defined(USE_AVX2)
+// register state the OS saves on context switches, XCR0
+static uint64_t scrypt_xgetbv()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__ ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((uint64_t)edx << 32) | eax;
+#endif
+}
+#endif
+
+void scrypt_multi_kernels(std::vector<std::pair<int, scrypt_core_multi_fn> > &vKernels)
+{
+    unsigned int regs1[4];
+    vKernels.clear();
+    scrypt_cpuid(1, regs1);
+
+#if defined(USE_AVX512) || defined(USE_AVX2)
+    unsigned int regs7[4];
+    scrypt_cpuid(7, regs7);
+    // AVX registers are only usable if the OS saves them (OSXSAVE and XCR0)
+    uint64_t nXCR0 = (regs1[2] & (1 << 27)) ? scrypt_xgetbv() : 0;
+#endif
+#if defined(USE_AVX512)
+    if ((regs7[1] & (1 << 16)) && (nXCR0 & 0xe6) == 0xe6)
+        vKernels.push_back(std::make_pair(16, &scrypt_core_avx512_16way));
+#endif
+#if defined(USE_AVX2)
+    if ((regs7[1] & (1 << 5)) && (nXCR0 & 0x6) == 0x6)
+        vKernels.push_back(std::make_pair(8, &scrypt_core_avx2_8way));
+#endif
+    if (regs1[3] & (1 << 26))
+        vKernels.push_back(std::make_pair(4, &scrypt_core_sse2_4way));
+}
+
 // By default, set to generic scrypt function. This will prevent crash in case when scrypt_detect_sse2() wasn't called
 void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_generic;
 
@@ -319,6 +445,19 @@ void scrypt_detect_sse2()
         printf("scrypt: using scrypt-generic, SSE2 unavailable.\n");
     }
 #endif // USE_SSE2_ALWAYS
+
+    std::vector<std::pair<int, scrypt_core_multi_fn> > vKernels;
+    scrypt_multi_kernels(vKernels);
+    if (!vKernels.empty()) {
+        scrypt_multi_nways = vKernels[0].first;
+        scrypt_multi_core = vKernels[0].second;
+        printf("scrypt: hashing %d lanes at once where possible.\n", scrypt_multi_nways);
+    }
+}
+#else
+void scrypt_multi_kernels(std::vector<std::pair<int, scrypt_core_multi_fn> > &vKernels)
+{
+    vKernels.clear();
 }
 #endif
 
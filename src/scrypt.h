@@ -3,6 +3,9 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#include <utility>
+#include <vector>
+
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
 void scrypt_1024_1_1_256(const char *input, char *output, unsigned char Nfactor);
@@ -26,6 +29,32 @@ extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output,
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
 
+// most inputs a multi-lane kernel hashes at once
+static const int SCRYPT_MAX_WAYS = 16;
+static const int SCRYPT_MULTI_SCRATCHPAD_SIZE = SCRYPT_MAX_WAYS * (131072 + 128) + 63;
+
+/* Hash nInputs consecutive 80 byte inputs into consecutive 32 byte outputs,
+ * as many at once as the lanes of the detected kernel allow. */
+void scrypt_1024_1_1_256_multi(const char *input, char *output, int nInputs);
+void scrypt_1024_1_1_256_sp_multi(const char *input, char *output, int nInputs, char *scratchpad);
+// number of inputs scrypt_1024_1_1_256_sp_multi hashes together, 1 without SIMD kernels
+int scrypt_multi_ways();
+// lane-interleaved scrypt core: X holds word k of lane l at X[k * ways + l]
+typedef void (*scrypt_core_multi_fn)(uint32_t *X, uint32_t *V);
+void scrypt_1024_1_1_256_sp_lanes(const char *input, char *output, char *scratchpad, int nWays, scrypt_core_multi_fn core);
+
+#if defined(USE_SSE2)
+void scrypt_core_sse2_4way(uint32_t *X, uint32_t *V);
+#endif
+#if defined(USE_AVX2)
+void scrypt_core_avx2_8way(uint32_t *X, uint32_t *V);
+#endif
+#if defined(USE_AVX512)
+void scrypt_core_avx512_16way(uint32_t *X, uint32_t *V);
+#endif
+// the kernels the CPU supports, widest first, with their number of lanes
+void scrypt_multi_kernels(std::vector<std::pair<int, scrypt_core_multi_fn> > &vKernels);
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
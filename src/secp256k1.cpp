@@ -0,0 +1,741 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "secp256k1.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// anonymous namespace with the field, scalar and group arithmetic
+namespace {
+
+#if defined(__SIZEOF_INT128__)
+typedef uint64_t limb;
+typedef unsigned __int128 dlimb;
+#else
+typedef uint32_t limb;
+typedef uint64_t dlimb;
+#endif
+
+static const int LIMB_BITS = 8 * sizeof(limb);
+static const int NLIMBS = 256 / LIMB_BITS;
+
+// A 256-bit number, least significant limb first
+struct CNum
+{
+    limb d[NLIMBS];
+};
+
+static void SetBytes(CNum &r, const unsigned char *pch)
+{
+    for (int i = 0; i < NLIMBS; i++)
+    {
+        r.d[i] = 0;
+        for (int j = 0; j < LIMB_BITS / 8; j++)
+            r.d[i] |= (limb)pch[31 - i * (LIMB_BITS / 8) - j] << (8 * j);
+    }
+}
+
+static CNum FromHex(const char *psz)
+{
+    unsigned char vch[32];
+    for (int i = 0; i < 32; i++)
+    {
+        int n = 0;
+        for (int j = 0; j < 2; j++)
+        {
+            char c = psz[2 * i + j];
+            n = 16 * n + (c <= '9' ? c - '0' : c - 'A' + 10);
+        }
+        vch[i] = n;
+    }
+    CNum r;
+    SetBytes(r, vch);
+    return r;
+}
+
+static CNum FromInt(limb n)
+{
+    CNum r;
+    memset(r.d, 0, sizeof(r.d));
+    r.d[0] = n;
+    return r;
+}
+
+static bool IsZero(const CNum &a)
+{
+    for (int i = 0; i < NLIMBS; i++)
+        if (a.d[i])
+            return false;
+    return true;
+}
+
+static bool IsOdd(const CNum &a)
+{
+    return a.d[0] & 1;
+}
+
+static int Compare(const CNum &a, const CNum &b)
+{
+    for (int i = NLIMBS - 1; i >= 0; i--)
+    {
+        if (a.d[i] < b.d[i])
+            return -1;
+        if (a.d[i] > b.d[i])
+            return 1;
+    }
+    return 0;
+}
+
+static bool operator==(const CNum &a, const CNum &b)
+{
+    return Compare(a, b) == 0;
+}
+
+// count bits of a starting at bit nPos, as a number
+static int GetBits(const CNum &a, int nPos, int nCount)
+{
+    int n = 0;
+    for (int i = 0; i < nCount; i++)
+    {
+        int nBit = nPos + i;
+        if (nBit < 256 && ((a.d[nBit / LIMB_BITS] >> (nBit % LIMB_BITS)) & 1))
+            n |= 1 << i;
+    }
+    return n;
+}
+
+// r = a + b, returning the carry
+static limb AddRaw(CNum &r, const CNum &a, const CNum &b)
+{
+    limb carry = 0;
+    for (int i = 0; i < NLIMBS; i++)
+    {
+        dlimb t = (dlimb)a.d[i] + b.d[i] + carry;
+        r.d[i] = (limb)t;
+        carry = (limb)(t >> LIMB_BITS);
+    }
+    return carry;
+}
+
+// r = a - b, returning the borrow
+static limb SubRaw(CNum &r, const CNum &a, const CNum &b)
+{
+    limb borrow = 0;
+    for (int i = 0; i < NLIMBS; i++)
+    {
+        dlimb t = (dlimb)a.d[i] - b.d[i] - borrow;
+        r.d[i] = (limb)t;
+        borrow = (limb)(t >> LIMB_BITS) & 1;
+    }
+    return borrow;
+}
+
+// product of two numbers, 2*NLIMBS limbs
+static void MulRaw(limb *t, const CNum &a, const CNum &b)
+{
+    memset(t, 0, 2 * NLIMBS * sizeof(limb));
+    for (int i = 0; i < NLIMBS; i++)
+    {
+        limb carry = 0;
+        for (int j = 0; j < NLIMBS; j++)
+        {
+            dlimb x = (dlimb)a.d[i] * b.d[j] + t[i + j] + carry;
+            t[i + j] = (limb)x;
+            carry = (limb)(x >> LIMB_BITS);
+        }
+        t[i + NLIMBS] = carry;
+    }
+}
+
+/** A prime modulus m = 2^256 - c, with c below 2^130 (both the field prime
+ *  and the group order of secp256k1 are of this form). Numbers modulo m are
+ *  always kept fully reduced, so equal numbers have equal limbs. */
+class CModulus
+{
+public:
+    CNum m;
+    CNum mMinus2;
+    limb c[NLIMBS];
+    int nc; // limbs in c
+
+    explicit CModulus(const char *pszHex)
+    {
+        m = FromHex(pszHex);
+        CNum cn;
+        SubRaw(cn, FromInt(0), m);
+        memcpy(c, cn.d, sizeof(c));
+        nc = NLIMBS;
+        while (nc > 1 && c[nc - 1] == 0)
+            nc--;
+        SubRaw(mMinus2, m, FromInt(2));
+    }
+
+    // r = a mod m, for a of n limbs: fold the part above 2^256 back in
+    // multiplied by c until it fits, then subtract m if still too big
+    void Reduce(CNum &r, const limb *a, int n) const
+    {
+        if (nc == 1 && n == 2 * NLIMBS)
+        {
+            // c fits in a limb (the field prime with 64-bit limbs): two
+            // folds without the general bookkeeping
+            dlimb acc = 0;
+            for (int i = 0; i < NLIMBS; i++)
+            {
+                acc += (dlimb)a[NLIMBS + i] * c[0] + a[i];
+                r.d[i] = (limb)acc;
+                acc >>= LIMB_BITS;
+            }
+            while (acc)
+            {
+                acc *= c[0];
+                for (int i = 0; i < NLIMBS; i++)
+                {
+                    acc += r.d[i];
+                    r.d[i] = (limb)acc;
+                    acc >>= LIMB_BITS;
+                }
+            }
+            if (Compare(r, m) >= 0)
+                SubRaw(r, r, m);
+            return;
+        }
+        limb t[2 * NLIMBS + 2], u[2 * NLIMBS + 2];
+        memcpy(t, a, n * sizeof(limb));
+        while (n > NLIMBS)
+        {
+            int nHigh = n - NLIMBS;
+            int nu = (nHigh + nc > NLIMBS ? nHigh + nc : NLIMBS) + 1;
+            memset(u, 0, nu * sizeof(limb));
+            memcpy(u, t, NLIMBS * sizeof(limb));
+            for (int i = 0; i < nHigh; i++)
+            {
+                limb carry = 0;
+                for (int j = 0; j < nc; j++)
+                {
+                    dlimb x = (dlimb)t[NLIMBS + i] * c[j] + u[i + j] + carry;
+                    u[i + j] = (limb)x;
+                    carry = (limb)(x >> LIMB_BITS);
+                }
+                for (int k = i + nc; carry; k++)
+                {
+                    dlimb x = (dlimb)u[k] + carry;
+                    u[k] = (limb)x;
+                    carry = (limb)(x >> LIMB_BITS);
+                }
+            }
+            n = nu;
+            while (n > NLIMBS && u[n - 1] == 0)
+                n--;
+            memcpy(t, u, n * sizeof(limb));
+        }
+        memset(r.d, 0, sizeof(r.d));
+        memcpy(r.d, t, n * sizeof(limb));
+        while (Compare(r, m) >= 0)
+            SubRaw(r, r, m);
+    }
+
+    void Add(CNum &r, const CNum &a, const CNum &b) const
+    {
+        if (AddRaw(r, a, b) || Compare(r, m) >= 0)
+            SubRaw(r, r, m);
+    }
+
+    void Sub(CNum &r, const CNum &a, const CNum &b) const
+    {
+        if (SubRaw(r, a, b))
+            AddRaw(r, r, m);
+    }
+
+    void Negate(CNum &r, const CNum &a) const
+    {
+        if (IsZero(a))
+            r = a;
+        else
+            SubRaw(r, m, a);
+    }
+
+    void Mul(CNum &r, const CNum &a, const CNum &b) const
+    {
+        limb t[2 * NLIMBS];
+        MulRaw(t, a, b);
+        Reduce(r, t, 2 * NLIMBS);
+    }
+
+    // r = a^e, four bits of the exponent at a time
+    void Pow(CNum &r, const CNum &a, const CNum &e) const
+    {
+        CNum vPow[16];
+        vPow[0] = FromInt(1);
+        for (int i = 1; i < 16; i++)
+            Mul(vPow[i], vPow[i - 1], a);
+        CNum x = vPow[0];
+        for (int nPos = 252; nPos >= 0; nPos -= 4)
+        {
+            for (int i = 0; i < 4; i++)
+                Mul(x, x, x);
+            int n = GetBits(e, nPos, 4);
+            if (n)
+                Mul(x, x, vPow[n]);
+        }
+        r = x;
+    }
+
+    // r = a^-1, for a not zero (m is prime)
+    void Inverse(CNum &r, const CNum &a) const
+    {
+        Pow(r, a, mMinus2);
+    }
+
+    // invert all of v with a single inversion (Montgomery's trick)
+    void BatchInverse(CNum *v, int n) const
+    {
+        if (n == 0)
+            return;
+        CNum *vProd = new CNum[n];
+        vProd[0] = v[0];
+        for (int i = 1; i < n; i++)
+            Mul(vProd[i], vProd[i - 1], v[i]);
+        CNum inv;
+        Inverse(inv, vProd[n - 1]);
+        for (int i = n - 1; i > 0; i--)
+        {
+            CNum vi;
+            Mul(vi, inv, vProd[i - 1]);
+            Mul(inv, inv, v[i]);
+            v[i] = vi;
+        }
+        v[0] = inv;
+        delete[] vProd;
+    }
+};
+
+static const CModulus field("FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEFFFFFC2F");
+static const CModulus order("FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFEBAAEDCE6AF48A03BBFD25E8CD0364141");
+
+static const CNum nHalfOrder = FromHex("7FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFF5D576E7357A4501DDFE92F46681B20A0");
+// p - n: x coordinates below it may be r or r + n
+static const CNum nFieldMinusOrder = FromHex("000000000000000000000000000000014551231950B75FC4402DA1722FC9BAEE");
+// (p + 1) / 4, as p = 3 mod 4 square roots are a power
+static const CNum nSqrtExp = FromHex("3FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFBFFFFF0C");
+static const CNum nCurveB = FromInt(7);
+
+// The endomorphism (x, y) -> (beta*x, y) multiplies points by lambda. A
+// scalar k is split into k1 + k2*lambda with k1 and k2 of about 128 bits
+// each, using the short basis of the lattice of (a, b) with a + b*lambda = 0:
+// c1 = round(k*g1 / 2^384), c2 = round(k*g2 / 2^384),
+// k2 = c1*(-b1) + c2*(-b2), k1 = k - k2*lambda.
+static const CNum nBeta = FromHex("7AE96A2B657C07106E64479EAC3434E99CF0497512F58995C1396C28719501EE");
+static const CNum nLambda = FromHex("5363AD4CC05C30E0A5261C028812645A122E22EA20816678DF02967C1B23BD72");
+static const CNum nMinusB1 = FromHex("00000000000000000000000000000000E4437ED6010E88286F547FA90ABFE4C3");
+static const CNum nMinusB2 = FromHex("FFFFFFFFFFFFFFFFFFFFFFFFFFFFFFFE8A280AC50774346DD765CDA83DB1562C");
+static const CNum nG1 = FromHex("3086D221A7D46BCDE86C90E49284EB153DAA8A1471E8CA7FE893209A45DBB031");
+static const CNum nG2 = FromHex("E4437ED6010E88286F547FA90ABFE4C4221208AC9DF506C61571B4AE8AC47F71");
+
+// round(a*b / 2^384)
+static CNum MulShift384(const CNum &a, const CNum &b)
+{
+    limb t[2 * NLIMBS];
+    MulRaw(t, a, b);
+    CNum r = FromInt(0);
+    for (int i = 0; i < NLIMBS / 2; i++)
+        r.d[i] = t[NLIMBS + NLIMBS / 2 + i];
+    if ((t[NLIMBS + NLIMBS / 2 - 1] >> (LIMB_BITS - 1)) & 1)
+        AddRaw(r, r, FromInt(1));
+    return r;
+}
+
+static void SplitLambda(CNum &k1, CNum &k2, const CNum &k)
+{
+    CNum c1 = MulShift384(k, nG1);
+    CNum c2 = MulShift384(k, nG2);
+    CNum t;
+    order.Mul(k2, c1, nMinusB1);
+    order.Mul(t, c2, nMinusB2);
+    order.Add(k2, k2, t);
+    order.Mul(t, k2, nLambda);
+    order.Sub(k1, k, t);
+}
+
+// Signed digits of a in base 2, all zero but for odd ones below 2^(w-1) in
+// absolute value with at least w-1 zeros between them. Returns the number
+// of digits.
+static int GetWNAF(int *vDigits, const CNum &a, int w)
+{
+    memset(vDigits, 0, 257 * sizeof(int));
+    int nCarry = 0, nLast = -1, nBit = 0;
+    while (nBit < 257)
+    {
+        if (GetBits(a, nBit, 1) == nCarry)
+        {
+            nBit++;
+            continue;
+        }
+        int nWord = GetBits(a, nBit, w) + nCarry;
+        nCarry = (nWord >> (w - 1)) & 1;
+        nWord -= nCarry << w;
+        vDigits[nBit] = nWord;
+        nLast = nBit;
+        nBit += w;
+    }
+    return nLast + 1;
+}
+
+struct CAffinePoint
+{
+    CNum x, y;
+};
+
+// (x/z^2, y/z^3), or the point at infinity
+struct CJacobianPoint
+{
+    CNum x, y, z;
+    bool fInfinity;
+
+    CJacobianPoint() : fInfinity(true) {}
+    explicit CJacobianPoint(const CAffinePoint &a) : x(a.x), y(a.y), z(FromInt(1)), fInfinity(false) {}
+};
+
+static void Double(CJacobianPoint &r, const CJacobianPoint &a)
+{
+    if (a.fInfinity || IsZero(a.y))
+    {
+        r.fInfinity = true;
+        return;
+    }
+    // dbl-2009-l, for a curve with a = 0
+    CNum A, B, C, D, E, F, t;
+    field.Mul(A, a.x, a.x);
+    field.Mul(B, a.y, a.y);
+    field.Mul(C, B, B);
+    field.Add(t, a.x, B);
+    field.Mul(t, t, t);
+    field.Sub(t, t, A);
+    field.Sub(t, t, C);
+    field.Add(D, t, t);
+    field.Add(E, A, A);
+    field.Add(E, E, A);
+    field.Mul(F, E, E);
+    CNum x3, y3, z3;
+    field.Add(t, D, D);
+    field.Sub(x3, F, t);
+    field.Sub(t, D, x3);
+    field.Mul(y3, E, t);
+    field.Add(C, C, C);
+    field.Add(C, C, C);
+    field.Add(C, C, C);
+    field.Sub(y3, y3, C);
+    field.Mul(z3, a.y, a.z);
+    field.Add(z3, z3, z3);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+static void Add(CJacobianPoint &r, const CJacobianPoint &a, const CJacobianPoint &b)
+{
+    if (a.fInfinity)
+    {
+        r = b;
+        return;
+    }
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+    CNum z1z1, z2z2, u1, u2, s1, s2, h, rr, t;
+    field.Mul(z1z1, a.z, a.z);
+    field.Mul(z2z2, b.z, b.z);
+    field.Mul(u1, a.x, z2z2);
+    field.Mul(u2, b.x, z1z1);
+    field.Mul(s1, a.y, b.z);
+    field.Mul(s1, s1, z2z2);
+    field.Mul(s2, b.y, a.z);
+    field.Mul(s2, s2, z1z1);
+    field.Sub(h, u2, u1);
+    field.Sub(rr, s2, s1);
+    if (IsZero(h))
+    {
+        if (IsZero(rr))
+            Double(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    CNum hh, hhh, v, x3, y3, z3;
+    field.Mul(hh, h, h);
+    field.Mul(hhh, h, hh);
+    field.Mul(v, u1, hh);
+    field.Mul(x3, rr, rr);
+    field.Sub(x3, x3, hhh);
+    field.Sub(x3, x3, v);
+    field.Sub(x3, x3, v);
+    field.Sub(t, v, x3);
+    field.Mul(y3, rr, t);
+    field.Mul(t, s1, hhh);
+    field.Sub(y3, y3, t);
+    field.Mul(z3, a.z, b.z);
+    field.Mul(z3, z3, h);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+// Add with b in affine coordinates, saving the multiplications by its z
+static void AddAffine(CJacobianPoint &r, const CJacobianPoint &a, const CAffinePoint &b)
+{
+    if (a.fInfinity)
+    {
+        r = CJacobianPoint(b);
+        return;
+    }
+    CNum z1z1, u2, s2, h, rr, t;
+    field.Mul(z1z1, a.z, a.z);
+    field.Mul(u2, b.x, z1z1);
+    field.Mul(s2, b.y, a.z);
+    field.Mul(s2, s2, z1z1);
+    field.Sub(h, u2, a.x);
+    field.Sub(rr, s2, a.y);
+    if (IsZero(h))
+    {
+        if (IsZero(rr))
+            Double(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+    CNum hh, hhh, v, x3, y3, z3;
+    field.Mul(hh, h, h);
+    field.Mul(hhh, h, hh);
+    field.Mul(v, a.x, hh);
+    field.Mul(x3, rr, rr);
+    field.Sub(x3, x3, hhh);
+    field.Sub(x3, x3, v);
+    field.Sub(x3, x3, v);
+    field.Sub(t, v, x3);
+    field.Mul(y3, rr, t);
+    field.Mul(t, a.y, hhh);
+    field.Sub(y3, y3, t);
+    field.Mul(z3, a.z, h);
+    r.x = x3;
+    r.y = y3;
+    r.z = z3;
+    r.fInfinity = false;
+}
+
+static bool IsOnCurve(const CAffinePoint &a)
+{
+    CNum y2, x3;
+    field.Mul(y2, a.y, a.y);
+    field.Mul(x3, a.x, a.x);
+    field.Mul(x3, x3, a.x);
+    field.Add(x3, x3, nCurveB);
+    return y2 == x3;
+}
+
+/** i * 16^j * G for every 4 bit window j of a scalar and i in [1, 15], so
+ *  that multiplying G takes one addition per window and no doublings. */
+class CGeneratorTable
+{
+public:
+    CAffinePoint vPoint[64][16];
+
+    CGeneratorTable()
+    {
+        CAffinePoint g;
+        g.x = FromHex("79BE667EF9DCBBAC55A06295CE870B07029BFCDB2DCE28D959F2815B16F81798");
+        g.y = FromHex("483ADA7726A3C4655DA4FBFC0E1108A8FD17B448A68554199C47D08FFB10D4B8");
+        CJacobianPoint base(g);
+        CJacobianPoint vJac[64][16];
+        for (int j = 0; j < 64; j++)
+        {
+            vJac[j][1] = base;
+            for (int i = 2; i < 16; i++)
+                Add(vJac[j][i], vJac[j][i - 1], base);
+            for (int i = 0; i < 4; i++)
+                Double(base, base);
+        }
+
+        // to affine coordinates, all with one inversion
+        CNum vZ[64 * 15];
+        for (int j = 0; j < 64; j++)
+            for (int i = 1; i < 16; i++)
+                vZ[j * 15 + i - 1] = vJac[j][i].z;
+        field.BatchInverse(vZ, 64 * 15);
+        for (int j = 0; j < 64; j++)
+        {
+            for (int i = 1; i < 16; i++)
+            {
+                const CNum &zi = vZ[j * 15 + i - 1];
+                CNum zi2, zi3;
+                field.Mul(zi2, zi, zi);
+                field.Mul(zi3, zi2, zi);
+                field.Mul(vPoint[j][i].x, vJac[j][i].x, zi2);
+                field.Mul(vPoint[j][i].y, vJac[j][i].y, zi3);
+            }
+        }
+    }
+};
+
+static const CGeneratorTable* pGeneratorTable = new CGeneratorTable();
+
+static const int WINDOW = 5;
+static const int TABLE_SIZE = 1 << (WINDOW - 2);
+
+static void AddDigit(CJacobianPoint &r, const CJacobianPoint *vOdd, const CJacobianPoint *vOddNeg, int nDigit)
+{
+    if (nDigit > 0)
+        Add(r, r, vOdd[(nDigit - 1) / 2]);
+    else if (nDigit < 0)
+        Add(r, r, vOddNeg[(-nDigit - 1) / 2]);
+}
+
+// r = na*a + ng*G
+static void Multiply(CJacobianPoint &r, const CAffinePoint &a, const CNum &na, const CNum &ng)
+{
+    // na*a = k1*a + k2*(lambda*a); either half is negated if that makes it
+    // small, with the point negated to match
+    CNum k1, k2;
+    SplitLambda(k1, k2, na);
+    bool fNeg1 = Compare(k1, nHalfOrder) > 0;
+    bool fNeg2 = Compare(k2, nHalfOrder) > 0;
+    if (fNeg1)
+        order.Negate(k1, k1);
+    if (fNeg2)
+        order.Negate(k2, k2);
+
+    // odd multiples of a and of lambda*a, and their negations
+    CJacobianPoint vOdd1[TABLE_SIZE], vOdd1Neg[TABLE_SIZE], vOdd2[TABLE_SIZE], vOdd2Neg[TABLE_SIZE];
+    CJacobianPoint a2, aj(a);
+    Double(a2, aj);
+    vOdd1[0] = aj;
+    for (int i = 1; i < TABLE_SIZE; i++)
+        Add(vOdd1[i], vOdd1[i - 1], a2);
+    for (int i = 0; i < TABLE_SIZE; i++)
+    {
+        vOdd2[i] = vOdd1[i];
+        field.Mul(vOdd2[i].x, vOdd1[i].x, nBeta);
+        if (fNeg1)
+            field.Negate(vOdd1[i].y, vOdd1[i].y);
+        if (fNeg2)
+            field.Negate(vOdd2[i].y, vOdd2[i].y);
+        vOdd1Neg[i] = vOdd1[i];
+        field.Negate(vOdd1Neg[i].y, vOdd1[i].y);
+        vOdd2Neg[i] = vOdd2[i];
+        field.Negate(vOdd2Neg[i].y, vOdd2[i].y);
+    }
+
+    int vDigits1[257], vDigits2[257];
+    int nDigits1 = GetWNAF(vDigits1, k1, WINDOW);
+    int nDigits2 = GetWNAF(vDigits2, k2, WINDOW);
+    int nDigits = nDigits1 > nDigits2 ? nDigits1 : nDigits2;
+
+    CJacobianPoint x;
+    for (int i = nDigits - 1; i >= 0; i--)
+    {
+        Double(x, x);
+        AddDigit(x, vOdd1, vOdd1Neg, vDigits1[i]);
+        AddDigit(x, vOdd2, vOdd2Neg, vDigits2[i]);
+    }
+
+    for (int j = 0; j < 64; j++)
+    {
+        int n = GetBits(ng, 4 * j, 4);
+        if (n)
+            AddAffine(x, x, pGeneratorTable->vPoint[j][n]);
+    }
+    r = x;
+}
+
+// Decode a public key as EC_POINT_oct2point does
+static bool ParsePubKey(CAffinePoint &a, const unsigned char *pch, unsigned int nSize)
+{
+    if (nSize == 33 && (pch[0] == 0x02 || pch[0] == 0x03))
+    {
+        SetBytes(a.x, pch + 1);
+        if (Compare(a.x, field.m) >= 0)
+            return false;
+        CNum y2;
+        field.Mul(y2, a.x, a.x);
+        field.Mul(y2, y2, a.x);
+        field.Add(y2, y2, nCurveB);
+        field.Pow(a.y, y2, nSqrtExp);
+        if (!IsOnCurve(a))
+            return false;
+        if (IsOdd(a.y) != (pch[0] & 1))
+        {
+            if (IsZero(a.y))
+                return false;
+            field.Negate(a.y, a.y);
+        }
+        return true;
+    }
+    if (nSize == 65 && (pch[0] == 0x04 || pch[0] == 0x06 || pch[0] == 0x07))
+    {
+        SetBytes(a.x, pch + 1);
+        SetBytes(a.y, pch + 33);
+        if (Compare(a.x, field.m) >= 0 || Compare(a.y, field.m) >= 0)
+            return false;
+        // hybrid keys carry the parity of y in the header as well
+        if (pch[0] != 0x04 && IsOdd(a.y) != (pch[0] & 1))
+            return false;
+        return IsOnCurve(a);
+    }
+    return false;
+}
+
+// r and s in [1, n-1] and the public key valid; e is the hash as a number
+static bool ParseCheck(const CECDSACheck &check, CAffinePoint &pubkey, CNum &e, CNum &r, CNum &s)
+{
+    if (!ParsePubKey(pubkey, check.pubkey, check.nPubKeySize))
+        return false;
+    SetBytes(e, check.hash);
+    SetBytes(r, check.r);
+    SetBytes(s, check.s);
+    if (IsZero(r) || Compare(r, order.m) >= 0)
+        return false;
+    if (IsZero(s) || Compare(s, order.m) >= 0)
+        return false;
+    return true;
+}
+
+// R = (e/s)*G + (r/s)*pubkey must have an x coordinate of r modulo n
+static bool VerifyWithInverse(const CAffinePoint &pubkey, const CNum &e, const CNum &r, const CNum &sinv)
+{
+    CNum u1, u2;
+    order.Mul(u1, e, sinv);
+    order.Mul(u2, r, sinv);
+    CJacobianPoint x;
+    Multiply(x, pubkey, u2, u1);
+    if (x.fInfinity)
+        return false;
+
+    // compare in Jacobian coordinates, x = X/Z^2, to avoid an inversion
+    CNum zz, t;
+    field.Mul(zz, x.z, x.z);
+    field.Mul(t, r, zz);
+    if (t == x.x)
+        return true;
+    if (Compare(r, nFieldMinusOrder) >= 0)
+        return false;
+    CNum rn;
+    AddRaw(rn, r, order.m);
+    field.Mul(t, rn, zz);
+    return t == x.x;
+}
+
+}; // end of anonymous namespace
+
+bool Secp256k1Verify(const CECDSACheck &check)
+{
+    CAffinePoint pubkey;
+    CNum e, r, s, sinv;
+    if (!ParseCheck(check, pubkey, e, r, s))
+        return false;
+    order.Inverse(sinv, s);
+    return VerifyWithInverse(pubkey, e, r, sinv);
+}
@@ -0,0 +1,25 @@
+// Copyright (c) 2013 The Bitcoin developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef BITCOIN_SECP256K1_H
+#define BITCOIN_SECP256K1_H
+
+/** An ECDSA signature on secp256k1 to be verified: the hash that was signed
+ *  and r and s of the signature as 32 byte big-endian numbers, and the public
+ *  key as it is serialized. */
+struct CECDSACheck
+{
+    unsigned char hash[32];
+    unsigned char r[32];
+    unsigned char s[32];
+    unsigned char pubkey[65];
+    unsigned int nPubKeySize;
+};
+
+/** Verify a signature without going through OpenSSL. The public key may be
+ *  compressed, uncompressed or hybrid, and must be a point on the curve; r
+ *  and s must be in [1, n-1]. These are the checks ECDSA_verify makes, so both
+ *  accept exactly the same signatures. Thread safe. */
+bool Secp256k1Verify(const CECDSACheck &check);
+
+#endif
@@ -0,0 +1,416 @@
+#include "servicedb.h"
+#include "main.h"
+
+#include <boost/scoped_ptr.hpp>
+
+using namespace std;
+
+static const string strBestBlockKey = "sbestblock";
+static const string strUndoPrefix = "sundo";
+static const string strExpiryPrefix = "sexpiry";
+static const string strExpiryNamePrefix = "sexpiryn";
+static const string strArchivePrefix = "sarchive";
+static const string strCountsKey = "scounts";
+static const string strRescanKey = "srescan";
+
+static string UndoKey(int nHeight) {
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << make_pair(strUndoPrefix, CBigEndianKey(nHeight));
+    return ssKey.str();
+}
+
+/** Forward iterator over a service DB with its cache layers merged in. */
+class CServiceDBIterator : public leveldb::Iterator {
+private:
+    leveldb::Iterator *piter;
+    const vector<CServiceCacheMap> &vLayers;
+    bool fValid;
+    string strKey;
+    string strValue;
+
+    // move to the first visible record at or after strFrom
+    void Settle(string strFrom, bool fInclusive) {
+        while (true) {
+            while (piter->Valid()) {
+                int nCmp = piter->key().compare(strFrom);
+                if (nCmp > 0 || (nCmp == 0 && fInclusive))
+                    break;
+                piter->Next();
+            }
+
+            bool fFound = false;
+            string strNext;
+            if (piter->Valid()) {
+                strNext = piter->key().ToString();
+                fFound = true;
+            }
+            for (unsigned int i = 0; i < vLayers.size(); i++) {
+                CServiceCacheMap::const_iterator it = fInclusive ? vLayers[i].lower_bound(strFrom) : vLayers[i].upper_bound(strFrom);
+                if (it != vLayers[i].end() && (!fFound || it->first < strNext)) {
+                    strNext = it->first;
+                    fFound = true;
+                }
+            }
+            if (!fFound) {
+                fValid = false;
+                return;
+            }
+
+            // the topmost layer holding the key decides its value
+            int i = vLayers.size() - 1;
+            CServiceCacheMap::const_iterator it;
+            for (; i >= 0; i--) {
+                it = vLayers[i].find(strNext);
+                if (it != vLayers[i].end())
+                    break;
+            }
+            if (i >= 0 && it->second.fErased) {
+                strFrom = strNext;
+                fInclusive = false;
+                continue;
+            }
+            strKey = strNext;
+            strValue = i >= 0 ? it->second.strValue : piter->value().ToString();
+            fValid = true;
+            return;
+        }
+    }
+
+public:
+    CServiceDBIterator(leveldb::Iterator *piterIn, const vector<CServiceCacheMap> &vLayersIn) : piter(piterIn), vLayers(vLayersIn), fValid(false) {}
+    ~CServiceDBIterator() { delete piter; }
+
+    bool Valid() const { return fValid; }
+    void SeekToFirst() { piter->SeekToFirst(); Settle(string(), true); }
+    void Seek(const leveldb::Slice& target) { piter->Seek(target); Settle(target.ToString(), true); }
+    void Next() { assert(fValid); Settle(strKey, false); }
+    leveldb::Slice key() const { return strKey; }
+    leveldb::Slice value() const { return strValue; }
+
+    // none of the service DBs iterate backwards
+    void SeekToLast() { fValid = false; }
+    void Prev() { fValid = false; }
+    leveldb::Status status() const {
+        return piter->status();
+    }
+};
+
+/** Folds the puts and deletes of a CLevelDBBatch into a CServiceDB cache. */
+class CServiceBatchHandler : public leveldb::WriteBatch::Handler {
+public:
+    vector<pair<string, CServiceCacheEntry> > vEntries;
+
+    void Put(const leveldb::Slice& key, const leveldb::Slice& value) {
+        vEntries.push_back(make_pair(key.ToString(), CServiceCacheEntry(value.ToString())));
+    }
+    void Delete(const leveldb::Slice& key) {
+        vEntries.push_back(make_pair(key.ToString(), CServiceCacheEntry()));
+    }
+};
+
+CServiceDB::CServiceDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(path, nCacheSize, fMemory, fWipe) {
+    vLayers.resize(1);
+    fCaptureUndo = false;
+    nUndoHeight = 0;
+}
+
+bool CServiceDB::GetRaw(const string &strKey, string &strValue) {
+    {
+        LOCK(cs_cache);
+        for (int i = vLayers.size() - 1; i >= 0; i--) {
+            CServiceCacheMap::const_iterator it = vLayers[i].find(strKey);
+            if (it != vLayers[i].end()) {
+                if (it->second.fErased)
+                    return false;
+                strValue = it->second.strValue;
+                return true;
+            }
+        }
+    }
+    return ReadRaw(strKey, strValue);
+}
+
+void CServiceDB::PutRaw(const string &strKey, const CServiceCacheEntry &entry) {
+    LOCK(cs_cache);
+    if (fCaptureUndo && !setUndoKeys.count(strKey)) {
+        CServiceCacheEntry prior;
+        string strPrior;
+        if (GetRaw(strKey, strPrior))
+            prior = CServiceCacheEntry(strPrior);
+        undo.vPrior.push_back(make_pair(strKey, prior));
+        setUndoKeys.insert(strKey);
+    }
+    vLayers.back()[strKey] = entry;
+    RecordChanged(strKey);
+}
+
+bool CServiceDB::DecodeRecordKey(const string &strKey, const string &strPrefix, vector<unsigned char> &vchName) {
+    // compare the serialized prefix before decoding anything
+    if (strKey.size() <= strPrefix.size() + 1 || (unsigned char)strKey[0] != strPrefix.size()
+            || strKey.compare(1, strPrefix.size(), strPrefix) != 0)
+        return false;
+    try {
+        CDataStream ssKey(strKey.data() + 1 + strPrefix.size(), strKey.data() + strKey.size(), SER_DISK, CLIENT_VERSION);
+        ssKey >> vchName;
+    } catch (std::exception &e) {
+        return false;
+    }
+    return true;
+}
+
+bool CServiceDB::WriteBatch(CLevelDBBatch &batch) {
+    CServiceBatchHandler handler;
+    if (!batch.batch.Iterate(&handler).ok())
+        return error("CServiceDB::WriteBatch() : corrupt batch");
+    LOCK(cs_cache);
+    for (unsigned int i = 0; i < handler.vEntries.size(); i++)
+        PutRaw(handler.vEntries[i].first, handler.vEntries[i].second);
+    return true;
+}
+
+leveldb::Iterator *CServiceDB::NewIterator() {
+    return new CServiceDBIterator(CLevelDB::NewIterator(), vLayers);
+}
+
+void CServiceDB::BeginView() {
+    LOCK(cs_cache);
+    vLayers.push_back(CServiceCacheMap());
+}
+
+void CServiceDB::CommitView() {
+    LOCK(cs_cache);
+    assert(vLayers.size() > 1);
+    CServiceCacheMap &mapBelow = vLayers[vLayers.size() - 2];
+    CServiceCacheMap &mapTop = vLayers.back();
+    for (CServiceCacheMap::iterator it = mapTop.begin(); it != mapTop.end(); ++it)
+        mapBelow[it->first] = it->second;
+    vLayers.pop_back();
+}
+
+void CServiceDB::DiscardView() {
+    LOCK(cs_cache);
+    assert(vLayers.size() > 1);
+    CServiceCacheMap mapTop;
+    mapTop.swap(vLayers.back());
+    vLayers.pop_back();
+    for (CServiceCacheMap::const_iterator it = mapTop.begin(); it != mapTop.end(); ++it)
+        RecordChanged(it->first);
+    fCaptureUndo = false;
+    undo.SetNull();
+    setUndoKeys.clear();
+}
+
+void CServiceDB::BeginBlockUndo(const CBlockIndex *pindex) {
+    LOCK(cs_cache);
+    fCaptureUndo = true;
+    nUndoHeight = pindex->nHeight;
+    undo.SetNull();
+    undo.hashBlock = pindex->GetBlockHash();
+    setUndoKeys.clear();
+}
+
+void CServiceDB::WriteBlockUndo() {
+    LOCK(cs_cache);
+    if (!fCaptureUndo)
+        return;
+    fCaptureUndo = false;
+    CDataStream ssUndo(SER_DISK, CLIENT_VERSION);
+    ssUndo << undo;
+    PutRaw(UndoKey(nUndoHeight), CServiceCacheEntry(ssUndo.str()));
+    if (nUndoHeight >= SERVICE_UNDO_DEPTH)
+        PutRaw(UndoKey(nUndoHeight - SERVICE_UNDO_DEPTH), CServiceCacheEntry());
+    undo.SetNull();
+    setUndoKeys.clear();
+}
+
+bool CServiceDB::ApplyBlockUndo(const CBlockIndex *pindex) {
+    LOCK(cs_cache);
+    CServiceUndo blockUndo;
+    string strKey = UndoKey(pindex->nHeight);
+    string strValue;
+    if (!GetRaw(strKey, strValue))
+        return false;
+    try {
+        CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+        ssValue >> blockUndo;
+    } catch (std::exception &e) {
+        return error("CServiceDB::ApplyBlockUndo() : deserialize error");
+    }
+    if (blockUndo.hashBlock != pindex->GetBlockHash())
+        return false;
+
+    for (unsigned int i = 0; i < blockUndo.vPrior.size(); i++)
+        PutRaw(blockUndo.vPrior[i].first, blockUndo.vPrior[i].second);
+    PutRaw(strKey, CServiceCacheEntry());
+    return true;
+}
+
+bool CServiceDB::ReadCounts(CServiceCounts &counts) {
+    return Read(strCountsKey, counts);
+}
+
+bool CServiceDB::UpdateExpiry(const vector<unsigned char> &vchName, int nExpiry) {
+    LOCK(cs_cache);
+    CServiceCounts counts;
+    ReadCounts(counts);
+    int nOldExpiry;
+    if (Read(make_pair(strExpiryNamePrefix, vchName), nOldExpiry)) {
+        if (nOldExpiry == nExpiry)
+            return true;
+        Erase(make_pair(strExpiryPrefix, make_pair(CBigEndianKey(nOldExpiry), vchName)));
+        if (nOldExpiry > counts.nHeight)
+            counts.nLive--;
+        else
+            counts.nExpired--;
+    } else if (ExistsArchived(vchName)) {
+        // written again after it was archived, e.g. a reactivated alias
+        Erase(make_pair(strArchivePrefix, vchName));
+        counts.nArchived--;
+    }
+
+    if (nExpiry >= 0) {
+        Write(make_pair(strExpiryPrefix, make_pair(CBigEndianKey(nExpiry), vchName)), string());
+        Write(make_pair(strExpiryNamePrefix, vchName), nExpiry);
+        if (nExpiry > counts.nHeight)
+            counts.nLive++;
+        else
+            counts.nExpired++;
+    } else
+        Erase(make_pair(strExpiryNamePrefix, vchName));
+    return Write(strCountsKey, counts);
+}
+
+// the (height, name) entries of the expiry index with nFrom <= height <= nTo
+static bool ReadExpiryRange(CServiceDB &db, int nFrom, int nTo, vector<pair<int, vector<unsigned char> > > &vEntries) {
+    if (nFrom > nTo)
+        return true;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(strExpiryPrefix, CBigEndianKey(nFrom));
+    for (pcursor->Seek(ssKeySet.str()); pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        try {
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            string strPrefix;
+            CBigEndianKey height;
+            vector<unsigned char> vchName;
+            ssKey >> strPrefix;
+            if (strPrefix != strExpiryPrefix)
+                break;
+            ssKey >> height >> vchName;
+            if ((int)height.n > nTo)
+                break;
+            vEntries.push_back(make_pair((int)height.n, vchName));
+        } catch (std::exception &e) {
+            return error("ReadExpiryRange() : deserialize error");
+        }
+    }
+    return true;
+}
+
+bool CServiceDB::ExpireRecords(int nHeight) {
+    if (strHeadPrefix.empty())
+        return true;
+    LOCK(cs_cache);
+    CServiceCounts counts;
+    ReadCounts(counts);
+
+    // both ranges hold about one block's worth of entries; they are read
+    // before anything is written, the cache must not change under an iterator
+    vector<pair<int, vector<unsigned char> > > vExpired, vArchive;
+    if (!ReadExpiryRange(*this, counts.nHeight + 1, nHeight, vExpired))
+        return false;
+    if (!ReadExpiryRange(*this, 0, nHeight - SERVICE_UNDO_DEPTH, vArchive))
+        return false;
+
+    counts.nLive -= vExpired.size();
+    counts.nExpired += vExpired.size();
+    if (nHeight > counts.nHeight)
+        counts.nHeight = nHeight;
+
+    for (unsigned int i = 0; i < vArchive.size(); i++) {
+        const vector<unsigned char> &vchName = vArchive[i].second;
+        string strHeadKey = KeyString(make_pair(strHeadPrefix, vchName));
+        string strValue;
+        if (GetRaw(strHeadKey, strValue)) {
+            HeadArchived(vchName);
+            PutRaw(KeyString(make_pair(strArchivePrefix, vchName)), CServiceCacheEntry(strValue));
+            PutRaw(strHeadKey, CServiceCacheEntry());
+        }
+        Erase(make_pair(strExpiryPrefix, make_pair(CBigEndianKey(vArchive[i].first), vchName)));
+        Erase(make_pair(strExpiryNamePrefix, vchName));
+        counts.nExpired--;
+        counts.nArchived++;
+    }
+    return Write(strCountsKey, counts);
+}
+
+bool CServiceDB::CheckExpiryIndex() {
+    if (strHeadPrefix.empty() || Exists(strCountsKey))
+        return true;
+
+    LOCK(cs_cache);
+    printf("Indexing %s expiry...\n", strHeadPrefix.c_str());
+    vector<pair<vector<unsigned char>, int> > vHeads;
+    {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << make_pair(strHeadPrefix, vector<unsigned char>());
+        for (pcursor->Seek(ssKeySet.str()); pcursor->Valid(); pcursor->Next()) {
+            leveldb::Slice slKey = pcursor->key();
+            vector<unsigned char> vchName;
+            if (!DecodeRecordKey(slKey.ToString(), strHeadPrefix, vchName))
+                break;
+            vHeads.push_back(make_pair(vchName, GetHeadExpiry(pcursor->value().ToString())));
+        }
+    }
+
+    // everything counts as live until the next block expires it
+    Write(strCountsKey, CServiceCounts());
+    for (unsigned int i = 0; i < vHeads.size(); i++)
+        if (vHeads[i].second >= 0)
+            UpdateExpiry(vHeads[i].first, vHeads[i].second);
+    return true;
+}
+
+bool CServiceDB::WriteRescanCheckpoint(const uint256 &hashBlock) {
+    return Write(strRescanKey, hashBlock);
+}
+
+bool CServiceDB::ReadRescanCheckpoint(uint256 &hashBlock) {
+    return Read(strRescanKey, hashBlock);
+}
+
+bool CServiceDB::EraseRescanCheckpoint() {
+    return Erase(strRescanKey);
+}
+
+bool CServiceDB::Flush(const uint256 &hashBestBlock) {
+    LOCK(cs_cache);
+    assert(vLayers.size() == 1);
+    CLevelDBBatch batch;
+    CServiceCacheMap &mapCache = vLayers[0];
+    for (CServiceCacheMap::const_iterator it = mapCache.begin(); it != mapCache.end(); ++it) {
+        if (it->second.fErased)
+            batch.batch.Delete(it->first);
+        else
+            batch.batch.Put(it->first, it->second.strValue);
+    }
+    batch.Write(strBestBlockKey, hashBestBlock);
+    if (!CLevelDB::WriteBatch(batch))
+        return false;
+    mapCache.clear();
+    return true;
+}
+
+bool CServiceDB::ReadBestBlock(uint256 &hashBestBlock) {
+    return Read(strBestBlockKey, hashBestBlock);
+}
+
+unsigned int CServiceDB::GetCacheSize() const {
+    LOCK(cs_cache);
+    unsigned int nSize = 0;
+    for (unsigned int i = 0; i < vLayers.size(); i++)
+        nSize += vLayers[i].size();
+    return nSize;
+}
@@ -0,0 +1,296 @@
+#ifndef SERVICEDB_H
+#define SERVICEDB_H
+
+#include "leveldb.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+class CBlockIndex;
+
+// undo records of blocks this deep are dropped, a reorg cannot go that far back
+static const int SERVICE_UNDO_DEPTH = 2016;
+
+/** Buffered state of a single service DB record: its serialized value, or erased. */
+class CServiceCacheEntry {
+public:
+    bool fErased;
+    std::string strValue;
+
+    CServiceCacheEntry() {
+        fErased = true;
+    }
+
+    CServiceCacheEntry(const std::string &strValueIn) {
+        fErased = false;
+        strValue = strValueIn;
+    }
+
+    IMPLEMENT_SERIALIZE (
+        READWRITE(fErased);
+        READWRITE(strValue);
+    )
+};
+
+typedef std::map<std::string, CServiceCacheEntry> CServiceCacheMap;
+
+/** Records of a service DB as they were before a block was connected. */
+class CServiceUndo {
+public:
+    uint256 hashBlock;
+    std::vector<std::pair<std::string, CServiceCacheEntry> > vPrior;
+
+    CServiceUndo() {
+        SetNull();
+    }
+
+    IMPLEMENT_SERIALIZE (
+        READWRITE(hashBlock);
+        READWRITE(vPrior);
+    )
+
+    void SetNull() { hashBlock = 0; vPrior.clear(); }
+};
+
+/** Number of heads of a service DB in each expiry state. Updated as heads
+ *  are written and blocks connect, so reporting them needs no scan. */
+class CServiceCounts {
+public:
+    int64 nLive;     // expiring after nHeight
+    int64 nExpired;  // expired at nHeight, still in the head keyspace
+    int64 nArchived; // moved to the archive
+    int nHeight;     // height ExpireRecords last ran for
+
+    CServiceCounts() : nLive(0), nExpired(0), nArchived(0), nHeight(0) {}
+
+    IMPLEMENT_SERIALIZE (
+        READWRITE(nLive);
+        READWRITE(nExpired);
+        READWRITE(nArchived);
+        READWRITE(nHeight);
+    )
+};
+
+/** Hit and miss counts of a CServiceRecordCache, reported by getservicecacheinfo. */
+struct CServiceCacheStats {
+    unsigned int nEntries;
+    uint64 nBytes;
+    uint64 nMaxBytes;
+    uint64 nHits;
+    uint64 nMisses;
+
+    CServiceCacheStats() : nEntries(0), nBytes(0), nMaxBytes(0), nHits(0), nMisses(0) {}
+};
+
+/** Least recently used decoded records of a service DB, keyed by alias,
+ *  offer or certificate name and bounded by their approximate size.
+ *  Callers hold the owning CServiceDB's cs_cache. */
+template<typename V>
+class CServiceRecordCache {
+private:
+    struct CEntry {
+        std::vector<unsigned char> vchName;
+        V value;
+        unsigned int nSize;
+    };
+    typedef std::list<CEntry> list_type;
+
+    list_type lru; // most recently used first
+    std::map<std::vector<unsigned char>, typename list_type::iterator> mapEntries;
+    CServiceCacheStats stats;
+
+public:
+    void SetMaxBytes(uint64 nMaxBytes) {
+        stats.nMaxBytes = nMaxBytes;
+        while (stats.nBytes > stats.nMaxBytes && !lru.empty())
+            Erase(lru.back().vchName);
+    }
+
+    bool Get(const std::vector<unsigned char> &vchName, V &value) {
+        typename std::map<std::vector<unsigned char>, typename list_type::iterator>::iterator mi = mapEntries.find(vchName);
+        if (mi == mapEntries.end()) {
+            stats.nMisses++;
+            return false;
+        }
+        stats.nHits++;
+        lru.splice(lru.begin(), lru, mi->second);
+        value = mi->second->value;
+        return true;
+    }
+
+    void Put(const std::vector<unsigned char> &vchName, const V &value) {
+        Erase(vchName);
+        // decoded records take more room than serialized ones, this is a lower bound
+        unsigned int nSize = ::GetSerializeSize(value, SER_DISK, CLIENT_VERSION) + vchName.size() + 64;
+        if (nSize > stats.nMaxBytes)
+            return;
+        while (stats.nBytes + nSize > stats.nMaxBytes)
+            Erase(lru.back().vchName);
+        CEntry entry;
+        entry.vchName = vchName;
+        entry.value = value;
+        entry.nSize = nSize;
+        lru.push_front(entry);
+        mapEntries[vchName] = lru.begin();
+        stats.nBytes += nSize;
+        stats.nEntries++;
+    }
+
+    void Erase(const std::vector<unsigned char> &vchName) {
+        typename std::map<std::vector<unsigned char>, typename list_type::iterator>::iterator mi = mapEntries.find(vchName);
+        if (mi == mapEntries.end())
+            return;
+        stats.nBytes -= mi->second->nSize;
+        stats.nEntries--;
+        lru.erase(mi->second);
+        mapEntries.erase(mi);
+    }
+
+    const CServiceCacheStats &GetStats() const {
+        return stats;
+    }
+};
+
+/** Base of the alias, offer and certificate DBs.
+ *
+ *  Writes and erases are kept in memory layers, the way CCoinsViewCache
+ *  buffers coins. The bottom layer holds everything not yet on disk and is
+ *  written in one batch by Flush(), together with the hash of the block the
+ *  coins were flushed at. SetBestChain and VerifyDB open a layer on top of it
+ *  and commit or discard it depending on whether the blocks connected.
+ *  Reads, Exists and iterators see the layers merged over the DB.
+ *
+ *  While a block is being connected, the prior state of every record it
+ *  touches is collected and stored as that block's undo record, so the block
+ *  can be disconnected by restoring them.
+ *
+ *  DBs with one head record per name (alias, offer, certificate) index the
+ *  heads by the height they expire at:
+ *    "sexpiry" (height, name) and "sexpiryn" name -> height
+ *  Once a head has been expired for SERVICE_UNDO_DEPTH blocks it is moved
+ *  from the head keyspace to "sarchive" name, so scans over the heads only
+ *  see live names and the few that expired recently. Writing the head again
+ *  takes it out of the archive. */
+class CServiceDB : public CLevelDB {
+protected:
+    mutable CCriticalSection cs_cache;
+
+    // called with cs_cache held whenever the visible value of a record may
+    // have changed, so decoded copies of it can be dropped
+    virtual void RecordChanged(const std::string &strKey) {}
+    // the name of a (strPrefix, name, ...) record key; false for other keys
+    static bool DecodeRecordKey(const std::string &strKey, const std::string &strPrefix, std::vector<unsigned char> &vchName);
+
+    // key prefix of the head records covered by the expiry index, empty if none
+    std::string strHeadPrefix;
+    // expiry height of a serialized head, -1 if it never expires
+    virtual int GetHeadExpiry(const std::string &strValue) { return -1; }
+    // called with cs_cache held before the head of a name is archived
+    virtual void HeadArchived(const std::vector<unsigned char> &vchName) {}
+
+    // index the head of a name as expiring at nExpiry, -1 once it is erased
+    bool UpdateExpiry(const std::vector<unsigned char> &vchName, int nExpiry);
+    template<typename V> bool ReadArchived(const std::vector<unsigned char> &vchName, V& value) {
+        return Read(make_pair(std::string("sarchive"), vchName), value);
+    }
+    bool ExistsArchived(const std::vector<unsigned char> &vchName) {
+        return Exists(make_pair(std::string("sarchive"), vchName));
+    }
+
+private:
+    std::vector<CServiceCacheMap> vLayers;
+
+    bool fCaptureUndo;
+    int nUndoHeight;
+    CServiceUndo undo;
+    std::set<std::string> setUndoKeys;
+
+    template<typename K> static std::string KeyString(const K& key) {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(ssKey.GetSerializeSize(key));
+        ssKey << key;
+        return ssKey.str();
+    }
+
+    bool GetRaw(const std::string &strKey, std::string &strValue);
+    void PutRaw(const std::string &strKey, const CServiceCacheEntry &entry);
+
+public:
+    CServiceDB(const boost::filesystem::path &path, size_t nCacheSize, bool fMemory, bool fWipe);
+    virtual ~CServiceDB() {}
+
+    template<typename K, typename V> bool Read(const K& key, V& value) {
+        std::string strValue;
+        if (!GetRaw(KeyString(key), strValue))
+            return false;
+        try {
+            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+            ssValue >> value;
+        } catch(std::exception &e) {
+            return false;
+        }
+        return true;
+    }
+
+    template<typename K> bool Exists(const K& key) {
+        std::string strValue;
+        return GetRaw(KeyString(key), strValue);
+    }
+
+    template<typename K, typename V> bool Write(const K& key, const V& value) {
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue.reserve(ssValue.GetSerializeSize(value));
+        ssValue << value;
+        PutRaw(KeyString(key), CServiceCacheEntry(ssValue.str()));
+        return true;
+    }
+
+    template<typename K> bool Erase(const K& key) {
+        PutRaw(KeyString(key), CServiceCacheEntry());
+        return true;
+    }
+
+    // applies the batch to the cache rather than to the DB
+    bool WriteBatch(CLevelDBBatch &batch);
+
+    // iterates the DB with the cache merged in; forward only, and the cache
+    // must not change while it is in use
+    leveldb::Iterator *NewIterator();
+
+    void BeginView();
+    void CommitView();
+    void DiscardView();
+
+    // collect undo for the records written while pindex is connected
+    void BeginBlockUndo(const CBlockIndex *pindex);
+    void WriteBlockUndo();
+    // restore the records of pindex's undo record; false if it has none
+    bool ApplyBlockUndo(const CBlockIndex *pindex);
+
+    // count the heads expiring at nHeight as expired and archive the ones
+    // that expired SERVICE_UNDO_DEPTH blocks earlier
+    bool ExpireRecords(int nHeight);
+    // build the expiry index from the heads if the DB predates it
+    bool CheckExpiryIndex();
+    bool ReadCounts(CServiceCounts &counts);
+
+    // last block applied by an unfinished rebuild of the DB from the chain
+    bool WriteRescanCheckpoint(const uint256 &hashBlock);
+    bool ReadRescanCheckpoint(uint256 &hashBlock);
+    bool EraseRescanCheckpoint();
+
+    // write the bottom layer to disk, marked as consistent with hashBestBlock
+    bool Flush(const uint256 &hashBestBlock);
+    bool ReadBestBlock(uint256 &hashBestBlock);
+    unsigned int GetCacheSize() const;
+
+    // budget and counters of the decoded record caches
+    virtual void SetRecordCacheSize(uint64 nBytes) {}
+    virtual void GetRecordCacheStats(std::vector<std::pair<std::string, CServiceCacheStats> > &vStats) const {}
+};
+
+#endif // SERVICEDB_H
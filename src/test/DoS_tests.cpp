@@ -287,15 +287,27 @@ BOOST_AUTO_TEST_CASE(DoS_checkSig)
     BOOST_CHECK(!VerifySignature(CCoins(orphans[1], MEMPOOL_HEIGHT), tx, 1, flags, SIGHASH_ALL));
     std::swap(tx.vin[0].scriptSig, tx.vin[1].scriptSig);
 
-    // Exercise -maxsigcachesize code:
-    mapArgs["-maxsigcachesize"] = "10";
-    // Generate a new, different signature for vin[0] to trigger cache clear:
+    // Exercise -sigcachesize code, with the cache turned off:
+    mapArgs["-sigcachesize"] = "0";
+    InitSignatureCache();
+    // Generate a new, different signature for vin[0]:
     CScript oldSig = tx.vin[0].scriptSig;
     BOOST_CHECK(SignSignature(keystore, orphans[0], tx, 0));
     BOOST_CHECK(tx.vin[0].scriptSig != oldSig);
     for (unsigned int j = 0; j < tx.vin.size(); j++)
         BOOST_CHECK(VerifySignature(CCoins(orphans[j], MEMPOOL_HEIGHT), tx, j, flags, SIGHASH_ALL));
+    CDigestCacheStats stats;
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nBytes, 0U);
+    mapArgs.erase("-sigcachesize");
+
+    // the old option counts signatures, and is not taken for megabytes
+    mapArgs["-maxsigcachesize"] = "50000";
+    InitSignatureCache();
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK(stats.nMaxEntries > 49000 && stats.nMaxEntries <= 50000);
     mapArgs.erase("-maxsigcachesize");
+    InitSignatureCache();
 
     LimitOrphanTxSize(0);
 }
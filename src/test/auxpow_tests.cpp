@@ -0,0 +1,49 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "auxpow.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(auxpow_tests)
+
+static CAuxPow MakeAuxPow(unsigned int nChainIndex) {
+    CAuxPow auxpow;
+    auxpow.nChainIndex = nChainIndex;
+    auxpow.vChainMerkleBranch.push_back(GetRandHash());
+    auxpow.parentBlockHeader.nNonce = nChainIndex;
+    return auxpow;
+}
+
+BOOST_AUTO_TEST_CASE(auxpow_store)
+{
+    boost::filesystem::path path = GetTempPath() / strprintf("test_syscoin_auxpow_%"PRI64x".dat", GetRand(1ULL << 62));
+    CAuxPowStore store;
+    BOOST_CHECK(store.Open(path, true));
+
+    uint256 hashA = GetRandHash(), hashB = GetRandHash();
+    CAuxPow auxpowA = MakeAuxPow(1), auxpowB = MakeAuxPow(2);
+    uint64 nPosA, nPosB;
+    BOOST_CHECK(store.Append(hashA, auxpowA, nPosA));
+    BOOST_CHECK(store.Append(hashB, auxpowB, nPosB));
+    BOOST_CHECK(nPosB > nPosA);
+
+    boost::shared_ptr<CAuxPow> auxpow;
+    BOOST_CHECK(store.Read(nPosB, hashB, auxpow));
+    BOOST_CHECK(auxpow->nChainIndex == 2 && auxpow->vChainMerkleBranch == auxpowB.vChainMerkleBranch);
+    // cached, and a record only answers for its own block
+    BOOST_CHECK(store.Read(nPosB, hashB, auxpow));
+    BOOST_CHECK(!store.Read(nPosA, hashB, auxpow));
+    BOOST_CHECK(!store.Read(nPosB + 1000, hashB, auxpow));
+
+    // records survive a reopen, and a wipe drops them
+    store.Close();
+    BOOST_CHECK(store.Open(path, false));
+    BOOST_CHECK(store.Read(nPosA, hashA, auxpow));
+    BOOST_CHECK(auxpow->parentBlockHeader.nNonce == 1);
+    BOOST_CHECK(store.Open(path, true));
+    BOOST_CHECK(!store.Read(nPosA, hashA, auxpow));
+    store.Close();
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,92 @@
+#include <boost/test/unit_test.hpp>
+
+#include "blockmap.h"
+#include "util.h"
+
+#include <map>
+
+using namespace std;
+
+// counts live objects, to see that the arena destroys what it created
+struct CArenaCounted {
+    static int nLive;
+    int n;
+    CArenaCounted() : n(0) { nLive++; }
+    CArenaCounted(const CArenaCounted &x) : n(x.n) { nLive++; }
+    ~CArenaCounted() { nLive--; }
+};
+int CArenaCounted::nLive = 0;
+
+BOOST_AUTO_TEST_SUITE(blockmap_tests)
+
+BOOST_AUTO_TEST_CASE(objectarena_addresses)
+{
+    objectarena<CArenaCounted> arena;
+    vector<CArenaCounted*> vp;
+    for (int i = 0; i < 10000; i++) {
+        CArenaCounted x;
+        x.n = i;
+        vp.push_back(arena.create(x));
+    }
+    BOOST_CHECK_EQUAL(arena.size(), 10000U);
+    BOOST_CHECK_EQUAL(CArenaCounted::nLive, 10000);
+    for (int i = 0; i < 10000; i++) {
+        BOOST_CHECK_EQUAL(vp[i]->n, i);
+        BOOST_CHECK(&arena[i] == vp[i]);
+    }
+    // objects in one chunk are contiguous
+    BOOST_CHECK(vp[1] == vp[0] + 1);
+    arena.clear();
+    BOOST_CHECK(arena.empty());
+    BOOST_CHECK_EQUAL(CArenaCounted::nLive, 0);
+}
+
+BOOST_AUTO_TEST_CASE(blockmap_matches_map)
+{
+    blockmap<int> bm;
+    map<uint256, int> m;
+    vector<const uint256*> vpKeys;
+    for (int i = 0; i < 5000; i++) {
+        uint256 hash = GetRandHash();
+        pair<blockmap<int>::iterator, bool> ret = bm.insert(make_pair(hash, i));
+        BOOST_CHECK(ret.second);
+        BOOST_CHECK((*ret.first).second == i);
+        vpKeys.push_back(&ret.first->first);
+        m[hash] = i;
+    }
+    BOOST_CHECK_EQUAL(bm.size(), m.size());
+
+    // keys stay where they were as the table grows
+    for (int i = 0; i < 5000; i++)
+        BOOST_CHECK_EQUAL(bm.find(*vpKeys[i])->second, i);
+
+    // iteration is in insertion order
+    int n = 0;
+    for (blockmap<int>::const_iterator it = bm.begin(); it != bm.end(); ++it, ++n) {
+        BOOST_CHECK(&it->first == vpKeys[n]);
+        BOOST_CHECK_EQUAL(it->second, m[it->first]);
+    }
+    BOOST_CHECK_EQUAL(n, 5000);
+
+    // existing keys are not replaced
+    pair<blockmap<int>::iterator, bool> ret = bm.insert(make_pair(*vpKeys[7], -1));
+    BOOST_CHECK(!ret.second);
+    BOOST_CHECK_EQUAL(ret.first->second, 7);
+
+    uint256 hashMissing = GetRandHash();
+    BOOST_CHECK(bm.find(hashMissing) == bm.end());
+    BOOST_CHECK_EQUAL(bm.count(hashMissing), 0U);
+    BOOST_CHECK_EQUAL(bm.count(*vpKeys[42]), 1U);
+    BOOST_CHECK_EQUAL(bm[hashMissing], 0);
+    BOOST_CHECK_EQUAL(bm.count(hashMissing), 1U);
+    bm[hashMissing] = 9;
+    BOOST_CHECK_EQUAL(bm.find(hashMissing)->second, 9);
+
+    bm.clear();
+    BOOST_CHECK(bm.empty());
+    BOOST_CHECK(bm.find(m.begin()->first) == bm.end());
+    bm.insert(make_pair(hashMissing, 1));
+    BOOST_CHECK_EQUAL(bm.size(), 1U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
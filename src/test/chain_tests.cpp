@@ -0,0 +1,54 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(chain_tests)
+
+// a chain of nBlocks blocks on top of pindexFork, or from genesis if NULL
+static void BuildBranch(vector<CBlockIndex> &vBlocks, CBlockIndex *pindexFork, int nBlocks) {
+    vBlocks.resize(nBlocks);
+    for (int i = 0; i < nBlocks; i++) {
+        CBlockIndex *pprev = i ? &vBlocks[i - 1] : pindexFork;
+        vBlocks[i].pprev = pprev;
+        vBlocks[i].nHeight = pprev ? pprev->nHeight + 1 : 0;
+    }
+}
+
+BOOST_AUTO_TEST_CASE(chain_set_tip)
+{
+    vector<CBlockIndex> vMain, vSide;
+    BuildBranch(vMain, NULL, 100);
+    BuildBranch(vSide, &vMain[49], 60);
+
+    CChain chain;
+    BOOST_CHECK(chain.Tip() == NULL);
+    chain.SetTip(&vMain[99]);
+    BOOST_CHECK_EQUAL(chain.Height(), 99);
+    BOOST_CHECK(chain.Genesis() == &vMain[0]);
+    BOOST_CHECK(chain[42] == &vMain[42]);
+    BOOST_CHECK(chain[100] == NULL && chain[-1] == NULL);
+    BOOST_CHECK(chain.Contains(&vMain[70]));
+    BOOST_CHECK(!chain.Contains(&vSide[0]));
+    BOOST_CHECK(chain.Next(&vMain[10]) == &vMain[11]);
+    BOOST_CHECK(chain.Next(&vMain[99]) == NULL);
+
+    // reorganize to the longer side branch, then back to a shorter tip
+    chain.SetTip(&vSide[59]);
+    BOOST_CHECK_EQUAL(chain.Height(), 109);
+    BOOST_CHECK(chain[49] == &vMain[49]);
+    BOOST_CHECK(chain[50] == &vSide[0]);
+    BOOST_CHECK(!chain.Contains(&vMain[50]));
+    BOOST_CHECK(chain.Next(&vMain[49]) == &vSide[0]);
+
+    chain.SetTip(&vMain[80]);
+    BOOST_CHECK_EQUAL(chain.Height(), 80);
+    BOOST_CHECK(chain.Contains(&vMain[50]));
+    BOOST_CHECK(chain.Tip() == &vMain[80]);
+
+    chain.SetTip(NULL);
+    BOOST_CHECK(chain.Genesis() == NULL);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
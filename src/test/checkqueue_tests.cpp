@@ -0,0 +1,142 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/thread.hpp>
+
+#include "checkqueue.h"
+#include "hash.h"
+#include "util.h"
+
+using namespace std;
+
+// counts how often it ran, and hashes a while like a signature check would
+struct CCountingCheck {
+    boost::mutex *pmutex;
+    int *pnRun;
+    bool fOk;
+    int nHashes;
+
+    CCountingCheck() : pmutex(NULL), pnRun(NULL), fOk(true), nHashes(0) {}
+    CCountingCheck(boost::mutex *pmutexIn, int *pnRunIn, bool fOkIn, int nHashesIn) :
+        pmutex(pmutexIn), pnRun(pnRunIn), fOk(fOkIn), nHashes(nHashesIn) {}
+
+    bool operator()() {
+        uint256 hash = nHashes;
+        for (int i = 0; i < nHashes; i++)
+            hash = Hash(BEGIN(hash), END(hash));
+        if (pnRun) {
+            boost::unique_lock<boost::mutex> lock(*pmutex);
+            (*pnRun)++;
+        }
+        return fOk;
+    }
+
+    void swap(CCountingCheck &check) {
+        std::swap(pmutex, check.pmutex);
+        std::swap(pnRun, check.pnRun);
+        std::swap(fOk, check.fOk);
+        std::swap(nHashes, check.nHashes);
+    }
+};
+
+// a queue with nThreads threads taking part, the master included
+struct CQueueThreads {
+    CCheckQueue<CCountingCheck> queue;
+    boost::thread_group threadGroup;
+
+    CQueueThreads(int nThreads, unsigned int nBatchSize) : queue(nBatchSize) {
+        for (int i = 0; i < nThreads - 1; i++)
+            threadGroup.create_thread(boost::bind(&CCheckQueue<CCountingCheck>::Thread, &queue));
+    }
+
+    ~CQueueThreads() {
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+};
+
+// Add nChecks checks in groups of 1 to 5, like the scripts of a block's
+// transactions, with check nFail failing, and wait for them.
+static bool RunChecks(CCheckQueue<CCountingCheck> &queue, int nChecks, int nFail, int nHashes, int &nRun) {
+    boost::mutex mutex;
+    nRun = 0;
+    CCheckQueueControl<CCountingCheck> control(&queue);
+    for (int i = 0; i < nChecks; ) {
+        vector<CCountingCheck> vChecks;
+        for (int n = 1 + GetRand(5); n > 0 && i < nChecks; n--, i++)
+            vChecks.push_back(CCountingCheck(&mutex, &nRun, i != nFail, nHashes));
+        control.Add(vChecks);
+    }
+    return control.Wait();
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_results)
+{
+    const int vThreads[] = {1, 2, 5};
+    BOOST_FOREACH(int nThreads, vThreads) {
+        CQueueThreads threads(nThreads, 128);
+        for (int i = 0; i < 200; i++) {
+            int nChecks = GetRand(500);
+            int nRun;
+            BOOST_CHECK(RunChecks(threads.queue, nChecks, -1, 0, nRun));
+            BOOST_CHECK_EQUAL(nRun, nChecks);
+        }
+        // a failure fails the round, and only that round
+        for (int i = 0; i < 200; i++) {
+            int nChecks = 1 + GetRand(500);
+            int nRun;
+            BOOST_CHECK(!RunChecks(threads.queue, nChecks, GetRand(nChecks), 0, nRun));
+            BOOST_CHECK(RunChecks(threads.queue, nChecks, -1, 0, nRun));
+            BOOST_CHECK_EQUAL(nRun, nChecks);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_control)
+{
+    // nothing added, or no queue at all
+    CQueueThreads threads(3, 16);
+    {
+        CCheckQueueControl<CCountingCheck> control(&threads.queue);
+        BOOST_CHECK(control.Wait());
+    }
+    CCheckQueueControl<CCountingCheck> control(NULL);
+    vector<CCountingCheck> vChecks(1, CCountingCheck(NULL, NULL, false, 0));
+    control.Add(vChecks);
+    BOOST_CHECK(control.Wait());
+
+    // the destructor waits when Wait was not called
+    boost::mutex mutex;
+    int nRun = 0;
+    {
+        CCheckQueueControl<CCountingCheck> control(&threads.queue);
+        vector<CCountingCheck> vChecks;
+        for (int i = 0; i < 100; i++)
+            vChecks.push_back(CCountingCheck(&mutex, &nRun, true, 10));
+        control.Add(vChecks);
+    }
+    BOOST_CHECK_EQUAL(nRun, 100);
+}
+
+// Not a check as much as a measurement: checks per second from 1 to 64
+// threads, for as much as the machine running the tests shows.
+BOOST_AUTO_TEST_CASE(checkqueue_threads)
+{
+    for (int nThreads = 1; nThreads <= 64; nThreads *= 2) {
+        CQueueThreads threads(nThreads, 128);
+        int nTotal = 0;
+        int64 nStart = GetTimeMicros();
+        for (int i = 0; i < 10; i++) {
+            int nRun;
+            BOOST_CHECK(RunChecks(threads.queue, 1000, -1, 20, nRun));
+            nTotal += nRun;
+        }
+        BOOST_CHECK_EQUAL(nTotal, 10 * 1000);
+        BOOST_TEST_MESSAGE(strprintf("CCheckQueue with %d threads: %.0f checks/s", nThreads,
+                                     1e6 * nTotal / std::max(GetTimeMicros() - nStart, (int64)1)));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
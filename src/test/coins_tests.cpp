@@ -0,0 +1,205 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "util.h"
+
+#include <map>
+
+using namespace std;
+
+// a base view keeping its coins in a map, counting the entries written to it
+class CCoinsViewTest : public CCoinsView
+{
+public:
+    map<uint256, CCoins> mapCoins;
+    CBlockIndex *pindexBest;
+    unsigned int nWritten;
+
+    CCoinsViewTest() : pindexBest(NULL), nWritten(0) {}
+
+    bool GetCoins(const uint256 &txid, CCoins &coins) {
+        map<uint256, CCoins>::iterator it = mapCoins.find(txid);
+        if (it == mapCoins.end())
+            return false;
+        coins = it->second;
+        return true;
+    }
+    bool HaveCoins(const uint256 &txid) {
+        return mapCoins.count(txid) > 0;
+    }
+    CBlockIndex *GetBestBlock() {
+        return pindexBest;
+    }
+    bool SetBestBlock(CBlockIndex *pindex) {
+        pindexBest = pindex;
+        return true;
+    }
+    bool BatchWrite(CCoinsMap &mapCoinsIn, CBlockIndex *pindex) {
+        for (CCoinsMap::iterator it = mapCoinsIn.begin(); it != mapCoinsIn.end(); it++) {
+            if (!(it->second.flags & CCoinsCacheEntry::DIRTY))
+                continue;
+            nWritten++;
+            if (it->second.coins.IsPruned())
+                mapCoins.erase(it->first);
+            else
+                mapCoins[it->first] = it->second.coins;
+        }
+        pindexBest = pindex;
+        return true;
+    }
+};
+
+static CTxOut RandomTxOut(unsigned int nScriptSize) {
+    CTxOut out;
+    out.nValue = 1 + GetRand(100 * COIN);
+    out.scriptPubKey.resize(nScriptSize, OP_TRUE);
+    return out;
+}
+
+static bool CoinsMatch(const CCoins *pcoins, const CCoins &expected) {
+    if (pcoins == NULL || pcoins->IsPruned())
+        return expected.IsPruned();
+    return !expected.IsPruned() && pcoins->vout == expected.vout;
+}
+
+BOOST_AUTO_TEST_SUITE(coins_tests)
+
+// random outputs added and spent through a stack of caches, which are
+// flushed and dropped along the way, must always read as a map would
+BOOST_AUTO_TEST_CASE(coins_cache_simulation)
+{
+    vector<uint256> vTxids;
+    for (int i = 0; i < 50; i++)
+        vTxids.push_back(GetRandHash());
+    map<uint256, CCoins> mapExpected;
+
+    CCoinsViewTest base;
+    vector<CCoinsViewCache*> vStack;
+    vStack.push_back(new CCoinsViewCache(base));
+
+    for (int nStep = 0; nStep < 20000; nStep++) {
+        const uint256 &txid = vTxids[GetRand(vTxids.size())];
+        CCoins &expected = mapExpected[txid];
+        {
+            CCoinsModifier coins = vStack.back()->ModifyCoins(txid);
+            BOOST_CHECK(CoinsMatch(&*coins, expected));
+            if (GetRand(4) == 0 && !expected.IsPruned()) {
+                // spend everything
+                *coins = CCoins();
+                expected = CCoins();
+            } else if (GetRand(2) == 0 && !expected.IsPruned()) {
+                unsigned int n = GetRand(expected.vout.size());
+                coins->Spend(n);
+                expected.Spend(n);
+            } else {
+                CTxOut out = RandomTxOut(GetRand(40));
+                coins->vout.push_back(out);
+                expected.vout.push_back(out);
+            }
+        }
+
+        if (GetRand(100) == 0) {
+            BOOST_FOREACH(const uint256 &txidCheck, vTxids)
+                BOOST_CHECK(CoinsMatch(vStack.back()->AccessCoins(txidCheck), mapExpected[txidCheck]));
+        }
+
+        if (GetRand(500) == 0) {
+            // flush the top cache, and sometimes drop it or add another
+            vStack.back()->Flush();
+            BOOST_CHECK_EQUAL(vStack.back()->GetCacheSize(), 0U);
+            if (vStack.size() > 1 && GetRand(2) == 0) {
+                delete vStack.back();
+                vStack.pop_back();
+            } else if (vStack.size() < 4) {
+                vStack.push_back(new CCoinsViewCache(*(CCoinsView*)vStack.back()));
+            }
+        }
+    }
+
+    while (!vStack.empty()) {
+        vStack.back()->Flush();
+        delete vStack.back();
+        vStack.pop_back();
+    }
+    BOOST_FOREACH(const uint256 &txid, vTxids) {
+        map<uint256, CCoins>::iterator it = base.mapCoins.find(txid);
+        BOOST_CHECK(CoinsMatch(it == base.mapCoins.end() ? NULL : &it->second, mapExpected[txid]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_fresh)
+{
+    CCoinsViewTest base;
+    uint256 txidOld = GetRandHash();
+    base.mapCoins[txidOld].vout.push_back(RandomTxOut(25));
+
+    CCoinsViewCache cache(base);
+    // created and spent again in the cache: never written
+    uint256 txidNew = GetRandHash();
+    cache.ModifyNewCoins(txidNew)->vout.push_back(RandomTxOut(25));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 1U);
+    BOOST_CHECK(cache.ModifyCoins(txidNew)->Spend(0));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+
+    // read but left alone: not written either
+    BOOST_CHECK(cache.AccessCoins(txidOld) != NULL);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWritten, 0U);
+
+    // spent in the cache, erased from the base
+    BOOST_CHECK(cache.ModifyCoins(txidOld)->Spend(0));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWritten, 1U);
+    BOOST_CHECK(!base.HaveCoins(txidOld));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_memory_usage)
+{
+    CCoinsViewTest base;
+    CCoinsViewCache cache(base);
+    size_t nEmpty = cache.DynamicMemoryUsage();
+
+    uint256 txid = GetRandHash();
+    cache.ModifyNewCoins(txid)->vout.push_back(RandomTxOut(10000));
+    size_t nOne = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nOne >= nEmpty + 10000);
+
+    cache.ModifyCoins(txid)->vout.push_back(RandomTxOut(5000));
+    BOOST_CHECK(cache.DynamicMemoryUsage() >= nOne + 5000);
+
+    // spending everything created in the cache gives all of it back
+    *cache.ModifyCoins(txid) = CCoins();
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK(cache.DynamicMemoryUsage() < nEmpty + 10000);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_prefetch)
+{
+    CCoinsViewTest base;
+    vector<uint256> vTxids;
+    for (int i = 0; i < 100; i++) {
+        vTxids.push_back(GetRandHash());
+        if (i % 4 != 0)
+            base.mapCoins[vTxids[i]].vout.push_back(RandomTxOut(25));
+    }
+
+    CCoinsViewCache cache(base);
+    BOOST_CHECK(cache.AccessCoins(vTxids[1]) != NULL);
+    // duplicates and what is cached already are looked up once, if at all
+    vector<uint256> vPrefetch(vTxids);
+    vPrefetch.push_back(vTxids[5]);
+    BOOST_CHECK_EQUAL(cache.PrefetchCoins(vPrefetch), 99U);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 75U);
+    BOOST_CHECK_EQUAL(cache.PrefetchCoins(vPrefetch), 25U);
+
+    map<uint256, CCoins> mapExpected;
+    mapExpected.swap(base.mapCoins);
+    for (int i = 0; i < 100; i++)
+        BOOST_CHECK(CoinsMatch(cache.AccessCoins(vTxids[i]), mapExpected[vTxids[i]]));
+
+    // what was read is not written back
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(base.nWritten, 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
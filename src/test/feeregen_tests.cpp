@@ -0,0 +1,114 @@
+#include <boost/test/unit_test.hpp>
+
+#include <list>
+
+#include "feeregen.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+// The fee list algorithm GetBlockValue used before CFeeRegenWindow:
+// newest fee first, scanned in full for every block.
+struct ReferenceFee {
+    uint64 nHeight;
+    uint64 nTime;
+    uint64 nFee;
+};
+
+static uint64 ReferenceSubsidy(const list<ReferenceFee> &lstFees, unsigned int nHeight, unsigned int h12, bool fAverage)
+{
+    uint64 hr1 = 1, hr12 = 1;
+    unsigned int nTargetTime = 0;
+    unsigned int nTarget1hrTime = 0;
+    unsigned int blk1hrht = nHeight - 1;
+    unsigned int blk12hrht = nHeight - 1;
+    bool bFound = false;
+
+    BOOST_FOREACH(const ReferenceFee &nmFee, lstFees) {
+        if(nmFee.nHeight <= nHeight)
+            bFound = true;
+        if(bFound) {
+            if(nTargetTime==0) {
+                hr1 = hr12 = 0;
+                nTargetTime = nmFee.nTime - h12;
+                nTarget1hrTime = nmFee.nTime - (h12/12);
+            }
+            if(nmFee.nTime > nTargetTime) {
+                hr12 += nmFee.nFee;
+                blk12hrht = nmFee.nHeight;
+                if(nmFee.nTime > nTarget1hrTime) {
+                    hr1 += nmFee.nFee;
+                    blk1hrht = nmFee.nHeight;
+                }
+            }
+        }
+    }
+    hr12 /= (nHeight - blk12hrht) + 1;
+    hr1 /= (nHeight - blk1hrht) + 1;
+    if (fAverage)
+        return (hr12 + hr1) / 2;
+    return hr1 > hr12 ? hr1 : hr12;
+}
+
+BOOST_AUTO_TEST_SUITE(feeregen_tests)
+
+BOOST_AUTO_TEST_CASE(feeregen_matches_list)
+{
+    const unsigned int nWindow = 360 * 12;
+    const int nBlocks = 3000;
+
+    for (int nAverage = 0; nAverage < 2; nAverage++) {
+        CFeeRegenWindow window("test", nWindow, true, nAverage != 0);
+        list<ReferenceFee> lstFees;
+
+        // one minute blocks with jittered, occasionally non-monotonic times
+        vector<CBlockIndex> vBlocks(nBlocks);
+        unsigned int nTime = 1400000000;
+        for (int i = 0; i < nBlocks; i++) {
+            vBlocks[i].nHeight = i;
+            vBlocks[i].pprev = i ? &vBlocks[i - 1] : NULL;
+            nTime += 60;
+            vBlocks[i].nTime = nTime + GetRandInt(240) - 120;
+        }
+
+        for (int i = 1; i < nBlocks; i++) {
+            CBlockIndex *pindex = &vBlocks[i];
+            // bursts of service txns separated by quiet periods
+            int nTxs = (i / 500) % 2 ? GetRandInt(3) : (GetRandInt(20) == 0);
+            for (int j = 0; j < nTxs; j++) {
+                uint64 nFee = GetRandInt(100) * COIN;
+                window.Insert(pindex, GetRandHash(), nFee);
+                ReferenceFee fee = { (uint64)pindex->nHeight, (uint64)pindex->nTime, nFee };
+                lstFees.push_front(fee);
+            }
+            BOOST_CHECK_EQUAL(window.GetSubsidy(i), ReferenceSubsidy(lstFees, i, nWindow, nAverage != 0));
+            BOOST_CHECK_EQUAL(window.GetSubsidy(i + 1), ReferenceSubsidy(lstFees, i + 1, nWindow, nAverage != 0));
+        }
+
+        // old entries are pruned, recent history is kept
+        BOOST_CHECK(window.size() < lstFees.size());
+        BOOST_CHECK(window.size() > 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(feeregen_insert_remove)
+{
+    CFeeRegenWindow window("test", 360 * 12, false, false);
+    CBlockIndex block;
+    block.nHeight = 10;
+    block.nTime = 1400000000;
+
+    // without fUpdateExisting the first fee at a height is kept
+    BOOST_CHECK(!window.Insert(&block, 0, 5 * COIN));
+    BOOST_CHECK(window.Insert(&block, 0, 7 * COIN));
+    BOOST_CHECK_EQUAL(window.size(), 1U);
+    BOOST_CHECK_EQUAL(window.GetSubsidy(10), (uint64)5 * COIN);
+
+    BOOST_CHECK(window.Remove(10, 0));
+    BOOST_CHECK(!window.Remove(10, 0));
+    BOOST_CHECK_EQUAL(window.size(), 0U);
+    BOOST_CHECK_EQUAL(window.GetSubsidy(10), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,4 +1,8 @@
 #include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include <openssl/ecdsa.h>
+#include <openssl/obj_mac.h>
 
 #include <string>
 #include <vector>
@@ -138,4 +142,119 @@ BOOST_AUTO_TEST_CASE(key_test1)
     }
 }
 
+// ECDSA_verify on a key decoded by OpenSSL, as CPubKey::Verify did before
+// it used secp256k1.cpp
+static bool OpenSSLVerify(const CPubKey &pubkey, const uint256 &hash, const vector<unsigned char> &vchSig)
+{
+    EC_KEY *pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    const unsigned char *pbegin = pubkey.begin();
+    bool fOk = o2i_ECPublicKey(&pkey, &pbegin, pubkey.size()) &&
+               ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey) == 1;
+    EC_KEY_free(pkey);
+    return fOk;
+}
+
+BOOST_AUTO_TEST_CASE(key_verify_mutations)
+{
+    for (int n=0; n<32; n++)
+    {
+        CKey key;
+        key.MakeNewKey(n % 2 == 0);
+        CPubKey pubkey = key.GetPubKey();
+        uint256 hashMsg = GetRandHash();
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hashMsg, vchSig));
+        BOOST_CHECK(pubkey.Verify(hashMsg, vchSig));
+        BOOST_CHECK(OpenSSLVerify(pubkey, hashMsg, vchSig));
+
+        // another hash, a changed s, or no signature at all
+        BOOST_CHECK(!pubkey.Verify(GetRandHash(), vchSig));
+        vector<unsigned char> vchBad(vchSig);
+        vchBad[vchBad.size() - 1] ^= 1;
+        BOOST_CHECK(!pubkey.Verify(hashMsg, vchBad));
+        BOOST_CHECK(!OpenSSLVerify(pubkey, hashMsg, vchBad));
+        BOOST_CHECK(!pubkey.Verify(hashMsg, vector<unsigned char>()));
+
+        // hybrid keys are accepted with the parity of y in the header, as
+        // OpenSSL does, and rejected with the wrong one
+        if (!pubkey.IsCompressed()) {
+            vector<unsigned char> vchHybrid(pubkey.begin(), pubkey.end());
+            vchHybrid[0] = 0x06 | (vchHybrid[64] & 1);
+            BOOST_CHECK(CPubKey(vchHybrid).Verify(hashMsg, vchSig));
+            vchHybrid[0] ^= 1;
+            BOOST_CHECK(!CPubKey(vchHybrid).Verify(hashMsg, vchSig));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(key_verify_strict_der)
+{
+    // signatures that are valid but not encoded the one way DER allows are
+    // rejected, as ECDSA_verify does
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hashMsg = GetRandHash();
+    vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hashMsg, vchSig));
+    CPubKey pubkey = key.GetPubKey();
+    BOOST_CHECK(pubkey.Verify(hashMsg, vchSig));
+    BOOST_CHECK(vchSig[0] == 0x30 && vchSig[1] == vchSig.size() - 2 && vchSig[2] == 0x02);
+
+    vector<vector<unsigned char> > vBad;
+    // a byte after the sequence
+    vBad.push_back(vchSig);
+    vBad.back().push_back(0x00);
+    // the sequence length in the long form
+    vBad.push_back(vchSig);
+    vBad.back()[1] = vchSig.size() - 2;
+    vBad.back().insert(vBad.back().begin() + 1, 0x81);
+    // r with a leading zero it does not need
+    vBad.push_back(vchSig);
+    vBad.back()[1]++;
+    vBad.back()[3]++;
+    vBad.back().insert(vBad.back().begin() + 4, 0x00);
+
+    BOOST_FOREACH(const vector<unsigned char> &vchBad, vBad) {
+        BOOST_CHECK(!pubkey.Verify(hashMsg, vchBad));
+        BOOST_CHECK(!OpenSSLVerify(pubkey, hashMsg, vchBad));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(key_verify_speed)
+{
+    // the keys and messages of key_test1
+    const string vSecret[4] = {strSecret1, strSecret2, strSecret1C, strSecret2C};
+    vector<CPubKey> vPubKey;
+    vector<uint256> vHash;
+    vector<vector<unsigned char> > vSig;
+    for (int n=0; n<16; n++)
+    {
+        CBitcoinSecret bsecret;
+        BOOST_CHECK(bsecret.SetString(vSecret[n % 4]));
+        CKey key = bsecret.GetKey();
+        string strMsg = strprintf("Very secret message %i: 11", n);
+        uint256 hashMsg = Hash(strMsg.begin(), strMsg.end());
+        vector<unsigned char> vchSig;
+        BOOST_CHECK(key.Sign(hashMsg, vchSig));
+        vPubKey.push_back(key.GetPubKey());
+        vHash.push_back(hashMsg);
+        vSig.push_back(vchSig);
+    }
+
+    const int nRounds = 25;
+    int64 nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++)
+        for (unsigned int n = 0; n < vSig.size(); n++)
+            BOOST_CHECK(OpenSSLVerify(vPubKey[n], vHash[n], vSig[n]));
+    int64 nOpenSSL = std::max(GetTimeMicros() - nStart, (int64)1);
+    nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds; i++)
+        for (unsigned int n = 0; n < vSig.size(); n++)
+            BOOST_CHECK(vPubKey[n].Verify(vHash[n], vSig[n]));
+    int64 nSecp256k1 = std::max(GetTimeMicros() - nStart, (int64)1);
+    BOOST_TEST_MESSAGE(strprintf("ECDSA verify: OpenSSL %.0f/s, secp256k1.cpp %.0f/s",
+                                 1e6 * nRounds * vSig.size() / nOpenSSL,
+                                 1e6 * nRounds * vSig.size() / nSecp256k1));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
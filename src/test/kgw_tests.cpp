@@ -0,0 +1,119 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bignum.h"
+#include "main.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(kgw_tests)
+
+BOOST_AUTO_TEST_CASE(uint256_retarget_arithmetic)
+{
+    unsigned int pCompacts[] = { 0x1e0fffff, 0x1d00ffff, 0x1b0404cb, 0x1c7fffff, 0x03123456, 0x01120000, 0x20000001 };
+    for (unsigned int i = 0; i < sizeof(pCompacts) / sizeof(pCompacts[0]); i++) {
+        uint256 n;
+        bool fNegative, fOverflow;
+        n.SetCompact(pCompacts[i], &fNegative, &fOverflow);
+        BOOST_CHECK(!fNegative && !fOverflow);
+        CBigNum bn;
+        bn.SetCompact(pCompacts[i]);
+        BOOST_CHECK(n == bn.getuint256());
+        BOOST_CHECK_EQUAL(n.GetCompact(), bn.GetCompact());
+    }
+
+    uint256 n;
+    bool fNegative, fOverflow;
+    n.SetCompact(0x1d80ffff, &fNegative, &fOverflow);
+    BOOST_CHECK(fNegative);
+    n.SetCompact(0x23000001, &fNegative, &fOverflow);
+    BOOST_CHECK(fOverflow);
+
+    uint256 a = ~uint256(0) >> 20;
+    CBigNum bn(a);
+    a /= 7;
+    bn /= 7;
+    BOOST_CHECK(a == bn.getuint256());
+    a *= 1000;
+    bn *= 1000;
+    BOOST_CHECK(a == bn.getuint256());
+
+    // the intermediate product needs more than 256 bits
+    uint256 b = ~uint256(0) >> 4;
+    CBigNum bnB(b);
+    BOOST_CHECK(b.MulDiv(5880, 0xffffffffU));
+    bnB *= 5880;
+    bnB /= 0xffffffffU;
+    BOOST_CHECK(b == bnB.getuint256());
+    uint256 c = ~uint256(0) >> 4;
+    BOOST_CHECK(!c.MulDiv(17, 1));
+    BOOST_CHECK(c == ~uint256(0) >> 4);
+}
+
+// a chain retargeted by the reference implementation, with block times
+// that come in fast, slow, on target and backwards
+static void BuildChain(vector<CBlockIndex> &vBlocks, vector<uint256> &vHashes, unsigned int nBlocks) {
+    vBlocks.resize(nBlocks);
+    vHashes.resize(nBlocks);
+    unsigned int nTime = 1386000000;
+    unsigned int nSeed = 42;
+    for (unsigned int i = 0; i < nBlocks; i++) {
+        nSeed = nSeed * 1103515245 + 12345;
+        unsigned int nPhase = (i / 150) % 4;
+        if (nPhase == 0)
+            nTime += 5 + (nSeed >> 16) % 20;
+        else if (nPhase == 1)
+            nTime += 100 + (nSeed >> 16) % 400;
+        else if (nPhase == 2)
+            nTime += 60;
+        else if ((nSeed >> 16) % 3 == 0)
+            nTime -= (nSeed >> 20) % 120;
+        else
+            nTime += (nSeed >> 16) % 180;
+
+        CBlockIndex &block = vBlocks[i];
+        vHashes[i] = i;
+        block.phashBlock = &vHashes[i];
+        block.nHeight = i;
+        block.nTime = nTime;
+        block.pprev = i ? &vBlocks[i - 1] : NULL;
+        block.nBits = KimotoGravityWellBigNum(block.pprev, NULL, 60, 7, 98);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(kgw_matches_bignum)
+{
+    vector<CBlockIndex> vBlocks;
+    vector<uint256> vHashes;
+    BuildChain(vBlocks, vHashes, 2400);
+
+    for (unsigned int i = 0; i < vBlocks.size(); i++) {
+        BOOST_CHECK_EQUAL(KimotoGravityWell(&vBlocks[i], NULL, 60, 7, 98),
+                          KimotoGravityWellBigNum(&vBlocks[i], NULL, 60, 7, 98));
+        // a longer horizon than the deviation table covers
+        BOOST_CHECK_EQUAL(KimotoGravityWell(&vBlocks[i], NULL, 60, 7, 400),
+                          KimotoGravityWellBigNum(&vBlocks[i], NULL, 60, 7, 400));
+    }
+
+    // difficulties far apart, so the average both rises and falls
+    for (unsigned int i = 1; i < vBlocks.size(); i++)
+        vBlocks[i].nBits = (i % 5 == 0) ? 0x1b0404cb : vBlocks[i].nBits;
+    for (unsigned int i = 0; i < vBlocks.size(); i++)
+        BOOST_CHECK_EQUAL(KimotoGravityWell(&vBlocks[i], NULL, 60, 7, 98),
+                          KimotoGravityWellBigNum(&vBlocks[i], NULL, 60, 7, 98));
+
+    int64 nStart = GetTimeMicros();
+    unsigned int nCheck = 0;
+    for (unsigned int i = 0; i < vBlocks.size(); i++)
+        nCheck += KimotoGravityWellBigNum(&vBlocks[i], NULL, 60, 7, 98);
+    int64 nBigNum = GetTimeMicros() - nStart;
+    nStart = GetTimeMicros();
+    for (unsigned int i = 0; i < vBlocks.size(); i++)
+        nCheck -= KimotoGravityWell(&vBlocks[i], NULL, 60, 7, 98);
+    int64 nNative = GetTimeMicros() - nStart;
+    BOOST_CHECK_EQUAL(nCheck, 0U);
+    BOOST_TEST_MESSAGE(strprintf("KimotoGravityWell over %"PRIszu" blocks: CBigNum %"PRI64d"us, uint256 %"PRI64d"us",
+                                 vBlocks.size(), nBigNum, nNative));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
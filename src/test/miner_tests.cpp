@@ -69,6 +69,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
         pblock->vtx[0].vin[0].scriptSig.push_back(blockinfo[i].extranonce);
         pblock->vtx[0].vin[0].scriptSig.push_back(pindexBest->nHeight);
         pblock->vtx[0].vout[0].scriptPubKey = CScript();
+        pblock->vtx[0].InvalidateCache();
         if (txFirst.size() < 2)
             txFirst.push_back(new CTransaction(pblock->vtx[0]));
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
@@ -94,6 +95,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     for (unsigned int i = 0; i < 1001; ++i)
     {
         tx.vout[0].nValue -= 1000000;
+        tx.InvalidateCache();
         hash = tx.GetHash();
         mempool.addUnchecked(hash, tx);
         tx.vin[0].prevout.hash = hash;
@@ -114,6 +116,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     for (unsigned int i = 0; i < 128; ++i)
     {
         tx.vout[0].nValue -= 10000000;
+        tx.InvalidateCache();
         hash = tx.GetHash();
         mempool.addUnchecked(hash, tx);
         tx.vin[0].prevout.hash = hash;
@@ -123,6 +126,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     mempool.clear();
 
     // orphan in mempool
+    tx.InvalidateCache();
     hash = tx.GetHash();
     mempool.addUnchecked(hash, tx);
     BOOST_CHECK(pblocktemplate = CreateNewBlockWithKey(reservekey));
@@ -133,6 +137,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vin[0].scriptSig = CScript() << OP_1;
     tx.vin[0].prevout.hash = txFirst[1]->GetHash();
     tx.vout[0].nValue = 4900000000LL;
+    tx.InvalidateCache();
     hash = tx.GetHash();
     mempool.addUnchecked(hash, tx);
     tx.vin[0].prevout.hash = hash;
@@ -141,6 +146,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vin[1].prevout.hash = txFirst[0]->GetHash();
     tx.vin[1].prevout.n = 0;
     tx.vout[0].nValue = 5900000000LL;
+    tx.InvalidateCache();
     hash = tx.GetHash();
     mempool.addUnchecked(hash, tx);
     BOOST_CHECK(pblocktemplate = CreateNewBlockWithKey(reservekey));
@@ -152,6 +158,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vin[0].prevout.SetNull();
     tx.vin[0].scriptSig = CScript() << OP_0 << OP_1;
     tx.vout[0].nValue = 0;
+    tx.InvalidateCache();
     hash = tx.GetHash();
     mempool.addUnchecked(hash, tx);
     BOOST_CHECK(pblocktemplate = CreateNewBlockWithKey(reservekey));
@@ -165,11 +172,13 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vout[0].nValue = 4900000000LL;
     script = CScript() << OP_0;
     tx.vout[0].scriptPubKey.SetDestination(script.GetID());
+    tx.InvalidateCache();
     hash = tx.GetHash();
     mempool.addUnchecked(hash, tx);
     tx.vin[0].prevout.hash = hash;
     tx.vin[0].scriptSig = CScript() << (std::vector<unsigned char>)script;
     tx.vout[0].nValue -= 1000000;
+    tx.InvalidateCache();
     hash = tx.GetHash();
     mempool.addUnchecked(hash,tx);
     BOOST_CHECK(pblocktemplate = CreateNewBlockWithKey(reservekey));
@@ -181,9 +190,11 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     tx.vin[0].scriptSig = CScript() << OP_1;
     tx.vout[0].nValue = 4900000000LL;
     tx.vout[0].scriptPubKey = CScript() << OP_1;
+    tx.InvalidateCache();
     hash = tx.GetHash();
     mempool.addUnchecked(hash, tx);
     tx.vout[0].scriptPubKey = CScript() << OP_2;
+    tx.InvalidateCache();
     hash = tx.GetHash();
     mempool.addUnchecked(hash, tx);
     BOOST_CHECK(pblocktemplate = CreateNewBlockWithKey(reservekey));
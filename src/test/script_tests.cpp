@@ -328,6 +328,56 @@ BOOST_AUTO_TEST_CASE(script_CHECKMULTISIG23)
     BOOST_CHECK(!VerifyScript(badsig6, scriptPubKey23, txTo23, 0, flags, 0));
 }    
 
+BOOST_AUTO_TEST_CASE(script_sigcache)
+{
+    CKey key;
+    key.MakeNewKey(true);
+
+    CScript scriptPubKey;
+    scriptPubKey << OP_1 << key.GetPubKey() << OP_1 << OP_CHECKMULTISIG;
+
+    CTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vout.resize(1);
+    txTo.vin[0].prevout.n = 0;
+    txTo.vin[0].prevout.hash = GetRandHash();
+    txTo.vout[0].nValue = 1;
+    CScript scriptSig = sign_multisig(scriptPubKey, key, txTo);
+
+    CDigestCacheStats stats0, stats;
+    GetSignatureCacheStats(stats0);
+    BOOST_CHECK(stats0.nBytes > 0);
+
+    // not stored with NOCACHE
+    BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags | SCRIPT_VERIFY_NOCACHE, 0));
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nMisses, stats0.nMisses + 1);
+    BOOST_CHECK_EQUAL(stats.nEntries, stats0.nEntries);
+
+    BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags, 0));
+    BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags, 0));
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nMisses, stats0.nMisses + 2);
+    BOOST_CHECK_EQUAL(stats.nHits, stats0.nHits + 1);
+    BOOST_CHECK_EQUAL(stats.nEntries, stats0.nEntries + 1);
+
+    // found once more as the block is connected, and then forgotten
+    BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags | SCRIPT_VERIFY_NOCACHE | SCRIPT_VERIFY_UNCACHE, 0));
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, stats0.nHits + 2);
+    BOOST_CHECK_EQUAL(stats.nErased, stats0.nErased + 1);
+    BOOST_CHECK_EQUAL(stats.nEntries, stats0.nEntries);
+    BOOST_CHECK(VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags | SCRIPT_VERIFY_NOCACHE, 0));
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nMisses, stats0.nMisses + 3);
+
+    // a different signature hash is not a hit
+    txTo.vout[0].nValue = 2;
+    BOOST_CHECK(!VerifyScript(scriptSig, scriptPubKey, txTo, 0, flags, 0));
+    GetSignatureCacheStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, stats0.nHits + 2);
+}
+
 BOOST_AUTO_TEST_CASE(script_combineSigs)
 {
     // Test the CombineSignatures function
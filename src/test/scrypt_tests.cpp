@@ -3,6 +3,10 @@
 #include "util.h"
 #include "scrypt.h"
 
+#include <vector>
+
+using namespace std;
+
 BOOST_AUTO_TEST_SUITE(scrypt_tests)
 
 BOOST_AUTO_TEST_CASE(scrypt_hashtest)
@@ -30,4 +34,73 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+// inputs that differ in every byte, so a lane mixup changes the hashes
+static void MakeInputs(vector<char> &vInput, int nInputs) {
+    vInput.resize(80 * nInputs);
+    for (unsigned int i = 0; i < vInput.size(); i++)
+        vInput[i] = (char)(i * 7 + 3);
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_multi_lanes)
+{
+#if defined(USE_SSE2)
+    scrypt_detect_sse2();
+#endif
+    // more inputs than lanes and not a multiple of them, so lanes get padded
+    const int nInputs = 2 * SCRYPT_MAX_WAYS + 3;
+    vector<char> vInput;
+    MakeInputs(vInput, nInputs);
+    vector<char> vExpected(32 * nInputs);
+    vector<char> vScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    for (int i = 0; i < nInputs; i++)
+        scrypt_1024_1_1_256_sp_generic(&vInput[80 * i], &vExpected[32 * i], &vScratchpad[0]);
+
+    // every kernel this CPU can run, not only the one picked
+    vector<pair<int, scrypt_core_multi_fn> > vKernels;
+    scrypt_multi_kernels(vKernels);
+    for (unsigned int k = 0; k < vKernels.size(); k++) {
+        int nWays = vKernels[k].first;
+        vector<char> vOutput(32 * nInputs);
+        for (int i = 0; i + nWays <= nInputs; i += nWays)
+            scrypt_1024_1_1_256_sp_lanes(&vInput[80 * i], &vOutput[32 * i], &vScratchpad[0], nWays, vKernels[k].second);
+        int nHashed = nInputs / nWays * nWays;
+        BOOST_CHECK_MESSAGE(memcmp(&vOutput[0], &vExpected[0], 32 * nHashed) == 0, strprintf("%d lane kernel", nWays));
+    }
+
+    for (int n = 1; n <= nInputs; n += SCRYPT_MAX_WAYS / 2 + 1) {
+        vector<char> vOutput(32 * n);
+        scrypt_1024_1_1_256_multi(&vInput[0], &vOutput[0], n);
+        BOOST_CHECK(memcmp(&vOutput[0], &vExpected[0], 32 * n) == 0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(scrypt_multi_throughput)
+{
+#if defined(USE_SSE2)
+    scrypt_detect_sse2();
+#endif
+    vector<char> vInput;
+    MakeInputs(vInput, SCRYPT_MAX_WAYS);
+    vector<char> vOutput(32 * SCRYPT_MAX_WAYS);
+    vector<char> vScratchpad(SCRYPT_MULTI_SCRATCHPAD_SIZE);
+    const int nRounds = 8;
+
+    int64 nStart = GetTimeMicros();
+    for (int i = 0; i < nRounds * SCRYPT_MAX_WAYS; i++)
+        scrypt_1024_1_1_256_sp_generic(&vInput[0], &vOutput[0], &vScratchpad[0]);
+    BOOST_TEST_MESSAGE(strprintf("scrypt generic: %.0f hashes/s",
+                                 1e6 * nRounds * SCRYPT_MAX_WAYS / std::max(GetTimeMicros() - nStart, (int64)1)));
+
+    vector<pair<int, scrypt_core_multi_fn> > vKernels;
+    scrypt_multi_kernels(vKernels);
+    for (unsigned int k = 0; k < vKernels.size(); k++) {
+        int nWays = vKernels[k].first;
+        nStart = GetTimeMicros();
+        for (int i = 0; i < nRounds * SCRYPT_MAX_WAYS / nWays; i++)
+            scrypt_1024_1_1_256_sp_lanes(&vInput[0], &vOutput[0], &vScratchpad[0], nWays, vKernels[k].second);
+        BOOST_TEST_MESSAGE(strprintf("scrypt %d lanes: %.0f hashes/s", nWays,
+                                     1e6 * nRounds * SCRYPT_MAX_WAYS / std::max(GetTimeMicros() - nStart, (int64)1)));
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,306 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "servicedb.h"
+#include "main.h"
+#include "alias.h"
+#include "offer.h"
+#include "util.h"
+
+using namespace std;
+
+static vector<string> ListKeys(CServiceDB &db) {
+    vector<string> vKeys;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        string strKey;
+        ssKey >> strKey;
+        vKeys.push_back(strKey);
+    }
+    return vKeys;
+}
+
+// heads are (name -> expiry height) records
+class CTestExpiryDB : public CServiceDB {
+protected:
+    int GetHeadExpiry(const string &strValue) {
+        CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
+        int nExpiry;
+        ssValue >> nExpiry;
+        return nExpiry;
+    }
+
+public:
+    CTestExpiryDB() : CServiceDB(GetDataDir() / "servicedb_test", 1 << 20, true, false) {
+        strHeadPrefix = "head";
+    }
+
+    void WriteHead(const string &strName, int nExpiry) {
+        vector<unsigned char> vchName(strName.begin(), strName.end());
+        Write(make_pair(strHeadPrefix, vchName), nExpiry);
+        UpdateExpiry(vchName, nExpiry);
+    }
+
+    bool IsArchived(const string &strName) {
+        vector<unsigned char> vchName(strName.begin(), strName.end());
+        return ExistsArchived(vchName) && !Exists(make_pair(strHeadPrefix, vchName));
+    }
+};
+
+BOOST_AUTO_TEST_SUITE(servicedb_tests)
+
+BOOST_AUTO_TEST_CASE(servicedb_views)
+{
+    CServiceDB db(GetDataDir() / "servicedb_test", 1 << 20, true, false);
+    int n;
+
+    db.Write(string("a"), 1);
+    db.Write(string("c"), 3);
+    BOOST_CHECK(db.Flush(0));
+    BOOST_CHECK_EQUAL(db.GetCacheSize(), 0U);
+
+    db.BeginView();
+    db.Write(string("b"), 2);
+    db.Erase(string("c"));
+    BOOST_CHECK(db.Read(string("b"), n) && n == 2);
+    BOOST_CHECK(!db.Exists(string("c")));
+    BOOST_CHECK(db.Read(string("a"), n) && n == 1);
+    db.DiscardView();
+    BOOST_CHECK(!db.Exists(string("b")));
+    BOOST_CHECK(db.Read(string("c"), n) && n == 3);
+
+    db.BeginView();
+    db.Write(string("b"), 2);
+    db.Erase(string("c"));
+    db.CommitView();
+    BOOST_CHECK(db.Read(string("b"), n) && n == 2);
+    BOOST_CHECK(!db.Exists(string("c")));
+
+    // nothing reaches the DB before the flush
+    string strValue;
+    BOOST_CHECK(!db.ReadRaw(string("\x01") + "b", strValue));
+    BOOST_CHECK(db.Flush(1));
+    BOOST_CHECK(db.ReadRaw(string("\x01") + "b", strValue));
+    uint256 hashBest;
+    BOOST_CHECK(db.ReadBestBlock(hashBest) && hashBest == 1);
+}
+
+BOOST_AUTO_TEST_CASE(servicedb_iterator)
+{
+    CServiceDB db(GetDataDir() / "servicedb_test", 1 << 20, true, false);
+    db.Write(string("b"), 0);
+    db.Write(string("d"), 0);
+    db.Write(string("f"), 0);
+    BOOST_CHECK(db.Flush(0));
+
+    db.Write(string("a"), 0);
+    db.Erase(string("d"));
+    db.BeginView();
+    db.Write(string("e"), 0);
+    db.Erase(string("f"));
+    db.Write(string("d"), 0);
+
+    vector<string> vKeys = ListKeys(db);
+    const char *expected[] = { "a", "b", "d", "e", "sbestblock" };
+    BOOST_CHECK_EQUAL(vKeys.size(), 5U);
+    for (unsigned int i = 0; i < vKeys.size() && i < 5; i++)
+        BOOST_CHECK_EQUAL(vKeys[i], expected[i]);
+    db.DiscardView();
+
+    vKeys = ListKeys(db);
+    const char *expected2[] = { "a", "b", "f", "sbestblock" };
+    BOOST_CHECK_EQUAL(vKeys.size(), 4U);
+    for (unsigned int i = 0; i < vKeys.size() && i < 4; i++)
+        BOOST_CHECK_EQUAL(vKeys[i], expected2[i]);
+}
+
+BOOST_AUTO_TEST_CASE(servicedb_undo)
+{
+    CServiceDB db(GetDataDir() / "servicedb_test", 1 << 20, true, false);
+    db.Write(string("a"), 1);
+    db.Write(string("b"), 2);
+    BOOST_CHECK(db.Flush(0));
+
+    uint256 hashBlock = GetRandHash();
+    CBlockIndex block;
+    block.phashBlock = &hashBlock;
+    block.nHeight = 100;
+
+    db.BeginView();
+    db.BeginBlockUndo(&block);
+    db.Write(string("a"), 10);
+    db.Write(string("a"), 11);
+    db.Erase(string("b"));
+    db.Write(string("c"), 3);
+    db.WriteBlockUndo();
+    db.CommitView();
+
+    int n;
+    BOOST_CHECK(db.Read(string("a"), n) && n == 11);
+    BOOST_CHECK(!db.Exists(string("b")));
+
+    // an undo record belongs to one block only
+    uint256 hashOther = GetRandHash();
+    CBlockIndex other;
+    other.phashBlock = &hashOther;
+    other.nHeight = 100;
+    BOOST_CHECK(!db.ApplyBlockUndo(&other));
+
+    BOOST_CHECK(db.ApplyBlockUndo(&block));
+    BOOST_CHECK(db.Read(string("a"), n) && n == 1);
+    BOOST_CHECK(db.Read(string("b"), n) && n == 2);
+    BOOST_CHECK(!db.Exists(string("c")));
+    BOOST_CHECK(!db.ApplyBlockUndo(&block));
+}
+
+BOOST_AUTO_TEST_CASE(servicedb_expiry)
+{
+    CTestExpiryDB db;
+    CServiceCounts counts;
+    db.Write(make_pair(string("head"), vchFromString("a")), 10);
+    BOOST_CHECK(db.CheckExpiryIndex());
+    BOOST_CHECK(db.ReadCounts(counts) && counts.nLive == 1);
+
+    db.WriteHead("b", 20);
+    db.WriteHead("c", 5000);
+    BOOST_CHECK(db.ExpireRecords(15));
+    BOOST_CHECK(db.ReadCounts(counts));
+    BOOST_CHECK_EQUAL(counts.nLive, 2);
+    BOOST_CHECK_EQUAL(counts.nExpired, 1);
+
+    // b is renewed before it expires, c is erased
+    db.WriteHead("b", 3000);
+    db.WriteHead("c", -1);
+    BOOST_CHECK(db.ReadCounts(counts) && counts.nLive == 1 && counts.nExpired == 1);
+
+    BOOST_CHECK(db.ExpireRecords(10 + SERVICE_UNDO_DEPTH));
+    BOOST_CHECK(db.IsArchived("a"));
+    BOOST_CHECK(db.ReadCounts(counts));
+    BOOST_CHECK_EQUAL(counts.nLive, 1);
+    BOOST_CHECK_EQUAL(counts.nExpired, 0);
+    BOOST_CHECK_EQUAL(counts.nArchived, 1);
+
+    // writing an archived head brings it back
+    db.WriteHead("a", 10000);
+    BOOST_CHECK(!db.IsArchived("a"));
+    BOOST_CHECK(db.ReadCounts(counts) && counts.nLive == 2 && counts.nArchived == 0);
+}
+
+BOOST_AUTO_TEST_CASE(servicedb_record_cache)
+{
+    CServiceRecordCache<vector<unsigned char> > cache;
+    vector<unsigned char> vchValue(100), vchOut;
+    vector<unsigned char> vchA(1, 'a'), vchB(1, 'b'), vchC(1, 'c');
+    // room for two records of this size, not three
+    cache.SetMaxBytes(2 * (1 + 100 + 1 + 64));
+
+    cache.Put(vchA, vchValue);
+    cache.Put(vchB, vchValue);
+    BOOST_CHECK(cache.Get(vchA, vchOut));
+    cache.Put(vchC, vchValue);
+    // b was least recently used
+    BOOST_CHECK(!cache.Get(vchB, vchOut));
+    BOOST_CHECK(cache.Get(vchA, vchOut));
+    BOOST_CHECK(cache.Get(vchC, vchOut));
+    BOOST_CHECK_EQUAL(cache.GetStats().nEntries, 2U);
+    BOOST_CHECK_EQUAL(cache.GetStats().nHits, 3U);
+    BOOST_CHECK_EQUAL(cache.GetStats().nMisses, 1U);
+
+    cache.Erase(vchA);
+    BOOST_CHECK(!cache.Get(vchA, vchOut));
+    cache.SetMaxBytes(0);
+    BOOST_CHECK_EQUAL(cache.GetStats().nEntries, 0U);
+    BOOST_CHECK_EQUAL(cache.GetStats().nBytes, 0U);
+}
+
+static string LexicalKeyString(const string &str, bool fPrefix = false) {
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << CLexicalKey(vector<unsigned char>(str.begin(), str.end()), fPrefix) << CBigEndianKey64(1);
+    return ssKey.str();
+}
+
+BOOST_AUTO_TEST_CASE(servicedb_index_keys)
+{
+    // keys sort like their strings, whatever follows them
+    BOOST_CHECK(LexicalKeyString("ab") < LexicalKeyString("abc"));
+    BOOST_CHECK(LexicalKeyString("ab") < LexicalKeyString(string("ab\0", 3)));
+    BOOST_CHECK(LexicalKeyString(string("ab\0", 3)) < LexicalKeyString("ab\x01"));
+    BOOST_CHECK(LexicalKeyString("abc") < LexicalKeyString("abd"));
+    string strPrefix = LexicalKeyString("ab", true).substr(0, 2);
+    BOOST_CHECK(LexicalKeyString("abc").compare(0, 2, strPrefix) == 0);
+
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    vector<unsigned char> vch(3, 0);
+    ssKey << CLexicalKey(vch) << CBigEndianKey64(0x0102030405060708ULL);
+    CLexicalKey key;
+    CBigEndianKey64 n;
+    ssKey >> key >> n;
+    BOOST_CHECK(key.vch == vch);
+    BOOST_CHECK(n.n == 0x0102030405060708ULL);
+
+    set<vector<unsigned char> > setWords;
+    string strTitle = "Red BIKE, red-bike x 26\"";
+    GetOfferTitleWords(vector<unsigned char>(strTitle.begin(), strTitle.end()), setWords);
+    BOOST_CHECK_EQUAL(setWords.size(), 4U);
+    BOOST_CHECK(setWords.count(vchFromString("red")));
+    BOOST_CHECK(setWords.count(vchFromString("bike")));
+    BOOST_CHECK(setWords.count(vchFromString("x")));
+    BOOST_CHECK(setWords.count(vchFromString("26")));
+}
+
+BOOST_AUTO_TEST_CASE(servicedb_offer_order)
+{
+    COfferDB db(1 << 20, true, false);
+    vector<unsigned char> vchOffer = vchFromString("offer");
+    COfferHead head;
+
+    // two updates in one block keep both versions, in chain order
+    for (int i = 0; i < 2; i++) {
+        db.ReadOfferHead(vchOffer, head);
+        head.offer.nHeight = 100;
+        head.offer.nPrice = 10 + i;
+        head.offer.txHash = i + 1;
+        BOOST_CHECK(db.WriteOfferVersion(vchOffer, head));
+    }
+    // accepts in one block are read back in chain order, not by guid
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK(db.ReadOfferHead(vchOffer, head));
+        COfferAccept accept;
+        accept.vchRand = vchFromString(i == 0 ? "z" : "a");
+        accept.nHeight = 101;
+        accept.nQty = 1;
+        accept.txHash = 10 + i;
+        head.nQtyAccepted += accept.nQty;
+        BOOST_CHECK(db.WriteOfferAcceptEvent(vchOffer, accept, head));
+    }
+
+    vector<COffer> vtxPos;
+    BOOST_CHECK(db.ReadOfferVersions(vchOffer, vtxPos));
+    BOOST_CHECK_EQUAL(vtxPos.size(), 2U);
+    BOOST_CHECK(vtxPos.size() == 2 && vtxPos[0].nPrice == 10 && vtxPos[1].nPrice == 11);
+    vector<COfferAccept> vAccepts;
+    BOOST_CHECK(db.ReadOfferAccepts(vchOffer, vAccepts));
+    BOOST_CHECK(vAccepts.size() == 2 && vAccepts[0].vchRand == vchFromString("z")
+                && vAccepts[1].vchRand == vchFromString("a"));
+
+    // disconnecting needs the txn that wrote the accept, last first
+    COfferAccept accept;
+    accept.vchRand = vchFromString("a");
+    BOOST_CHECK(!db.DisconnectOfferAcceptEvent(vchOffer, accept, 10, false));
+    BOOST_CHECK(db.DisconnectOfferAcceptEvent(vchOffer, accept, 11, false));
+    accept.vchRand = vchFromString("z");
+    BOOST_CHECK(db.DisconnectOfferAcceptEvent(vchOffer, accept, 10, false));
+    BOOST_CHECK(!db.DisconnectOfferAcceptEvent(vchOffer, accept, 10, false));
+    BOOST_CHECK(db.ReadOfferAccepts(vchOffer, vAccepts) && vAccepts.empty());
+
+    BOOST_CHECK(db.DisconnectOfferVersion(vchOffer, 100));
+    BOOST_CHECK(db.ReadOfferHead(vchOffer, head));
+    BOOST_CHECK_EQUAL(head.offer.nPrice, 10U);
+    BOOST_CHECK_EQUAL(head.nQtyAccepted, 0);
+    BOOST_CHECK(db.DisconnectOfferVersion(vchOffer, 100));
+    BOOST_CHECK(!db.ExistsOffer(vchOffer));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
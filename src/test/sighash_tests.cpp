@@ -0,0 +1,134 @@
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "script.h"
+#include "util.h"
+
+using namespace std;
+
+extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+
+// the signature hash as it was computed before it was streamed: on a copy of
+// the transaction with the parts that are not signed blanked out
+static uint256 SignatureHashOld(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    if (nIn >= txTo.vin.size())
+        return 1;
+    CTransaction txTmp(txTo);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+        txTmp.vin[i].scriptSig = CScript();
+    txTmp.vin[nIn].scriptSig = scriptCode;
+
+    if ((nHashType & 0x1f) == SIGHASH_NONE)
+    {
+        txTmp.vout.clear();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+    {
+        unsigned int nOut = nIn;
+        if (nOut >= txTmp.vout.size())
+            return 1;
+        txTmp.vout.resize(nOut+1);
+        for (unsigned int i = 0; i < nOut; i++)
+            txTmp.vout[i].SetNull();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+
+    if (nHashType & SIGHASH_ANYONECANPAY)
+    {
+        txTmp.vin[0] = txTmp.vin[nIn];
+        txTmp.vin.resize(1);
+    }
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << txTmp << nHashType;
+    return ss.GetHash();
+}
+
+static CScript RandomScript()
+{
+    static const opcodetype oplist[] = {OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR};
+    CScript script;
+    int nOps = GetRand(10);
+    for (int i = 0; i < nOps; i++)
+        script << oplist[GetRand(sizeof(oplist)/sizeof(oplist[0]))];
+    return script;
+}
+
+static void RandomTransaction(CTransaction &tx)
+{
+    tx.nVersion = GetRand(3) == 0 ? (int)GetRand((uint64)1 << 32) : CTransaction::CURRENT_VERSION;
+    tx.vin.clear();
+    tx.vout.clear();
+    tx.nLockTime = GetRand(2) ? GetRand(500000000) : 0;
+    int nIns = GetRand(4) + 1;
+    int nOuts = GetRand(4);
+    for (int in = 0; in < nIns; in++) {
+        tx.vin.push_back(CTxIn());
+        CTxIn &txin = tx.vin.back();
+        txin.prevout.hash = GetRandHash();
+        txin.prevout.n = GetRand(4);
+        txin.scriptSig = RandomScript();
+        txin.nSequence = GetRand(2) ? GetRand((uint64)1 << 32) : (unsigned int)-1;
+    }
+    for (int out = 0; out < nOuts; out++) {
+        tx.vout.push_back(CTxOut());
+        CTxOut &txout = tx.vout.back();
+        txout.nValue = GetRand(100000000);
+        txout.scriptPubKey = RandomScript();
+    }
+    tx.data.clear();
+    if (GetRand(3) == 0)
+        for (int i = GetRand(1000); i > 0; i--)
+            tx.data.push_back(GetRand(256));
+    tx.InvalidateCache();
+}
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+BOOST_AUTO_TEST_CASE(sighash_matches_copy)
+{
+    for (int i = 0; i < 20000; i++) {
+        int nHashType = GetRand(4) == 0 ? (int)GetRand((uint64)1 << 32) : (int)(GetRand(3) + 1) | (GetRand(2) ? SIGHASH_ANYONECANPAY : 0);
+        CTransaction txTo;
+        RandomTransaction(txTo);
+        CScript scriptCode = RandomScript();
+        // now and then an input or output that is not there
+        unsigned int nIn = GetRand(txTo.vin.size() + (GetRand(10) == 0));
+
+        uint256 sh = SignatureHashOld(scriptCode, txTo, nIn, nHashType);
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType) == sh);
+
+        CSignatureHashCache cache(txTo);
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, nHashType, &cache) == sh);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sighash_cache_inputs)
+{
+    // every input of one transaction from the same cache, with a payload
+    CTransaction txTo;
+    RandomTransaction(txTo);
+    for (int i = 0; i < 40; i++)
+        txTo.vin.push_back(CTxIn(GetRandHash(), i, RandomScript()));
+    txTo.data.assign(300000, 0x42);
+    txTo.InvalidateCache();
+
+    CSignatureHashCache cache(txTo);
+    BOOST_CHECK_EQUAL(cache.vMidstate.size(), txTo.vin.size());
+    CScript scriptCode = RandomScript();
+    for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++) {
+        uint256 sh = SignatureHashOld(scriptCode, txTo, nIn, SIGHASH_ALL);
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, nIn, SIGHASH_ALL, &cache) == sh);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -29,6 +29,8 @@ struct TestingSetup {
         pblocktree = new CBlockTreeDB(1 << 20, true);
         pcoinsdbview = new CCoinsViewDB(1 << 23, true);
         pcoinsTip = new CCoinsViewCache(*pcoinsdbview);
+        InitSignatureCache();
+        InitScriptExecutionCache();
         InitBlockIndex();
         bool fFirstRun;
         pwalletMain = new CWallet("wallet.dat");
@@ -5,6 +5,9 @@
 
 #include "main.h"
 #include "wallet.h"
+#include "alias.h"
+#include "offer.h"
+#include "cert.h"
 
 using namespace std;
 using namespace json_spirit;
@@ -242,6 +245,157 @@ BOOST_AUTO_TEST_CASE(test_Get)
     BOOST_CHECK(!t1.AreInputsStandard(coins));
 }
 
+BOOST_AUTO_TEST_CASE(test_TxInputs)
+{
+    CBasicKeyStore keystore;
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(coinsDummy);
+    std::vector<CTransaction> dummyTransactions = SetupDummyInputs(keystore, coins);
+
+    // an alias output to spend next to the regular ones
+    CTransaction txAlias;
+    txAlias.nVersion = SYSCOIN_TX_VERSION;
+    txAlias.vout.resize(1);
+    txAlias.vout[0].nValue = 5*CENT;
+    txAlias.vout[0].scriptPubKey << CScript::EncodeOP_N(OP_ALIAS_UPDATE) << vchFromString("name")
+                                 << vchFromString("value") << OP_2DROP << OP_DROP << OP_TRUE;
+    coins.SetCoins(txAlias.GetHash(), CCoins(txAlias, 0));
+
+    CTransaction t1;
+    t1.vin.resize(3);
+    t1.vin[0].prevout.hash = dummyTransactions[0].GetHash();
+    t1.vin[0].prevout.n = 1;
+    t1.vin[1].prevout.hash = txAlias.GetHash();
+    t1.vin[1].prevout.n = 0;
+    t1.vin[2].prevout.hash = dummyTransactions[1].GetHash();
+    t1.vin[2].prevout.n = 0;
+
+    CTxInputs inputs(t1, coins);
+    BOOST_CHECK(inputs.fHaveInputs);
+    BOOST_CHECK_EQUAL(t1.GetValueIn(inputs), t1.GetValueIn(coins));
+    BOOST_CHECK_EQUAL(t1.GetP2SHSigOpCount(inputs), t1.GetP2SHSigOpCount(coins));
+    BOOST_CHECK(&inputs.GetOutput(2) == &coins.AccessCoins(dummyTransactions[1].GetHash())->vout[0]);
+
+    int nIn, op;
+    vector<vector<unsigned char> > vvch;
+    BOOST_CHECK(inputs.GetServiceInput(SERVICE_ALIAS, nIn, op, vvch));
+    BOOST_CHECK_EQUAL(nIn, 1);
+    BOOST_CHECK_EQUAL(op, OP_ALIAS_UPDATE);
+    BOOST_CHECK(vvch.size() == 2 && vvch[0] == vchFromString("name"));
+    BOOST_CHECK(!inputs.GetServiceInput(SERVICE_OFFER, nIn, op, vvch));
+
+    // a spent output ends the lookup
+    t1.vin[2].prevout.n = 5;
+    CTxInputs inputsMissing(t1, coins);
+    BOOST_CHECK(!inputsMissing.fHaveInputs);
+    BOOST_CHECK(!t1.HaveInputs(coins));
+}
+
+BOOST_AUTO_TEST_CASE(test_ScriptExecutionCache)
+{
+    CBasicKeyStore keystore;
+    CCoinsView coinsDummy;
+    CCoinsViewCache coins(coinsDummy);
+    std::vector<CTransaction> dummyTransactions = SetupDummyInputs(keystore, coins);
+
+    CTransaction t1;
+    t1.vin.resize(2);
+    t1.vin[0].prevout.hash = dummyTransactions[0].GetHash();
+    t1.vin[0].prevout.n = 0;
+    t1.vin[1].prevout.hash = dummyTransactions[1].GetHash();
+    t1.vin[1].prevout.n = 1;
+    t1.vout.resize(1);
+    t1.vout[0].nValue = 30*CENT;
+    t1.vout[0].scriptPubKey << OP_1;
+    BOOST_CHECK(SignSignature(keystore, dummyTransactions[0], t1, 0));
+    BOOST_CHECK(SignSignature(keystore, dummyTransactions[1], t1, 1));
+
+    CTxInputs inputs(t1, coins);
+    CValidationState state;
+    CDigestCacheStats before, after;
+    GetScriptExecutionCacheStats(before);
+
+    // checks handed to the caller have not passed yet, so are not remembered
+    std::vector<CScriptCheck> vChecks;
+    BOOST_CHECK(t1.CheckScripts(state, inputs, SCRIPT_VERIFY_P2SH, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 2U);
+    BOOST_CHECK(t1.CheckScripts(state, inputs, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_NOCACHE, NULL));
+    GetScriptExecutionCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries);
+
+    // checked inline, the transaction is skipped from then on, under the same flags only
+    BOOST_CHECK(t1.CheckScripts(state, inputs, SCRIPT_VERIFY_P2SH, NULL));
+    GetScriptExecutionCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries + 1);
+    vChecks.clear();
+    BOOST_CHECK(t1.CheckScripts(state, inputs, SCRIPT_VERIFY_P2SH, &vChecks));
+    BOOST_CHECK(vChecks.empty());
+    BOOST_CHECK(t1.CheckScripts(state, inputs, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 2U);
+    GetScriptExecutionCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nHits, before.nHits + 1);
+
+    // connecting it takes it out
+    vChecks.clear();
+    BOOST_CHECK(t1.CheckScripts(state, inputs, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_NOCACHE | SCRIPT_VERIFY_UNCACHE, &vChecks));
+    BOOST_CHECK(vChecks.empty());
+    GetScriptExecutionCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries);
+    BOOST_CHECK_EQUAL(after.nErased, before.nErased + 1);
+
+    // as the mempool checks it: with STRICTENC, and no encoding turned down,
+    // it is remembered for the flags blocks are checked with, and its
+    // signatures are not stored in the signature cache as well
+    CDigestCacheStats sigBefore, sigAfter;
+    GetSignatureCacheStats(sigBefore);
+    BOOST_CHECK(t1.CheckScripts(state, inputs, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, NULL));
+    GetSignatureCacheStats(sigAfter);
+    BOOST_CHECK_EQUAL(sigAfter.nEntries, sigBefore.nEntries);
+    vChecks.clear();
+    BOOST_CHECK(t1.CheckScripts(state, inputs, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_NOCACHE | SCRIPT_VERIFY_UNCACHE, &vChecks));
+    BOOST_CHECK(vChecks.empty());
+    GetScriptExecutionCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries);
+
+    // a script that passes because STRICTENC turned an encoding down is only
+    // remembered for STRICTENC, as without it the signature is checked
+    CKey key;
+    key.MakeNewKey(true);
+    CTransaction txFrom;
+    txFrom.vout.resize(1);
+    txFrom.vout[0].nValue = 10*CENT;
+    txFrom.vout[0].scriptPubKey << key.GetPubKey() << OP_CHECKSIG << OP_NOT;
+    coins.SetCoins(txFrom.GetHash(), CCoins(txFrom, 0));
+    CTransaction t2;
+    t2.vin.resize(1);
+    t2.vin[0].prevout.hash = txFrom.GetHash();
+    t2.vin[0].prevout.n = 0;
+    t2.vout.resize(1);
+    t2.vout[0].nValue = 10*CENT;
+    t2.vout[0].scriptPubKey << OP_1;
+    vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(GetRandHash(), vchSig));
+    vchSig.push_back(0); // not a hash type
+    t2.vin[0].scriptSig << vchSig;
+    CTxInputs inputs2(t2, coins);
+    BOOST_CHECK(t2.CheckScripts(state, inputs2, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC, NULL));
+    vChecks.clear();
+    BOOST_CHECK(t2.CheckScripts(state, inputs2, SCRIPT_VERIFY_P2SH, &vChecks));
+    BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+    vChecks.clear();
+    BOOST_CHECK(t2.CheckScripts(state, inputs2, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_STRICTENC | SCRIPT_VERIFY_UNCACHE, &vChecks));
+    BOOST_CHECK(vChecks.empty());
+
+    // a transaction whose scripts fail is not remembered
+    t1.vin[1].scriptSig = t1.vin[0].scriptSig;
+    t1.InvalidateCache();
+    CTxInputs inputsBad(t1, coins);
+    BOOST_CHECK(!t1.CheckScripts(state, inputsBad, SCRIPT_VERIFY_P2SH, NULL));
+    BOOST_CHECK(!t1.CheckScripts(state, inputsBad, SCRIPT_VERIFY_P2SH, NULL));
+    GetScriptExecutionCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries);
+}
+
 BOOST_AUTO_TEST_CASE(test_IsStandard)
 {
     CBasicKeyStore keystore;
@@ -273,4 +427,90 @@ BOOST_AUTO_TEST_CASE(test_IsStandard)
     BOOST_CHECK(!t.IsStandard());
 }
 
+BOOST_AUTO_TEST_CASE(test_ServiceOutputs)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CScript scriptDest;
+    scriptDest.SetDestination(key.GetPubKey().GetID());
+    vector<unsigned char> vchName(5, 'n'), vchValue(10, 'v'), vchRand(8, 'r');
+
+    CTransaction t;
+    t.vout.resize(4);
+    t.vout[0].scriptPubKey = scriptDest;
+    // OP_N with a wrong number of arguments is not a service script
+    t.vout[1].scriptPubKey = CScript() << CScript::EncodeOP_N(OP_ALIAS_UPDATE) << vchName << OP_DROP;
+    t.vout[1].scriptPubKey += scriptDest;
+    t.vout[2].scriptPubKey = CScript() << CScript::EncodeOP_N(OP_OFFER_UPDATE) << vchName << vchValue << OP_2DROP;
+    t.vout[2].scriptPubKey += scriptDest;
+    t.vout[3].scriptPubKey = CScript() << CScript::EncodeOP_N(OP_ALIAS_ACTIVATE) << vchName << vchRand << vchValue << OP_2DROP << OP_DROP;
+    t.vout[3].scriptPubKey += scriptDest;
+
+    int op, nOut;
+    vector<vector<unsigned char> > vvch;
+    BOOST_CHECK(t.GetServiceOutput(SERVICE_ALIAS, op, nOut, vvch));
+    BOOST_CHECK(op == OP_ALIAS_ACTIVATE && nOut == 3 && vvch.size() == 3 && vvch[2] == vchValue);
+    BOOST_CHECK(t.GetServiceOutput(SERVICE_OFFER, op, nOut, vvch));
+    BOOST_CHECK(op == OP_OFFER_UPDATE && nOut == 2 && vvch.size() == 2);
+    BOOST_CHECK(!t.GetServiceOutput(SERVICE_CERT, op, nOut, vvch));
+    BOOST_CHECK(vvch.empty());
+    BOOST_CHECK_EQUAL(t.GetServiceOutput(op, nOut, vvch), SERVICE_ALIAS);
+
+    // the per-service decoders agree with the shared one
+    BOOST_CHECK(DecodeAliasTx(t, op, nOut, vvch, -1) && nOut == 3);
+    BOOST_CHECK(DecodeOfferTx(t, op, nOut, vvch, -1) && nOut == 2);
+    BOOST_CHECK(!DecodeCertTx(t, op, nOut, vvch, -1));
+    BOOST_CHECK(!DecodeAliasScript(t.vout[1].scriptPubKey, op, vvch));
+
+    // results are kept until the outputs are marked changed through InvalidateCache
+    t.vout.resize(1);
+    BOOST_CHECK(t.GetServiceOutput(SERVICE_ALIAS, op, nOut, vvch));
+    t.InvalidateCache();
+    BOOST_CHECK_EQUAL(t.GetServiceOutput(op, nOut, vvch), SERVICE_NONE);
+
+    // or by reading the transaction
+    CTransaction t2;
+    t2.vout.push_back(CTxOut(0, CScript() << CScript::EncodeOP_N(OP_CERTISSUER_UPDATE) << vchName << vchValue << OP_2DROP));
+    BOOST_CHECK_EQUAL(t2.GetServiceOutput(op, nOut, vvch), SERVICE_CERT);
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << t;
+    ss >> t2;
+    BOOST_CHECK_EQUAL(t2.GetServiceOutput(op, nOut, vvch), SERVICE_NONE);
+}
+
+BOOST_AUTO_TEST_CASE(test_CachedHash)
+{
+    CTransaction t;
+    t.vin.resize(1);
+    t.vout.resize(1);
+    t.data = vector<unsigned char>(1000, 'd');
+    BOOST_CHECK(t.GetHash() == SerializeHash(t));
+    BOOST_CHECK(t.GetAuxHash() == SerializeHash(t, SER_GETAUXHASH | SER_GETHASH));
+
+    // changes marked with InvalidateCache are hashed again
+    uint256 hashOld = t.GetHash();
+    uint256 hashAuxOld = t.GetAuxHash();
+    t.nLockTime = 1;
+    t.InvalidateCache();
+    BOOST_CHECK(t.GetHash() == SerializeHash(t) && t.GetHash() != hashOld);
+    BOOST_CHECK(t.GetAuxHash() == SerializeHash(t, SER_GETAUXHASH | SER_GETHASH) && t.GetAuxHash() != hashAuxOld);
+    // data is not part of the aux hash
+    uint256 hashAux = t.GetAuxHash();
+    t.data.clear();
+    t.InvalidateCache();
+    BOOST_CHECK(t.GetHash() == SerializeHash(t));
+    BOOST_CHECK(t.GetAuxHash() == hashAux);
+
+    // copies keep the hash, reading a transaction recomputes it
+    CTransaction t2(t);
+    BOOST_CHECK(t2.GetHash() == t.GetHash());
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << t;
+    CTransaction t3;
+    t3.nLockTime = 2;
+    t3.GetHash();
+    ss >> t3;
+    BOOST_CHECK(t3.GetHash() == t.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
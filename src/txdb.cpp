@@ -42,7 +42,7 @@ CBlockIndex *CCoinsViewDB::GetBestBlock() {
     uint256 hashBestChain;
     if (!db.Read('B', hashBestChain))
         return NULL;
-    std::map<uint256, CBlockIndex*>::iterator it = mapBlockIndex.find(hashBestChain);
+    BlockMap::iterator it = mapBlockIndex.find(hashBestChain);
     if (it == mapBlockIndex.end())
         return NULL;
     return it->second;
@@ -54,12 +54,16 @@ bool CCoinsViewDB::SetBestBlock(CBlockIndex *pindex) {
     return db.WriteBatch(batch);
 }
 
-bool CCoinsViewDB::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex) {
-    printf("Committing %u changed transactions to coin database...\n", (unsigned int)mapCoins.size());
-
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex) {
     CLevelDBBatch batch;
-    for (std::map<uint256, CCoins>::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++)
-        BatchWriteCoins(batch, it->first, it->second);
+    unsigned int nChanged = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            BatchWriteCoins(batch, it->first, it->second.coins);
+            nChanged++;
+        }
+    }
+    printf("Committing %u changed transactions (out of %u) to coin database...\n", nChanged, (unsigned int)mapCoins.size());
     if (pindex)
         BatchWriteHashBestChain(batch, pindex->GetBlockHash());
 
@@ -67,16 +71,25 @@ bool CCoinsViewDB::BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockI
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDB(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+    fSnapshotJournal = Exists('S');
 }
 
 bool CBlockTreeDB::WriteDiskBlockIndex(const CDiskBlockIndex& diskblockindex)
 {
-    return Write(boost::tuples::make_tuple('b', *diskblockindex.phashBlock, 'a'), diskblockindex);
+    CLevelDBBatch batch;
+    batch.Write(boost::tuples::make_tuple('b', *diskblockindex.phashBlock, 'a'), diskblockindex);
+    if (fSnapshotJournal)
+        batch.Write(make_pair('s', *diskblockindex.phashBlock), '1');
+    return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::WriteBlockIndex(const CBlockIndex& blockindex)
 {
-    return Write(boost::tuples::make_tuple('b', blockindex.GetBlockHash(), 'b'), blockindex);
+    CLevelDBBatch batch;
+    batch.Write(boost::tuples::make_tuple('b', blockindex.GetBlockHash(), 'b'), blockindex);
+    if (fSnapshotJournal)
+        batch.Write(make_pair('s', blockindex.GetBlockHash()), '1');
+    return WriteBatch(batch);
 }
 
 bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &blkid, CDiskBlockIndex &diskblockindex) {
@@ -121,6 +134,34 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read('l', nFile);
 }
 
+bool CBlockTreeDB::ReadSnapshotToken(uint256 &token) {
+    return Read('S', token);
+}
+
+bool CBlockTreeDB::WriteSnapshotToken(const uint256 &token) {
+    // the journal starts over with the new snapshot
+    CLevelDBBatch batch;
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('s', uint256(0));
+    for (pcursor->Seek(ssKeySet.str()); pcursor->Valid(); pcursor->Next()) {
+        leveldb::Slice slKey = pcursor->key();
+        CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+        char cType;
+        uint256 hash;
+        ssKey >> cType;
+        if (cType != 's')
+            break;
+        ssKey >> hash;
+        batch.Erase(make_pair('s', hash));
+    }
+    batch.Write('S', token);
+    if (!WriteBatch(batch, true))
+        return false;
+    fSnapshotJournal = true;
+    return true;
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) {
     boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
     pcursor->SeekToFirst();
@@ -176,13 +217,23 @@ bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair('t', txid), pos);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
+bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect, const CTxBlockPos &blockpos) {
     CLevelDBBatch batch;
-    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+    for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         batch.Write(make_pair('t', it->first), it->second);
+        batch.Write(make_pair('h', it->first), blockpos);
+    }
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadTxBlockPos(const uint256 &txid, CTxBlockPos &blockpos) {
+    return Read(make_pair('h', txid), blockpos);
+}
+
+bool CBlockTreeDB::WriteTxBlockPos(const uint256 &txid, const CTxBlockPos &blockpos) {
+    return Write(make_pair('h', txid), blockpos);
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair('F', name), fValue ? '1' : '0');
 }
@@ -195,6 +246,33 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+// the immutable parts of a block index entry, from its 'a' record
+static CBlockIndex *InsertDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &diskindex)
+{
+    CBlockIndex* pindexNew = InsertBlockIndex(hash);
+    assert(diskindex.CalcBlockHash() == *pindexNew->phashBlock); // paranoia check
+
+    pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+    pindexNew->nHeight        = diskindex.nHeight;
+    pindexNew->nVersion       = diskindex.nVersion;
+    pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+    pindexNew->nTime          = diskindex.nTime;
+    pindexNew->nBits          = diskindex.nBits;
+    pindexNew->nNonce         = diskindex.nNonce;
+    pindexNew->nTx            = diskindex.nTx;
+    // Watch for genesis block
+    if (pindexGenesisBlock == NULL && pindexNew->GetBlockHash() == hashGenesisBlock)
+        pindexGenesisBlock = pindexNew;
+
+    // CheckIndex needs phashBlock to be set
+    diskindex.phashBlock = pindexNew->phashBlock;
+    if (!diskindex.CheckIndex()) {
+        error("LoadBlockIndex() : CheckIndex failed: %s", pindexNew->ToString().c_str());
+        return NULL;
+    }
+    return pindexNew;
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts()
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
@@ -224,25 +302,9 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 ssValue_immutable >> diskindex; // read all immutable data
 
                 // Construct immutable parts of block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(hash);
-                assert(diskindex.CalcBlockHash() == *pindexNew->phashBlock); // paranoia check
-
-                pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nTx            = diskindex.nTx;
-                // Watch for genesis block
-                if (pindexGenesisBlock == NULL && pindexNew->GetBlockHash() == hashGenesisBlock)
-                    pindexGenesisBlock = pindexNew;
-
-                // CheckIndex needs phashBlock to be set
-                diskindex.phashBlock = pindexNew->phashBlock;
-                if (!diskindex.CheckIndex())
-                    return error("LoadBlockIndex() : CheckIndex failed: %s", pindexNew->ToString().c_str());
+                CBlockIndex* pindexNew = InsertDiskBlockIndex(hash, diskindex);
+                if (pindexNew == NULL)
+                    return false;
 
                 pcursor->Next(); // now we should be on the 'b' subkey
 
@@ -263,3 +325,42 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
 
     return true;
 }
+
+bool CBlockTreeDB::LoadBlockIndexJournal(std::vector<CBlockIndex*> &vChanged)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('s', uint256(0));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            char cType;
+            ssKey >> cType;
+            if (cType != 's')
+                break;
+            uint256 hash;
+            ssKey >> hash;
+
+            CDiskBlockIndex diskindex;
+            if (!ReadDiskBlockIndex(hash, diskindex))
+                return error("LoadBlockIndexJournal() : block index of %s not found", hash.ToString().c_str());
+            CBlockIndex* pindexNew = InsertDiskBlockIndex(hash, diskindex);
+            if (pindexNew == NULL)
+                return false;
+            if (!Read(boost::tuples::make_tuple('b', hash, 'b'), *pindexNew))
+                return error("LoadBlockIndexJournal() : block status of %s not found", hash.ToString().c_str());
+            vChanged.push_back(pindexNew);
+
+            pcursor->Next();
+        } catch (std::exception &e) {
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+        }
+    }
+
+    return true;
+}
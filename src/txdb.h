@@ -21,7 +21,7 @@ public:
     bool HaveCoins(const uint256 &txid);
     CBlockIndex *GetBestBlock();
     bool SetBestBlock(CBlockIndex *pindex);
-    bool BatchWrite(const std::map<uint256, CCoins> &mapCoins, CBlockIndex *pindex);
+    bool BatchWrite(CCoinsMap &mapCoins, CBlockIndex *pindex);
     bool GetStats(CCoinsStats &stats);
 };
 
@@ -33,6 +33,10 @@ public:
 private:
     CBlockTreeDB(const CBlockTreeDB&);
     void operator=(const CBlockTreeDB&);
+
+    // while a block index snapshot is current, every block index write also
+    // records the block under 's', so the snapshot can be brought up to date
+    bool fSnapshotJournal;
 public:
     bool WriteDiskBlockIndex(const CDiskBlockIndex& diskblockindex);
     bool WriteBlockIndex(const CBlockIndex& blockindex);
@@ -46,10 +50,16 @@ public:
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list, const CTxBlockPos &blockpos);
+    bool ReadTxBlockPos(const uint256 &txid, CTxBlockPos &blockpos);
+    bool WriteTxBlockPos(const uint256 &txid, const CTxBlockPos &blockpos);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool ReadSnapshotToken(uint256 &token);
+    bool WriteSnapshotToken(const uint256 &token);
     bool LoadBlockIndexGuts();
+    // the entries written since the snapshot, read over the ones it loaded
+    bool LoadBlockIndexJournal(std::vector<CBlockIndex*> &vChanged);
 };
 
 #endif // BITCOIN_TXDB_LEVELDB_H
@@ -180,6 +180,75 @@ public:
     }
 
 
+    // multiply by a 32 bit factor, dropping the bits that do not fit
+    base_uint& operator*=(uint32_t b32)
+    {
+        uint64 carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64 n = carry + (uint64)b32 * pn[i];
+            pn[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        return *this;
+    }
+
+    // divide by a non-zero 32 bit divisor, rounding down
+    base_uint& operator/=(uint32_t b32)
+    {
+        uint64 rem = 0;
+        for (int i = WIDTH-1; i >= 0; i--)
+        {
+            uint64 n = (rem << 32) | pn[i];
+            pn[i] = (uint32_t)(n / b32);
+            rem = n % b32;
+        }
+        return *this;
+    }
+
+    // *this * nMul / nDiv rounded down, with the product kept at full
+    // width; returns false and leaves *this alone if the result overflows
+    bool MulDiv(uint32_t nMul, uint32_t nDiv)
+    {
+        uint32_t pnProd[WIDTH+1];
+        uint64 carry = 0;
+        for (int i = 0; i < WIDTH; i++)
+        {
+            uint64 n = carry + (uint64)nMul * pn[i];
+            pnProd[i] = n & 0xffffffff;
+            carry = n >> 32;
+        }
+        pnProd[WIDTH] = (uint32_t)carry;
+        uint64 rem = 0;
+        for (int i = WIDTH; i >= 0; i--)
+        {
+            uint64 n = (rem << 32) | pnProd[i];
+            pnProd[i] = (uint32_t)(n / nDiv);
+            rem = n % nDiv;
+        }
+        if (pnProd[WIDTH] != 0)
+            return false;
+        for (int i = 0; i < WIDTH; i++)
+            pn[i] = pnProd[i];
+        return true;
+    }
+
+    // number of significant bits
+    unsigned int bits() const
+    {
+        for (int pos = WIDTH-1; pos >= 0; pos--)
+        {
+            if (pn[pos])
+            {
+                for (int nbits = 31; nbits > 0; nbits--)
+                    if (pn[pos] & (1U << nbits))
+                        return 32*pos + nbits + 1;
+                return 32*pos + 1;
+            }
+        }
+        return 0;
+    }
+
     base_uint& operator++()
     {
         // prefix operator
@@ -587,6 +656,55 @@ public:
         else
             *this = 0;
     }
+
+    // The "compact" nBits format of CBigNum::SetCompact: a sign bit, a 23 bit
+    // mantissa and a base 256 exponent. Negative values and values over 256
+    // bits are flagged rather than represented.
+    uint256& SetCompact(unsigned int nCompact, bool *pfNegative = NULL, bool *pfOverflow = NULL)
+    {
+        unsigned int nSize = nCompact >> 24;
+        unsigned int nWord = nCompact & 0x007fffff;
+        if (nSize <= 3)
+        {
+            nWord >>= 8*(3-nSize);
+            *this = nWord;
+        }
+        else
+        {
+            *this = nWord;
+            *this <<= 8*(nSize-3);
+        }
+        if (pfNegative)
+            *pfNegative = nWord != 0 && (nCompact & 0x00800000) != 0;
+        if (pfOverflow)
+            *pfOverflow = nWord != 0 && ((nSize > 34) ||
+                                         (nWord > 0xff && nSize > 33) ||
+                                         (nWord > 0xffff && nSize > 32));
+        return *this;
+    }
+
+    unsigned int GetCompact() const
+    {
+        unsigned int nSize = (bits() + 7) / 8;
+        unsigned int nCompact = 0;
+        if (nSize <= 3)
+            nCompact = Get64() << 8*(3-nSize);
+        else
+        {
+            uint256 bn(*this);
+            bn >>= 8*(nSize-3);
+            nCompact = bn.Get64();
+        }
+        // The 0x00800000 bit denotes the sign.
+        // Thus, if it is already set, divide the mantissa by 256 and increase the exponent.
+        if (nCompact & 0x00800000)
+        {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        return nCompact;
+    }
 };
 
 inline bool operator==(const uint256& a, uint64 b)                           { return (base_uint256)a == b; }
@@ -369,7 +369,7 @@ void CWallet::WalletUpdateSpent(const CTransaction &tx)
                     vector<vector<unsigned char> > vvchArgs;
                     int op, nOut;
 
-                    if(DecodeAliasTx(tx, op, nOut, vvchArgs, -1)) {
+                    if(tx.GetServiceOutput(op, nOut, vvchArgs) != SERVICE_NONE) {
                         if(IsAliasOp(op)) {
                             NotifyAliasListChanged(this, &tx, CT_UPDATED);                       
                         } 
@@ -518,7 +518,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
         // notify on syscoin transaction
         vector<vector<unsigned char> > vvchArgs;
         int op, nOut;
-        if(DecodeAliasTx(wtx, op, nOut, vvchArgs, -1)) {
+        if(wtx.GetServiceOutput(op, nOut, vvchArgs) != SERVICE_NONE) {
             // alias
             if(IsAliasOp(op)) {
                 NotifyAliasListChanged(this, &wtx, fInsertedNew ? CT_NEW : CT_UPDATED);    
@@ -1327,6 +1327,7 @@ bool CWallet::CreateTransaction(const std::vector<std::pair<CScript, int64> >& v
             {
                 wtxNew.vin.clear();
                 wtxNew.vout.clear();
+                wtxNew.InvalidateCache();
                 wtxNew.fFromMe = true;
 
                 int64 nTotalValue = nValue + nFeeRet;
@@ -1507,7 +1508,7 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 // notify on syscoin transaction
                 vector<vector<unsigned char> > vvchArgs;
                 int op, nOut;
-                if(DecodeAliasTx(wtxNew, op, nOut, vvchArgs, -1)) {
+                if(wtxNew.GetServiceOutput(op, nOut, vvchArgs) != SERVICE_NONE) {
                     // alias
                     if(IsAliasOp(op)) {
                         NotifyAliasListChanged(this, &wtxNew, CT_UPDATED);                   
@@ -2083,7 +2084,7 @@ void CWallet::UpdatedTransaction(const uint256 &hashTx)
             vector<vector<unsigned char> > vvchArgs;
             int op, nOut;
 
-            if(DecodeAliasTx(wtx, op, nOut, vvchArgs, -1)) {
+            if(wtx.GetServiceOutput(op, nOut, vvchArgs) != SERVICE_NONE) {
                 // alias
                 if(IsAliasOp(op)) {
                     NotifyAliasListChanged(this, &wtx, CT_UPDATED); 
@@ -173,6 +173,7 @@ HEADERS += src/qt/bitcoingui.h \
     src/main.h \
     src/net.h \
     src/key.h \
+    src/secp256k1.h \
     src/db.h \
     src/walletdb.h \
     src/script.h \
@@ -183,6 +184,8 @@ HEADERS += src/qt/bitcoingui.h \
     src/alias.h \
     src/offer.h \
     src/cert.h \
+    src/feeregen.h \
+    src/servicedb.h \
     src/json/json_spirit_writer_template.h \
     src/json/json_spirit_writer.h \
     src/json/json_spirit_value.h \
@@ -234,6 +237,8 @@ HEADERS += src/qt/bitcoingui.h \
     src/leveldb.h \
     src/threadsafety.h \
     src/limitedmap.h \
+    src/blockmap.h \
+    src/digestcache.h \
     src/qt/macnotificationhandler.h \
     src/qt/splashscreen.h \
     src/qt/aliastablemodel.h \
@@ -271,6 +276,7 @@ SOURCES += src/qt/bitcoin.cpp \
     src/hash.cpp \
     src/netbase.cpp \
     src/key.cpp \
+    src/secp256k1.cpp \
     src/script.cpp \
     src/main.cpp \
     src/init.cpp \
@@ -282,6 +288,8 @@ SOURCES += src/qt/bitcoin.cpp \
     src/alias.cpp \
     src/offer.cpp \
     src/cert.cpp \
+    src/feeregen.cpp \
+    src/servicedb.cpp \
     src/walletdb.cpp \
     src/qt/clientmodel.cpp \
     src/qt/guiutil.cpp \
@@ -391,6 +399,24 @@ QMAKE_EXTRA_COMPILERS += gccsse2
 SOURCES_SSE2 += src/scrypt-sse2.cpp
 }
 
+contains(USE_AVX2, 1) {
+DEFINES += USE_AVX2
+gccavx2.input  = SOURCES_AVX2
+gccavx2.output = $$PWD/build/${QMAKE_FILE_BASE}.o
+gccavx2.commands = $(CXX) -c $(CXXFLAGS) $(INCPATH) -o ${QMAKE_FILE_OUT} ${QMAKE_FILE_NAME} -mavx2 -mstackrealign
+QMAKE_EXTRA_COMPILERS += gccavx2
+SOURCES_AVX2 += src/scrypt-avx2.cpp
+}
+
+contains(USE_AVX512, 1) {
+DEFINES += USE_AVX512
+gccavx512.input  = SOURCES_AVX512
+gccavx512.output = $$PWD/build/${QMAKE_FILE_BASE}.o
+gccavx512.commands = $(CXX) -c $(CXXFLAGS) $(INCPATH) -o ${QMAKE_FILE_OUT} ${QMAKE_FILE_NAME} -mavx512f -mstackrealign
+QMAKE_EXTRA_COMPILERS += gccavx512
+SOURCES_AVX512 += src/scrypt-avx512.cpp
+}
+
 # Todo: Remove this line when switching to Qt5, as that option was removed
 CODECFORTR = UTF-8
 